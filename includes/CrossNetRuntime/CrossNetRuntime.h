@@ -37,6 +37,7 @@
 #include "CrossNetRuntime/System/MulticastDelegate.h"
 
 #include "CrossNetRuntime/GC/GCManager.h"
+#include "CrossNetRuntime/GC/RegionScope.h"
 #include "CrossNetRuntime/InterfaceMapper.h"
 #include "CrossNetRuntime/InitOptions.h"
 
@@ -22,6 +22,10 @@
 
 #define CROSSNET_FINLINE    __forceinline
 #define CROSSNET_INLINE     inline
+// Thread local storage, only for POD types (no constructor / destructor)
+#define CROSSNET_THREAD_LOCAL   __declspec(thread)
+// Alignment of a type or a member (n must be a power of 2)
+#define CROSSNET_ALIGN(n)       __declspec(align(n))
 
 #define CROSSNET_STRINGIFY2(a, b)    a ## b
 #define CROSSNET_STRINGIFY3(a, b, c) a ## b ## c
@@ -0,0 +1,139 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __GCALLOCATIONPROFILER_H__
+#define __GCALLOCATIONPROFILER_H__
+
+#include "CrossNetRuntime/Defines.h"
+#include "CrossNetRuntime/InitOptions.h"
+#include <stdio.h>
+
+namespace System
+{
+    class Type;
+}
+
+namespace CrossNetRuntime
+{
+    // Sampling profiler of the managed allocations
+    //  One allocation is sampled every N bytes allocated (per thread), the type, the size and the call stack
+    //  of the sampled allocations are aggregated in a lock-free table. The table can then be dumped
+    //  as collapsed stacks (for flame graphs) or in the pprof legacy heap profile format.
+    //
+    //  When the sampling is off, the cost is a thread local decrement and a test per allocation,
+    //  so the profiler can stay compiled in the production builds.
+    class GCAllocationProfiler
+    {
+    public:
+        static void Setup(const ::CrossNetRuntime::InitOptions & options);
+        static void Teardown();
+
+        // Sample one allocation every interval bytes (0 to stop the sampling)
+        //  Should not be called concurrently with itself
+        static void SetSampleInterval(int interval);
+        static int  GetSampleInterval();
+
+        // Called by System::Object::operator new for each managed allocation
+        CROSSNET_FINLINE
+        static void OnAllocate(void * buffer, int size)
+        {
+            int remaining = sBytesUntilSample - size;
+            sBytesUntilSample = remaining;
+            if (remaining < 0)
+            {
+                // A sample is due (or the sampling is off and we have to check again)
+                SampleSlow(buffer, size);
+            }
+        }
+
+        // The type of a sampled object is only known after its constructor
+        //  So it is resolved at the next allocation of the same thread, this is called before a collection
+        //  to resolve the sample of the current thread while the object is still there
+        static void ResolvePendingSample();
+
+        // Removes all the samples recorded so far
+        static void Reset();
+
+        // Returns the name to display for a type, if NULL is passed (or returned), the type id is used
+        typedef const char *    (*TypeNameFunctionPointer)(System::Type * type, int typeId);
+
+        // One line per call stack and type: "frame;frame;...;type bytes"
+        //  The frames are addresses (outermost first), use a symbolizer to get the function names
+        static void DumpCollapsedStacks(FILE * file, TypeNameFunctionPointer typeName = NULL);
+
+        // pprof legacy heap profile (text), the types are not part of this format
+        static void DumpPprof(FILE * file);
+
+    private:
+        enum
+        {
+            MAX_STACK_DEPTH = 32,
+            // Frames of the profiler itself (CaptureStack and SampleSlow, OnAllocate is inlined)
+            NUM_SKIPPED_FRAMES = 2,
+            // Number of different stack / type pairs that can be recorded (must be a power of 2)
+            TABLE_SIZE = 4096,
+            // When the sampling is off, how often each thread checks if it has been turned on
+            SAMPLING_OFF_CHECK_INTERVAL = 1024 * 1024,
+        };
+
+        enum EntryState
+        {
+            ENTRY_EMPTY = 0,
+            ENTRY_FILLING,
+            ENTRY_READY,
+        };
+
+        struct SampleEntry
+        {
+            volatile long       mState;
+            unsigned int        mHash;
+            void * *            mInterfaceMap;      // NULL if the type could not be resolved
+            int                 mDepth;
+            void *              mStack[MAX_STACK_DEPTH];
+            volatile long       mCount;
+            volatile long long  mBytes;             // Estimation of the bytes allocated (each sample stands for the interval)
+        };
+
+        // Last sample of a thread, waiting for the type of the object to be known
+        struct PendingSample
+        {
+            void *              mObject;
+            int                 mBytes;
+            int                 mNumCollections;    // If a collection happened since, the object might not be there anymore
+            int                 mBytesUntilSample;  // Countdown to restore once the sample is resolved
+            int                 mDepth;
+            void *              mStack[MAX_STACK_DEPTH];
+        };
+
+        static void             SampleSlow(void * buffer, int size);
+        static int              CaptureStack(void * * stack, int maxDepth);
+        static void             Record(void * * interfaceMap, const PendingSample & sample);
+        static unsigned int     Hash(void * * interfaceMap, void * const * stack, int depth);
+        static void             AtomicAdd64(volatile long long * value, long long delta);
+        static void             CreateTable();
+
+        static SampleEntry * volatile                   sTable;
+        static volatile long                            sSampleInterval;
+        static volatile long                            sNumDroppedSamples;
+        static CROSSNET_THREAD_LOCAL int                sBytesUntilSample;
+        static CROSSNET_THREAD_LOCAL PendingSample      sPendingSample;
+
+        GCAllocationProfiler();
+        GCAllocationProfiler(const GCAllocationProfiler & other);
+        GCAllocationProfiler & operator=(const GCAllocationProfiler & other);
+    };
+}
+
+#endif
@@ -18,6 +18,14 @@
 
 #include "CrossNetRuntime/Defines.h"
 #include "CrossNetRuntime/InitOptions.h"
+#include "CrossNetRuntime/GC/GCBitmap.h"
+#include "CrossNetRuntime/GC/GCLargeObjectSpace.h"
+#include "CrossNetRuntime/GC/GCPointerFreeSpace.h"
+#include "CrossNetRuntime/GC/GCPolicy.h"
+#include "CrossNetRuntime/GC/GCThread.h"
+
+// For _BitScanForward / _BitScanReverse
+#include <intrin.h>
 
 namespace CrossNetRuntime
 {
@@ -27,18 +35,96 @@ namespace CrossNetRuntime
         static void Setup(const ::CrossNetRuntime::InitOptions & options);
         static void Teardown();
 
-        // We might want to add some aligned allocation as well
-        //  (might be needed for VMX code for example).
-
 //  Define this macro if you want to override it in your code
 //  #define CN_GC_NO_DEFAULT_ALLOCATE_FREE_IMPLEMENTATION
         static void *   Allocate(int size);
         static void     Free(void * freedPtr, int size);
 
+        // Same as Allocate() but the returned memory is cleared
+        //  Large objects go in the large object space, their pages come zeroed from the OS
+        //  so there is no need to clear them again.
+        //  It is inlined, so when the size is a constant (like in "new MyClass()" through System::Object::operator new)
+        //  the compiler resolves the size class and the alignment at compile time
+        CROSSNET_FINLINE
+        static void *   AllocateClear(int size)
+        {
+#ifndef CN_GC_NO_DEFAULT_ALLOCATE
+            if (size <= SMALL_SIZE_BIN)
+            {
+                // Small objects are never large objects (the threshold is at least a page)
+                void * smallBuffer = RecordAllocationStart(AllocateSmallFast(Align(size)));
+                ClearAllocatedBlock(smallBuffer, size);
+                return (smallBuffer);
+            }
+#endif
+            if (GCLargeObjectSpace::IsLargeObject(size))
+            {
+                return (AllocateLarge(size));
+            }
+            void * buffer = Allocate(size);
+            ClearAllocatedBlock(buffer, size);
+            return (buffer);
+        }
+
+        // Same as AllocateClear() for the objects without any managed pointer (strings and arrays of base types)
+        //  They go in the pointer-free space if it is enabled and if they are not too big
+        CROSSNET_FINLINE
+        static void *   AllocateClearPointerFree(int size)
+        {
+            if (GCPointerFreeSpace::IsPointerFreeSize(size))
+            {
+                return (AllocatePointerFree(size));
+            }
+            return (AllocateClear(size));
+        }
+
+        // Same as AllocateClear() but the content is not cleared
+        //  For the callers that overwrite the whole object anyway (like MemberwiseClone())
+        CROSSNET_FINLINE
+        static void *   AllocateUncleared(int size)
+        {
+#ifndef CN_GC_NO_DEFAULT_ALLOCATE
+            if (size <= SMALL_SIZE_BIN)
+            {
+                return (RecordAllocationStart(AllocateSmallFast(Align(size))));
+            }
+#endif
+            if (GCLargeObjectSpace::IsLargeObject(size))
+            {
+                return (AllocateLarge(size));
+            }
+            return (Allocate(size));
+        }
+
+        // Allocates count cleared blocks (one per size), carved from one contiguous run (one bounds check and one bump)
+        //  The blocks are next to each other in memory, which is good for objects used together (like the strings of String::Split())
+        //  A run never reaches the large object threshold: a bigger batch is cut in several runs,
+        //  and a block that is a large object by itself goes in the large object space.
+        //  Returns false if there is not enough memory (nothing is allocated in that case)
+        //  The objects must be constructed before the next allocation, the GC can't parse an empty block
+        static bool     AllocateBatchClear(const int * sizes, int count, void * * objects);
+
+        // Same as AllocateClear() but (returned pointer + offset) is a multiple of alignment
+        //  Alignment must be a power of 2 up to a page (like 32 for AVX, 64 for a cache line or 4096)
+        //  Offset must be a multiple of 16, so the object itself stays aligned as any other object
+        //  (For an array, the offset is the position of the first item, see Array__G::__CreateAligned__())
+        //  The padding before and after the object is given back as free blocks, so the heap stays parsable.
+        static void *   AllocateClearAligned(int size, int alignment, int offset);
+
 //  #define CN_GC_NO_UNMANAGED_ALLOCATE_FREE_IMPLEMENTATION
         static void *   UnmanagedAllocate(int size);
         static void     UnmanagedFree(int size);
 
+        // Only used when InitOptions::mThreadAllocBufferSize is set
+        //  A thread is attached the first time it allocates, the collections then suspend it and scan its stack
+        //  A thread that uses managed objects without allocating any has to call this first
+        static void     AttachCurrentThread();
+
+        // Only used when InitOptions::mThreadAllocBufferSize or InitOptions::mPointerFreeSpaceSize is set
+        //  A thread that allocated managed objects should call this before exiting
+        //  So its allocation buffer (and its runs of the pointer-free space) can be reused by another thread
+        static void     DetachThread();
+
     private:
         CROSSNET_FINLINE
         static int NextPowerOf2(int size)
@@ -53,17 +139,33 @@ namespace CrossNetRuntime
             return (size);
         }
 
+        // Returns the number of bits needed to store size (i.e. index of the highest bit set + 1)
         CROSSNET_FINLINE
         static int TopBit(int size)
         {
-            // TODO:    This implementation is using a slow loop, we'll optimize that later!
-            int topBit = 0;
-            while (size != 0)
+            if (size == 0)
             {
-                size >>= 1;
-                ++topBit;
+                return (0);
             }
-            return (topBit);
+            return (HighestBit(size) + 1);
+        }
+
+        // Returns the index of the highest bit set, mask must not be zero
+        CROSSNET_FINLINE
+        static int HighestBit(unsigned int mask)
+        {
+            unsigned long index;
+            _BitScanReverse(&index, mask);
+            return (int)(index);
+        }
+
+        // Returns the index of the lowest bit set, mask must not be zero
+        CROSSNET_FINLINE
+        static int LowestBit(unsigned int mask)
+        {
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return (int)(index);
         }
 
         CROSSNET_FINLINE
@@ -95,6 +197,12 @@ namespace CrossNetRuntime
             ALIGNMENT_SHIFT = 4,
             ALIGNMENT = 1 << ALIGNMENT_SHIFT,
 
+            // Biggest alignment supported by AllocateClearAligned() (the smallest page size)
+            MAX_ALIGNMENT = 4096,
+
+            // Freed runs at least that big are cleared with non-temporal stores (so they don't evict the live objects from the cache)
+            NON_TEMPORAL_CLEAR_SIZE = 16 * 1024,
+
             // Minimum size allocated
             // System.Object takes 12 bytes (4 bytes for the VTable, 4 for the interface map, 4 for the flags).
             MIN_SIZE = 16,
@@ -103,18 +211,45 @@ namespace CrossNetRuntime
             SMALL_SIZE_SHIFT = 10,
             SMALL_SIZE_BIN  = 1 << SMALL_SIZE_SHIFT,
 
+            // One free list per 16 bytes size class, the index is the aligned size >> ALIGNMENT_SHIFT
+            //  Index 0 is never used (MIN_SIZE is 16), index SMALL_BIN_COUNT - 1 is for SMALL_SIZE_BIN exactly
+            SMALL_BIN_COUNT = (SMALL_SIZE_BIN >> ALIGNMENT_SHIFT) + 1,
+            // Number of 32 bits words needed for the occupancy mask of the small bins
+            SMALL_BIN_MASK_SIZE = (SMALL_BIN_COUNT + 31) / 32,
+
             // Bigger size where we use slow allocator
-            // This is currently not used yet...
+            // This is not used here, see GCLargeObjectSpace and InitOptions::mLargeObjectThreshold
             //  BIG_SIZE_BIN    = 16 * 1024,
 
             // Note that in between SMALL_SIZE_BIN and BIG_SIZE_BIN we are using a medium
             // allocator with a slightly different allocator from the small one
 
+            // The medium allocator is a two level segregated fit (TLSF)
+            //  The first level is the power of 2 range of the size (index of the highest bit)
+            //  The second level divides each range in MEDIUM_SECOND_LEVEL_COUNT linear size classes
+            //  So the worst case waste is 1 / MEDIUM_SECOND_LEVEL_COUNT of the size (instead of 50% with power of 2 bins)
+            MEDIUM_FIRST_LEVEL_COUNT = 32,
+            MEDIUM_SECOND_LEVEL_SHIFT = 4,
+            MEDIUM_SECOND_LEVEL_COUNT = 1 << MEDIUM_SECOND_LEVEL_SHIFT,
+
             // Marker to tell that the block is free
             // Must be odd to make sure it doesn't correspond to a VTable or interface map
             // In case, VTable would not be the first pointer
             FREE_MARKER = 0xFEEFFEEF,
 
+            // Marker to tell that the block is free but owned by a thread allocation buffer (or the pool)
+            // It is not in any bin, but the sweep considers it as a free block
+            RESERVED_MARKER = 0xFAAFFAAF,
+
+            // Marker of an object moved by the compaction (see GCManager), mNext is the address of the copy
+            //  The sweep considers it as a dead object without calling __OnCollect__() (the copy is alive)
+            FORWARDED_MARKER = 0xFDDFFDDF,
+
+            // Number of thread allocation buffers carved at once when the pool is empty
+            THREAD_ALLOC_BUFFER_REPLENISH_COUNT = 8,
+            // Smallest buffer carved from the free blocks when the heap is fragmented (it must fit any small object)
+            MIN_THREAD_ALLOC_BUFFER_SIZE = 2 * SMALL_SIZE_BIN,
+
             // Marker to tell that the block is allocated but still has a size
             // This will be used for arrays / strings for example...
             //  This should not be used...
@@ -126,27 +261,487 @@ namespace CrossNetRuntime
             int                 mMarker;
             AllocStructure *    mNext;
             int                 mSize;
-            int                 mPad;
+            AllocStructure *    mPrev;      // Valid only if the block is not the first of its bin (so a block can be removed in O(1) when coalescing)
+        };
+        // The free blocks bigger than MIN_SIZE also have their size in the last 4 bytes (boundary tag)
+        //  So a block being freed can find the free block right before it
+        //  The markers only tell the sweep how to parse the heap, whether a block is free (i.e. in a bin)
+        //  is given by sFreeBlockBitmap: an object can end with anything, a freshly allocated block still has its old header
+
+        // Allocation buffer of a given thread, each thread has one if the buffers are enabled
+        //  The first buffer is allocated the first time the thread allocates
+        struct ThreadAllocBuffer
+        {
+            unsigned char *         mCurrent;
+            unsigned char *         mEnd;
+            ThreadAllocBuffer *     mNextBuffer;    // All the buffers are chained so the GC can retire them
+            volatile long           mInUse;         // 0 if the owner thread detached, the buffer can then be reused
+            volatile long           mAllocating;    // Set by the owner thread during a bump (see BumpThreadAllocBuffer())
+            unsigned char *         mRetiredEnd;    // End of the buffer while the collector retires it
+            bool                    mBypassed;      // An allocation or a free of the owner thread didn't use this buffer (see RegionScope)
+            void *                  mThread;        // Owner thread (see GCThread::OpenCurrentThread()), NULL once detached
+            void *                  mStackBase;     // Top of the stack of the owner thread
+            void *                  mStackPointer;  // Bottom of the stack in use while the collector suspends the owner, NULL otherwise
+            void *                  mRegisters[GCThread::NUM_SAVED_REGISTERS];
+        };
+
+        // Free lists filled on the side of the bins by a sweeping thread (see GCParallelSweeper)
+        //  Each list keeps its tail, so they are spliced into the bins in O(number of size classes)
+        struct LocalBins
+        {
+            AllocStructure *    mSmallHead[SMALL_BIN_COUNT];
+            AllocStructure *    mSmallTail[SMALL_BIN_COUNT];
+            AllocStructure *    mMediumHead[MEDIUM_FIRST_LEVEL_COUNT][MEDIUM_SECOND_LEVEL_COUNT];
+            AllocStructure *    mMediumTail[MEDIUM_FIRST_LEVEL_COUNT][MEDIUM_SECOND_LEVEL_COUNT];
         };
 
+        // Head of the lock-free pool of thread allocation buffers
+        //  The tag is incremented with each pop, so a concurrent pop / push doesn't create an ABA issue
+        union ThreadAllocBufferPoolHead
+        {
+            struct
+            {
+                AllocStructure *    mTop;
+                int                 mTag;
+            };
+            long long               mValue;
+        };
+
+        // State of each segment of the growable heap
+        enum SegmentState
+        {
+            SEGMENT_COMMITTED = 0,
+            SEGMENT_RELEASED,       // The pages have been given back to the OS, the segment is not parsable
+        };
+
+        // Bump allocation in the buffer of the current thread, returns NULL if the block doesn't fit
+        //  The collector retires the buffers of all the threads without stopping them (see RetireAllThreadAllocBuffers())
+        //  mAllocating tells it to wait for the end of a bump that started before it took the buffer,
+        //  it is a simple store: the collector flushes the write buffers of the other processors instead.
+        CROSSNET_FINLINE
+        static void *   BumpThreadAllocBuffer(ThreadAllocBuffer * buffer, int alignedSize)
+        {
+            buffer->mAllocating = 1;
+            // Only the compiler must not read the buffer before the flag is set
+            _ReadWriteBarrier();
+            unsigned char * currentAlloc = buffer->mCurrent;
+            unsigned char * endAlloc = currentAlloc + alignedSize;
+            if (endAlloc <= buffer->mEnd)
+            {
+                buffer->mCurrent = endAlloc;
+                // The buffer can have been carved from free blocks, their headers are still there
+                reinterpret_cast<AllocStructure *>(currentAlloc)->mMarker = 0;
+            }
+            else
+            {
+                currentAlloc = NULL;
+            }
+            _ReadWriteBarrier();
+            buffer->mAllocating = 0;
+            return (currentAlloc);
+        }
+
+        // Inline part of the allocation of small objects, the size must be aligned and not bigger than SMALL_SIZE_BIN
+        //  It does the same as Allocate() and the beginning of Allocate(size, false), everything else is done by AllocateSlow()
+        CROSSNET_FINLINE
+        static void *   AllocateSmallFast(int alignedSize)
+        {
+            ThreadAllocBuffer * buffer = sThreadAllocBuffer;
+            if (buffer != NULL)
+            {
+                void * block = BumpThreadAllocBuffer(buffer, alignedSize);
+                if (block != NULL)
+                {
+                    return (block);
+                }
+            }
+            else if ((sThreadAllocBufferSize == 0) && GCPolicy::ConsumeBudget(alignedSize))
+            {
+                // Single threaded allocator, first the exact size bin then the end of the main buffer
+                //  (With the thread allocation buffers, the budget is consumed when a buffer is refilled)
+                int indexSmallBin = alignedSize >> ALIGNMENT_SHIFT;
+                if (sSmallBin[indexSmallBin] != NULL)
+                {
+                    return (PopSmallBin(indexSmallBin));
+                }
+                unsigned char * currentAlloc = sCurrentAllocPointer;
+                unsigned char * endAlloc = currentAlloc + alignedSize;
+                if (endAlloc < sEndMainBuffer)
+                {
+                    sCurrentAllocPointer = endAlloc;
+                    // A block given back to the bump allocation might still be there
+                    reinterpret_cast<AllocStructure *>(currentAlloc)->mMarker = 0;
+                    return (currentAlloc);
+                }
+            }
+            return (AllocateSlow(alignedSize, buffer));
+        }
+
+        // Clears a block returned by Allocate()
+        //  If the free memory is kept zeroed, only the first and last 16 bytes can be set (free block header and boundary tag)
+        //  Unless the memory has been given by the user callback
+        CROSSNET_FINLINE
+        static void     ClearAllocatedBlock(void * buffer, int size)
+        {
+            unsigned char * start = static_cast<unsigned char *>(buffer);
+            if (sZeroFreeMemory && ((size_t)(start - sHeapBase) < (size_t)(sEndReservedHeap - sHeapBase)))
+            {
+                __memclear__(start, ALIGNMENT);
+                __memclear__(start + Align(size) - ALIGNMENT, ALIGNMENT);
+            }
+            else
+            {
+                __memclear__(buffer, size);
+            }
+        }
+
+        // Clears the header and the boundary tag of a free block (the rest is zero if the free memory is kept zeroed)
+        //  Used when the block is merged in a bigger one or given back to the bump allocation
+        CROSSNET_FINLINE
+        static void     ClearFreeBlockTags(void * block, int alignedSize)
+        {
+            unsigned char * start = static_cast<unsigned char *>(block);
+            __memclear__(start, ALIGNMENT);
+            __memclear__(start + alignedSize - ALIGNMENT, ALIGNMENT);
+        }
+
+        CROSSNET_FINLINE
+        static bool     IsZeroingFreeMemory()
+        {
+            return (sZeroFreeMemory);
+        }
+
+        static void     ClearFreedMemory(void * start, int alignedSize);
+
+        // Object starts of the main buffer (only with InitOptions::mExactInteriorPointers, see GCManager::ValidateRoot())
+        //  Records the start of an object returned by the public allocation functions
+        //  NULL and the memory given by the user callbacks are not covered by the bitmap
+        CROSSNET_FINLINE
+        static void *   RecordAllocationStart(void * block)
+        {
+            if (sRecordAllocationStarts && sAllocationStartBitmap.Covers(block))
+            {
+                if (sThreadAllocBufferSize != 0)
+                {
+                    // Other threads might allocate in the same 512 bytes
+                    sAllocationStartBitmap.TestAndSetAtomic(block);
+                }
+                else
+                {
+                    sAllocationStartBitmap.Set(block);
+                }
+            }
+            return (block);
+        }
+        // Same for an object bigger than SMALL_SIZE_BIN, the biggest size bounds the search of FindAllocationStart()
+        static void *   RecordBigAllocationStart(void * block, int alignedSize);
+        // Forgets the object starts of [start, end[ (dead objects swept, explicit frees, released regions)
+        //  The lazy and the parallel sweeps run at the same time as the allocations, the words at both ends can be shared
+        CROSSNET_FINLINE
+        static void     ClearAllocationStarts(void * start, void * end)
+        {
+            if (sRecordAllocationStarts && sAllocationStartBitmap.Covers(start))
+            {
+                sAllocationStartBitmap.ClearRangeAtomic(start, end);
+            }
+        }
+        // Returns the last object start at or before the pointer (not further than the biggest object), NULL if there is none
+        //  The pointer must be in the current allocation space. The object might end before the pointer.
+        static void *   FindAllocationStart(void * pointer);
+        CROSSNET_FINLINE
+        static bool     IsRecordingAllocationStarts()
+        {
+            return (sRecordAllocationStarts);
+        }
+
         static void *   Allocate(int size, bool afterGC);
+        static void *   AllocateSlow(int size, ThreadAllocBuffer * buffer);
+        static void *   AllocateLarge(int size);
+        static void *   AllocatePointerFree(int size);
+        static void     FreeBatch(const int * sizes, int count, void * * objects);
         static void     InternalFree(AllocStructure * freedPtr, int alignedSize);
         static void *   GetCurrentAllocPointer();
         static void     SetCurrentAllocPointer(void * currentPointer);
         static bool     InCurrentAllocationSpace(void * pointer);
 
+        static void     SetupGrowableHeap(const ::CrossNetRuntime::InitOptions & options);
+        static bool     GrowHeap(int alignedSize);
+        // Called by the sweep for each run of free blocks
+        //  With bins, the blocks go in these local bins instead of the bins of the allocator (no lock needed)
+        static void     FreeRun(void * start, int size, LocalBins * bins);
+        static void     ClearLocalBins(LocalBins & bins);
+        static void     SpliceLocalBins(LocalBins & bins);
+        static void     ReleaseTailSegments();
+        static void *   SkipReleasedSegments(void * pointer);
+
+        CROSSNET_FINLINE
+        static unsigned char * GetHeapBase()
+        {
+            return (sHeapBase);
+        }
+
+        // End of the address space the main buffer can use (committed or not)
+        CROSSNET_FINLINE
+        static unsigned char * GetHeapEnd()
+        {
+            return (sEndReservedHeap);
+        }
+
+        // Returns true if the pointer is the start of a segment that has been given back to the OS
+        CROSSNET_FINLINE
+        static bool     IsReleasedSegment(void * pointer)
+        {
+            if (sSegmentStates == NULL)
+            {
+                // Fixed size heap, no segment
+                return (false);
+            }
+            size_t offset = (unsigned char *)pointer - sHeapBase;
+            if ((offset & (sSegmentSize - 1)) != 0)
+            {
+                // Not at the start of the segment
+                //  As a released segment is always completely free, a block can't start inside it
+                return (false);
+            }
+            return (sSegmentStates[offset >> sSegmentShift] == SEGMENT_RELEASED);
+        }
+
         static void     ClearBins();
-        static void     ReconcileMediumCache();
-        static void     SafeReconcileMediumCache();
 
-        static void *           sEndMainBuffer;
+        // Exact state of the blocks of the main buffer, one bit per free block in a bin (set by the Push, cleared by the Pop / Remove)
+        //  The blocks given by the user callbacks are not covered, they are never coalesced
+        CROSSNET_FINLINE
+        static bool     IsFreeBlock(void * pointer)
+        {
+            return (sFreeBlockBitmap.Covers(pointer) && sFreeBlockBitmap.Test(pointer));
+        }
+
+        CROSSNET_FINLINE
+        static void     SetFreeBlock(void * pointer)
+        {
+            if (sFreeBlockBitmap.Covers(pointer))
+            {
+                sFreeBlockBitmap.Set(pointer);
+            }
+        }
+
+        CROSSNET_FINLINE
+        static void     ClearFreeBlock(void * pointer)
+        {
+            if (sFreeBlockBitmap.Covers(pointer))
+            {
+                sFreeBlockBitmap.Clear(pointer);
+            }
+        }
+
+        // Pops the first block of a small bin, the bin must not be empty
+        //  The block is allocated, so it must not look free anymore (even before the constructor sets the VTable)
+        CROSSNET_FINLINE
+        static AllocStructure * PopSmallBin(int index)
+        {
+            AllocStructure * ptr = sSmallBin[index];
+            AllocStructure * next = ptr->mNext;
+            sSmallBin[index] = next;
+            if (next == NULL)
+            {
+                // The bin is now empty, update the occupancy mask accordingly
+                sSmallBinMask[index >> 5] &= ~(1U << (index & 31));
+            }
+            ClearFreeBlock(ptr);
+            ptr->mMarker = 0;
+            return (ptr);
+        }
+
+        CROSSNET_FINLINE
+        static void PushSmallBin(AllocStructure * freedPtr, int index)
+        {
+            SetFreeBlock(freedPtr);
+            AllocStructure * head = sSmallBin[index];
+            freedPtr->mNext = head;
+            if (head != NULL)
+            {
+                head->mPrev = freedPtr;
+            }
+            sSmallBin[index] = freedPtr;
+            sSmallBinMask[index >> 5] |= (1U << (index & 31));
+        }
+
+        // Removes a block from its small bin, the block can be anywhere in the list
+        CROSSNET_FINLINE
+        static void RemoveSmallBin(AllocStructure * ptr, int index)
+        {
+            ClearFreeBlock(ptr);
+            AllocStructure * next = ptr->mNext;
+            if (sSmallBin[index] == ptr)
+            {
+                sSmallBin[index] = next;
+                if (next == NULL)
+                {
+                    sSmallBinMask[index >> 5] &= ~(1U << (index & 31));
+                }
+                return;
+            }
+            AllocStructure * prev = ptr->mPrev;
+            prev->mNext = next;
+            if (next != NULL)
+            {
+                next->mPrev = prev;
+            }
+        }
+
+        static int      FindSmallBin(int index);
+
+        // Returns the first and second level indexes of the medium bin for this size
+        CROSSNET_FINLINE
+        static void MediumMapping(int size, int & firstLevel, int & secondLevel)
+        {
+            firstLevel = HighestBit(size);
+            secondLevel = (size >> (firstLevel - MEDIUM_SECOND_LEVEL_SHIFT)) & (MEDIUM_SECOND_LEVEL_COUNT - 1);
+        }
+
+        CROSSNET_FINLINE
+        static void PushMediumBin(AllocStructure * freedPtr)
+        {
+            int firstLevel, secondLevel;
+            MediumMapping(freedPtr->mSize, firstLevel, secondLevel);
+
+            SetFreeBlock(freedPtr);
+            AllocStructure * head = sMediumBin[firstLevel][secondLevel];
+            freedPtr->mNext = head;
+            if (head != NULL)
+            {
+                head->mPrev = freedPtr;
+            }
+            sMediumBin[firstLevel][secondLevel] = freedPtr;
+            sMediumFirstLevelMask |= (1U << firstLevel);
+            sMediumSecondLevelMask[firstLevel] |= (1U << secondLevel);
+        }
+
+        // Removes a block from its medium bin, the block can be anywhere in the list
+        CROSSNET_FINLINE
+        static void RemoveMediumBin(AllocStructure * ptr)
+        {
+            ClearFreeBlock(ptr);
+            AllocStructure * next = ptr->mNext;
+            int firstLevel, secondLevel;
+            MediumMapping(ptr->mSize, firstLevel, secondLevel);
+            if (sMediumBin[firstLevel][secondLevel] == ptr)
+            {
+                // It was the first block of the list
+                sMediumBin[firstLevel][secondLevel] = next;
+                if (next == NULL)
+                {
+                    // The bin is now empty, update the masks accordingly
+                    sMediumSecondLevelMask[firstLevel] &= ~(1U << secondLevel);
+                    if (sMediumSecondLevelMask[firstLevel] == 0)
+                    {
+                        sMediumFirstLevelMask &= ~(1U << firstLevel);
+                    }
+                }
+                return;
+            }
+            AllocStructure * prev = ptr->mPrev;
+            prev->mNext = next;
+            if (next != NULL)
+            {
+                next->mPrev = prev;
+            }
+        }
+
+        // Removes a free block from its small or medium bin
+        CROSSNET_FINLINE
+        static void RemoveFromBin(AllocStructure * ptr)
+        {
+            if (ptr->mSize <= SMALL_SIZE_BIN)
+            {
+                RemoveSmallBin(ptr, ptr->mSize >> ALIGNMENT_SHIFT);
+            }
+            else
+            {
+                RemoveMediumBin(ptr);
+            }
+        }
+
+        static AllocStructure * FindMediumBlock(int alignedSize);
+        static AllocStructure * PeekMediumBlock(int alignedSize);
+        static bool             HasFreeBlock(int alignedSize);
+        static AllocStructure * FindFreeBlockBefore(void * pointer);
+
+        // Called when an allocation or a free doesn't use the buffer of the current thread
+        //  If the buffer is the arena of a region, the region is then promoted
+        CROSSNET_FINLINE
+        static void             MarkBufferBypassed()
+        {
+            ThreadAllocBuffer * buffer = sThreadAllocBuffer;
+            if (buffer != NULL)
+            {
+                buffer->mBypassed = true;
+            }
+        }
+
+        static ThreadAllocBuffer *  AttachThread();
+        static void *               RefillThreadAllocBuffer(ThreadAllocBuffer * buffer, int alignedSize);
+        static void                 RetireThreadAllocBuffer(ThreadAllocBuffer * buffer);
+        static void                 RetireAllThreadAllocBuffers();
+        // The two halves of the handshake of RetireAllThreadAllocBuffers() for one buffer (of another thread or of a region)
+        static void                 BeginRetireThreadAllocBuffer(ThreadAllocBuffer * buffer);
+        static void                 EndRetireThreadAllocBuffer(ThreadAllocBuffer * buffer);
+        // The other threads run during the collection otherwise, their stacks and registers are scanned while they are suspended
+        //  (The allocator lock must be taken, and the buffers retired first so no bump is pending)
+        static void                 SuspendOtherThreads();
+        static void                 ResumeOtherThreads();
+        static void                 ReserveBufferTail(unsigned char * current, unsigned char * end);
+        static bool                 ReplenishThreadAllocBufferPool();
+        static AllocStructure *     CarveThreadAllocBuffer(int & size);
+        static AllocStructure *     PopThreadAllocBufferPool();
+        static void                 PushThreadAllocBufferPool(AllocStructure * chunk, int size);
+
+        // Re-entrant allocator lock, only used when the thread allocation buffers are enabled
+        //  (Collect() is called during allocation and frees blocks)
+        static void     Lock();
+        static void     Unlock();
+
+        static unsigned char *  sHeapBase;
+        static void *           sEndMainBuffer;         // End of the committed part of the heap
         static unsigned char *  sCurrentAllocPointer;
-        static AllocStructure * sSmallBin[SMALL_SIZE_BIN / ALIGNMENT];
-        static AllocStructure * sMediumBin[32];
-        static AllocStructure * sCurrentMediumPointer;
-        static int              sCurrentMediumSize;
+        static AllocStructure * sSmallBin[SMALL_BIN_COUNT];
+        static unsigned int     sSmallBinMask[SMALL_BIN_MASK_SIZE];
+        static AllocStructure * sMediumBin[MEDIUM_FIRST_LEVEL_COUNT][MEDIUM_SECOND_LEVEL_COUNT];
+        static unsigned int     sMediumFirstLevelMask;
+        static unsigned int     sMediumSecondLevelMask[MEDIUM_FIRST_LEVEL_COUNT];
+
+        // Growable heap, sSegmentStates is NULL if the user provided the main buffer
+        static unsigned char *  sEndReservedHeap;       // Same as sEndMainBuffer if the user provided the main buffer
+        static unsigned char *  sSegmentStates;
+        static int              sSegmentShift;
+        static int              sSegmentSize;
+        static int              sMinCommittedSize;
+        static void *           sReservation;
+        static size_t           sReservationSize;
+        static HeapBacking      sHeapBacking;
+        static bool             sZeroFreeMemory;
+        // Set once the allocation callbacks returned some memory (the objects there are not in the heap)
+        static bool             sExternalObjects;
+
+        // One bit per object start of the main buffer (see RecordAllocationStart())
+        static bool             sRecordAllocationStarts;
+        static GCBitmap         sAllocationStartBitmap;
+        static volatile long    sMaxObjectSize;         // Aligned size of the biggest object allocated in the main buffer
+
+        // One bit per free block in a bin (see IsFreeBlock())
+        static GCBitmap         sFreeBlockBitmap;
+
+        static int                                      sThreadAllocBufferSize;
+        static ThreadAllocBuffer * volatile             sAllThreadAllocBuffers;
+        static volatile long long                       sThreadAllocBufferPool;
+        static volatile long                            sAllocatorLock;
+        static CROSSNET_THREAD_LOCAL ThreadAllocBuffer *    sThreadAllocBuffer;
+        static CROSSNET_THREAD_LOCAL int                    sLockDepth;
 
         friend class GCManager;
+        friend class GCParallelSweeper;
+        friend class GCPolicy;
+        friend class RegionScope;
     };
 }
 
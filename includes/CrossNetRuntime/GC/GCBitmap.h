@@ -0,0 +1,137 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __GCBITMAP_H__
+#define __GCBITMAP_H__
+
+#include "CrossNetRuntime/Defines.h"
+
+// For _InterlockedOr
+#include <intrin.h>
+
+namespace CrossNetRuntime
+{
+    // Bitmap covering a range of memory, one bit per 16 bytes granule (the allocation alignment)
+    //  The bits are stored in a separate buffer, so setting a bit never writes to the covered memory.
+    //  The buffer is reserved and committed with GCVirtualMemory, it is zeroed at setup
+    //  and only the pages actually used take physical memory.
+    class GCBitmap
+    {
+    public:
+        enum
+        {
+            GRANULE_SHIFT = 4,
+            GRANULE_SIZE = 1 << GRANULE_SHIFT,
+        };
+
+        GCBitmap();
+
+        void    Setup(void * base, size_t size);
+        void    Teardown();
+
+        CROSSNET_FINLINE
+        bool    Covers(void * pointer) const
+        {
+            return ((size_t)((unsigned char *)pointer - mBase) < mSize);
+        }
+
+        CROSSNET_FINLINE
+        bool    Test(void * pointer) const
+        {
+            size_t index = GetIndex(pointer);
+            return ((mBits[index >> 5] & (1U << (index & 31))) != 0);
+        }
+
+        CROSSNET_FINLINE
+        void    Set(void * pointer)
+        {
+            size_t index = GetIndex(pointer);
+            mBits[index >> 5] |= (1U << (index & 31));
+        }
+
+        CROSSNET_FINLINE
+        void    Clear(void * pointer)
+        {
+            size_t index = GetIndex(pointer);
+            mBits[index >> 5] &= ~(1U << (index & 31));
+        }
+
+        // Same as Test() then Set(), but several threads can mark the same bitmap at the same time
+        //  Returns false if the bit was already set
+        CROSSNET_FINLINE
+        bool    TestAndSetAtomic(void * pointer)
+        {
+            size_t index = GetIndex(pointer);
+            long bit = (long)(1U << (index & 31));
+            return ((_InterlockedOr(reinterpret_cast<volatile long *>(&mBits[index >> 5]), bit) & bit) == 0);
+        }
+
+        // Same as Clear(), but other threads can set or clear other bits of the same word at the same time
+        CROSSNET_FINLINE
+        void    ClearAtomic(void * pointer)
+        {
+            size_t index = GetIndex(pointer);
+            _InterlockedAnd(reinterpret_cast<volatile long *>(&mBits[index >> 5]), ~(long)(1U << (index & 31)));
+        }
+
+        // Sets / clears the bits of all the granules in [start, end[
+        void    SetRange(void * start, void * end);
+        void    ClearRange(void * start, void * end);
+        // Same as SetRange() for several threads at the same time
+        //  Returns false if the bit of start was already set (i.e. another thread set the same range)
+        bool    SetRangeAtomic(void * start, void * end);
+        // Same as ClearRange(), the first and the last words can be shared with other threads
+        void    ClearRangeAtomic(void * start, void * end);
+
+        // Returns the first granule in [start, end[ with the bit set (or clear), end if there is none
+        //  The bitmap is parsed 32 bits at a time
+        void *  FindNextSet(void * start, void * end) const;
+        void *  FindNextClear(void * start, void * end) const;
+        // Returns the last granule in [start, pointer] with the bit set, NULL if there is none
+        void *  FindPrevSet(void * start, void * pointer) const;
+
+        // Returns the number of bits set in [start, end[
+        int     CountRange(void * start, void * end) const;
+
+        // Replaces the bits of [start, end[ by the ones of source (same range of memory), the bits of source are cleared
+        //  Returns the number of bits set, start and end must be on a 32 granules boundary
+        int     TakeRange(GCBitmap & source, void * start, void * end);
+
+    private:
+        CROSSNET_FINLINE
+        size_t  GetIndex(void * pointer) const
+        {
+            return ((size_t)((unsigned char *)pointer - mBase) >> GRANULE_SHIFT);
+        }
+
+        CROSSNET_FINLINE
+        void *  GetPointer(size_t index) const
+        {
+            return (mBase + (index << GRANULE_SHIFT));
+        }
+
+        void *  FindNext(void * start, void * end, unsigned int invert) const;
+
+        unsigned char *     mBase;
+        size_t              mSize;
+        unsigned int *      mBits;
+        size_t              mBitsSize;
+
+        GCBitmap(const GCBitmap & other);
+        GCBitmap & operator=(const GCBitmap & other);
+    };
+}
+
+#endif
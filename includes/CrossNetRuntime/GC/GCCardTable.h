@@ -0,0 +1,91 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef __GCCARDTABLE_H__
+#define __GCCARDTABLE_H__
+
+#include "CrossNetRuntime/Defines.h"
+
+namespace CrossNetRuntime
+{
+    // Card table covering a range of memory, one byte per card of 512 bytes
+    //  Used by the generational collection to find the old objects written to since the last collection,
+    //  and by the compaction for the pinned memory and the parts of the heap being evacuated.
+    //  Dirtying a card is a single byte store (no read, no interlocked operation), so several threads
+    //  can dirty cards at the same time. The cards are only read and cleared during the collections.
+    //  Like GCBitmap, the table is reserved and committed with GCVirtualMemory, only the pages used take physical memory.
+    class GCCardTable
+    {
+    public:
+        enum
+        {
+            CARD_SHIFT = 9,
+            CARD_SIZE = 1 << CARD_SHIFT,
+
+            CLEAN_CARD = 0,
+            DIRTY_CARD = 1,
+        };
+
+        GCCardTable();
+
+        void    Setup(void * base, size_t size);
+        void    Teardown();
+
+        CROSSNET_FINLINE
+        bool    Covers(void * pointer) const
+        {
+            return ((size_t)((unsigned char *)pointer - mBase) < mSize);
+        }
+
+        CROSSNET_FINLINE
+        void    MarkCard(void * pointer)
+        {
+            mCards[(size_t)((unsigned char *)pointer - mBase) >> CARD_SHIFT] = DIRTY_CARD;
+        }
+
+        CROSSNET_FINLINE
+        bool    IsCardDirty(void * pointer) const
+        {
+            return (mCards[(size_t)((unsigned char *)pointer - mBase) >> CARD_SHIFT] != CLEAN_CARD);
+        }
+
+        // Dirties / cleans the cards overlapping [start, end[
+        void    MarkRange(void * start, void * end);
+        void    ClearRange(void * start, void * end);
+
+        // Finds the first run of dirty cards overlapping [start, end[, returns false if there is none
+        //  The run is returned on card boundaries, except that it is clamped to [start, end[
+        //  The table is parsed 4 cards at a time
+        bool    FindDirtyRun(void * start, void * end, unsigned char * & runStart, unsigned char * & runEnd) const;
+
+    private:
+        CROSSNET_FINLINE
+        size_t  GetIndex(void * pointer) const
+        {
+            return ((size_t)((unsigned char *)pointer - mBase) >> CARD_SHIFT);
+        }
+
+        unsigned char *     mBase;
+        size_t              mSize;
+        unsigned char *     mCards;
+        size_t              mCardsSize;
+
+        GCCardTable(const GCCardTable & other);
+        GCCardTable & operator=(const GCCardTable & other);
+    };
+}
+
+#endif
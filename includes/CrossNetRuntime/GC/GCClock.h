@@ -0,0 +1,39 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef __GCCLOCK_H__
+#define __GCCLOCK_H__
+
+#include "CrossNetRuntime/Defines.h"
+
+namespace CrossNetRuntime
+{
+    // High resolution clock used for the time budgets of the GC
+    //  clock() is not precise enough for budgets of a few hundred microseconds
+    class GCClock
+    {
+    public:
+        // Microseconds since an arbitrary point in time (only the differences are meaningful)
+        static long long    GetMicroseconds();
+
+    private:
+        GCClock();
+        GCClock(const GCClock & other);
+        GCClock & operator=(const GCClock & other);
+    };
+}
+
+#endif
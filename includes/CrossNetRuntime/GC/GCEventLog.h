@@ -0,0 +1,139 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __GCEVENTLOG_H__
+#define __GCEVENTLOG_H__
+
+#include "CrossNetRuntime/Defines.h"
+#include "CrossNetRuntime/InitOptions.h"
+#include <stdio.h>
+
+namespace CrossNetRuntime
+{
+    // Log of the last pauses of the GC
+    //  Each collection (and each step of the incremental collection) is recorded with the high resolution clock (see GCClock):
+    //  the duration of the pause and of its phases, the bytes before and after, the objects freed and the free runs created.
+    //  The events go in a ring buffer: the oldest ones are overwritten, the writers never wait for the readers.
+    //  Any thread can read the log at any time (a slot being written is simply skipped).
+    //
+    //  The timestamps are GCClock::GetMicroseconds(), the application can use the same clock for its own events
+    //  so the exported trace lines up with them.
+    class GCEventLog
+    {
+    public:
+        enum EventKind
+        {
+            EVENT_COLLECT,      // Pause of GCManager::Collect()
+            EVENT_STEP,         // Step of the incremental collection (see GCManager::Step())
+            EVENT_SWEEP,        // End of a lazy (or incremental) sweep, the duration is the sum of the chunks (not a pause)
+        };
+
+        enum Phase
+        {
+            PHASE_PERMANENT_ROOTS,  // CrossNetRuntime::Trace()
+            PHASE_STACK,            // Stack and registers of all the threads (or the shadow stack)
+            PHASE_STATICS,          // InitOptions::mMainTrace
+            PHASE_MARK,             // Rest of the marking (dirty cards, parallel marking, rescans)
+            PHASE_COMPACT,
+            PHASE_SWEEP,
+            NUM_PHASES,
+        };
+
+        struct Event
+        {
+            long long   mStart;                         // Microseconds (GCClock)
+            long long   mDuration;
+            int         mPhaseStarts[NUM_PHASES];       // Microseconds after mStart, -1 if the phase didn't happen
+            int         mPhaseDurations[NUM_PHASES];
+            int         mKind;                          // EventKind
+            int         mGeneration;
+            int         mBytesBefore;                   // Bytes after plus the bytes freed (the freed pointer-free objects are not counted)
+            int         mBytesAfter;                    // GCManager::GetLiveBytes() (0 if the sweep continues after the pause)
+            int         mCompactedBytes;
+            int         mObjectsFreed;                  // Since the previous event (a lazy sweep frees most objects after the pause)
+            int         mFreeRuns;                      // Runs of dead objects turned into free blocks in the main buffer
+        };
+
+        struct PauseStatistics
+        {
+            int         mNumPauses;                     // EVENT_COLLECT and EVENT_STEP still in the log
+            long long   mTotal;                         // Microseconds
+            long long   mP50;
+            long long   mP90;
+            long long   mP99;
+            long long   mMax;
+        };
+
+        static void Setup(const ::CrossNetRuntime::InitOptions & options);
+        static void Teardown();
+
+        // Recording, called by GCManager
+        //  Each thread builds its own event, without lock (a Step() releases the allocator lock between its phases)
+        //  The end of a sweep is recorded directly
+        static void BeginEvent(EventKind kind, int generation);
+        // The phase can be added several times, the durations are summed
+        static void AddPhase(Phase phase, long long start, long long end);
+        static void EndEvent(int bytesAfter, int compactedBytes);
+        // Can be called by several threads at the same time (parallel sweeping)
+        static void AddFreed(int numObjects, int bytes, int numRuns);
+        // Time spent on one chunk of the lazy sweep, and end of the sweep
+        static void AddSweepChunk(long long start, long long end);
+        static void EndSweep(int bytesAfter);
+
+        // Copies the last events (up to maxEvents, oldest first), returns the number copied
+        static int  GetEvents(Event * events, int maxEvents);
+        static void GetPauseStatistics(PauseStatistics & statistics);
+
+        // Percentiles and a log2 histogram of the pauses in the log
+        static void DumpPauseHistogram(FILE * file);
+        // Chrome trace event format (chrome://tracing, Perfetto), one complete event per pause with its phases
+        //  And a counter for the live bytes
+        static void DumpChromeTrace(FILE * file);
+
+    private:
+        enum
+        {
+            DEFAULT_LOG_SIZE = 256,
+        };
+
+        // The sequence is odd while the event is written, then 2 * (index + 1) for the event index
+        struct Slot
+        {
+            volatile long       mSequence;
+            Event               mEvent;
+        };
+
+        static void Record(const Event & event);
+        static bool ReadSlot(long index, Event & event);
+
+        static Slot *           sSlots;
+        static int              sLogSize;               // Power of 2
+        static volatile long    sNextIndex;
+
+        // Event being built by the current thread (between BeginEvent() and EndEvent())
+        static CROSSNET_THREAD_LOCAL Event  sCurrentEvent;
+        static volatile long    sObjectsFreed;
+        static volatile long    sBytesFreed;
+        static volatile long    sFreeRuns;
+        static long long        sSweepStart;            // -1 if no chunk has been swept since the last collection
+        static long long        sSweepDuration;
+
+        GCEventLog();
+        GCEventLog(const GCEventLog & other);
+        GCEventLog & operator=(const GCEventLog & other);
+    };
+}
+
+#endif
@@ -0,0 +1,109 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __GCLARGEOBJECTSPACE_H__
+#define __GCLARGEOBJECTSPACE_H__
+
+#include "CrossNetRuntime/Defines.h"
+#include "CrossNetRuntime/InitOptions.h"
+
+namespace CrossNetRuntime
+{
+    // Space dedicated to the big arrays and strings
+    //  Each large object gets its own pages, they are never moved and never share a page with another object.
+    //  The space is swept separately from the main buffer, and the pages of a dead object are given back
+    //  to the OS immediately. As a side effect, a new large object always gets zeroed pages.
+    //
+    //  The free pages are tracked with a page map (one int per page):
+    //      > 0     First page of an object, number of pages used by the object
+    //      < 0     First or last page of a free run, minus the number of pages of the run
+    //      0       Any other page of an object or a free run
+    //  The last page of a free run is a boundary tag, so a freed object is coalesced right away
+    //  with the free runs on both sides. Free runs never touch each other.
+    //  The free runs are kept in bins by size (one bin per power of 2 pages), double linked
+    //  through two side arrays indexed by the first page of the run.
+    //
+    //  This class is not thread safe, GCAllocator takes its lock before calling it.
+    class GCLargeObjectSpace
+    {
+    public:
+        static void Setup(const ::CrossNetRuntime::InitOptions & options);
+        static void Teardown();
+
+        // Returns true if an allocation of this size should go in the large object space
+        //  Always false if the space is disabled
+        CROSSNET_FINLINE
+        static bool     IsLargeObject(int size)
+        {
+            return (size >= sThreshold);
+        }
+
+        // Returns zeroed memory aligned on a page, or NULL if there is not enough contiguous pages
+        static void *   Allocate(int size);
+        // Frees the pages of the object, the pointer must have been returned by Allocate()
+        static void     Free(void * object);
+
+        CROSSNET_FINLINE
+        static bool     InLargeObjectSpace(void * pointer)
+        {
+            return ((size_t)((unsigned char *)pointer - sBase) < sSize);
+        }
+
+        // Returns true if the pointer is the start of a live (i.e. not freed yet) large object
+        static bool     IsObjectStart(void * pointer);
+        // Returns the start of the object containing the pointer, NULL if the page is free
+        static void *   FindObjectContaining(void * pointer);
+
+        // Reserved range (the writes are tracked if the incremental or the generational collection is enabled)
+        static void *   GetBase();
+        static size_t   GetReservedSize();
+
+        // Iterates through the allocated objects (in address order)
+        //  GetNextObject() must be called before the current object is freed,
+        //  freeing it can coalesce its first page in the middle of a free run
+        static void *   GetFirstObject();
+        static void *   GetNextObject(void * object);
+
+    private:
+        static int      FindObject(int page);
+
+        static int      GetBinIndex(int numPages);
+        static void     InsertRun(int page, int numPages);
+        static void     RemoveRun(int page);
+
+        enum
+        {
+            NUM_BINS = 32,
+            NO_RUN = -1,
+        };
+
+        static unsigned char *  sBase;
+        static size_t           sSize;
+        static int *            sPageMap;
+        static int *            sNextRun;
+        static int *            sPrevRun;
+        static int              sBins[NUM_BINS];
+        static unsigned int     sBinMask;
+        static int              sNumPages;
+        static int              sPageShift;
+        static int              sThreshold;
+
+        GCLargeObjectSpace();
+        GCLargeObjectSpace(const GCLargeObjectSpace & other);
+        GCLargeObjectSpace & operator=(const GCLargeObjectSpace & other);
+    };
+}
+
+#endif
@@ -19,6 +19,13 @@
 #include "CrossNetRuntime/System/Object.h"
 #include "CrossNetRuntime/InitOptions.h"
 #include "CrossNetRuntime/System/String.h"
+#include "CrossNetRuntime/InterfaceMapper.h"
+#include "CrossNetRuntime/GC/GCBitmap.h"
+#include "CrossNetRuntime/GC/GCCardTable.h"
+#include "CrossNetRuntime/GC/GCMarkStack.h"
+#include "CrossNetRuntime/GC/GCParallelMarker.h"
+#include "CrossNetRuntime/GC/RegionScope.h"
+#include <vector>
 
 namespace CrossNetRuntime
 {
@@ -33,67 +40,379 @@ namespace CrossNetRuntime
         static void Setup(const ::CrossNetRuntime::InitOptions & options);
         static void Teardown();
 
+        // Collects the objects not reachable anymore
+        //  With the generational collection (see InitOptions::mGenerationalCollection), a generation lower than
+        //  MAX_GENERATION only collects the young objects (the ones allocated since the last collection).
+        //  The old objects are not traced (except the ones on the dirty cards) and stay alive until the next complete collection.
+        //  Otherwise, and with final, all the objects are collected.
+        //  With the compaction (see InitOptions::mCompaction), a complete collection also evacuates the sparse parts of the main buffer.
         static void Collect(int generation, bool final);
 
+        // Incremental collection (see InitOptions::mIncrementalCollection)
+        //  Advances the current collection for about budgetMicroseconds, starts a new one if none is in progress.
+        //  The first step only marks the roots, the next ones trace the objects of the gray worklist.
+        //  When the worklist is empty, the roots and the marked objects written to since the first step
+        //  are traced again in one last pause, then the next steps sweep the main buffer.
+        //  A negative budget finishes the collection. Returns true if there is no collection in progress anymore.
+        //  Without mIncrementalCollection (or with CN_GC_HEADER_MARK), this is a simple Collect().
+        //  Like with Collect(), the other threads must not run managed code during a step.
+        static bool Step(int budgetMicroseconds);
+
+        // To call when the application has some time left (like at the end of a frame)
+        //  Starts a collection if half of the allocation budget has been consumed (see GCPolicy),
+        //  and advances it for about budgetMicroseconds.
+        //  Without budget (InitOptions::mGcBudgetMinSize set to 0), the collections have to be started with Step().
+        static void OnIdle(int budgetMicroseconds);
+
+        CROSSNET_FINLINE
+        static bool IsIncrementalCollectionEnabled()
+        {
+            return (sIncrementalEnabled);
+        }
+
+        CROSSNET_FINLINE
+        static bool IsIncrementalCollectionInProgress()
+        {
+            return (sPhase != PHASE_IDLE);
+        }
+
+        CROSSNET_FINLINE
+        static bool IsIncrementalMarking()
+        {
+            return (sPhase == PHASE_MARKING);
+        }
+
+        // Returns true if the memory is going to be swept by the incremental collection in progress
+        //  The allocator must not reuse it until then
+        CROSSNET_FINLINE
+        static bool IsUnsweptMemory(void * pointer)
+        {
+#ifndef CN_GC_HEADER_MARK
+            return ((sPhase != PHASE_IDLE) && (pointer >= sSweepCursor) && (pointer < sMarkingLimit));
+#else
+            pointer;
+            return (false);
+#endif
+        }
+
+        // True if the main buffer is being swept by chunks (see InitOptions::mLazySweeping)
+        //  False while a chunk is being swept (a destructor allocating must not sweep)
+        CROSSNET_FINLINE
+        static bool IsLazySweeping()
+        {
+            return (sLazySweepingEnabled && (sPhase == PHASE_SWEEPING) && (sSweepingChunk == false));
+        }
+
+        // Sweeps the next chunk of the main buffer, called by the allocator before it takes new memory
+        //  The allocator lock is taken
+        static void SweepNextChunk();
+
+        CROSSNET_FINLINE
+        static bool IsGenerationalCollectionEnabled()
+        {
+            return (sGenerationalEnabled);
+        }
+
+        // Generation of the last collection (MAX_GENERATION if it was complete)
+        CROSSNET_FINLINE
+        static int GetLastGeneration()
+        {
+            return (sGeneration);
+        }
+
+        // True if the generated code calls WriteBarrier() after each store of a managed pointer (see InitOptions::mGeneratedWriteBarrier)
+        CROSSNET_FINLINE
+        static bool IsWriteBarrierGenerated()
+        {
+            return (sGeneratedWriteBarrier);
+        }
+
+        // Write barrier of the generational collection
+        //  To call after a managed pointer has been stored in a managed object, slot is the address of the field
+        //  The card of the slot is dirtied, the next young collection traces again the old objects on the dirty cards.
+        //  Without generational collection, or for an object outside the heap, this does nothing.
+        //  A store outside the arena of the region of the current thread (if any) promotes the region (see RegionScope).
+        CROSSNET_FINLINE
+        static void WriteBarrier(void * slot)
+        {
+            RegionScope::OnStore(slot);
+#ifndef CN_GC_HEADER_MARK
+            if (sCardTable.Covers(slot))
+            {
+                sCardTable.MarkCard(slot);
+            }
+            else if (sLargeObjectCardTable.Covers(slot))
+            {
+                sLargeObjectCardTable.MarkCard(slot);
+            }
+#else
+            slot;
+#endif
+        }
+
+        // Same for the pointers stored in [start, start + size[ (like a copy of array items)
+        static void WriteBarrierRange(void * start, int size);
+
+        // Called by the allocator when a block of the main buffer is explicitly freed (the allocator lock is taken)
+        //  With the generational collection, its marks would make it look old to the young collections
+        CROSSNET_FINLINE
+        static void OnFree(void * block, int alignedSize)
+        {
+#ifndef CN_GC_HEADER_MARK
+            if (sGenerationalEnabled)
+            {
+                unsigned char * start = static_cast<unsigned char *>(block);
+                sMarkBitmap.ClearRange(start, start + alignedSize);
+                sObjectStartBitmap.Clear(start);
+            }
+#else
+            block;
+            alignedSize;
+#endif
+        }
+
+        // Mostly-copying compaction (see InitOptions::mCompaction)
+        //  Does a complete collection that evacuates all the parts of the main buffer less than COMPACTION_FORCED_LIVE_PERCENT full
+        //  (The other complete collections only evacuate the parts less than COMPACTION_LIVE_PERCENT full)
+        //  Called by the allocator when an allocation fails even after a collection, enough bytes might be free but not in one block.
+        //  Without mCompaction (or with CN_GC_HEADER_MARK), this is a simple complete collection.
+        static void Compact();
+
+        CROSSNET_FINLINE
+        static bool IsCompactionEnabled()
+        {
+            return (sCompactionEnabled);
+        }
+
+        // True if the last collection was done by Compact()
+        CROSSNET_FINLINE
+        static bool WasLastCollectionCompact()
+        {
+            return (sLastCollectionCompact);
+        }
+
+        // Bytes moved by the last collection
+        static int GetCompactedBytes();
+
+        // Called by the allocator for each large object allocated during the incremental marking
+        //  The object can't be marked now (its header is not set yet), it is marked in the last step
+        static void OnLargeObjectAllocated(void * object);
+
         // The GC enable collection of one single object (without tracing pointers)
         //  This function should be used _extremely carefully_
         //  The user must be sure that no pointer is tracing to this object
         //
         //  TODO:   Implement method for delayed collection by setting a flag
         //          To detect during the tracing if this object is really not traced from another pointer
+        //  With the generational collection, the old objects on the dirty cards are traced even if they are dead,
+        //  so the dead objects must not point to it either (clear the pointers to it).
         static void CollectOneObject(::System::Object * object);
 
         // Tracing an object
+        //  The pointer is passed by value, so the compaction can't update it: the object is pinned
         static CROSSNET_FINLINE
         void Trace(System::Object * object, unsigned char currentMark)
         {
+#ifndef CN_GC_HEADER_MARK
+            if (sCompactionPhase == COMPACTION_MARKING)
+            {
+                Pin(object);
+            }
+#endif
+            TraceReference(object, currentMark);
+        }
+
+        // Specialization for strings (to speed things up a bit)
+        static CROSSNET_FINLINE
+        void Trace(System::String * str, unsigned char currentMark)
+        {
+#ifndef CN_GC_HEADER_MARK
+            if (sCompactionPhase == COMPACTION_MARKING)
+            {
+                Pin(str);
+            }
+#endif
+            TraceReference(str, currentMark);
+        }
+
+        // Tracing an interface (that is actually pointing to an object)
+        static CROSSNET_FINLINE
+        void Trace(::CrossNetRuntime::IInterface * interface, unsigned char currentMark)
+        {
+            ::System::Object * object = reinterpret_cast<::System::Object *>(interface);
+            Trace(object, currentMark);
+        }
+
+        // Tracing a field (or an array item), slot is the pointer itself (see Tracer)
+        //  During a compaction, the pointer is updated if the object is moved
+        template <typename T>
+        static CROSSNET_FINLINE
+        void TraceSlot(T * & slot, unsigned char currentMark)
+        {
+#ifndef CN_GC_HEADER_MARK
+            if (sCompactionPhase > COMPACTION_MARKING)
+            {
+                // The objects are being moved (or the pointers to them updated)
+                VisitSlot(reinterpret_cast<void * *>(&slot), currentMark);
+                return;
+            }
+#endif
+            TraceReference(slot, currentMark);
+        }
+
+        // Tracing a pointer that might not point to a managed object (or not to its start), like a stack root
+        //  If it does, the object is traced and pinned
+        static void TraceConservative(void * pointer, unsigned char currentMark);
+
+        static void CheckCollecting(::System::Object * object);
+
+//  By default the marks are stored in a bitmap on the side of the main buffer (one bit per 16 bytes)
+//  So the collection doesn't write to the live objects, and the sweep doesn't read them.
+//  Define this macro to use the mark byte of System::Object::m__AllFlags__ instead.
+//  #define CN_GC_HEADER_MARK
+
+    private:
+        // Same as Trace() without pinning the object
+        static CROSSNET_FINLINE
+        void TraceReference(System::Object * object, unsigned char currentMark)
+        {
             if (object == NULL)
             {
                 return;
             }
-            // One possible cache miss here
-            if (object->__GetMark__() == currentMark)
+            if (GCPointerFreeSpace::InPointerFreeSpace(object))
+            {
+                // Nothing to trace inside, no need to read the object
+                GCPointerFreeSpace::Mark(object);
+                return;
+            }
+            if (Mark(object, currentMark) == false)
             {
                 // Already traced, skip this step
                 return;
             }
-            // Tell that the pointer has been traced
-            object->m__AllFlags__ &= 0xffffff00;
-            object->m__AllFlags__ |= currentMark;
 
-            // Now trace all the other pointers
-            // One possible cache miss here to get the VTable
-            // And another one to access the corresponding method
-            // Note that if we are calling the same types over and over, the number of cache misses will be reduced
+            // The other pointers are traced later from the gray worklist (see DrainMarkStack())
+            //  That way the native stack doesn't grow with the depth of the graph, and the marking can be done in steps
+            if (GCParallelMarker::IsMarking())
+            {
+                // Each marking thread has its own worklist, the other threads can steal from it
+                if (GCParallelMarker::Push(object))
+                {
+                    return;
+                }
+            }
+            else if (sMarkStack.Push(object))
+            {
+                return;
+            }
 
-            // There are ways to improve that...
+            // The worklist is full, trace them now
             object->__Trace__(currentMark);
         }
 
-        // Specialization for strings (to speed things up a bit)
         static CROSSNET_FINLINE
-        void Trace(System::String * str, unsigned char currentMark)
+        void TraceReference(System::String * str, unsigned char currentMark)
         {
             if (str == NULL)
             {
                 return;
             }
-            // Tell that the pointer has been traced (no need to read the mark as we are not tracing it)
-            str->m__AllFlags__ &= 0xffffff00;
-            str->m__AllFlags__ |= currentMark;
+            // Tell that the pointer has been traced (no need to trace anything else)
+            Mark(str, currentMark);
         }
 
-        // Tracing an interface (that is actually pointing to an object)
         static CROSSNET_FINLINE
-        void Trace(::CrossNetRuntime::IInterface * interface, unsigned char currentMark)
+        void TraceReference(::CrossNetRuntime::IInterface * interface, unsigned char currentMark)
         {
             ::System::Object * object = reinterpret_cast<::System::Object *>(interface);
-            Trace(object, currentMark);
+            TraceReference(object, currentMark);
         }
 
-        static void CheckCollecting(::System::Object * object);
+    public:
+        // Marks the object as traced, returns false if it was already marked
+        static CROSSNET_FINLINE
+        bool Mark(System::Object * object, unsigned char currentMark)
+        {
+            if (GCPointerFreeSpace::InPointerFreeSpace(object))
+            {
+                // The pointer-free space has its own mark bitmap, one bit per object
+                return (GCPointerFreeSpace::Mark(object));
+            }
+#ifndef CN_GC_HEADER_MARK
+            if (sMarkBitmap.Covers(object))
+            {
+                // One possible cache miss here (in the bitmap, the page of the object is not written)
+                if (sMarkBitmap.Test(object))
+                {
+                    return (false);
+                }
+                // Mark the whole object, so the sweep can find the dead runs without reading the live objects
+                //  (Up to its aligned size, otherwise the last granule of the block would look dead)
+                unsigned char * start = reinterpret_cast<unsigned char *>(object);
+                unsigned char * end = start + GCAllocator::Align(GetSize(object));
+                if (GCParallelMarker::IsMarking())
+                {
+                    // Several threads might reach the same object, only one of them traces it
+                    if (sMarkBitmap.SetRangeAtomic(start, end) == false)
+                    {
+                        return (false);
+                    }
+                    if (sRecordObjectStarts)
+                    {
+                        // Other threads might set a bit of the same word
+                        sObjectStartBitmap.TestAndSetAtomic(object);
+                    }
+                    return (true);
+                }
+                sMarkBitmap.SetRange(start, end);
+                if (sRecordObjectStarts)
+                {
+                    // The last step of the incremental marking (and the young collections)
+                    //  need to find the marked objects of a page (or of a card)
+                    sObjectStartBitmap.Set(object);
+                }
+                return (true);
+            }
+            // Objects outside the main buffer (large objects, user allocated) use the mark in the header
+#endif
+            if (GCParallelMarker::IsMarking())
+            {
+                return (MarkHeaderAtomic(object, currentMark));
+            }
+            // One possible cache miss here
+            if (object->__GetMark__() == currentMark)
+            {
+                return (false);
+            }
+            // Tell that the pointer has been traced
+            object->m__AllFlags__ &= 0xffffff00;
+            object->m__AllFlags__ |= currentMark;
+            return (true);
+        }
+
+        // Returns the size of the object in memory
+        static CROSSNET_FINLINE
+        int GetSize(System::Object * object)
+        {
+            if ((object->m__AllFlags__ & ::System::Object::__DYN_ALLOC__) == 0)
+            {
+                // Standard allocation, use the interface map to get the size
+                return ((int)InterfaceMapper::GetSize(object->m__InterfaceMap__));
+            }
+            // Variable size allocations (for arrays and strings)
+            return (object->__GetVariableSize__());
+        }
 
         static int GetNumCollections();
+        // Bytes of the objects that survived the last collection (main buffer and large objects)
+        static int GetLiveBytes();
+
+        CROSSNET_FINLINE
+        static bool IsCollecting()
+        {
+            return (sCollecting);
+        }
         static double GetNumSecondsInGcManager();
         static double GetNumSecondsInTracingPermanent();
         static double GetNumSecondsInTracingStack();
@@ -103,19 +422,201 @@ namespace CrossNetRuntime
         static void SetTopOfStack();
 
     private:
+        enum Phase
+        {
+            PHASE_IDLE,
+            PHASE_MARKING,
+            PHASE_SWEEPING,
+        };
+
+        enum
+        {
+            // Address space reserved for the gray worklist (one pointer per object)
+            MARK_STACK_RESERVED_SIZE = 16 * 1024 * 1024,
+            // Number of objects traced (or runs swept) between two reads of the clock
+            DEADLINE_CHECK_INTERVAL = 256,
+            // Number of written pages read from the OS in one go
+            WRITTEN_PAGES_BATCH = 256,
+            // Part of the main buffer swept in one go by the lazy sweeping
+            LAZY_SWEEP_CHUNK_SIZE = 256 * 1024,
+
+            // The compaction evacuates the blocks of the main buffer (aligned on the heap base) with less live bytes than this percent
+            COMPACTION_BLOCK_SIZE = 256 * 1024,
+            COMPACTION_LIVE_PERCENT = 25,
+            COMPACTION_FORCED_LIVE_PERCENT = 75,
+            // The copies are bump allocated in chunks of at least this size (taken from the bins or at the end of the heap)
+            COMPACTION_COPY_CHUNK_SIZE = 32 * 1024,
+        };
+
+        enum CompactionPhase
+        {
+            COMPACTION_NONE,
+            COMPACTION_MARKING,         // The objects traced by value (and the pages of the stack roots) are pinned
+            COMPACTION_EVACUATING,      // The objects pointed by the evacuated objects are evacuated too (depth-first)
+            COMPACTION_FIXING,          // The pointers to the evacuated objects are updated
+        };
+
+        static unsigned char NextMarker();
+        static void TraceRoots(unsigned char mark, bool drain);
         static void TraceStack(unsigned char mark);
+        // Traces the objects of the gray worklist until it is empty (returns true) or the deadline is reached
+        //  A negative deadline means no deadline
+        static bool DrainMarkStack(unsigned char mark, long long deadline);
+        static void SweepMainBuffer(unsigned char currentMarker, bool final);
+        // Sets up the lazy sweep of the main buffer instead of sweeping it now, returns false if it is not enabled
+        static bool StartLazySweep(bool final);
+        static void SweepLargeObjects(unsigned char currentMarker, bool final);
+
+        // If the free memory is kept zeroed, clears the range of dead objects [start, end) in one go
+        //  start is reset so the sweep can begin a new range
+        CROSSNET_FINLINE
+        static void ClearDeadObjects(unsigned char * & start, unsigned char * end)
+        {
+            if (start != NULL)
+            {
+                if (GCAllocator::IsZeroingFreeMemory())
+                {
+                    GCAllocator::ClearFreedMemory(start, (int)(end - start));
+                }
+                start = NULL;
+            }
+        }
         static bool ValidateRoot(void * value, unsigned char mark);
         static void ValidateRoot2(void * value, unsigned char mark);
+        // ValidateRoot2() for the values of [start, end[ pointing to the main buffer, the large object space or the pointer-free space
+        //  The other values are rejected 4 at a time
+        static void ValidateRoots(void * const * start, void * const * end, unsigned char mark);
+        // Returns the object containing the pointer, NULL if there is none (see InitOptions::mExactInteriorPointers)
+        static ::System::Object * FindObjectContaining(void * value);
+        // Mark() for the parallel marking, the mark byte is set with an interlocked operation
+        static bool MarkHeaderAtomic(System::Object * object, unsigned char currentMark);
+
+#ifndef CN_GC_HEADER_MARK
+        // Sweeps [start, end[ of the main buffer, returns where the sweep stopped (end if it is done)
+        //  Stops between two runs of dead objects if the deadline is reached, or once stop is passed
+        static unsigned char * SweepMainBufferRange(unsigned char * start, unsigned char * end, unsigned char * stop, long long deadline, bool final);
+
+        // The different steps of the incremental collection
+        static void StartMarking();
+        static void FinishMarking(unsigned char mark);
+        // Sweeps from the sweep cursor until the deadline, or for about maxBytes of the main buffer
+        //  A negative maxBytes means no limit. Returns true if there is nothing left to sweep.
+        static bool SweepStep(long long deadline, int maxBytes);
+
+        // Sweeps the runs of dead objects starting in [chunkStart, chunkEnd[ for GCParallelSweeper
+        //  The free runs go in the given bins, except the one ending at endBuffer (returned in tailRun)
+        //  Returns the live bytes of the chunk
+        static int SweepChunk(unsigned char * chunkStart, unsigned char * chunkEnd, unsigned char * endBuffer,
+                                GCAllocator::LocalBins & bins, unsigned char * & tailRun);
+        // Calls __OnCollect__() on the dead objects of [start, end[ (a run between two live objects)
+        //  Their memory is cleared as well if clearMemory is set (and if the free memory is kept zeroed)
+        static void CollectDeadRun(unsigned char * start, unsigned char * end, bool clearMemory);
+        // CollectDeadRun() without clearing for all the runs of [start, endBuffer[, called by the collecting thread
+        //  before a parallel sweep, so the sweeping threads never call __OnCollect__()
+        static void CollectDeadObjects(unsigned char * start, unsigned char * endBuffer);
+        // Clears a run already collected by CollectDeadObjects() (if the free memory is kept zeroed)
+        static void ClearDeadRun(unsigned char * start, unsigned char * end);
+
+        // Traces again the marked objects written to since the last call (or the start of the marking)
+        static void RescanWrittenPages(unsigned char mark);
+        static void RescanMarkedObjects(unsigned char * start, unsigned char * end, unsigned char mark);
+        static void RescanLargeObjects(unsigned char mark);
+        // Traces the objects allocated after the marking limit
+        static void RescanNewObjects(unsigned char mark);
+
+        // Young collections, traces again the old objects of the dirty cards (and of the pages written to)
+        //  The cards are clean afterward
+        static void ScanDirtyCards(unsigned char mark);
+        static void ScanDirtyLargeObjectCards(unsigned char mark);
+        // Dirties the cards of the pages of [start, end[ written to since the last collection
+        static void DirtyWrittenPages(GCCardTable & cardTable, unsigned char * start, unsigned char * end);
+        // The cards and the written pages are reset at the start of each complete collection
+        static void ResetCards();
+        static void ClearCards();
+
+        // Sweeps the chunks left after each lazy collection (only with the thread allocation buffers)
+        static void BackgroundSweeperThread(void * parameter);
+
+        // The memory of the stack roots and of the objects traced by value can't be moved
+        //  The objects overlapping a pinned card are not evacuated
+        CROSSNET_FINLINE
+        static void Pin(void * pointer)
+        {
+            if (GCAllocator::InCurrentAllocationSpace(pointer))
+            {
+                sPinnedCards.MarkCard(pointer);
+            }
+        }
+        static bool IsPinned(::System::Object * object, int alignedSize);
+
+        // Compaction, after the marking of a complete collection (the bins are still the ones of the last sweep)
+        //  Evacuates the live objects of the sparse blocks of the main buffer, then updates the pointers to them
+        static void CompactMainBuffer(unsigned char mark, int maxLivePercent);
+        // Marks the evacuated cards of the blocks less than maxLivePercent full, returns the number of blocks
+        static int SelectSparseBlocks(unsigned char * start, unsigned char * end, int maxLivePercent);
+        // Copies the object and leaves a forwarding block in its place, returns NULL if it can't be moved
+        static ::System::Object * Evacuate(::System::Object * object, unsigned char mark);
+        // Returns alignedSize bytes for a copy, NULL if there is no room left
+        static unsigned char * AllocateCopy(int alignedSize);
+        static void RetireCopyChunk();
+        // Tracer callback during the evacuation and the update of the pointers (see TraceSlot())
+        static void VisitSlot(void * * slot, unsigned char mark);
+        // Updates the pointers of the roots, of the live objects of the main buffer and of the large objects
+        static void FixupPointers(unsigned char mark);
+#endif
 
         static unsigned char                sCurrentMarker;
         static bool                         sCollecting;
         static int                          sNumCollections;
+        static int                          sLiveBytes;
         static double                       sNumSecondsInGcManager;
         static double                       sNumSecondsInTracingPermanent;
         static double                       sNumSecondsInTracingStack;
         static double                       sNumSecondsInTracingStatics;
         static double                       sNumSecondsInCollect;
         static void *                       sTopOfStack;
+        static GCMarkStack                  sMarkStack;
+        static bool                         sIncrementalEnabled;
+        static Phase                        sPhase;
+#ifndef CN_GC_HEADER_MARK
+        static GCBitmap                     sMarkBitmap;
+        // Start of the objects marked during the incremental marking (of all the old objects with the generational collection)
+        static GCBitmap                     sObjectStartBitmap;
+        static bool                         sRecordObjectStarts;
+        static bool                         sPrecleaned;
+        // Current alloc pointer when the incremental marking started
+        //  The objects after it have been allocated during the collection, they are not swept by this collection
+        static unsigned char *              sMarkingLimit;
+        static unsigned char *              sSweepCursor;
+        static std::vector<void *>          sLargeObjectsAllocatedBlack;
+        static void *                       sSweeperThread;
+        static void *                       sSweeperSemaphore;
+        static volatile bool                sSweeperShutdown;
+        static GCCardTable                  sCardTable;
+        static GCCardTable                  sLargeObjectCardTable;
+        static GCCardTable                  sPinnedCards;
+        // Cards of the blocks being evacuated by the compaction
+        static GCCardTable                  sEvacuatedCards;
+        static unsigned char *              sCopyCurrent;
+        static unsigned char *              sCopyEnd;
+#endif
+        static bool                         sCompactionEnabled;
+        static bool                         sCompactionRequested;
+        static bool                         sLastCollectionCompact;
+        static CompactionPhase              sCompactionPhase;
+        static int                          sCompactedBytes;
+        static bool                         sGenerationalEnabled;
+        static bool                         sGeneratedWriteBarrier;
+        // Generation of the collection in progress (or of the last one)
+        static int                          sGeneration;
+        // Bytes of the pointer-free objects alive after the last complete collection (the young collections don't sweep them)
+        static int                          sPointerFreeLiveBytes;
+        static bool                         sLazySweepingEnabled;
+        // True while SweepStep() runs (protected by the allocator lock, unlike sCollecting)
+        static bool                         sSweepingChunk;
+
+        friend class RegionScope;
+        friend class GCParallelSweeper;
     };
 }
 
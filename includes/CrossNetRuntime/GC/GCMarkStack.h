@@ -0,0 +1,95 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef __GCMARKSTACK_H__
+#define __GCMARKSTACK_H__
+
+#include "CrossNetRuntime/Defines.h"
+
+namespace System
+{
+    class Object;
+}
+
+namespace CrossNetRuntime
+{
+    // Gray worklist of the marking: the objects marked but whose pointers have not been traced yet
+    //  The address space is reserved once, the pages are committed as the stack grows.
+    //  Push() returns false when the reservation is full, the caller then traces the object right away
+    //  (i.e. recursively, like before there was a worklist).
+    class GCMarkStack
+    {
+    public:
+        GCMarkStack();
+
+        void    Setup(size_t reservedSize);
+        void    Teardown();
+
+        CROSSNET_FINLINE
+        bool    Push(::System::Object * object)
+        {
+            if (mTop == mCommittedEnd)
+            {
+                if (Grow() == false)
+                {
+                    return (false);
+                }
+            }
+            *mTop++ = object;
+            return (true);
+        }
+
+        // Returns NULL if the stack is empty
+        CROSSNET_FINLINE
+        ::System::Object *  Pop()
+        {
+            if (mTop == mBottom)
+            {
+                return (NULL);
+            }
+            return (*--mTop);
+        }
+
+        CROSSNET_FINLINE
+        bool    IsEmpty() const
+        {
+            return (mTop == mBottom);
+        }
+
+        // Gives back the pages committed by a deep marking, only the first ones are kept
+        //  The stack must be empty
+        void    Shrink();
+
+    private:
+        enum
+        {
+            // Pages are committed by chunks of this size
+            COMMIT_SIZE = 64 * 1024,
+        };
+
+        bool    Grow();
+
+        ::System::Object * *    mBottom;
+        ::System::Object * *    mTop;
+        ::System::Object * *    mCommittedEnd;
+        ::System::Object * *    mReservedEnd;
+
+        GCMarkStack(const GCMarkStack & other);
+        GCMarkStack & operator=(const GCMarkStack & other);
+    };
+}
+
+#endif
@@ -0,0 +1,94 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef __GCPARALLELMARKER_H__
+#define __GCPARALLELMARKER_H__
+
+#include "CrossNetRuntime/Defines.h"
+#include "CrossNetRuntime/InitOptions.h"
+#include "CrossNetRuntime/GC/GCWorkStealingDeque.h"
+
+namespace CrossNetRuntime
+{
+    // Parallel marking of Collect() (see InitOptions::mNumMarkThreads)
+    //  The collecting thread marks the roots and pushes them on its deque, the worker threads steal them
+    //  and then trace what they point to. Each thread pushes the objects it marks on its own deque,
+    //  and steals from the other deques when its own is empty. The marking ends when all the deques are empty.
+    //
+    //  While the parallel marking is active, the marks are set with interlocked operations (see GCManager::Mark()).
+    class GCParallelMarker
+    {
+    public:
+        static void Setup(const ::CrossNetRuntime::InitOptions & options);
+        static void Teardown();
+
+        // True if there are worker threads
+        CROSSNET_FINLINE
+        static bool IsEnabled()
+        {
+            return (sNumThreads > 1);
+        }
+
+        // True between Begin() and End()
+        CROSSNET_FINLINE
+        static bool IsMarking()
+        {
+            return (sMarking);
+        }
+
+        // Called by the collecting thread before the roots are traced, the workers start stealing right away
+        static void Begin(unsigned char currentMarker);
+        // Called by the collecting thread after the roots are traced
+        //  It marks as well, and returns when all the reachable objects have been traced
+        static void End();
+
+        // Pushes a marked object on the deque of the current thread, returns false if the deque is full
+        CROSSNET_FINLINE
+        static bool Push(::System::Object * object)
+        {
+            return (sThreadDeque->Push(object));
+        }
+
+    private:
+        enum
+        {
+            // Gray objects per thread (the objects that don't fit are traced recursively)
+            DEQUE_CAPACITY = 64 * 1024,
+        };
+
+        static void MarkLoop(int index);
+        static ::System::Object * StealWork(int index);
+        static bool WaitForWork();
+        static void WorkerThread(void * parameter);
+
+        static int                      sNumThreads;
+        static GCWorkStealingDeque *    sDeques;
+        static void * *                 sThreads;
+        static void *                   sStartSemaphore;
+        static volatile long            sNumActive;
+        static volatile long            sNumFinished;
+        static volatile bool            sShutdown;
+        static bool                     sMarking;
+        static unsigned char            sCurrentMarker;
+        static CROSSNET_THREAD_LOCAL GCWorkStealingDeque *  sThreadDeque;
+
+        GCParallelMarker();
+        GCParallelMarker(const GCParallelMarker & other);
+        GCParallelMarker & operator=(const GCParallelMarker & other);
+    };
+}
+
+#endif
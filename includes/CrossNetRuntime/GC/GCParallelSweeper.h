@@ -0,0 +1,87 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef __GCPARALLELSWEEPER_H__
+#define __GCPARALLELSWEEPER_H__
+
+#include "CrossNetRuntime/Defines.h"
+#include "CrossNetRuntime/InitOptions.h"
+#include "CrossNetRuntime/GC/GCAllocator.h"
+
+namespace CrossNetRuntime
+{
+    // Parallel sweep of the main buffer by Collect() (see InitOptions::mNumSweepThreads)
+    //  The main buffer is split in fixed chunks, the threads (including the collecting one) take the chunks in turn.
+    //  Each thread puts the free runs of its chunks in its own local bins, without any lock,
+    //  and the local bins are spliced into the bins of the allocator when all the chunks are swept.
+    //  The run of dead objects crossing the end of a chunk is swept by the chunk where it starts.
+    //
+    //  The dead objects are collected by the collecting thread before the chunks are swept (see GCManager::CollectDeadObjects()),
+    //  the other threads only clear the dead runs and put them in their bins: __OnCollect__() is never called from them.
+    class GCParallelSweeper
+    {
+    public:
+        static void Setup(const ::CrossNetRuntime::InitOptions & options);
+        static void Teardown();
+
+        // True if there are worker threads
+        CROSSNET_FINLINE
+        static bool IsEnabled()
+        {
+            return (sNumThreads > 1);
+        }
+
+        // Sweeps [start, end[ of the main buffer (the allocator lock is taken and the bins are empty)
+        //  end is the current alloc pointer, it is moved back if the last run is free
+        //  Returns the live bytes
+        static int Sweep(unsigned char * start, unsigned char * end);
+
+    private:
+        enum
+        {
+            // Part of the main buffer taken by a thread in one go (a multiple of 32 granules, one word of the mark bitmap)
+            CHUNK_SIZE = 256 * 1024,
+        };
+
+        // What a thread found in its chunks
+        struct ThreadResult
+        {
+            GCAllocator::LocalBins  mBins;
+            int                     mLiveBytes;
+            unsigned char *         mTailRun;
+        };
+
+        static void SweepChunks(int index);
+        static void WorkerThread(void * parameter);
+
+        static int              sNumThreads;
+        static ThreadResult *   sResults;
+        static void * *         sThreads;
+        static void *           sStartSemaphore;
+        static volatile long    sNextChunk;
+        static volatile long    sNumFinished;
+        static volatile bool    sShutdown;
+        static int              sNumChunks;
+        static unsigned char *  sStart;
+        static unsigned char *  sEnd;
+
+        GCParallelSweeper();
+        GCParallelSweeper(const GCParallelSweeper & other);
+        GCParallelSweeper & operator=(const GCParallelSweeper & other);
+    };
+}
+
+#endif
@@ -0,0 +1,198 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+
+#ifndef __GCPOINTERFREESPACE_H__
+#define __GCPOINTERFREESPACE_H__
+
+#include "CrossNetRuntime/Defines.h"
+#include "CrossNetRuntime/InitOptions.h"
+#include "CrossNetRuntime/GC/GCBitmap.h"
+#include "CrossNetRuntime/GC/GCParallelMarker.h"
+
+namespace CrossNetRuntime
+{
+    // Tag for System::Object::operator new, the object doesn't contain any managed pointer
+    //  Use it like this: new (::CrossNetRuntime::POINTER_FREE) ...
+    //  Selected at compile time for the arrays of base types (see GetTraceMode and TM_NONE) and used by the strings
+    enum PointerFreeTag
+    {
+        POINTER_FREE,
+    };
+
+    // Space dedicated to the objects without managed pointers (strings and arrays of base types)
+    //  As there is nothing to trace inside, the collection only sets one bit in a mark bitmap (no virtual call to __Trace__)
+    //  and the sweep never reads the objects: they don't have any destructor to call either.
+    //
+    //  The space is divided in blocks of 64 Kb, each block contains objects of a single size class.
+    //  So the start of each object is known from the address alone, and the allocation bitmap (one bit per object start)
+    //  tells which slots are used. After the marking, the live objects are exactly the marked ones:
+    //  the sweep simply moves the mark bits of each block to the allocation bitmap and counts them.
+    //  The blocks without any live object are given back to the OS.
+    //
+    //  The free slots are found by parsing the allocation bitmap, a slot freed by the sweep is reused
+    //  when the allocation cursor of its size class goes through its block again.
+    //
+    //  Each thread allocates in its own runs of consecutive free slots (one run per size class), without lock.
+    //  A run is taken from the shared cursor of its size class with GCAllocator's lock, its slots are set in
+    //  the allocation bitmap in one go. The collector retires the runs of all the threads at the beginning of
+    //  a collection with the same handshake as the thread allocation buffers (see GCAllocator::RetireAllThreadAllocBuffers()),
+    //  the unused slots are then cleared from the bitmaps.
+    //
+    //  Apart from BumpThreadCursor(), this class is not thread safe, GCAllocator takes its lock before calling it.
+    class GCPointerFreeSpace
+    {
+    public:
+        enum
+        {
+            BLOCK_SHIFT = 16,
+            BLOCK_SIZE = 1 << BLOCK_SHIFT,
+
+            // Bigger objects use the main buffer (or the large object space)
+            MAX_OBJECT_SIZE = 8 * 1024,
+        };
+
+        static void Setup(const ::CrossNetRuntime::InitOptions & options);
+        static void Teardown();
+
+        CROSSNET_FINLINE
+        static bool     IsEnabled()
+        {
+            return (sMaxSize != 0);
+        }
+
+        // Returns true if an object of this size should go in the pointer-free space
+        //  Always false if the space is disabled
+        CROSSNET_FINLINE
+        static bool     IsPointerFreeSize(int size)
+        {
+            return (size <= sMaxSize);
+        }
+
+        // Returns zeroed memory from the run of the current thread for this size, NULL if the run is empty
+        //  No lock, the collector can retire the run at any time (the bump then fails)
+        static void *   BumpThreadCursor(int size);
+        // Takes a new run for this size and returns its first slot (zeroed), NULL if there is no slot left for this size
+        //  The slots of the run are marked if markRun is set (allocated black during an incremental marking)
+        static void *   RefillThreadCursor(int size, bool markRun);
+        // Maximum size of a run for this size (what a refill consumes from the allocation budget)
+        static int      GetRunSize(int size);
+        // The slot can be reused after the next collection
+        static void     Free(void * object);
+
+        // Called at the beginning of a collection (the allocator lock is taken)
+        //  The two halves of the handshake of GCAllocator::RetireAllThreadAllocBuffers() for the runs of all the threads
+        static void     BeginRetireAllThreadCursors();
+        static void     EndRetireAllThreadCursors();
+        // Gives back the runs of the current thread (the allocator lock is taken), see GCAllocator::DetachThread()
+        static void     DetachThread();
+
+        CROSSNET_FINLINE
+        static bool     InPointerFreeSpace(void * pointer)
+        {
+            return ((size_t)((unsigned char *)pointer - sBase) < sSize);
+        }
+
+        // Marks the object as traced, returns false if it was already marked
+        CROSSNET_FINLINE
+        static bool     Mark(void * object)
+        {
+            if (sMarkBitmap.Test(object))
+            {
+                return (false);
+            }
+            if (GCParallelMarker::IsMarking())
+            {
+                // Another thread might set a bit of the same word
+                return (sMarkBitmap.TestAndSetAtomic(object));
+            }
+            sMarkBitmap.Set(object);
+            return (true);
+        }
+
+        // Returns the object that contains the pointer, NULL if the pointer is in a free slot
+        //  Used for the conservative roots, the interior pointers are handled directly
+        static void *   FindObject(void * pointer);
+
+        // Reserved range (empty if the space is disabled)
+        static void *   GetBase();
+        static size_t   GetReservedSize();
+
+        // Frees the objects not marked since the last sweep, returns the number of bytes still alive
+        static int      Sweep();
+        // Clears the marks set since the last sweep
+        //  The young collections don't sweep this space, the next complete collection starts from clear marks
+        static void     ClearMarks();
+
+    private:
+        enum
+        {
+            FREE_BLOCK = 0xff,
+            NO_BLOCK = -1,
+
+            // 16 bytes steps up to 128 bytes, then 4 size classes per power of 2
+            NUM_SIZE_CLASSES = 32,
+
+            // A run has at least one slot, then as many as fit in this size
+            RUN_SIZE = 2 * 1024,
+        };
+
+        // Runs of a given thread, created the first time the thread allocates a pointer-free object
+        struct ThreadCursors
+        {
+            unsigned char *         mCurrent[NUM_SIZE_CLASSES];
+            unsigned char *         mEnd[NUM_SIZE_CLASSES];
+            unsigned char *         mRetiredEnd[NUM_SIZE_CLASSES];  // End of each run while the collector retires it
+            bool                    mZeroed[NUM_SIZE_CLASSES];      // The block of the run comes from the OS
+            ThreadCursors *         mNextCursors;   // All the cursors are chained so the GC can retire them
+            bool                    mInUse;         // False if the owner thread detached, the cursors can then be reused
+            volatile long           mAllocating;    // Set by the owner thread during a bump (see BumpThreadCursor())
+        };
+
+        static int      GetSizeClass(int size);
+        static bool     GetNextBlock(int sizeClass);
+        static int      GetCapacity(int sizeClass);
+        static bool     TakeRun(int sizeClass, unsigned char * & start, unsigned char * & end, bool & zeroed);
+        static void     ReleaseRun(unsigned char * start, unsigned char * end);
+        static ThreadCursors *  AttachThread();
+
+        static unsigned char *  sBase;
+        static size_t           sSize;
+        static int              sMaxSize;
+        static int              sNumBlocks;
+        static unsigned char *  sBlockClasses;      // Size class of each block, FREE_BLOCK if the block is not used
+        static int *            sNextBlocks;        // Chains the free blocks, and the blocks of a size class with free slots
+        static int              sFirstFreeBlock;
+        static GCBitmap         sAllocBitmap;
+        static GCBitmap         sMarkBitmap;
+
+        static int              sClassSizes[NUM_SIZE_CLASSES];
+        static unsigned char    sSizeToClass[(MAX_OBJECT_SIZE >> GCBitmap::GRANULE_SHIFT) + 1];
+        static int              sAvailableBlocks[NUM_SIZE_CLASSES];
+        static unsigned char *  sCursors[NUM_SIZE_CLASSES];
+        static unsigned char *  sCursorEnds[NUM_SIZE_CLASSES];
+        static bool             sCursorsZeroed[NUM_SIZE_CLASSES];   // The block of the cursor comes from the OS
+        static ThreadCursors *  sAllThreadCursors;
+
+        static CROSSNET_THREAD_LOCAL ThreadCursors *    sThreadCursors;
+
+        GCPointerFreeSpace();
+        GCPointerFreeSpace(const GCPointerFreeSpace & other);
+        GCPointerFreeSpace & operator=(const GCPointerFreeSpace & other);
+    };
+}
+
+#endif
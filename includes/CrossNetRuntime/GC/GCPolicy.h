@@ -0,0 +1,116 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef __GCPOLICY_H__
+#define __GCPOLICY_H__
+
+#include "CrossNetRuntime/Defines.h"
+#include "CrossNetRuntime/InitOptions.h"
+
+namespace CrossNetRuntime
+{
+    // Decides when to collect, instead of waiting for the heap to be full
+    //  After each collection, the allocation budget is set from the live bytes
+    //  (see InitOptions::mGcBudgetMinSize and mGcBudgetLivePercent).
+    //  The allocator consumes the budget and collects when it is exhausted.
+    //
+    //  The unmanaged memory held by managed objects can be reported with AddMemoryPressure(),
+    //  it consumes the budget as well and counts toward the memory limit.
+    //  The memory limit comes from InitOptions::mGcMemoryLimit, or from the cgroup v2 memory.max of the process
+    //  (the memory limit of its job object on Windows), clamped to the address space.
+    class GCPolicy
+    {
+    public:
+        static void Setup(const ::CrossNetRuntime::InitOptions & options);
+        static void Teardown();
+
+        // Consumes some of the allocation budget, returns false if the budget is exhausted
+        //  Only for the single threaded allocator (no interlocked operation)
+        CROSSNET_FINLINE
+        static bool ConsumeBudget(int size)
+        {
+            long remaining = sBudgetRemaining - size;
+            sBudgetRemaining = remaining;
+            return (remaining >= 0);
+        }
+
+        // Same as ConsumeBudget() but can be called by several threads at the same time
+        static bool ConsumeBudgetShared(int size);
+
+        // Collects if the budget is exhausted
+        //  Called by the allocator outside of the fast path, or after some memory pressure has been added
+        static void CollectIfNeeded();
+
+        // Reports unmanaged memory kept alive by managed objects (like native buffers)
+        //  So the collection happens sooner and the memory can be freed by the finalization of these objects
+        static void AddMemoryPressure(int bytes);
+        static void RemoveMemoryPressure(int bytes);
+        static int  GetMemoryPressure();
+
+        // Memory limit of the process in bytes (0 if there is no limit)
+        static long long    GetMemoryLimit();
+        // Number of bytes that can be allocated between the last collection and the next one
+        static int  GetAllocationBudget();
+        // Number of bytes that can still be allocated before the next collection (negative if exhausted)
+        static int  GetRemainingBudget();
+        // The whole allocation budget can be consumed again
+        //  For the collections that continue after their pause, the next budget is set when they end
+        static void RestartBudget();
+
+        // Generation of the next collection
+        //  With the generational collection, only the young objects are collected (generation 0),
+        //  until the old objects have grown by a whole budget since the last complete collection (MAX_GENERATION).
+        static int  GetNextGeneration();
+
+        // Called by GCManager::Collect() and the incremental collection, at the beginning and at the end
+        //  The allocator lock is held if the collection has been triggered by an allocation (see InitOptions::mBeforeCollectCallback)
+        static void OnBeforeCollect(int generation);
+        static void OnAfterCollect(int generation, int liveBytes);
+
+    private:
+        static long long    ReadSystemMemoryLimit();
+
+        enum
+        {
+            // Value of the budget when the policy is disabled, big enough to not be exhausted often
+            //  When it is, the budget is simply reset
+            UNLIMITED_BUDGET = 0x7fffffff,
+
+            // The budget is never smaller than this, even close to the memory limit
+            //  Otherwise we would collect for each allocation
+            MIN_BUDGET = 64 * 1024,
+        };
+
+        static volatile long    sBudgetRemaining;
+        static int              sBudget;
+        static bool             sEnabled;
+        static int              sMinBudget;
+        static int              sLivePercent;
+        static long long        sMemoryLimit;
+        static int              sMemoryLimitPercent;
+        static volatile long    sMemoryPressure;
+        // Live bytes and budget after the last complete collection, and live bytes after the last collection
+        static int              sCompleteLiveBytes;
+        static int              sCompleteBudget;
+        static int              sLastLiveBytes;
+
+        GCPolicy();
+        GCPolicy(const GCPolicy & other);
+        GCPolicy & operator=(const GCPolicy & other);
+    };
+}
+
+#endif
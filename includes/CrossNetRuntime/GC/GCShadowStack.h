@@ -0,0 +1,180 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef __GCSHADOWSTACK_H__
+#define __GCSHADOWSTACK_H__
+
+#include "CrossNetRuntime/Defines.h"
+#include "CrossNetRuntime/Assert.h"
+#include "CrossNetRuntime/InitOptions.h"
+
+namespace CrossNetRuntime
+{
+    // Frame of the shadow stack, declared by the generated code with the CN_GC_FRAME macros below
+    //  The constructor pushes it on the shadow stack of the current thread, the destructor pops it.
+    class GCShadowFrame
+    {
+    public:
+        GCShadowFrame(void * * * slots, int numSlots);
+        ~GCShadowFrame();
+
+    private:
+        GCShadowFrame *     mPrevious;
+        // Address of each managed local (or parameter) of the frame
+        void * * *          mSlots;
+        int                 mNumSlots;
+
+        GCShadowFrame(const GCShadowFrame & other);
+        GCShadowFrame & operator=(const GCShadowFrame & other);
+
+        friend class GCShadowStack;
+    };
+
+    // Precise stack roots (see InitOptions::mPreciseStackRoots)
+    //  Each thread has a linked list of frames registering the address of its managed locals.
+    //  The collection traces these slots instead of scanning the native stack conservatively:
+    //  nothing is kept alive by a stale value, the stacks of all the threads are traced,
+    //  and the compaction can move the objects they point to (the slots are updated).
+    //
+    //  The generated code must register every managed pointer that is alive during an allocation
+    //  (the temporaries of an expression included), the registers are not scanned anymore.
+    //  The runtime registers its own (see String::Split() or StringBuilder::Append()), its frames are only pushed
+    //  when the precise stack roots are enabled.
+    class GCShadowStack
+    {
+    public:
+        static void Setup(const ::CrossNetRuntime::InitOptions & options);
+        static void Teardown();
+
+        CROSSNET_FINLINE
+        static bool IsEnabled()
+        {
+            return (sEnabled);
+        }
+
+        // A thread that registered frames should call this before exiting
+        //  So its stack can be reused by another thread (all its frames must have been popped)
+        static void DetachThread();
+
+        // Traces the slots of the frames of all the threads
+        //  The other threads are suspended meanwhile (see GCAllocator::SuspendOtherThreads()), so their frames don't change
+        //  The slots are traced by reference, so the compaction updates them
+        static void Trace(unsigned char currentMark);
+
+        // Returns true if a slot of the current thread points to [start, start + size[ (see RegionScope)
+        static bool IsReferenced(void * start, size_t size);
+
+        CROSSNET_FINLINE
+        static void Push(GCShadowFrame * frame)
+        {
+            ThreadStack * stack = sThreadStack;
+            if (stack == NULL)
+            {
+                // First frame of this thread
+                stack = AttachThread();
+            }
+            frame->mPrevious = stack->mTop;
+            stack->mTop = frame;
+        }
+
+        CROSSNET_FINLINE
+        static void Pop(GCShadowFrame * frame)
+        {
+            ThreadStack * stack = sThreadStack;
+            CROSSNET_ASSERT(stack->mTop == frame, "The frames must be popped in the reverse order!");
+            stack->mTop = frame->mPrevious;
+        }
+
+    private:
+        // Shadow stack of a thread
+        struct ThreadStack
+        {
+            GCShadowFrame * volatile    mTop;
+            ThreadStack *               mNextStack;     // All the stacks are chained so the collection can trace them
+            volatile long               mInUse;         // 0 if the owner thread detached, the stack can then be reused
+        };
+
+        static ThreadStack *    AttachThread();
+
+        static bool                                 sEnabled;
+        static ThreadStack * volatile               sAllThreadStacks;
+        static CROSSNET_THREAD_LOCAL ThreadStack *  sThreadStack;
+
+        GCShadowStack();
+        GCShadowStack(const GCShadowStack & other);
+        GCShadowStack & operator=(const GCShadowStack & other);
+    };
+
+    CROSSNET_FINLINE
+    GCShadowFrame::GCShadowFrame(void * * * slots, int numSlots)
+        :
+        mSlots(slots),
+        mNumSlots(numSlots)
+    {
+        if (GCShadowStack::IsEnabled())
+        {
+            GCShadowStack::Push(this);
+        }
+        else
+        {
+            // Not pushed, the destructor doesn't pop it either (the frames of the runtime are always declared)
+            mSlots = NULL;
+        }
+    }
+
+    CROSSNET_FINLINE
+    GCShadowFrame::~GCShadowFrame()
+    {
+        if (mSlots != NULL)
+        {
+            GCShadowStack::Pop(this);
+        }
+    }
+}
+
+// Registers the managed locals given as parameter (pointers to classes, interfaces or strings) until the end of the scope
+//  They must be initialized before (to NULL if needed), and there can be only one frame per scope.
+//  For example:
+//      ::System::Object * a = NULL;
+//      ::System::String * b = NULL;
+//      CN_GC_FRAME2(a, b);
+#define CN_GC_FRAME1(a)                                                     \
+    void * * __gcSlots__[] = { reinterpret_cast<void * *>(&(a)) };          \
+    ::CrossNetRuntime::GCShadowFrame __gcFrame__(__gcSlots__, 1)
+
+#define CN_GC_FRAME2(a, b)                                                  \
+    void * * __gcSlots__[] = { reinterpret_cast<void * *>(&(a)),            \
+                                reinterpret_cast<void * *>(&(b)) };         \
+    ::CrossNetRuntime::GCShadowFrame __gcFrame__(__gcSlots__, 2)
+
+#define CN_GC_FRAME3(a, b, c)                                               \
+    void * * __gcSlots__[] = { reinterpret_cast<void * *>(&(a)),            \
+                                reinterpret_cast<void * *>(&(b)),           \
+                                reinterpret_cast<void * *>(&(c)) };         \
+    ::CrossNetRuntime::GCShadowFrame __gcFrame__(__gcSlots__, 3)
+
+#define CN_GC_FRAME4(a, b, c, d)                                            \
+    void * * __gcSlots__[] = { reinterpret_cast<void * *>(&(a)),            \
+                                reinterpret_cast<void * *>(&(b)),           \
+                                reinterpret_cast<void * *>(&(c)),           \
+                                reinterpret_cast<void * *>(&(d)) };         \
+    ::CrossNetRuntime::GCShadowFrame __gcFrame__(__gcSlots__, 4)
+
+// For more locals, slots is an array of their addresses (void * * slots[numSlots])
+#define CN_GC_FRAME_ARRAY(slots, numSlots)                                  \
+    ::CrossNetRuntime::GCShadowFrame __gcFrame__(slots, numSlots)
+
+#endif
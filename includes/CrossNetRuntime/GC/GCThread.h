@@ -0,0 +1,78 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef __GCTHREAD_H__
+#define __GCTHREAD_H__
+
+#include "CrossNetRuntime/Defines.h"
+
+namespace CrossNetRuntime
+{
+    // Thin layer on top of the OS threads, for the worker threads of the GC
+    //  On Windows this maps to CreateThread / semaphores, on the other platforms to pthreads / POSIX semaphores
+    //  (The names avoid the macros of windows.h)
+    class GCThread
+    {
+    public:
+        typedef void    (*ThreadFunction)(void * parameter);
+
+        // Returns NULL if the thread could not be created
+        static void *   Start(ThreadFunction function, void * parameter);
+        // Waits for the end of the thread and releases it
+        static void     Join(void * thread);
+
+        // Returns NULL if the semaphore could not be created, the initial count is 0
+        static void *   NewSemaphore();
+        static void     DeleteSemaphore(void * semaphore);
+        static void     WaitSemaphore(void * semaphore);
+        static void     SignalSemaphore(void * semaphore, int count);
+
+        // To call in the spin loops, gives the processor to another thread from time to time
+        static void     Relax(int iteration);
+
+        // Flushes the write buffers of all the processors running a thread of the process
+        //  After this, the stores done by the other threads before the call are visible to the calling thread
+        //  and their loads after the call see the stores done by the calling thread before it.
+        //  That way the other side of a handshake doesn't need any fence (see GCAllocator::RetireAllThreadAllocBuffers())
+        static void     FlushWriteBuffers();
+
+        // Number of registers stored by Suspend()
+        enum
+        {
+            NUM_SAVED_REGISTERS = 7,
+        };
+
+        // Handle of the calling thread, so another thread can suspend it (released with CloseThread())
+        static void *   OpenCurrentThread();
+        static void     CloseThread(void * thread);
+        // Highest address of the stack of the calling thread (the stack grows down from there)
+        static void *   GetStackBase();
+
+        // Stops another thread, returns the lowest address of its stack in use
+        //  The general purpose registers of the thread are stored in registers (NUM_SAVED_REGISTERS values)
+        //  On the platforms where they are saved on the stack of the thread instead, the values are NULL
+        //  The thread must not be suspended already, and has to be resumed with Resume()
+        static void *   Suspend(void * thread, void * * registers);
+        static void     Resume(void * thread);
+
+    private:
+        GCThread();
+        GCThread(const GCThread & other);
+        GCThread & operator=(const GCThread & other);
+    };
+}
+
+#endif
@@ -0,0 +1,85 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __GCVIRTUALMEMORY_H__
+#define __GCVIRTUALMEMORY_H__
+
+#include "CrossNetRuntime/Defines.h"
+
+namespace CrossNetRuntime
+{
+    // Thin layer on top of the OS virtual memory
+    //  Used by the GC to reserve address space and commit / return pages as needed
+    //  On Windows this maps to VirtualAlloc / VirtualFree, on the other platforms to mmap / mprotect / madvise
+    class GCVirtualMemory
+    {
+    public:
+        static int      GetPageSize();
+
+        // Reserves address space without committing it (i.e. no physical memory used)
+        //  Returns NULL if the address space could not be reserved
+        static void *   Reserve(size_t size);
+        // Same as Reserve() but the OS also tracks the pages written to (see GetWrittenPages())
+        //  On Windows this is a write watch, on Linux the soft-dirty bits of /proc/self/pagemap
+        //  Where the OS can't do it (like a Linux kernel without soft-dirty bits), this is a normal reservation
+        static void *   ReserveWatched(size_t size);
+        static void     Release(void * address, size_t size);
+
+        // Commits some pages of a reserved range, the pages are zeroed by the OS
+        static bool     Commit(void * address, size_t size);
+        // Gives back the physical pages to the OS, the address space stays reserved
+        //  Next time the pages are committed, they will be zeroed
+        static void     Decommit(void * address, size_t size);
+
+        // Touches every page so the page faults are taken now instead of during allocation
+        static void     Prefault(void * address, size_t size);
+        // Asks the OS to back the range with huge pages (if supported)
+        static void     AdviseHugePages(void * address, size_t size);
+
+        // Fills pages with the pages of [address, address + size[ written to since the last reset, and resets them
+        //  The range must be in a reservation made by ReserveWatched(), the pages are returned in address order
+        //  Returns the number of pages found (if maxPages, call again to get the next ones)
+        //  Returns -1 if the writes are not tracked, the caller must then assume that all the pages have been written to
+        //  On Linux the pages are not reset (the soft-dirty bits can only be cleared for the whole process),
+        //  they are reported again until the next ResetWrittenPages(): the caller simply rescans more pages.
+        static int      GetWrittenPages(void * address, size_t size, void * * pages, int maxPages);
+        // Resets the pages written to of all the reservations made by ReserveWatched()
+        //  On Linux this clears the soft-dirty bits of the whole process, so the collector calls it once per collection
+        static void     ResetWrittenPages();
+
+    private:
+        static bool     SetupSoftDirtyBits();
+        static bool     ClearSoftDirtyBits();
+
+        // The heap and the large object space
+        enum
+        {
+            MAX_WATCHED_RESERVATIONS = 4,
+        };
+
+        // Open /proc/self/pagemap, -1 if the soft-dirty bits are not available, -2 if not checked yet (Linux only)
+        static int      sPagemapFile;
+        // Reservations made by ReserveWatched(), not released yet
+        static void *   sWatchedAddresses[MAX_WATCHED_RESERVATIONS];
+        static size_t   sWatchedSizes[MAX_WATCHED_RESERVATIONS];
+        static int      sNumWatched;
+
+        GCVirtualMemory();
+        GCVirtualMemory(const GCVirtualMemory & other);
+        GCVirtualMemory & operator=(const GCVirtualMemory & other);
+    };
+}
+
+#endif
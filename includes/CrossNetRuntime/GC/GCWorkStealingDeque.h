@@ -0,0 +1,113 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef __GCWORKSTEALINGDEQUE_H__
+#define __GCWORKSTEALINGDEQUE_H__
+
+#include "CrossNetRuntime/Defines.h"
+
+// For the interlocked operations
+#include <intrin.h>
+
+namespace System
+{
+    class Object;
+}
+
+namespace CrossNetRuntime
+{
+    // Chase-Lev work-stealing deque of gray objects, used by the parallel marking (see GCParallelMarker)
+    //  The owner thread pushes and pops at the bottom without interlocked operation (except for the last object),
+    //  the other threads steal the oldest objects at the top.
+    //  The capacity is fixed, Push() returns false when the deque is full (the owner then traces the object right away).
+    //  x86 doesn't reorder the stores with the other stores, nor the loads with the other loads,
+    //  so only the compiler has to be prevented to reorder them (volatile and _ReadWriteBarrier()).
+    class GCWorkStealingDeque
+    {
+    public:
+        GCWorkStealingDeque();
+
+        // capacity must be a power of 2
+        void    Setup(int capacity);
+        void    Teardown();
+
+        // Owner thread only
+        CROSSNET_FINLINE
+        bool    Push(::System::Object * object)
+        {
+            long bottom = mBottom;
+            if (bottom - mTop >= mCapacity)
+            {
+                return (false);
+            }
+            mItems[bottom & mMask] = object;
+            // The object must be visible before the new bottom
+            _ReadWriteBarrier();
+            mBottom = bottom + 1;
+            return (true);
+        }
+
+        // Owner thread only, returns NULL if the deque is empty
+        CROSSNET_FINLINE
+        ::System::Object *  Pop()
+        {
+            long bottom = mBottom - 1;
+            // The store of bottom must be visible before top is read (store / load ordering needs a fence on x86)
+            _InterlockedExchange(&mBottom, bottom);
+            long top = mTop;
+            if (top > bottom)
+            {
+                // Empty
+                mBottom = bottom + 1;
+                return (NULL);
+            }
+            ::System::Object * object = mItems[bottom & mMask];
+            if (top == bottom)
+            {
+                // Last object, a thief might be taking it at the same time
+                if (_InterlockedCompareExchange(&mTop, top + 1, top) != top)
+                {
+                    object = NULL;
+                }
+                mBottom = bottom + 1;
+            }
+            return (object);
+        }
+
+        // Any thread, returns NULL if the deque is empty or if another thread stole the object first
+        ::System::Object *  Steal();
+
+        CROSSNET_FINLINE
+        bool    IsEmpty() const
+        {
+            return (mBottom <= mTop);
+        }
+
+    private:
+        ::System::Object * volatile *   mItems;
+        long                            mCapacity;
+        long                            mMask;
+        volatile long                   mTop;
+        // On its own cache line, the owner writes it all the time
+        char                            mPadding[64];
+        volatile long                   mBottom;
+
+        GCWorkStealingDeque(const GCWorkStealingDeque & other);
+        GCWorkStealingDeque & operator=(const GCWorkStealingDeque & other);
+    };
+}
+
+#endif
@@ -0,0 +1,113 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef __REGIONSCOPE_H__
+#define __REGIONSCOPE_H__
+
+#include "CrossNetRuntime/Defines.h"
+#include "CrossNetRuntime/GC/GCAllocator.h"
+
+namespace CrossNetRuntime
+{
+    // Region allocation for temporaries that die together (for example everything allocated while handling a request)
+    //  Put a RegionScope on the stack, the managed allocations of the current thread then go in an arena
+    //  reserved in the main buffer (same inlined bump allocation as the thread allocation buffers).
+    //  When the scope ends, the whole arena is given back in one go instead of waiting for the next collection.
+    //
+    //  {
+    //      ::CrossNetRuntime::RegionScope region;
+    //      ... temporaries ...
+    //  }
+    //
+    //  The arena is released only if nothing escaped, otherwise its objects simply stay in the main buffer
+    //  as normal objects (they are promoted for free, nothing is copied). The objects are promoted if:
+    //      - The stores are not tracked (InitOptions::mGeneratedWriteBarrier is not set).
+    //      - GCManager::WriteBarrier() has been called for a slot outside the arena during the region
+    //        (whatever the value stored, it might point to the arena).
+    //      - A collection happened during the region.
+    //      - An allocation didn't fit in the arena (or went to the large object space),
+    //        or an object has been freed with GCManager::CollectOneObject().
+    //      - A pointer to the arena is found in the registers or the stack of the calling functions,
+    //        or in the registered slots of the shadow stack. The native stack is only scanned with MSVC on x86,
+    //        on the other platforms the region is always promoted.
+    //      - Promote() has been called.
+    //
+    //  The escapes are detected by the write barrier, so the stores in the static fields must call
+    //  GCManager::WriteBarrier() as well (the card tables ignore them, but the regions don't).
+    //
+    //  A region belongs to the thread that created it, the regions of a thread must end in the reverse order.
+    class RegionScope
+    {
+    public:
+        enum
+        {
+            DEFAULT_ARENA_SIZE = 64 * 1024,
+        };
+
+        explicit RegionScope(int arenaSize = DEFAULT_ARENA_SIZE);
+        ~RegionScope();
+
+        // Keeps all the objects of the region, they'll be collected normally
+        void    Promote();
+
+        bool    IsPromoted() const
+        {
+            return (mPromoted);
+        }
+
+        // Called by GCManager::WriteBarrier() for each store of a managed pointer
+        //  A store outside the arena of the innermost region of this thread might make the arena reachable
+        CROSSNET_FINLINE
+        static void OnStore(void * slot)
+        {
+            RegionScope * region = sCurrentRegion;
+            if ((region != NULL) && ((size_t)((unsigned char *)slot - region->mArenaStart) >= (size_t)region->mArenaSize))
+            {
+                region->mEscaped = true;
+            }
+        }
+
+    private:
+        bool    CanRelease() const;
+        bool    IsReferencedFromStack(void * const * callerFrame, void * const * registers, int numRegisters) const;
+        void    Release();
+
+        // Called at the beginning of a collection (the allocator lock is taken)
+        //  Same handshake as the thread allocation buffers, see GCAllocator::RetireAllThreadAllocBuffers()
+        static void BeginRetireAllRegions();
+        static void EndRetireAllRegions();
+
+        GCAllocator::ThreadAllocBuffer      mBuffer;
+        GCAllocator::ThreadAllocBuffer *    mPreviousBuffer;
+        RegionScope *                       mPreviousRegion;
+        unsigned char *                     mArenaStart;
+        int                                 mArenaSize;
+        int                                 mNumCollections;
+        bool                                mPromoted;
+        bool                                mEscaped;       // Set by OnStore()
+        RegionScope *                       mNextRegion;    // All the active regions are chained so the GC can retire them
+
+        static RegionScope *                sActiveRegions;
+        static CROSSNET_THREAD_LOCAL RegionScope *  sCurrentRegion;    // Innermost region of the current thread
+
+        friend class GCAllocator;
+
+        RegionScope(const RegionScope & other);
+        RegionScope & operator=(const RegionScope & other);
+    };
+}
+
+#endif
@@ -35,6 +35,18 @@ namespace CrossNetRuntime
 
     typedef void    (*RegisterSystemTypeFunctionPointer)();
 
+    // Called before and after each collection (generation is the one collected, see GCManager::Collect())
+    typedef void    (*CollectCallbackFunctionPointer)(int generation);
+
+    // How the pages of the growable heap are backed
+    enum HeapBacking
+    {
+        HB_LAZY_COMMIT,     // Segments are committed when needed, pages are faulted on first access
+        HB_PREFAULT,        // Same but the pages are touched when committed (no page fault during allocation)
+        HB_HUGE_PAGES,      // Same as HB_LAZY_COMMIT but asks the OS for transparent huge pages
+                            //  (Same as HB_LAZY_COMMIT on Windows, where large pages can't be committed lazily)
+    };
+
     struct InitOptions
     {
         InitOptions()
@@ -46,6 +58,10 @@ namespace CrossNetRuntime
         void *  mInterfaceMapBuffer;
         int     mInterfaceMapSize;
         int     mInitialReservedNumTypes;
+        // Bytes taken at the end of mInterfaceMapBuffer for the interface wrappers (0 to allocate each wrapper with mUnmanagedAllocateCallback)
+        //  The wrappers are then bump allocated next to each other and close to the interface maps
+        //  When the arena is full, the next wrappers use mUnmanagedAllocateCallback
+        int     mInterfaceWrapperArenaSize;
         // This gets called as soon as the interface map is registered
         //  But before any CrossNetRuntime type is created
         RegisterSystemTypeFunctionPointer   mRegisterSystemTypeCallback;
@@ -53,10 +69,54 @@ namespace CrossNetRuntime
         // Allocator
 
         // Buffer for the main buffer
+        //  If NULL, the runtime reserves mMaxHeapSize bytes of address space instead
+        //  And commits it by segments as the heap grows (mMainBufferSize is then the initial committed size)
         void *  mMainBuffer;
         // Size for the main buffer
         int     mMainBufferSize;
 
+        // Growable heap, only used if mMainBuffer is NULL
+        //  Maximum size of the heap (address space reserved at setup)
+        int         mMaxHeapSize;
+        //  Granularity of the commit / release, rounded up to a power of 2 (1 Mb if 0)
+        //  Segments that are completely free after a collection are given back to the OS
+        int         mHeapSegmentSize;
+        HeapBacking mHeapBacking;
+
+        // Size of the per-thread allocation buffers (0 to disable them)
+        //  When set, the allocator becomes thread safe and each thread bump allocates
+        //  its small objects in its own buffer without taking any lock.
+        //  Buffers are carved from the main buffer and recycled through a lock-free pool.
+        //  A thread is attached the first time it allocates (see GCAllocator::AttachCurrentThread()),
+        //  the collections suspend the other attached threads and scan their stacks and registers.
+        //  As a thread can be suspended anywhere, the unmanaged allocation callbacks must not take a lock
+        //  that the application holds elsewhere (the collector calls them while the threads are suspended).
+        int     mThreadAllocBufferSize;
+
+        // Size of the address space reserved for the large object space (0 to disable it)
+        //  Objects (in practice arrays and strings) of mLargeObjectThreshold bytes or more
+        //  are allocated on their own pages instead of the main buffer, and their pages
+        //  are given back to the OS as soon as they are collected.
+        int     mLargeObjectSpaceSize;
+        //  Minimum size of a large object (16 Kb if 0, never smaller than a page)
+        int     mLargeObjectThreshold;
+
+        // Size of the address space reserved for the pointer-free space (0 to disable it)
+        //  The strings and the arrays of base types up to 8 Kb are allocated there (see GCPointerFreeSpace).
+        //  The collection marks them with one bit without reading them, and sweeps them with a bitmap scan.
+        int     mPointerFreeSpaceSize;
+
+        // Average number of bytes between two samples of the allocation profiler (0 to disable it)
+        //  Each sample records the type and the call stack of the allocation (see GCAllocationProfiler).
+        //  The sampling can also be turned on later with GCAllocationProfiler::SetSampleInterval().
+        int     mAllocationSampleInterval;
+
+        // Keeps the free memory of the main buffer zeroed
+        //  The sweep clears the dead objects in bulk (with non-temporal stores for the big runs)
+        //  So the allocation only has to clear the header and the boundary tag of the free block it comes from.
+        //  Pages coming from the OS are already zero, a user provided main buffer is cleared once at setup.
+        bool    mZeroFreeMemory;
+
         // Design flaw to resolve soon:
         //  If the user allocates some memory, we are actually not able to deallocate it 
         //  By the user callback, the memory will stay allocated...
@@ -64,6 +124,8 @@ namespace CrossNetRuntime
         //          And when recycling, we need to try to use first normal memory and avoid to use user provided memory last...
         //          Note actually we cannot collect memory allocated by the user ;)
         //          We really have to improve this...
+        //  With the growable heap (mMainBuffer set to NULL), those callbacks are only called
+        //  When the heap reached mMaxHeapSize, so most applications should not need them anymore.
 
         // Callback used to allocate when the allocation is full but before GC
         //  The goal is to let the user decide if he prefers use more memory to save GC
@@ -84,6 +146,91 @@ namespace CrossNetRuntime
         MasterTraceFunctionPointer  mMainTrace;
         OnDestructObjectPtr         mDestructGCObjectCallback;
 
+        // Collection policy (see GCPolicy)
+        //  By default (mGcBudgetMinSize set to 0) the collection happens only when the heap is full.
+        //  Otherwise the collection happens when the allocations since the last collection exceed the budget.
+        //  The budget is mGcBudgetLivePercent of the live bytes after the last collection (100% if 0),
+        //  but at least mGcBudgetMinSize bytes.
+        int         mGcBudgetMinSize;
+        int         mGcBudgetLivePercent;
+        //  Memory limit of the process in bytes (if 0, the cgroup v2 memory.max or the memory limit of the job object on Windows is used if there is one)
+        //  The budget is reduced so the live bytes plus the budget stay under mGcMemoryLimitPercent of the limit (90% if 0)
+        int         mGcMemoryLimit;
+        int         mGcMemoryLimitPercent;
+
+        // Incremental collection (see GCManager::Step())
+        //  The host advances the collection by small steps, for example with GCManager::OnIdle() at the end of each frame.
+        //  The OS tracks the pages of the heap and of the large object space written to during the marking (write watch),
+        //  the marked objects on these pages are traced again in the last step of the marking.
+        //  Where the writes are not tracked (like a user provided mMainBuffer), all the marked objects are traced again.
+        //  The objects allocated with mAllocateBeforeGCCallback / mAllocateAfterGCCallback are not tracked.
+        bool        mIncrementalCollection;
+
+        // Number of threads marking in parallel during Collect(), including the collecting thread (0 or 1 to disable it)
+        //  The other threads are created at setup and wait for the collections (see GCParallelMarker)
+        //  The marks are then set with interlocked operations.
+        int         mNumMarkThreads;
+
+        // Lazy sweeping (ignored with CN_GC_HEADER_MARK)
+        //  Collect() ends after the marking, the main buffer is then swept by chunks when the allocator runs out of memory
+        //  (or by GCManager::Step() / OnIdle()). The dead objects are collected (__OnCollect__() is called) at that time.
+        //  With mThreadAllocBufferSize, a background thread also sweeps the remaining chunks after each collection,
+        //  so __OnCollect__() and mAfterCollectCallback can be called from that thread.
+        bool        mLazySweeping;
+
+        // Number of threads sweeping the main buffer in parallel during Collect(), including the collecting thread
+        //  (0 or 1 to disable it, ignored with CN_GC_HEADER_MARK and when the main buffer is swept lazily)
+        //  The dead objects are still collected (__OnCollect__() is called) by the collecting thread, before the other threads
+        //  clear and free their memory. As for any collection, the destructors must not allocate or free managed memory.
+        int         mNumSweepThreads;
+
+        // Generational collection (ignored with CN_GC_HEADER_MARK, see GCManager::Collect())
+        //  The objects that survive a collection keep their mark and become old, the young collections
+        //  (generation 0 or 1) only trace and sweep the objects allocated since the last collection.
+        //  The old objects written to since the last collection are found with a card table: the cards are dirtied
+        //  by GCManager::WriteBarrier() and, where the OS tracks them (write watch), by the pages written to.
+        //  The complete collections (MAX_GENERATION) are done when the old objects have grown by a whole budget (see GCPolicy).
+        bool        mGenerationalCollection;
+        //  Set if the generated code calls GCManager::WriteBarrier() after each store of a managed pointer in a managed object
+        //  Otherwise where the writes are not tracked (like a user provided mMainBuffer), all the old objects are traced
+        //  again by the young collections (only the sweep is reduced).
+        //  The regions (see RegionScope) rely on it to detect their escapes, including the stores in the static fields:
+        //  without it, they are always promoted.
+        bool        mGeneratedWriteBarrier;
+
+        // Mostly-copying compaction (ignored with CN_GC_HEADER_MARK, see GCManager::Compact())
+        //  The complete collections done by Collect() (not the incremental ones) move the live objects of the sparse parts of the main buffer to the free blocks
+        //  of the dense parts (or to the end of the heap), the pointers to them are updated.
+        //  The objects pointed from the stack and the registers (or traced with GCManager::Trace() instead of Tracer),
+        //  the objects with __FIXED__ and the ones whose address has been used as hash code are not moved.
+        //  The generated __Trace__() must trace the fields with Tracer::DoTrace() so they can be updated.
+        bool        mCompaction;
+
+        // Precise stack roots (see GCShadowStack)
+        //  The generated code registers the addresses of its managed locals with the CN_GC_FRAME macros,
+        //  the collection traces only these slots (for all the threads) instead of scanning the registers and the native stack.
+        //  These objects are then not pinned, the compaction can move them and updates the slots.
+        //  Every managed pointer that lives across an allocation (temporaries included) must be registered.
+        //  The runtime registers its own locals the same way.
+        bool        mPreciseStackRoots;
+
+        // Exact interior pointers for the conservative stack scan (ignored with CN_GC_HEADER_MARK, CN_GC_NO_DEFAULT_ALLOCATE and mPreciseStackRoots)
+        //  The allocator records the start of each object of the main buffer in a bitmap (one bit per 16 bytes),
+        //  so each value of the stack is mapped to the object containing it, or rejected, without reading the memory it points to.
+        //  Without it, the values are checked against the vtable and the interface map they seem to point to,
+        //  and a pointer inside an object is only found if it is close enough to the start.
+        bool        mExactInteriorPointers;
+
+        // Called before each collection, the application can drop its caches here
+        //  When the collection is triggered by an allocation, the allocator lock is already held by the allocating thread:
+        //  these callbacks must not allocate managed objects, nor wait for another thread that allocates.
+        CollectCallbackFunctionPointer  mBeforeCollectCallback;
+        // Called after each collection, GCManager::GetLiveBytes() is up to date
+        CollectCallbackFunctionPointer  mAfterCollectCallback;
+
+        // Number of pauses kept by the event log, rounded up to a power of 2 (256 if 0, see GCEventLog)
+        int                             mGcEventLogSize;
+
     private:
         static InitOptions sOptions;
 
@@ -117,6 +117,10 @@ namespace CrossNetRuntime
 
         static bool InInterfaceMapSpace(void * pointer);
 
+        // Memory of the interface wrappers (used by IInterface::operator new / delete)
+        static void *   AllocateWrapper(size_t size);
+        static void     FreeWrapper(void * buffer, size_t size);
+
     private:
         InterfaceMapper();
         InterfaceMapper(const InterfaceMapper & other);
@@ -143,6 +147,8 @@ namespace CrossNetRuntime
         static int      RetrieveNextInterfaceId();
         static int      RetrieveNextObjectId();
 
+        static IInterface *     DeduplicateWrapper(IInterface * wrapper);
+
         static System::Type *   CreateSystemType();
         static void             TraceSystemType(System::Type * type, unsigned char currentMark);
 
@@ -155,6 +161,14 @@ namespace CrossNetRuntime
         static std::vector<int> sStaticInterfaceId;
         static std::vector<int> sStaticObjectId;
         static std::vector<::System::Type *> sAllTypes;
+
+        static const int    WRAPPER_ALIGNMENT = 8;
+
+        static unsigned char *  sWrapperArenaStart;
+        static unsigned char *  sWrapperArenaCurrent;
+        static unsigned char *  sWrapperArenaEnd;
+        // All the wrappers registered so far, sorted by vtable
+        static std::vector<IInterface *>    sWrappers;
     };
 }
 
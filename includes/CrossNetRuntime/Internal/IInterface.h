@@ -74,14 +74,16 @@ namespace CrossNetRuntime
         // For pure interface, this should be private (and declared but not implemented)
         // But because wrappers are deriving from interfaces, this should at least be protected
         // But actually because wrappers are actually created from other classes, this then needs to be public
+        // The wrappers go in the wrapper arena of the interface mapper (see InitOptions::mInterfaceWrapperArenaSize)
         void * operator new(size_t size)
         {
-            void * buffer = GetOptions().mUnmanagedAllocateCallback(size);
+            void * buffer = InterfaceMapper::AllocateWrapper(size);
             return (buffer);
         }
-        void operator delete(void * buffer)
+        // The size is the one of the actual wrapper (the destructor is virtual)
+        void operator delete(void * buffer, size_t size)
         {
-            GetOptions().mUnmanagedFreeCallback(buffer);
+            InterfaceMapper::FreeWrapper(buffer, size);
         }
 
     protected:
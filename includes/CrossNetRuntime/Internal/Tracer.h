@@ -106,6 +106,7 @@ namespace CrossNetRuntime
     };
 
     // Specialization for classes
+    //  The pointers are passed by reference, so the compaction can update them if the object is moved
     template <typename U>
     struct TraceTrait<U, TM_CLASS>
     {
@@ -113,13 +114,13 @@ namespace CrossNetRuntime
         {
             for (int i = 0 ; i < size ; ++i)
             {
-                ::CrossNetRuntime::GCManager::Trace(ptr[i], currentMark);
+                ::CrossNetRuntime::GCManager::TraceSlot(ptr[i], currentMark);
             }
         }
 
-        static void DoTrace(unsigned char currentMark, U ptr)
+        static void DoTrace(unsigned char currentMark, U & ptr)
         {
-            ::CrossNetRuntime::GCManager::Trace(ptr, currentMark);
+            ::CrossNetRuntime::GCManager::TraceSlot(ptr, currentMark);
         }
     };
 
@@ -150,7 +151,7 @@ namespace CrossNetRuntime
         }
 
         template <typename U>
-        static void DoTrace(unsigned char currentMark, U ptr)
+        static void DoTrace(unsigned char currentMark, U & ptr)
         {
             TraceTrait<U, GetTraceMode<U>::Value >::DoTrace(currentMark, ptr);
         }
@@ -164,6 +164,8 @@ namespace System
             void * arrayDstItems = (void *)((int)(array->GetAddressOfFirstItem()) + (index * sizeOfT));
 
             __memcopy__(arrayDstItems, arraySrcItems, length * sizeOfT);
+            // The destination might be old and the items young
+            ::CrossNetRuntime::GCManager::WriteBarrierRange(arrayDstItems, length * sizeOfT);
         }
 
         static void Copy(System::Array *, System::Array *, int);
@@ -305,27 +307,55 @@ namespace System
             NULL
         )
 
+        // The arrays of base types don't contain any managed pointer, they go in the pointer-free space
+        //  The test is resolved at compile time
+        static void * __Allocate__(size_t size)
+        {
+            if (::CrossNetRuntime::GetTraceMode<T>::Value == ::CrossNetRuntime::TM_NONE)
+            {
+                return (operator new(size, ::CrossNetRuntime::POINTER_FREE));
+            }
+            return (operator new(size));
+        }
+
         static Array__G * __Create__(int first, T * initValues = NULL)
         {
-            Array__G * array = (Array__G *)operator new(sizeof(Array__G) + (sizeof(T) * first));
+            Array__G * array = (Array__G *)__Allocate__(sizeof(Array__G) + (sizeof(T) * first));
             array->Array__G::Array__G(first, initValues);
             return (array);
         }
 
         static Array__G * __Create__(int first, int second, T * initValues = NULL)
         {
-            Array__G * array = (Array__G *)operator new(sizeof(Array__G) + (sizeof(T) * first * second));
+            Array__G * array = (Array__G *)__Allocate__(sizeof(Array__G) + (sizeof(T) * first * second));
             array->Array__G::Array__G(first, second, initValues);
             return (array);
         }
 
         static Array__G * __Create__(int first, int second, int third, T * initValues = NULL)
         {
-            Array__G * array = (Array__G *)operator new(sizeof(Array__G) + (sizeof(T) * first * second * third));
+            Array__G * array = (Array__G *)__Allocate__(sizeof(Array__G) + (sizeof(T) * first * second * third));
             array->Array__G::Array__G(first, second, third, initValues);
             return (array);
         }
 
+        // Same as __Create__(first, initValues), but the first item is aligned on alignment bytes
+        //  (like 32 for AVX, 64 for a cache line, up to 4096)
+        //  The object itself stays aligned on 16 bytes: when the header isn't a multiple of 16 bytes (Single, Int32, Double...),
+        //  the items of this array start after a padding (see GetItems()). The compaction doesn't move it.
+        static Array__G * __CreateAligned__(int first, int alignment, T * initValues = NULL)
+        {
+            int offset = sizeof(Array__G) + GetAlignedPadding();
+            Array__G * array = (Array__G *)operator new(offset + (sizeof(T) * first), alignment, offset);
+            array->Array__G::Array__G(first);
+            array->__SetFlags__(0, __ALIGNED__);
+            if (initValues != NULL)
+            {
+                memcpy(array->GetItems(), initValues, sizeof(T) * first);
+            }
+            return (array);
+        }
+
         static Array__G * __Create__(int first, int second, int third, int fourth, T * initValues = NULL);
         static Array__G * __Create__(int first, int second, int third, int fourth, int fifth, T * initValues = NULL);
         static Array__G * __Create__(int first, int second, int third, int fourth, int fifth, int sixth, T * initValues = NULL);
@@ -334,12 +364,16 @@ namespace System
         {
             int size = sizeof(Array__G);
             size += sizeof(T) * GetSize();
+            if ((__GetFlags__() & __ALIGNED__) != 0)
+            {
+                size += GetAlignedPadding();
+            }
             return (size);
         }
 
         T * __ToPointer__()
         {
-            return (mItems);
+            return (GetItems());
         }
 
         const T & Item(int first) const
@@ -347,7 +381,7 @@ namespace System
             CROSSNET_ASSERT(mSecond == 0, "This is not a one dimension array!");
             CROSSNET_ASSERT(((first >= 0) && (first < mFirst)), "Out of bound!");
             int index = first;
-            return (*(mItems + index));
+            return (*(GetItems() + index));
         }
 
         T & Item(int first)
@@ -355,7 +389,7 @@ namespace System
             CROSSNET_ASSERT(mSecond == 0, "This is not a one dimension array!");
             CROSSNET_ASSERT(((first >= 0) && (first < mFirst)), "Out of bound!");
             int index = first;
-            return (*(mItems + index));
+            return (*(GetItems() + index));
         }
 
         const T & Item(int first, int second) const
@@ -364,7 +398,7 @@ namespace System
             CROSSNET_ASSERT(((first >= 0) && (first < mFirst)), "Out of bound!");
             CROSSNET_ASSERT(((second >= 0) && (second < mSecond)), "Out of bound!");
             int index = (first * mSecond) + second;
-            return (*(mItems + index));
+            return (*(GetItems() + index));
         }
 
         T & Item(int first, int second)
@@ -373,7 +407,7 @@ namespace System
             CROSSNET_ASSERT(((first >= 0) && (first < mFirst)), "Out of bound!");
             CROSSNET_ASSERT(((second >= 0) && (second < mSecond)), "Out of bound!");
             int index = (first * mSecond) + second;
-            return (*(mItems + index));
+            return (*(GetItems() + index));
         }
 
         const T & Item(int first, int second, int third) const
@@ -383,7 +417,7 @@ namespace System
             CROSSNET_ASSERT(((second >= 0) && (second < mSecond)), "Out of bound!");
             CROSSNET_ASSERT(((third >= 0) && (third < mThird)), "Out of bound!");
             int index = (((first * mSecond) + second) * mThird) + third;
-            return (*(mItems + index));
+            return (*(GetItems() + index));
         }
 
         T & Item(int first, int second, int third)
@@ -393,27 +427,29 @@ namespace System
             CROSSNET_ASSERT(((second >= 0) && (second < mSecond)), "Out of bound!");
             CROSSNET_ASSERT(((third >= 0) && (third < mThird)), "Out of bound!");
             int index = (((first * mSecond) + second) * mThird) + third;
-            return (*(mItems + index));
+            return (*(GetItems() + index));
         }
 
         const T & SingleDimensionItem(int first) const
         {
             CROSSNET_ASSERT(((first >= 0) && (first < GetSize())), "Out of bound!");
             int index = first;
-            return (*(mItems + index));
+            return (*(GetItems() + index));
         }
 
         T & SingleDimensionItem(int first)
         {
             CROSSNET_ASSERT(((first >= 0) && (first < GetSize())), "Out of bound!");
             int index = first;
-            return (*(mItems + index));
+            return (*(GetItems() + index));
         }
 
         void SetValue(System::Object * value, System::Int32 first)
         {
             T temp = CrossNetRuntime::Unbox<CrossNetRuntime::BaseTypeWrapper<T>::BoxeableType >(value);
-            Item(first) = temp;
+            T & item = Item(first);
+            item = temp;
+            ::CrossNetRuntime::GCManager::WriteBarrierRange(&item, sizeof(T));
         }
 
         virtual void SetValue(System::Object *, System::Array__G<System::Int32> *)
@@ -424,7 +460,9 @@ namespace System
         virtual void SetValue(System::Object * value, System::Int64 first)
         {
             T temp = CrossNetRuntime::Unbox<CrossNetRuntime::BaseTypeWrapper<T>::BoxeableType >(value);
-            Item((int)first) = temp;
+            T & item = Item((int)first);
+            item = temp;
+            ::CrossNetRuntime::GCManager::WriteBarrierRange(&item, sizeof(T));
         }
 
         virtual void SetValue(System::Object *, System::Array__G<System::Int64> *)
@@ -435,25 +473,33 @@ namespace System
         virtual void SetValue(System::Object * value, System::Int32 first, System::Int32 second)
         {
             T temp = CrossNetRuntime::Unbox<CrossNetRuntime::BaseTypeWrapper<T>::BoxeableType >(value);
-            Item(first, second) = temp;
+            T & item = Item(first, second);
+            item = temp;
+            ::CrossNetRuntime::GCManager::WriteBarrierRange(&item, sizeof(T));
         }
 
         virtual void SetValue(System::Object * value, System::Int64 first, System::Int64 second)
         {
             T temp = CrossNetRuntime::Unbox<CrossNetRuntime::BaseTypeWrapper<T>::BoxeableType >(value);
-            Item((int)first, (int)second) = temp;
+            T & item = Item((int)first, (int)second);
+            item = temp;
+            ::CrossNetRuntime::GCManager::WriteBarrierRange(&item, sizeof(T));
         }
 
         virtual void SetValue(System::Object * value, System::Int32 first, System::Int32 second, System::Int32 third)
         {
             T temp = CrossNetRuntime::Unbox<CrossNetRuntime::BaseTypeWrapper<T>::BoxeableType >(value);
-            Item(first, second, third) = temp;
+            T & item = Item(first, second, third);
+            item = temp;
+            ::CrossNetRuntime::GCManager::WriteBarrierRange(&item, sizeof(T));
         }
 
         virtual void SetValue(System::Object * value, System::Int64 first, System::Int64 second, System::Int64 third)
         {
             T temp = CrossNetRuntime::Unbox<CrossNetRuntime::BaseTypeWrapper<T>::BoxeableType >(value);
-            Item((int)first, (int)second, (int)third) = temp;
+            T & item = Item((int)first, (int)second, (int)third);
+            item = temp;
+            ::CrossNetRuntime::GCManager::WriteBarrierRange(&item, sizeof(T));
         }
 
         virtual System::Object * GetValue(System::Int32 first)
@@ -596,8 +642,8 @@ namespace System
         {
             int size = GetSize();
 
-            T * first = mItems;
-            T * last = mItems + size - 1;
+            T * first = GetItems();
+            T * last = GetItems() + size - 1;
 
             T temp;
 
@@ -612,6 +658,7 @@ namespace System
                 ++first;
                 --last;
             }
+            ::CrossNetRuntime::GCManager::WriteBarrierRange(GetItems(), size * sizeof(T));
         }
 
         virtual void * * GetItemInterfaceMap()
@@ -731,7 +778,7 @@ namespace System
         System::Object * Clone()
         {
             Int32 rank = get_Rank();
-            T * initValues = mItems;
+            T * initValues = GetItems();
             switch (rank)
             {
             case 1:
@@ -774,7 +821,7 @@ namespace System
             System::Object * tempObj = CrossNetRuntime::Box<System::Object>(item);
             for (Int32 i = 0 ; i < length ; ++i)
             {
-                if (CrossNetRuntime::GenWrapperConvert(mItems[i])->Equals(tempObj))
+                if (CrossNetRuntime::GenWrapperConvert(GetItems()[i])->Equals(tempObj))
                 {
                     return (i);
                 }
@@ -791,7 +838,7 @@ namespace System
             System::Object * tempObj = CrossNetRuntime::Box<System::Object>(item);
             for (Int32 i = 0 ; i < length ; ++i)
             {
-                if (CrossNetRuntime::GenWrapperConvert(mItems[i])->Equals(tempObj))
+                if (CrossNetRuntime::GenWrapperConvert(GetItems()[i])->Equals(tempObj))
                 {
                     return (true);
                 }
@@ -804,7 +851,7 @@ namespace System
             Int32 length = get_Length();
             for (Int32 i = 0 ; i < length ; ++i)
             {
-                if (CrossNetRuntime::GenWrapperConvert(mItems[i])->Equals(value))
+                if (CrossNetRuntime::GenWrapperConvert(GetItems()[i])->Equals(value))
                 {
                     return (i);
                 }
@@ -939,7 +986,10 @@ namespace System
             virtual T set_Item(void * __instance__, ::System::Int32 index, T value)
             {
                 Array__G * __temp__ = static_cast<Array__G *>(__instance__);
-                return (__temp__->Item(index) = value);
+                T & item = __temp__->Item(index);
+                item = value;
+                ::CrossNetRuntime::GCManager::WriteBarrierRange(&item, sizeof(T));
+                return (value);
             }
             virtual ::System::Int32 IndexOf(void * __instance__, T item)
             {
@@ -1010,7 +1060,29 @@ namespace System
 
         virtual void __Trace__(unsigned char currentMark)
         {
-            ::CrossNetRuntime::Tracer::DoTrace(currentMark, mItems, GetSize());
+            ::CrossNetRuntime::Tracer::DoTrace(currentMark, GetItems(), GetSize());
+        }
+
+        virtual void __TraceRange__(unsigned char currentMark, void * start, void * end)
+        {
+            // Only the items overlapping [start, end[, the rest of a big array is not even read
+            int itemSize = sizeof(T);
+            int size = GetSize();
+            unsigned char * items = reinterpret_cast<unsigned char *>(GetItems());
+            int first = 0;
+            if (start > items)
+            {
+                first = (int)(static_cast<unsigned char *>(start) - items) / itemSize;
+            }
+            int last = size;
+            if (end < items + size * itemSize)
+            {
+                last = ((int)(static_cast<unsigned char *>(end) - items) + itemSize - 1) / itemSize;
+            }
+            if (first < last)
+            {
+                ::CrossNetRuntime::Tracer::DoTrace(currentMark, GetItems() + first, last - first);
+            }
         }
 
     protected:
@@ -1031,7 +1103,7 @@ namespace System
 
         virtual void * GetAddressOfFirstItem()
         {
-            return (mItems);
+            return (GetItems());
         }
 
     private:
@@ -1068,14 +1140,28 @@ namespace System
             // Copy the objects
             if (initValues != NULL)
             {
-                memcpy(mItems, initValues, sizeof(T) * size);
+                memcpy(GetItems(), initValues, sizeof(T) * size);
             }
-            else
+            // Otherwise there is nothing to do, operator new returns cleared memory
+            //  So the items already have their default value (zero for base types, struct members and GC pointers)
+        }
+
+        // Padding between the header and the items of an array created by __CreateAligned__()
+        //  Resolved at compile time, 0 when the header is already a multiple of 16 bytes
+        CROSSNET_FINLINE
+        static int GetAlignedPadding()
+        {
+            return ((16 - (sizeof(Array__G) & 15)) & 15);
+        }
+
+        CROSSNET_FINLINE
+        T * GetItems() const
+        {
+            if ((GetAlignedPadding() != 0) && ((__GetFlags__() & __ALIGNED__) != 0))
             {
-                // No initial values, set the memory to zero
-                // Default value for base types (and thus struct members) as well as GC pointers...
-                __memclear__(mItems, sizeof(T) * size);
+                return (reinterpret_cast<T *>(reinterpret_cast<unsigned char *>(mItems) + GetAlignedPadding()));
             }
+            return (mItems);
         }
 
         int GetSize() const
@@ -1096,6 +1182,9 @@ namespace System
         Int32   mFirst;
         Int32   mSecond;
         Int32   mThird;
+        // The items get the alignment of T, so an item type declared with CROSSNET_ALIGN(16) starts on 16 bytes
+        //  Access them with GetItems(), they start further for an array created by __CreateAligned__()
+        //  (The other arrays don't pay for the padding of the header)
         mutable T mItems[0];
     };
 }
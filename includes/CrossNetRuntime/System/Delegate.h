@@ -187,6 +187,13 @@ namespace System
             CROSSNET_ASSERT(mMode == ptr->mMode, "");                       \
             return (true);                                                  \
         }                                                                   \
+        virtual void __Trace__(unsigned char currentMark)                   \
+        {                                                                   \
+            ::System::MulticastDelegate::__Trace__(currentMark);            \
+            /* __T__ might not be a managed class, trace it like a stack root */   \
+            /* (So the instance is pinned by the compaction) */             \
+            ::CrossNetRuntime::GCManager::TraceConservative(mInstance, currentMark);   \
+        }                                                                   \
     };
 
 #define CREATE_DELEGATE__G(className, returnKeyword, returnValue, methodSignature, parameters, templateParametersDeclaration, templateParameters)   \
@@ -290,6 +297,13 @@ namespace System
             CROSSNET_ASSERT(mMode == ptr->mMode, "");                       \
             return (true);                                                  \
         }                                                                   \
+        virtual void __Trace__(unsigned char currentMark)                   \
+        {                                                                   \
+            ::System::MulticastDelegate::__Trace__(currentMark);            \
+            /* __T__ might not be a managed class, trace it like a stack root */   \
+            /* (So the instance is pinned by the compaction) */             \
+            ::CrossNetRuntime::GCManager::TraceConservative(mInstance, currentMark);   \
+        }                                                                   \
     };
 }
 
@@ -30,6 +30,9 @@ namespace System
         virtual System::Delegate * CombineImpl(System::Delegate * other);
         virtual System::Delegate * RemoveImpl(System::Delegate * other);
 
+        // The combined delegates are only referenced from the vector (outside of the managed heap)
+        virtual void __Trace__(unsigned char currentMark);
+
         std::vector<::System::Delegate *> mDelegates;
     };
 }
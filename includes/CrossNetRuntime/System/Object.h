@@ -20,6 +20,7 @@
 #include "CrossNetRuntime/Defines.h"
 #include "CrossNetRuntime/InterfaceMapper.h"
 #include "CrossNetRuntime/GC/GCAllocator.h"
+#include "CrossNetRuntime/GC/GCAllocationProfiler.h"
 #include "CrossNetRuntime/Internal/Primitives.h"
 #include "CrossNetRuntime/Internal/NewDelete.h"
 
@@ -30,6 +31,8 @@
 namespace CrossNetRuntime
 {
     class GCManager;
+    class GCParallelMarker;
+    class RegionScope;
 }
 
 namespace System
@@ -119,8 +122,13 @@ namespace System
 
         virtual System::Int32   GetHashCode()
         {
-            // Currently use the pointer as hashcode, note that when defragmentation will be used
-            // This won't work anymore...
+            // Currently use the pointer as hashcode
+            //  So the object must not be moved by the compaction anymore
+            //  (Only written the first time, the header of an object hashed repeatedly stays clean)
+            if ((m__AllFlags__ & __HASHED__) == 0)
+            {
+                m__AllFlags__ |= __HASHED__;
+            }
             return (System::Int32)(this);
         }
 
@@ -131,8 +139,11 @@ namespace System
             {
                 return (13);    // Returns 13 if the pointer is not set...
             }
-            // Currently use the pointer as hashcode, note that when defragmentation will be used
-            // This won't work anymore...
+            // Currently use the pointer as hashcode (see GetHashCode())
+            if ((obj->m__AllFlags__ & __HASHED__) == 0)
+            {
+                obj->m__AllFlags__ |= __HASHED__;
+            }
             return (System::Int32)(obj);
         }
 
@@ -167,7 +178,18 @@ namespace System
                 size = CrossNetRuntime::InterfaceMapper::GetSize(m__InterfaceMap__);
             }
             // Create an object with the same size
-            void * newObject = System::Object::operator new(size);
+            void * newObject;
+            if (::CrossNetRuntime::GCPointerFreeSpace::InPointerFreeSpace(this))
+            {
+                // The copy doesn't contain any managed pointer either
+                newObject = ::CrossNetRuntime::GCAllocator::AllocateClearPointerFree((int)size);
+            }
+            else
+            {
+                //  No need to clear it, everything is overwritten right after
+                newObject = ::CrossNetRuntime::GCAllocator::AllocateUncleared((int)size);
+            }
+            ::CrossNetRuntime::GCAllocationProfiler::OnAllocate(newObject, (int)size);
             // Copy byte by byte all the members
             __memcopy__(newObject, this, size);
             // Done, we can return...
@@ -296,6 +318,13 @@ namespace System
             // Do nothing as System.Object doesn't point to any other class
         }
 
+		// Same as __Trace__() but only the pointers stored in [start, end[ need to be traced
+		// Used for the dirty cards of the big objects (only the arrays trace less than the whole object)
+		virtual void			__TraceRange__(unsigned char currentMark, void * /* start */, void * /* end */)
+        {
+            __Trace__(currentMark);
+        }
+
 		// Locks the GC object - used for multi-threading application
 		// Another thread calling Lock() as well will wait until this object gets unlocked
 		// Lock() needs to be re-entrant (threadId is used to detech the thread currently carrying the lock).
@@ -314,6 +343,8 @@ namespace System
             __FIXED__       =   (1 << 9),
             __ARRAY__       =   (1 << 10),      //  We need to markup the array in a special manner for GC
             __STRING__      =   (1 << 11),      //  Same for the strings
+            __HASHED__      =   (1 << 12),      //  The address has been used as hash code, the compaction doesn't move it
+            __ALIGNED__     =   (1 << 13),      //  Array created with an alignment (see Array__G::__CreateAligned__()), the compaction doesn't move it
 
             __DYN_ALLOC__   =   __ARRAY__ | __STRING__,
         };
@@ -321,9 +352,33 @@ namespace System
         // Standard new / delete operators are protected so derived class can use it
         void * operator new(size_t size)
         {
-            void * buffer = ::CrossNetRuntime::GCAllocator::Allocate(size);
-            // We clear everything after System::Object instance
-            __memclear__((unsigned char *)(buffer) + sizeof(System::Object), size - sizeof(System::Object));
+            // Everything is cleared (the System::Object part will be set by the constructor anyway)
+            //  For large objects, the pages are already zeroed by the OS and are not cleared again
+            //  As this is inlined, with "new MyClass()" the size is a constant and the small allocation path is resolved at compile time
+            void * buffer = ::CrossNetRuntime::GCAllocator::AllocateClear(size);
+            // Only a decrement when the allocation is not sampled
+            ::CrossNetRuntime::GCAllocationProfiler::OnAllocate(buffer, (int)size);
+            return (buffer);
+        }
+
+        // Same as above, but the object is aligned on alignment bytes (power of 2, up to 4096)
+        //  Use it like this: new (64) MyHotObject() so the object starts on its own cache line
+        //  Only the start is aligned, the class should be padded to a multiple of the alignment to be fully isolated
+        //  Offset is used for arrays, so the items are aligned instead of the header
+        void * operator new(size_t size, int alignment, int offset = 0)
+        {
+            void * buffer = ::CrossNetRuntime::GCAllocator::AllocateClearAligned((int)size, alignment, offset);
+            ::CrossNetRuntime::GCAllocationProfiler::OnAllocate(buffer, (int)size);
+            return (buffer);
+        }
+
+        // Same as above, for the objects that don't contain any managed pointer (strings and arrays of base types)
+        //  Use it like this: new (::CrossNetRuntime::POINTER_FREE) ...
+        //  They go in the pointer-free space, the GC marks them without reading them
+        void * operator new(size_t size, ::CrossNetRuntime::PointerFreeTag /*tag*/)
+        {
+            void * buffer = ::CrossNetRuntime::GCAllocator::AllocateClearPointerFree((int)size);
+            ::CrossNetRuntime::GCAllocationProfiler::OnAllocate(buffer, (int)size);
             return (buffer);
         }
 
@@ -334,6 +389,16 @@ namespace System
             CROSSNET_FAIL("Should not call delete but the destructor...");
         }
 
+        // Only called if the constructor throws after an aligned new, the GC will collect the memory
+        void operator delete(void * /*buffer*/, int /*alignment*/, int /*offset*/)
+        {
+        }
+
+        // Same for the pointer-free new
+        void operator delete(void * /*buffer*/, ::CrossNetRuntime::PointerFreeTag /*tag*/)
+        {
+        }
+
     private:
         // Private and declare but not defined as we should never use this...
         void * operator new[](size_t size);
@@ -352,6 +417,10 @@ namespace System
 
 		// GCManager is friend so it can call the protected destructor and private members
         friend class ::CrossNetRuntime::GCManager;
+        // RegionScope collects the objects of its arena
+        friend class ::CrossNetRuntime::RegionScope;
+        // GCParallelMarker traces the objects on the worker threads
+        friend class ::CrossNetRuntime::GCParallelMarker;
     };
 }
 
@@ -284,6 +284,13 @@ namespace System
         // Specific version where the size of the string is known
         static String * __CreateWithLengthKnown__(System::Char * text, System::Int32 length);
 
+        // Creates count substrings of this string in one allocation and stores them in result (starting at resultIndex)
+        void __CreateSubstrings__(const System::Int32 * starts, const System::Int32 * lengths, int count,
+                                    System::Array__G<System::String *> * result, int resultIndex);
+
+        // Number of substrings created at once by Split()
+        static const int SPLIT_BATCH_SIZE = 32;
+
         class Wrapper__IComparable : public IComparable
         {
         public:
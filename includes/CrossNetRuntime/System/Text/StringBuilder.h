@@ -101,6 +101,9 @@ namespace System
 
             System::Int32   EnsureCapacity(System::Int32 capacity);
 
+            // Frees the buffer when the GC collects the builder
+            virtual ~StringBuilder();
+
         private:
             StringBuilder();
             void    Reserve(System::Int32 newSize);
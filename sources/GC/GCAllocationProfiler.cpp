@@ -0,0 +1,365 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CrossNetRuntime/GC/GCAllocationProfiler.h"
+#include "CrossNetRuntime/GC/GCManager.h"
+#include "CrossNetRuntime/System/Object.h"
+#include "CrossNetRuntime/InterfaceMapper.h"
+#include "CrossNetRuntime/Assert.h"
+
+// For the interlocked operations
+#include <intrin.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <execinfo.h>
+#endif
+
+namespace CrossNetRuntime
+{
+
+GCAllocationProfiler::SampleEntry * volatile            GCAllocationProfiler::sTable = NULL;
+volatile long                                           GCAllocationProfiler::sSampleInterval = 0;
+volatile long                                           GCAllocationProfiler::sNumDroppedSamples = 0;
+CROSSNET_THREAD_LOCAL int                               GCAllocationProfiler::sBytesUntilSample = 0;
+CROSSNET_THREAD_LOCAL GCAllocationProfiler::PendingSample   GCAllocationProfiler::sPendingSample;
+
+void GCAllocationProfiler::Setup(const ::CrossNetRuntime::InitOptions & options)
+{
+    sSampleInterval = 0;
+    sNumDroppedSamples = 0;
+    sTable = NULL;
+    if (options.mAllocationSampleInterval > 0)
+    {
+        SetSampleInterval(options.mAllocationSampleInterval);
+    }
+}
+
+void GCAllocationProfiler::Teardown()
+{
+    sSampleInterval = 0;
+    if (sTable != NULL)
+    {
+        ::CrossNetRuntime::GetOptions().mUnmanagedFreeCallback(sTable);
+        sTable = NULL;
+    }
+}
+
+void GCAllocationProfiler::SetSampleInterval(int interval)
+{
+    if ((interval > 0) && (sTable == NULL))
+    {
+        // The table is only created the first time the sampling is turned on
+        CreateTable();
+    }
+    // The threads will see the new interval at their next sample
+    //  (Or after SAMPLING_OFF_CHECK_INTERVAL bytes if the sampling was off)
+    _InterlockedExchange(&sSampleInterval, interval);
+}
+
+int GCAllocationProfiler::GetSampleInterval()
+{
+    return (sSampleInterval);
+}
+
+void GCAllocationProfiler::CreateTable()
+{
+    int size = TABLE_SIZE * sizeof(SampleEntry);
+    SampleEntry * table = static_cast<SampleEntry *>(::CrossNetRuntime::GetOptions().mUnmanagedAllocateCallback(size));
+    __memclear__(table, size);
+    sTable = table;
+}
+
+void GCAllocationProfiler::Reset()
+{
+    // Must not be called while other threads are recording samples
+    if (sTable != NULL)
+    {
+        __memclear__(sTable, TABLE_SIZE * sizeof(SampleEntry));
+    }
+    sNumDroppedSamples = 0;
+}
+
+void GCAllocationProfiler::SampleSlow(void * buffer, int size)
+{
+    PendingSample & pending = sPendingSample;
+    int remaining = sBytesUntilSample;
+
+    if (pending.mObject != NULL)
+    {
+        // The countdown was set to zero so we come here right after a sample
+        //  The previous object has been constructed, we can get its type
+        remaining = pending.mBytesUntilSample - size;
+        ResolvePendingSample();
+        if (remaining >= 0)
+        {
+            // Not the time to sample yet
+            sBytesUntilSample = remaining;
+            return;
+        }
+    }
+
+    int interval = sSampleInterval;
+    if ((interval == 0) || (sTable == NULL))
+    {
+        // Sampling is off, check again later
+        sBytesUntilSample = SAMPLING_OFF_CHECK_INTERVAL;
+        return;
+    }
+
+    // Sample this allocation, it stands for all the bytes allocated since the previous sample
+    pending.mObject = buffer;
+    pending.mBytes = (size > interval) ? size : interval;
+    pending.mNumCollections = GCManager::GetNumCollections();
+    pending.mDepth = CaptureStack(pending.mStack, MAX_STACK_DEPTH);
+
+    // Carry over what was allocated past the interval, so on average we sample every interval bytes
+    int next = interval + remaining;
+    if (next < 0)
+    {
+        next = 0;
+    }
+    pending.mBytesUntilSample = next;
+
+    // The type will be resolved at the next allocation of this thread
+    sBytesUntilSample = 0;
+}
+
+void GCAllocationProfiler::ResolvePendingSample()
+{
+    PendingSample & pending = sPendingSample;
+    if (pending.mObject == NULL)
+    {
+        return;
+    }
+
+    void * * interfaceMap = NULL;
+    if (pending.mNumCollections == GCManager::GetNumCollections())
+    {
+        // No collection since the allocation, so the object is still there
+        void * * objectInterfaceMap = static_cast<System::Object *>(pending.mObject)->m__InterfaceMap__;
+        if ((objectInterfaceMap != NULL) && InterfaceMapper::InInterfaceMapSpace(objectInterfaceMap))
+        {
+            interfaceMap = objectInterfaceMap;
+        }
+        // Otherwise the object is not constructed yet, the type stays unknown
+    }
+
+    Record(interfaceMap, pending);
+    pending.mObject = NULL;
+    sBytesUntilSample = pending.mBytesUntilSample;
+}
+
+int GCAllocationProfiler::CaptureStack(void * * stack, int maxDepth)
+{
+#ifdef _WIN32
+    return (RtlCaptureStackBackTrace(NUM_SKIPPED_FRAMES, maxDepth, stack, NULL));
+#else
+    // backtrace() can't skip the first frames
+    void * frames[MAX_STACK_DEPTH + NUM_SKIPPED_FRAMES];
+    int depth = backtrace(frames, maxDepth + NUM_SKIPPED_FRAMES) - NUM_SKIPPED_FRAMES;
+    if (depth <= 0)
+    {
+        return (0);
+    }
+    memcpy(stack, frames + NUM_SKIPPED_FRAMES, depth * sizeof(void *));
+    return (depth);
+#endif
+}
+
+unsigned int GCAllocationProfiler::Hash(void * * interfaceMap, void * const * stack, int depth)
+{
+    // FNV-1a on the addresses
+    unsigned int hash = 2166136261U;
+    hash = (hash ^ (unsigned int)(size_t)interfaceMap) * 16777619U;
+    for (int i = 0 ; i < depth ; ++i)
+    {
+        hash = (hash ^ (unsigned int)(size_t)stack[i]) * 16777619U;
+    }
+    return (hash);
+}
+
+void GCAllocationProfiler::Record(void * * interfaceMap, const PendingSample & sample)
+{
+    SampleEntry * table = sTable;
+    if (table == NULL)
+    {
+        return;
+    }
+
+    // Open addressing, an entry is never removed (except by Reset())
+    //  The first thread that finds an empty entry claims it, the other ones wait until it's filled
+    unsigned int hash = Hash(interfaceMap, sample.mStack, sample.mDepth);
+    for (int i = 0 ; i < TABLE_SIZE ; ++i)
+    {
+        SampleEntry * entry = &table[(hash + i) & (TABLE_SIZE - 1)];
+        long state = entry->mState;
+        if (state == ENTRY_EMPTY)
+        {
+            if (_InterlockedCompareExchange(&entry->mState, ENTRY_FILLING, ENTRY_EMPTY) == ENTRY_EMPTY)
+            {
+                entry->mHash = hash;
+                entry->mInterfaceMap = interfaceMap;
+                entry->mDepth = sample.mDepth;
+                memcpy(entry->mStack, sample.mStack, sample.mDepth * sizeof(void *));
+                _InterlockedExchange(&entry->mState, ENTRY_READY);
+            }
+            state = entry->mState;
+        }
+        while (state == ENTRY_FILLING)
+        {
+            _mm_pause();
+            state = entry->mState;
+        }
+
+        if ((entry->mHash == hash) && (entry->mInterfaceMap == interfaceMap) && (entry->mDepth == sample.mDepth)
+            && (memcmp(entry->mStack, sample.mStack, sample.mDepth * sizeof(void *)) == 0))
+        {
+            _InterlockedIncrement(&entry->mCount);
+            AtomicAdd64(&entry->mBytes, sample.mBytes);
+            return;
+        }
+        // Collision, look at the next entry
+    }
+
+    // The table is full
+    _InterlockedIncrement(&sNumDroppedSamples);
+}
+
+void GCAllocationProfiler::AtomicAdd64(volatile long long * value, long long delta)
+{
+    // There is no 64 bits interlocked add on x86
+    long long oldValue;
+    do
+    {
+        oldValue = *value;
+    }
+    while (_InterlockedCompareExchange64(value, oldValue + delta, oldValue) != oldValue);
+}
+
+static void PrintAddress(FILE * file, const char * prefix, void * address)
+{
+    fprintf(file, "%s0x%llx", prefix, (unsigned long long)(size_t)address);
+}
+
+void GCAllocationProfiler::DumpCollapsedStacks(FILE * file, TypeNameFunctionPointer typeName)
+{
+    SampleEntry * table = sTable;
+    if (table == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0 ; i < TABLE_SIZE ; ++i)
+    {
+        SampleEntry * entry = &table[i];
+        if (entry->mState != ENTRY_READY)
+        {
+            continue;
+        }
+
+        // Outermost frame first
+        for (int j = entry->mDepth - 1 ; j >= 0 ; --j)
+        {
+            PrintAddress(file, "", entry->mStack[j]);
+            fprintf(file, ";");
+        }
+
+        // The type is the leaf
+        void * * interfaceMap = entry->mInterfaceMap;
+        if (interfaceMap == NULL)
+        {
+            fprintf(file, "<unknown type>");
+        }
+        else
+        {
+            int typeId = InterfaceMapper::GetId(interfaceMap);
+            const char * name = NULL;
+            if (typeName != NULL)
+            {
+                name = typeName(InterfaceMapper::GetType(interfaceMap), typeId);
+            }
+            if (name != NULL)
+            {
+                fprintf(file, "%s", name);
+            }
+            else
+            {
+                fprintf(file, "Type#%d", typeId);
+            }
+        }
+        fprintf(file, " %lld\n", (long long)entry->mBytes);
+    }
+}
+
+void GCAllocationProfiler::DumpPprof(FILE * file)
+{
+    SampleEntry * table = sTable;
+    if (table == NULL)
+    {
+        return;
+    }
+
+    long totalCount = 0;
+    long long totalBytes = 0;
+    for (int i = 0 ; i < TABLE_SIZE ; ++i)
+    {
+        if (table[i].mState == ENTRY_READY)
+        {
+            totalCount += table[i].mCount;
+            totalBytes += table[i].mBytes;
+        }
+    }
+
+    // The in-use memory is not tracked (we don't know when the objects are collected)
+    //  So the allocated values are written for both in-use and allocated
+    //  "heapprofile" tells pprof that the values are already scaled (no unsampling)
+    fprintf(file, "heap profile: %ld: %lld [%ld: %lld] @ heapprofile\n", totalCount, totalBytes, totalCount, totalBytes);
+    for (int i = 0 ; i < TABLE_SIZE ; ++i)
+    {
+        SampleEntry * entry = &table[i];
+        if (entry->mState != ENTRY_READY)
+        {
+            continue;
+        }
+        fprintf(file, "%ld: %lld [%ld: %lld] @", (long)entry->mCount, (long long)entry->mBytes, (long)entry->mCount, (long long)entry->mBytes);
+        for (int j = 0 ; j < entry->mDepth ; ++j)
+        {
+            PrintAddress(file, " ", entry->mStack[j]);
+        }
+        fprintf(file, "\n");
+    }
+
+#ifndef _WIN32
+    // pprof needs the mapping to symbolize the addresses
+    fprintf(file, "\nMAPPED_LIBRARIES:\n");
+    FILE * maps = fopen("/proc/self/maps", "r");
+    if (maps != NULL)
+    {
+        char buffer[4096];
+        size_t numRead;
+        while ((numRead = fread(buffer, 1, sizeof(buffer), maps)) > 0)
+        {
+            fwrite(buffer, 1, numRead, file);
+        }
+        fclose(maps);
+    }
+#endif
+}
+
+}
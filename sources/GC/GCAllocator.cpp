@@ -15,43 +15,512 @@
 
 #include "CrossNetRuntime/GC/GCAllocator.h"
 #include "CrossNetRuntime/GC/GCManager.h"
+#include "CrossNetRuntime/GC/GCVirtualMemory.h"
+#include "CrossNetRuntime/GC/GCThread.h"
+#include "CrossNetRuntime/GC/RegionScope.h"
 #include "CrossNetRuntime/Assert.h"
 
+// For the non-temporal stores
+#include <emmintrin.h>
+
 namespace CrossNetRuntime
 {
 
+unsigned char *                 GCAllocator::sHeapBase = NULL;
 void *                          GCAllocator::sEndMainBuffer = NULL;
 unsigned char *                 GCAllocator::sCurrentAllocPointer = NULL;
-GCAllocator::AllocStructure *   GCAllocator::sSmallBin[SMALL_SIZE_BIN / ALIGNMENT];
-GCAllocator::AllocStructure *   GCAllocator::sMediumBin[32];
-GCAllocator::AllocStructure *   GCAllocator::sCurrentMediumPointer = NULL;
-int                             GCAllocator::sCurrentMediumSize = 0;
+GCAllocator::AllocStructure *   GCAllocator::sSmallBin[SMALL_BIN_COUNT];
+unsigned int                    GCAllocator::sSmallBinMask[SMALL_BIN_MASK_SIZE];
+GCAllocator::AllocStructure *   GCAllocator::sMediumBin[MEDIUM_FIRST_LEVEL_COUNT][MEDIUM_SECOND_LEVEL_COUNT];
+unsigned int                    GCAllocator::sMediumFirstLevelMask = 0;
+unsigned int                    GCAllocator::sMediumSecondLevelMask[MEDIUM_FIRST_LEVEL_COUNT];
+
+unsigned char *                 GCAllocator::sEndReservedHeap = NULL;
+unsigned char *                 GCAllocator::sSegmentStates = NULL;
+int                             GCAllocator::sSegmentShift = 0;
+int                             GCAllocator::sSegmentSize = 0;
+int                             GCAllocator::sMinCommittedSize = 0;
+void *                          GCAllocator::sReservation = NULL;
+size_t                          GCAllocator::sReservationSize = 0;
+HeapBacking                     GCAllocator::sHeapBacking = HB_LAZY_COMMIT;
+bool                            GCAllocator::sZeroFreeMemory = false;
+bool                            GCAllocator::sExternalObjects = false;
+bool                            GCAllocator::sRecordAllocationStarts = false;
+GCBitmap                        GCAllocator::sAllocationStartBitmap;
+volatile long                   GCAllocator::sMaxObjectSize = 0;
+GCBitmap                        GCAllocator::sFreeBlockBitmap;
+
+int                                         GCAllocator::sThreadAllocBufferSize = 0;
+GCAllocator::ThreadAllocBuffer * volatile   GCAllocator::sAllThreadAllocBuffers = NULL;
+volatile long long                          GCAllocator::sThreadAllocBufferPool = 0;
+volatile long                               GCAllocator::sAllocatorLock = 0;
+CROSSNET_THREAD_LOCAL GCAllocator::ThreadAllocBuffer *  GCAllocator::sThreadAllocBuffer = NULL;
+CROSSNET_THREAD_LOCAL int                               GCAllocator::sLockDepth = 0;
 
 void GCAllocator::Setup(const ::CrossNetRuntime::InitOptions & options)
 {
     CROSSNET_ASSERT(IsAligned(sizeof(AllocStructure)), "");
-    CROSSNET_ASSERT(IsAligned((int)options.mMainBuffer), "");
 
-    // Set the allocated buffer to a specific pattern (to detect bugs earlier)
-    __memset__(options.mMainBuffer, 0xA5, options.mMainBufferSize);
+    sZeroFreeMemory = options.mZeroFreeMemory;
+
+    if (options.mMainBuffer != NULL)
+    {
+        CROSSNET_ASSERT(IsAligned((int)options.mMainBuffer), "");
+
+        if (sZeroFreeMemory)
+        {
+            // The allocation relies on the free memory being zeroed
+            __memclear__(options.mMainBuffer, options.mMainBufferSize);
+        }
+        else
+        {
+#if _DEBUG
+            // Set the allocated buffer to a specific pattern (to detect bugs earlier)
+            //  Only in debug, that's a lot of memory bandwidth for nothing otherwise
+            __memset__(options.mMainBuffer, 0xA5, options.mMainBufferSize);
+#endif
+        }
 
-    sCurrentAllocPointer = static_cast<unsigned char *>(options.mMainBuffer);
-    sEndMainBuffer = sCurrentAllocPointer + options.mMainBufferSize;
+        sHeapBase = static_cast<unsigned char *>(options.mMainBuffer);
+        sCurrentAllocPointer = sHeapBase;
+        sEndMainBuffer = sCurrentAllocPointer + options.mMainBufferSize;
+        sEndReservedHeap = static_cast<unsigned char *>(sEndMainBuffer);
+        sSegmentStates = NULL;
+    }
+    else
+    {
+        // No pattern here, that would commit the whole heap...
+        SetupGrowableHeap(options);
+    }
 
+    // Like the allocation starts, only the pages of the bitmap used take physical memory
+    sFreeBlockBitmap.Setup(sHeapBase, sEndReservedHeap - sHeapBase);
     ClearBins();
+
+    // The sweep with the marks in the headers doesn't forget the starts of the dead objects
+    //  And an allocator overriden by the user doesn't record them
+#if !defined(CN_GC_HEADER_MARK) && !defined(CN_GC_NO_DEFAULT_ALLOCATE)
+    sRecordAllocationStarts = options.mExactInteriorPointers && (options.mPreciseStackRoots == false);
+#else
+    sRecordAllocationStarts = false;
+#endif
+    sMaxObjectSize = SMALL_SIZE_BIN;
+    if (sRecordAllocationStarts)
+    {
+        // Covers the whole address space the main buffer can use, only the pages used take physical memory
+        sAllocationStartBitmap.Setup(sHeapBase, sEndReservedHeap - sHeapBase);
+    }
+
+    GCLargeObjectSpace::Setup(options);
+    GCPointerFreeSpace::Setup(options);
+
+    sThreadAllocBufferSize = 0;
+    if (options.mThreadAllocBufferSize != 0)
+    {
+        // A thread allocation buffer must at least be able to contain a few small objects
+        int threadAllocBufferSize = Align(options.mThreadAllocBufferSize);
+        if (threadAllocBufferSize < 4 * SMALL_SIZE_BIN)
+        {
+            threadAllocBufferSize = 4 * SMALL_SIZE_BIN;
+        }
+        sThreadAllocBufferSize = threadAllocBufferSize;
+    }
+    sThreadAllocBufferPool = 0;
 }
 
 void GCAllocator::Teardown()
 {
     // For the moment doesn't do anything
     //  We should deallocate user allocated memory here...
+
+    GCLargeObjectSpace::Teardown();
+    GCPointerFreeSpace::Teardown();
+    sAllocationStartBitmap.Teardown();
+    sRecordAllocationStarts = false;
+    sFreeBlockBitmap.Teardown();
+
+    if (sReservation != NULL)
+    {
+        // But we can give back the memory of the growable heap
+        GCVirtualMemory::Release(sReservation, sReservationSize);
+        ::CrossNetRuntime::GetOptions().mUnmanagedFreeCallback(sSegmentStates);
+        sReservation = NULL;
+        sSegmentStates = NULL;
+    }
+}
+
+void GCAllocator::SetupGrowableHeap(const ::CrossNetRuntime::InitOptions & options)
+{
+    // The segment size must be a power of 2 and a multiple of the page size
+    int segmentSize = options.mHeapSegmentSize;
+    if (segmentSize == 0)
+    {
+        segmentSize = 1024 * 1024;
+    }
+    if (segmentSize < GCVirtualMemory::GetPageSize())
+    {
+        segmentSize = GCVirtualMemory::GetPageSize();
+    }
+    segmentSize = NextPowerOf2(segmentSize);
+    sSegmentSize = segmentSize;
+    sSegmentShift = TopBit(segmentSize) - 1;
+    CROSSNET_ASSERT((1 << sSegmentShift) == segmentSize, "");
+
+    int numSegments = (options.mMaxHeapSize + segmentSize - 1) / segmentSize;
+    CROSSNET_FATAL(numSegments > 0, "mMaxHeapSize must be set when mMainBuffer is NULL!");
+
+    // Reserve one more segment so the heap base can be aligned on the segment size
+    //  That way a segment boundary can be detected with a simple mask
+    size_t heapSize = (size_t)numSegments << sSegmentShift;
+    sReservationSize = heapSize + segmentSize;
+    if (options.mIncrementalCollection || options.mGenerationalCollection)
+    {
+        // The incremental marking and the young collections need to know which pages have been written to
+        sReservation = GCVirtualMemory::ReserveWatched(sReservationSize);
+    }
+    else
+    {
+        sReservation = GCVirtualMemory::Reserve(sReservationSize);
+    }
+    CROSSNET_FATAL(sReservation != NULL, "Could not reserve the address space for the heap!");
+
+    sHeapBase = (unsigned char *)(((size_t)sReservation + segmentSize - 1) & ~(size_t)(segmentSize - 1));
+    sEndReservedHeap = sHeapBase + heapSize;
+    sHeapBacking = options.mHeapBacking;
+    if (sHeapBacking == HB_HUGE_PAGES)
+    {
+        GCVirtualMemory::AdviseHugePages(sHeapBase, heapSize);
+    }
+
+    sSegmentStates = static_cast<unsigned char *>(options.mUnmanagedAllocateCallback(numSegments));
+    __memclear__(sSegmentStates, numSegments);      // All SEGMENT_COMMITTED (the ones after sEndMainBuffer are simply not used yet)
+
+    // Commit the initial size (at least one segment)
+    int initialSize = (options.mMainBufferSize + segmentSize - 1) & -segmentSize;
+    if (initialSize == 0)
+    {
+        initialSize = segmentSize;
+    }
+    if (sHeapBase + initialSize > sEndReservedHeap)
+    {
+        initialSize = (int)heapSize;
+    }
+    sMinCommittedSize = initialSize;
+
+    sCurrentAllocPointer = sHeapBase;
+    sEndMainBuffer = sHeapBase;
+    GrowHeap(initialSize - ALIGNMENT);
 }
 
 #ifndef CN_GC_NO_DEFAULT_ALLOCATE
 // This allocator has not been overriden by the user, so let's implement it here
 void * GCAllocator::Allocate(int size)
 {
-    return (Allocate(size, false));
+    if (size <= SMALL_SIZE_BIN)
+    {
+        // Same path as the inlined allocations
+        return (RecordAllocationStart(AllocateSmallFast(Align(size))));
+    }
+
+    // When the thread allocation buffers are enabled, bigger objects can still fit in the buffer of the current thread
+    //  Bump allocation, no lock, no interlocked operation
+    //  When the buffers are disabled sThreadAllocBuffer is always NULL
+    ThreadAllocBuffer * buffer = sThreadAllocBuffer;
+    if (buffer != NULL)
+    {
+        void * block = BumpThreadAllocBuffer(buffer, Align(size));
+        if (block != NULL)
+        {
+            //  Cost:   2 tests, 2 operations, 3 reads, 3 writes
+            return (RecordBigAllocationStart(block, Align(size)));
+        }
+    }
+    return (RecordBigAllocationStart(AllocateSlow(size, buffer), Align(size)));
+}
+
+void * GCAllocator::AllocateSlow(int size, ThreadAllocBuffer * buffer)
+{
+    if (buffer != NULL)
+    {
+        // The object doesn't fit in the buffer
+        buffer->mBypassed = true;
+    }
+
+    if (sThreadAllocBufferSize == 0)
+    {
+        // Single threaded allocator, nothing to protect
+        //  The small allocations consumed the budget in the inlined path already
+        if (size > SMALL_SIZE_BIN)
+        {
+            GCPolicy::ConsumeBudget(Align(size));
+        }
+        // We might be here because the budget is exhausted
+        GCPolicy::CollectIfNeeded();
+        return (Allocate(size, false));
+    }
+
+    if (buffer == NULL)
+    {
+        // First allocation for this thread, from now on the collections scan its stack
+        buffer = AttachThread();
+    }
+
+    if (size <= SMALL_SIZE_BIN)
+    {
+        // Small objects always go in the thread allocation buffer
+        // The whole buffer consumes the budget
+        if (GCPolicy::ConsumeBudgetShared(sThreadAllocBufferSize) == false)
+        {
+            GCPolicy::CollectIfNeeded();
+        }
+        void * result = RefillThreadAllocBuffer(buffer, Align(size));
+        if (result != NULL)
+        {
+            return (result);
+        }
+        // No buffer could be allocated (even after GC), try the standard allocation as last resort
+        //  It might still succeed with the user callback...
+    }
+
+    // Bigger sizes are shared between threads, they have to be protected
+    Lock();
+    if (GCPolicy::ConsumeBudgetShared(Align(size)) == false)
+    {
+        GCPolicy::CollectIfNeeded();
+    }
+    void * result = Allocate(size, false);
+    Unlock();
+    return (result);
+}
+
+void * GCAllocator::AllocateLarge(int size)
+{
+    AttachCurrentThread();
+    MarkBufferBypassed();
+
+    // The large object space is shared between threads
+    Lock();
+
+    if (GCPolicy::ConsumeBudgetShared(size) == false)
+    {
+        GCPolicy::CollectIfNeeded();
+    }
+    void * result = GCLargeObjectSpace::Allocate(size);
+    if (result != NULL)
+    {
+        // Alive until the end of the incremental marking (if any)
+        GCManager::OnLargeObjectAllocated(result);
+    }
+    else
+    {
+        // Not enough contiguous pages, collect and try again
+        //  (The collection finishes the incremental one, if any)
+        GCManager::Collect(GCManager::MAX_GENERATION, false);
+        result = GCLargeObjectSpace::Allocate(size);
+        if (result == NULL)
+        {
+            // Still not enough, fall back to the main buffer
+            //  The memory there is not zeroed
+            result = Allocate(size, false);
+            if (result != NULL)
+            {
+                __memclear__(result, size);
+                RecordBigAllocationStart(result, Align(size));
+            }
+        }
+    }
+
+    Unlock();
+    return (result);
+}
+
+void * GCAllocator::AllocatePointerFree(int size)
+{
+    // No need to tell the region of this thread (if any), this object can't point to its arena
+
+    // Bump allocation in the run of the current thread, no lock
+    void * result = GCPointerFreeSpace::BumpThreadCursor(size);
+    if (result != NULL)
+    {
+        return (result);
+    }
+
+    // The run is empty, take a new one in the pointer-free space (shared between threads)
+    AttachCurrentThread();
+    Lock();
+
+    // The whole run consumes the budget, like a thread allocation buffer
+    if (GCPolicy::ConsumeBudgetShared(GCPointerFreeSpace::GetRunSize(size)) == false)
+    {
+        GCPolicy::CollectIfNeeded();
+    }
+    // During an incremental marking the run is allocated black, the sweep at the end of the marking keeps its objects
+    //  (The unused slots are unmarked when the run is retired)
+    result = GCPointerFreeSpace::RefillThreadCursor(size, GCManager::IsIncrementalMarking());
+
+    Unlock();
+
+    if (result == NULL)
+    {
+        // No slot left for this size, fall back to the main buffer
+        //  No collection is forced for that, the budget triggers it as for the other objects
+        result = AllocateClear(size);
+    }
+    return (result);
+}
+
+bool GCAllocator::AllocateBatchClear(const int * sizes, int count, void * * objects)
+{
+    if (count <= 0)
+    {
+        return (count == 0);
+    }
+
+    int first = 0;
+    while (first < count)
+    {
+        if (GCLargeObjectSpace::IsLargeObject(sizes[first]))
+        {
+            // Big enough to be a large object by itself, it gets its own pages
+            void * large = AllocateLarge(sizes[first]);
+            if (large == NULL)
+            {
+                FreeBatch(sizes, first, objects);
+                return (false);
+            }
+            objects[first++] = large;
+            continue;
+        }
+
+        // Take as many blocks as possible in the run, without reaching the large object threshold
+        //  (Otherwise a big object made of small ones would bypass the large object space)
+        long long runSize = 0;
+        int last = first;
+        while (last < count)
+        {
+            long long newSize = runSize + Align(sizes[last]);
+            if ((newSize > 0x7fffffff) || GCLargeObjectSpace::IsLargeObject((int)newSize))
+            {
+                break;
+            }
+            runSize = newSize;
+            ++last;
+        }
+        CROSSNET_ASSERT(last > first, "");
+
+        // When it fits, it's simply one bump in the thread allocation buffer or at the end of the main buffer
+        unsigned char * run = static_cast<unsigned char *>(Allocate((int)runSize));
+        if (run == NULL)
+        {
+            FreeBatch(sizes, first, objects);
+            return (false);
+        }
+        // With the free memory kept zeroed, the inside of the run is already zero
+        ClearAllocatedBlock(run, (int)runSize);
+
+        for ( ; first < last ; ++first)
+        {
+            objects[first] = RecordAllocationStart(run);
+            run += Align(sizes[first]);
+        }
+    }
+    return (true);
+}
+
+void GCAllocator::FreeBatch(const int * sizes, int count, void * * objects)
+{
+    // Gives back the blocks already allocated by AllocateBatchClear() when the next run can't be allocated
+    for (int i = 0 ; i < count ; ++i)
+    {
+        void * object = objects[i];
+        if (GCLargeObjectSpace::IsObjectStart(object))
+        {
+            Lock();
+            GCLargeObjectSpace::Free(object);
+            Unlock();
+        }
+        else if (InCurrentAllocationSpace(object))
+        {
+            Free(object, sizes[i]);
+        }
+        // Otherwise the memory has been given by the user callback, we can't free it
+    }
+}
+
+void * GCAllocator::AllocateClearAligned(int size, int alignment, int offset)
+{
+    CROSSNET_ASSERT((alignment & (alignment - 1)) == 0, "The alignment must be a power of 2!");
+    CROSSNET_ASSERT(alignment <= MAX_ALIGNMENT, "The alignment can't be bigger than a page!");
+    CROSSNET_ASSERT(IsAligned(offset), "The offset must keep the object aligned on 16 bytes!");
+
+    if (alignment <= ALIGNMENT)
+    {
+        // Every allocation has this alignment already
+        return (AllocateClear(size));
+    }
+    MarkBufferBypassed();
+
+    if (GCLargeObjectSpace::IsLargeObject(size) && ((offset & (alignment - 1)) == 0))
+    {
+        // Large objects start on a page, that's aligned enough
+        //  Otherwise (for example an array aligned on 64 bytes), the object goes in the main buffer
+        void * result = AllocateLarge(size);
+        if (((size_t)result + offset) & (alignment - 1))
+        {
+            // The large object space was full and the object has been allocated in the main buffer
+            //  This is rare enough to just allocate again with the padding
+            Free(result, size);
+        }
+        else
+        {
+            return (result);
+        }
+    }
+
+    // Allocate enough to find an aligned address in the block whatever its position
+    //  The aligned sizes are multiple of 16, so the padding before and after are either empty or big enough for a free block
+    int alignedSize = Align(size);
+    int paddedSize = alignedSize + alignment - ALIGNMENT;
+
+    // Aligned allocations don't go in the thread allocation buffers, they are rare enough
+    Lock();
+    if (GCPolicy::ConsumeBudgetShared(paddedSize) == false)
+    {
+        GCPolicy::CollectIfNeeded();
+    }
+    unsigned char * block = static_cast<unsigned char *>(Allocate(paddedSize, false));
+    if (block == NULL)
+    {
+        Unlock();
+        return (NULL);
+    }
+
+    size_t alignedAddress = ((size_t)(block + offset) + alignment - 1) & ~(size_t)(alignment - 1);
+    unsigned char * result = reinterpret_cast<unsigned char *>(alignedAddress) - offset;
+    int headSize = (int)(result - block);
+    int tailSize = paddedSize - headSize - alignedSize;
+    CROSSNET_ASSERT(headSize >= 0, "");
+    CROSSNET_ASSERT(tailSize >= 0, "");
+
+    if (InCurrentAllocationSpace(block))
+    {
+        // The object starts in the middle of the block, its header must not look free either
+        reinterpret_cast<AllocStructure *>(result)->mMarker = 0;
+        if (tailSize > 0)
+        {
+            InternalFree(reinterpret_cast<AllocStructure *>(result + alignedSize), tailSize);
+        }
+        if (headSize > 0)
+        {
+            // This one can also coalesce with the free block before
+            Free(block, headSize);
+        }
+    }
+    // Otherwise the memory has been given by the user callback, we can't free a part of it
+    Unlock();
+
+    __memclear__(result, size);
+    return (RecordBigAllocationStart(result, alignedSize));
 }
 
 void * GCAllocator::Allocate(int size, bool afterGC)
@@ -83,51 +552,16 @@ void * GCAllocator::Allocate(int size, bool afterGC)
         // By doing this we reuse memory that has been allocated and freed before
         // This reduces memory consumption and fragmentation as well
 
-/*
-        int indexSmallBin = size >> ALIGNMENT_SHIFT;
-        ptr = sSmallBin[indexSmallBin];
-        if (ptr != NULL)
-        {
-            sSmallBin[indexSmallBin] = ptr->mNext;
-            // Done!
-            // Cost:    2 tests, 1 operation, 2 reads, 1 write
-            return (ptr);
-        }
-*/
-
         int alignedSize = Align(size);
+        int indexSmallBin = alignedSize >> ALIGNMENT_SHIFT;
+        CROSSNET_ASSERT(indexSmallBin > 0, "");
+        CROSSNET_ASSERT(indexSmallBin < SMALL_BIN_COUNT, "");
 
-        // Special optimization for small size
-        ptr = sCurrentMediumPointer;
-        if (ptr != NULL)
+        if (sSmallBin[indexSmallBin] != NULL)
         {
-            CROSSNET_ASSERT(IsAligned(ptr), "");
-            CROSSNET_ASSERT(IsAligned(sCurrentMediumSize), "");
-
-            // Good news, there is already a cached medium size
-//          if (sCurrentMediumSize >= size)     // For whatever reason, this is actually crashing... Use the bigger size,
-                                                //  this should not change tremendously the performance...
-                                                //  TODO:   Investigate this...
-            if (sCurrentMediumSize >= SMALL_SIZE_BIN)
-            {
-                CROSSNET_ASSERT(sCurrentMediumSize >= alignedSize, "");
-                // And the buffer is big enough...
-                // ptr is going to be the allocated pointer
-
-                // Note that when we use the medium buffer cache, we are not reading / writing anything more
-                // I.e. we are not pushing free blocks all over the place, nor poping / pushing in the medium size bin
-                // Or even looking iteratively at each medium size bins
-                sCurrentMediumPointer = (AllocStructure *)(((unsigned char *)ptr) + alignedSize);
-                sCurrentMediumSize -= alignedSize;
-
-                return (ptr);
-            }
-
-            // The buffer cannot be used anymore (smaller than the asked size)
-            // It certainly is a small size buffer now too ;)
-
-            // Clear the cache and look at the next medium buffer...
-            ReconcileMediumCache();
+            // Done!
+            // Cost:    3 tests, 2 operations, 3 reads, 1 write
+            return (PopSmallBin(indexSmallBin));
         }
 
 {
@@ -138,53 +572,47 @@ void * GCAllocator::Allocate(int size, bool afterGC)
     {
         // We have enough memory to allocate
         sCurrentAllocPointer = endAlloc;
+        // A free block given back to the bump allocation leaves its header
+        reinterpret_cast<AllocStructure *>(currentAlloc)->mMarker = 0;
 
         // Second most common case (if we are not running out of memory quickly)
-        //  Cost if size > SMALL_SIZE_BIN:  2 tests, 2 operations, 1 read, 1 write
+        //  Cost if size > SMALL_SIZE_BIN:  2 tests, 2 operations, 1 read, 2 writes
         //
-        //  Cost if size <= SMALL_SIZE_BIN: 3 tests, 3 operations, 2 reads, 1 write
+        //  Cost if size <= SMALL_SIZE_BIN: 3 tests, 3 operations, 2 reads, 2 writes
         return (currentAlloc);
     }
 }
 
-        // A bit more optimized for small size...
-        int topBit = SMALL_SIZE_SHIFT;
-        do
+        // No exact size and no more room at the end of the buffer
+        //  Look at the next non-empty small size class (the occupancy mask makes this O(1))
+        //  And split the block, the remainder goes back to its corresponding small bin
+        indexSmallBin = FindSmallBin(indexSmallBin + 1);
+        if (indexSmallBin >= 0)
         {
-            ptr = sMediumBin[topBit];
-            if (ptr != NULL)
-            {
-                // We found a block that should have enough size...
-                break;
-            }
-            ++topBit;
+            ptr = PopSmallBin(indexSmallBin);
+
+            int deltaSize = (indexSmallBin << ALIGNMENT_SHIFT) - alignedSize;
+            CROSSNET_ASSERT(deltaSize >= MIN_SIZE, "");     // The size class is strictly bigger, so there is always a remainder
+            CROSSNET_ASSERT(IsAligned(deltaSize), "");
+
+            AllocStructure * newFreeBlock = (AllocStructure *)(((unsigned char *)ptr) + alignedSize);
+            InternalFree(newFreeBlock, deltaSize);
+            return (ptr);
         }
-        while (topBit < 32);
 
+        // Last chance, split the smallest medium block available
+        ptr = FindMediumBlock(alignedSize);
         if (ptr != NULL)
         {
-            CROSSNET_ASSERT(ptr->mSize >= size, "");
-
-            // Good, we found a free block of the good size!
-            // Remove it from the free list, move the next free block at the top
-            sMediumBin[topBit] = ptr->mNext;
-
             int deltaSize = ptr->mSize - alignedSize;
-            CROSSNET_ASSERT(deltaSize >= 0, "");                // The free block should be at least as big as the allocation we are looking for
-            CROSSNET_ASSERT(ptr->mSize >= (1 << topBit), "");   // The block should be bigger than the corresponding top bit
+            CROSSNET_ASSERT(deltaSize >= MIN_SIZE, "");     // Medium blocks are bigger than SMALL_SIZE_BIN, so there is always a remainder
             CROSSNET_ASSERT(IsAligned(deltaSize), "");
 
             // Because we are allocating for a small size and we look inside the medium bin
             // We know that we are going to have left over room...
-            // This will increase memory fragmentation
-
+            //  The remainder goes back in the small or medium bins (in O(1) either way)
             AllocStructure * newFreeBlock = (AllocStructure *)(((unsigned char *)ptr) + alignedSize);
-
-            // Put this medium buffer in the cache for next time...
-            sCurrentMediumPointer = newFreeBlock;
-            sCurrentMediumSize = deltaSize;
-
-            // No need to free the block...
+            InternalFree(newFreeBlock, deltaSize);
             return (ptr);
         }
     }
@@ -202,42 +630,25 @@ void * GCAllocator::Allocate(int size, bool afterGC)
     {
         // We have enough memory to allocate
         sCurrentAllocPointer = endAlloc;
+        // A free block given back to the bump allocation leaves its header
+        reinterpret_cast<AllocStructure *>(currentAlloc)->mMarker = 0;
 
         // Second most common case (if we are not running out of memory quickly)
-        //  Cost if size > SMALL_SIZE_BIN:  2 tests, 2 operations, 1 read, 1 write
+        //  Cost if size > SMALL_SIZE_BIN:  2 tests, 2 operations, 1 read, 2 writes
         //
-        //  Cost if size <= SMALL_SIZE_BIN: 3 tests, 3 operations, 2 reads, 1 write
+        //  Cost if size <= SMALL_SIZE_BIN: 3 tests, 3 operations, 2 reads, 2 writes
         return (currentAlloc);
     }
 }
 
-        // In that case we have to update the medium bin with the cached medium pointer (if there is one)
-        SafeReconcileMediumCache();
-
-        int topBit = TopBit(NextPowerOf2(size));
-        do
-        {
-            ptr = sMediumBin[topBit];
-            if (ptr != NULL)
-            {
-                // We found a block that should have enough size...
-                break;
-            }
-            ++topBit;
-        }
-        while (topBit < 32);
-
+        // Good fit in the medium bins, O(1) with the bit scans
+        ptr = FindMediumBlock(alignedSize);
         if (ptr != NULL)
         {
             CROSSNET_ASSERT(ptr->mSize >= size, "");
 
-            // Good, we found a free block of the good size!
-            // Remove it from the free list, move the next free block at the top
-            sMediumBin[topBit] = ptr->mNext;
-
             int deltaSize = ptr->mSize - alignedSize;
             CROSSNET_ASSERT(deltaSize >= 0, "");                // The free block should be at least as big as the allocation we are looking for
-            CROSSNET_ASSERT(ptr->mSize >= (1 << topBit), "");   // The block should be bigger than the corresponding top bit
             CROSSNET_ASSERT(IsAligned(deltaSize), "");
 
             if (deltaSize > 0)
@@ -276,14 +687,57 @@ void * GCAllocator::Allocate(int size, bool afterGC)
     //  2. At the end of the main buffer (for new objects)
     //  3. In the medium allocator (recycled medium and big objects).
 
+    if (GCManager::IsLazySweeping())
+    {
+        // The free blocks after the sweep cursor are not in the bins yet
+        //  Sweep the main buffer by chunks until one of them fits (or until the sweep is done), instead of collecting
+        int alignedSize = Align(size);
+        do
+        {
+            GCManager::SweepNextChunk();
+        }
+        while (GCManager::IsLazySweeping() && (HasFreeBlock(alignedSize) == false));
+        return (Allocate(size, afterGC));
+    }
+
     if (afterGC)
     {
         // We did a GC already with no luck...
+        // First let's see if the heap can grow
+        if (GrowHeap(Align(size)))
+        {
+            // There is now enough committed memory, this time it should succeed
+            //  (In the worst case another segment will be committed)
+            return (Allocate(size, true));
+        }
+
+        if (GCManager::GetLastGeneration() < GCManager::MAX_GENERATION)
+        {
+            // The last collection only collected the young objects, some old objects might be dead too
+            //  The heap can't grow anymore, so this time collect everything
+            GCManager::Collect(GCManager::MAX_GENERATION, false);
+            return (Allocate(size, true));
+        }
+
+        if (GCManager::IsCompactionEnabled() && (GCManager::WasLastCollectionCompact() == false))
+        {
+            // Enough bytes might be free, but not in one block
+            //  Move the objects of the sparse parts of the heap next to each other, then try again (only once)
+            GCManager::Compact();
+            return (Allocate(size, true));
+        }
+
         // let's try with the last user allocator
         AllocateFunctionPointer func = ::CrossNetRuntime::GetOptions().mAllocateAfterGCCallback;
         if (func != NULL)
         {
-            return (func(size));
+            void * result = func(size);
+            if (result != NULL)
+            {
+                // The collections can't track the writes to this memory, they are all complete from now on
+                sExternalObjects = true;
+            }
+            return (result);
         }
         // No function pointer set, can't allocate
         return (NULL);
@@ -299,6 +753,7 @@ void * GCAllocator::Allocate(int size, bool afterGC)
             if (result != NULL)
             {
                 // And the callback allocated something!
+                sExternalObjects = true;
                 return (result);
             }
         }
@@ -311,8 +766,9 @@ void * GCAllocator::Allocate(int size, bool afterGC)
 
     // The only remaining thing to do is to Garbage Collect,
     // hoping it will free some memory...
+    //  (Only the young objects first if the collection is generational, the heap can still grow after that)
 
-    GCManager::Collect(GCManager::MAX_GENERATION, false);
+    GCManager::Collect(GCPolicy::GetNextGeneration(), false);
 
     // Recurse the same function again, this time stating that the GC has been done already
     // This won't be done more often...
@@ -324,39 +780,655 @@ void GCAllocator::Free(void * ptr, int size)
 {
     CROSSNET_ASSERT(IsAligned(ptr), "");
 
+    MarkBufferBypassed();
+
     AllocStructure * freedPtr = static_cast<AllocStructure *>(ptr);
     int alignedSize = Align(size);
-    InternalFree(freedPtr, alignedSize);
-}
+    if (sZeroFreeMemory)
+    {
+        // The content of the object is not needed anymore
+        ClearFreedMemory(ptr, alignedSize);
+    }
+    Lock();
 
-void    GCAllocator::InternalFree(AllocStructure * freedPtr, int alignedSize)
-{
-    CROSSNET_ASSERT(IsAligned(freedPtr), "");
-    CROSSNET_ASSERT(IsAligned(alignedSize), "");
+    // The block must not look alive (or old) to the next collection
+    GCManager::OnFree(freedPtr, alignedSize);
+    // Nor be found by the conservative roots
+    ClearAllocationStarts(freedPtr, reinterpret_cast<unsigned char *>(freedPtr) + alignedSize);
 
-    freedPtr->mMarker = FREE_MARKER;
-    freedPtr->mSize = alignedSize;
+    if (GCManager::IsUnsweptMemory(freedPtr))
+    {
+        // An incremental collection is in progress and its sweep has not been done here yet
+        //  The block can't go in the bins now (it might be reused and not be marked),
+        //  it is simply formatted as free and the next sweep recycles it
+        freedPtr->mMarker = RESERVED_MARKER;
+        freedPtr->mSize = alignedSize;
+        Unlock();
+        return;
+    }
 
-/*
-    if (alignedSize <= SMALL_SIZE_BIN)
+    // Coalesce right away with the free block before (if any), using its boundary tag
+    //  InternalFree() takes care of the free block after
+    //  That way an explicit free gives back a bigger block instead of shards waiting for the next collection
+    AllocStructure * previous = FindFreeBlockBefore(freedPtr);
+    if ((previous != NULL) && (GCManager::IsUnsweptMemory(previous) == false))
+    {
+        RemoveFromBin(previous);
+        alignedSize += previous->mSize;
+        if (sZeroFreeMemory && (previous->mSize > MIN_SIZE))
+        {
+            // Its boundary tag is now in the middle of the block (its header stays the header of the merged block)
+            __memclear__(reinterpret_cast<unsigned char *>(freedPtr) - ALIGNMENT, ALIGNMENT);
+        }
+        freedPtr = previous;
+    }
+
+    InternalFree(freedPtr, alignedSize);
+    Unlock();
+}
+
+void * GCAllocator::RecordBigAllocationStart(void * block, int alignedSize)
+{
+    if (sRecordAllocationStarts == false)
+    {
+        return (block);
+    }
+    // The object containing a pointer is never searched further back than the biggest object
+    //  Rare enough (only when a bigger object is allocated) to use an interlocked operation
+    for ( ; ; )
+    {
+        long biggest = sMaxObjectSize;
+        if ((alignedSize <= biggest) || (_InterlockedCompareExchange(&sMaxObjectSize, alignedSize, biggest) == biggest))
+        {
+            break;
+        }
+    }
+    return (RecordAllocationStart(block));
+}
+
+void * GCAllocator::FindAllocationStart(void * pointer)
+{
+    CROSSNET_ASSERT(InCurrentAllocationSpace(pointer), "");
+    unsigned char * current = static_cast<unsigned char *>(pointer);
+    // With only small objects, that's one or two words of the bitmap
+    unsigned char * start = sHeapBase;
+    if ((size_t)(current - sHeapBase) >= (size_t)sMaxObjectSize)
+    {
+        start = current - sMaxObjectSize + ALIGNMENT;
+    }
+    return (sAllocationStartBitmap.FindPrevSet(start, current));
+}
+
+GCAllocator::AllocStructure * GCAllocator::FindFreeBlockBefore(void * pointer)
+{
+    // Returns the free block that ends at pointer, NULL if the block before is not in a bin
+    unsigned char * start = static_cast<unsigned char *>(pointer);
+    int * footer = reinterpret_cast<int *>(start) - 1;
+    if (InCurrentAllocationSpace(footer) == false)
+    {
+        // Start of the heap, or the segment before has been released
+        return (NULL);
+    }
+
+    // If the block before is a free block, the last 4 bytes are its size (boundary tag)
+    //  Otherwise it is the end of an object and it can be anything, so the size is validated:
+    //  the block it points to must be in a bin (exact with the free block bitmap) and have the same size
+    int size = *footer;
+    if ((size > MIN_SIZE) && IsAligned(size) && (size <= start - sHeapBase))
+    {
+        AllocStructure * candidate = reinterpret_cast<AllocStructure *>(start - size);
+        if (IsFreeBlock(candidate) && (candidate->mSize == size))
+        {
+            return (candidate);
+        }
+    }
+
+    // Blocks of MIN_SIZE are too small to have a boundary tag (it would overlap mPrev)
+    AllocStructure * candidate = reinterpret_cast<AllocStructure *>(start - MIN_SIZE);
+    if (IsFreeBlock(candidate) && (candidate->mSize == MIN_SIZE))
+    {
+        return (candidate);
+    }
+    return (NULL);
+}
+
+void    GCAllocator::InternalFree(AllocStructure * freedPtr, int alignedSize)
+{
+    CROSSNET_ASSERT(IsAligned(freedPtr), "");
+    CROSSNET_ASSERT(IsAligned(alignedSize), "");
+
+    // Coalesce with the block right after if it is free as well
+    unsigned char * next = reinterpret_cast<unsigned char *>(freedPtr) + alignedSize;
+    if (next == sCurrentAllocPointer)
+    {
+        // It's the end of the allocated part of the buffer, simply give the room back to the bump allocation
+        if (sZeroFreeMemory)
+        {
+            // The bump allocation expects zeroed memory
+            ClearFreeBlockTags(freedPtr, alignedSize);
+        }
+        sCurrentAllocPointer = reinterpret_cast<unsigned char *>(freedPtr);
+        return;
+    }
+    // Only a block in a bin is coalesced, the free block bitmap is exact:
+    //  The memory at the current position of a thread allocation buffer, in a released segment,
+    //  or in a block freed but not swept yet is never in a bin, whatever it contains.
+    //  The bins are doubly linked, so the block after can be removed from its bin in O(1)
+    if (IsFreeBlock(next))
+    {
+        AllocStructure * nextBlock = reinterpret_cast<AllocStructure *>(next);
+        CROSSNET_ASSERT(nextBlock->mMarker == FREE_MARKER, "The free block bitmap is out of sync!");
+        RemoveFromBin(nextBlock);
+        alignedSize += nextBlock->mSize;
+        if (sZeroFreeMemory)
+        {
+            // The end of this block and the header of the next one are now in the middle of the merged block
+            __memclear__(next - ALIGNMENT, 2 * ALIGNMENT);
+        }
+    }
+
+    freedPtr->mMarker = FREE_MARKER;
+    freedPtr->mSize = alignedSize;
+    if (alignedSize > MIN_SIZE)
+    {
+        // Boundary tag, used by Free() to coalesce with the block before
+        reinterpret_cast<int *>(reinterpret_cast<unsigned char *>(freedPtr) + alignedSize)[-1] = alignedSize;
+    }
+
+    if (alignedSize <= SMALL_SIZE_BIN)
     {
         // Deallocation that happens most of the time
+        //  Exact size class, so next allocation of the same size will be O(1)
         int indexSmallBin = alignedSize >> ALIGNMENT_SHIFT;
-        freedPtr->mNext = sSmallBin[indexSmallBin];
-        sSmallBin[indexSmallBin] = freedPtr;
+        PushSmallBin(freedPtr, indexSmallBin);
     }
     else
-*/
     {
-        // Do not use next power of 2 here, as this should be greater than the size we are looking for
-        int newTopBit = TopBit(alignedSize + 1);        // Increment so if the size is exactly a poer of two, the bit will stay in the same range
-        --newTopBit;                                    // But will write one level below as the size is guaranteed to be at least in the range we are looking
+        // Segregated fit, the block goes in the bin of its size class (not rounded up)
+        PushMediumBin(freedPtr);
+    }
+}
+
+void    GCAllocator::ClearFreedMemory(void * start, int alignedSize)
+{
+    CROSSNET_ASSERT(IsAligned(start), "");
+    CROSSNET_ASSERT(IsAligned(alignedSize), "");
+
+    if (alignedSize < NON_TEMPORAL_CLEAR_SIZE)
+    {
+        // Small enough, it's going to be reused soon anyway
+        __memclear__(start, alignedSize);
+        return;
+    }
 
-        CROSSNET_ASSERT(alignedSize >= (1 << newTopBit), "");       // Check that the range is correct...
-        CROSSNET_ASSERT(alignedSize < (1 << (newTopBit + 1)), "");
+    // Non-temporal stores, the cleared memory doesn't go through the cache
+    //  Both the start and the size are multiple of 16, so no need to handle the edges
+    __m128i zero = _mm_setzero_si128();
+    __m128i * current = static_cast<__m128i *>(start);
+    __m128i * end = reinterpret_cast<__m128i *>(static_cast<unsigned char *>(start) + alignedSize);
+    while (current < end)
+    {
+        _mm_stream_si128(current, zero);
+        ++current;
+    }
+    // Make sure the stores are visible before the memory is reused
+    _mm_sfence();
+}
 
-        freedPtr->mNext = sMediumBin[newTopBit];
-        sMediumBin[newTopBit] = freedPtr;
+GCAllocator::AllocStructure * GCAllocator::FindMediumBlock(int alignedSize)
+{
+    // Returns (and removes from its bin) a medium block of at least alignedSize, NULL if there is none
+    AllocStructure * ptr = PeekMediumBlock(alignedSize);
+    if (ptr != NULL)
+    {
+        RemoveMediumBin(ptr);
+        // Allocated, it must not look free anymore
+        ptr->mMarker = 0;
+    }
+    return (ptr);
+}
+
+GCAllocator::AllocStructure * GCAllocator::PeekMediumBlock(int alignedSize)
+{
+    // Same as FindMediumBlock() but the block stays in its bin
+    int firstLevel;
+    int secondLevel;
+    if (alignedSize <= SMALL_SIZE_BIN)
+    {
+        // Any medium block is big enough
+        firstLevel = SMALL_SIZE_SHIFT;
+        secondLevel = 0;
+    }
+    else
+    {
+        // Round up the size to the next second level class
+        //  So any block of the class we are going to look at is big enough (good fit, no list parsing)
+        int roundedSize = alignedSize + (1 << (HighestBit(alignedSize) - MEDIUM_SECOND_LEVEL_SHIFT)) - 1;
+        MediumMapping(roundedSize, firstLevel, secondLevel);
+    }
+
+    // First look at the classes of the same range
+    unsigned int mask = sMediumSecondLevelMask[firstLevel] & (0xffffffff << secondLevel);
+    if (mask == 0)
+    {
+        // Then look at the next non-empty range
+        if (firstLevel + 1 >= MEDIUM_FIRST_LEVEL_COUNT)
+        {
+            return (NULL);
+        }
+        unsigned int firstLevelMask = sMediumFirstLevelMask & (0xffffffff << (firstLevel + 1));
+        if (firstLevelMask == 0)
+        {
+            return (NULL);
+        }
+        firstLevel = LowestBit(firstLevelMask);
+        mask = sMediumSecondLevelMask[firstLevel];
+        CROSSNET_ASSERT(mask != 0, "");
+    }
+    secondLevel = LowestBit(mask);
+
+    AllocStructure * ptr = sMediumBin[firstLevel][secondLevel];
+    CROSSNET_ASSERT(ptr != NULL, "");
+    CROSSNET_ASSERT(ptr->mSize >= alignedSize, "");
+    return (ptr);
+}
+
+bool    GCAllocator::HasFreeBlock(int alignedSize)
+{
+    // True if the bins can satisfy an allocation of alignedSize (without using the end of the main buffer)
+    if (alignedSize <= SMALL_SIZE_BIN)
+    {
+        int indexSmallBin = alignedSize >> ALIGNMENT_SHIFT;
+        if ((sSmallBin[indexSmallBin] != NULL) || (FindSmallBin(indexSmallBin + 1) >= 0))
+        {
+            return (true);
+        }
+    }
+    return (PeekMediumBlock(alignedSize) != NULL);
+}
+
+int     GCAllocator::FindSmallBin(int index)
+{
+    // Returns the first non-empty small bin with an index greater or equal to index, -1 if there is none
+    if (index >= SMALL_BIN_COUNT)
+    {
+        return (-1);
+    }
+
+    int word = index >> 5;
+    // Mask out the size classes smaller than the one we are looking for
+    unsigned int mask = sSmallBinMask[word] & (0xffffffff << (index & 31));
+    for ( ; ; )
+    {
+        if (mask != 0)
+        {
+            return ((word << 5) + LowestBit(mask));
+        }
+        if (++word >= SMALL_BIN_MASK_SIZE)
+        {
+            return (-1);
+        }
+        mask = sSmallBinMask[word];
+    }
+}
+
+void    GCAllocator::AttachCurrentThread()
+{
+    if ((sThreadAllocBufferSize != 0) && (sThreadAllocBuffer == NULL))
+    {
+        AttachThread();
+    }
+}
+
+void    GCAllocator::DetachThread()
+{
+    // The collector might be retiring the buffer and the runs of the pointer-free space at the same time
+    ThreadAllocBuffer * buffer = sThreadAllocBuffer;
+    Lock();
+    GCPointerFreeSpace::DetachThread();
+    if (buffer != NULL)
+    {
+        RetireThreadAllocBuffer(buffer);
+        // The next collections don't suspend this thread anymore
+        GCThread::CloseThread(buffer->mThread);
+        buffer->mThread = NULL;
+    }
+    Unlock();
+    if (buffer == NULL)
+    {
+        // This thread never allocated anything (or the buffers are disabled)
+        return;
+    }
+    sThreadAllocBuffer = NULL;
+
+    // Now another thread can pick this buffer
+    _InterlockedExchange(&buffer->mInUse, 0);
+}
+
+GCAllocator::ThreadAllocBuffer * GCAllocator::AttachThread()
+{
+    ThreadAllocBuffer * buffer;
+
+    // The lock is taken so a collection can't start between the attachment and the registration of the thread
+    //  (Its stack would not be scanned)
+    Lock();
+
+    // First try to reuse the buffer of a thread that detached
+    //  Buffers are never removed from the list, so we can iterate without lock
+    for (buffer = sAllThreadAllocBuffers ; buffer != NULL ; buffer = buffer->mNextBuffer)
+    {
+        if ((buffer->mInUse == 0) && (_InterlockedCompareExchange(&buffer->mInUse, 1, 0) == 0))
+        {
+            buffer->mThread = GCThread::OpenCurrentThread();
+            buffer->mStackBase = GCThread::GetStackBase();
+            sThreadAllocBuffer = buffer;
+            Unlock();
+            return (buffer);
+        }
+    }
+
+    // None available, create a new one and push it on the list
+    buffer = static_cast<ThreadAllocBuffer *>(::CrossNetRuntime::GetOptions().mUnmanagedAllocateCallback(sizeof(ThreadAllocBuffer)));
+    buffer->mCurrent = NULL;
+    buffer->mEnd = NULL;
+    buffer->mInUse = 1;
+    buffer->mAllocating = 0;
+    buffer->mRetiredEnd = NULL;
+    buffer->mBypassed = false;
+    buffer->mThread = GCThread::OpenCurrentThread();
+    buffer->mStackBase = GCThread::GetStackBase();
+    buffer->mStackPointer = NULL;
+
+    ThreadAllocBuffer * head;
+    do
+    {
+        head = sAllThreadAllocBuffers;
+        buffer->mNextBuffer = head;
+    }
+    while (_InterlockedCompareExchange((volatile long *)&sAllThreadAllocBuffers, (long)buffer, (long)head) != (long)head);
+
+    sThreadAllocBuffer = buffer;
+    Unlock();
+    return (buffer);
+}
+
+void *  GCAllocator::RefillThreadAllocBuffer(ThreadAllocBuffer * buffer, int alignedSize)
+{
+    // Returns the first block of the new buffer, NULL if out of memory even after GC
+    //  The lock is taken so the collector doesn't retire the buffer while it is being replaced
+    //  (Once every buffer, the bumps themselves don't need it)
+    Lock();
+
+    // Give back what remains of the current buffer
+    //  It is not put in the bins, the next sweep will recycle it
+    //  As we refill only when a small object doesn't fit, this wastes less than SMALL_SIZE_BIN per buffer
+    RetireThreadAllocBuffer(buffer);
+
+    AllocStructure * chunk = PopThreadAllocBufferPool();
+    if ((chunk == NULL) && ReplenishThreadAllocBufferPool())
+    {
+        // The pool was empty, new buffers have been carved from the main buffer
+        chunk = PopThreadAllocBufferPool();
+    }
+    if (chunk == NULL)
+    {
+        Unlock();
+        return (NULL);
+    }
+
+    CROSSNET_ASSERT(chunk->mMarker == RESERVED_MARKER, "");
+    CROSSNET_ASSERT(chunk->mSize >= alignedSize, "");
+    unsigned char * start = reinterpret_cast<unsigned char *>(chunk);
+    buffer->mCurrent = start + alignedSize;
+    buffer->mEnd = start + chunk->mSize;
+    Unlock();
+    return (start);
+}
+
+void    GCAllocator::RetireThreadAllocBuffer(ThreadAllocBuffer * buffer)
+{
+    ReserveBufferTail(buffer->mCurrent, buffer->mEnd);
+    buffer->mCurrent = NULL;
+    buffer->mEnd = NULL;
+}
+
+void    GCAllocator::ReserveBufferTail(unsigned char * current, unsigned char * end)
+{
+    // Format the unused part of the buffer as a free block so the heap can still be parsed
+    int remainingSize = (int)(end - current);
+    if (remainingSize > 0)
+    {
+        AllocStructure * tail = reinterpret_cast<AllocStructure *>(current);
+        tail->mMarker = RESERVED_MARKER;
+        tail->mSize = remainingSize;
+    }
+}
+
+void    GCAllocator::RetireAllThreadAllocBuffers()
+{
+    // Called at the beginning of a collection (the allocator lock is taken)
+    //  The other threads bump allocate in their buffer without the lock, so we do a handshake with them:
+    //  1.  The end of each buffer is set to NULL, so the next bump of its owner fails
+    //      The owner goes to the slow path, which waits for the lock (i.e. the end of the collection)
+    //  2.  The write buffers of all the processors are flushed
+    //      A bump that read the previous end is now visible through mAllocating
+    //  3.  We wait for those bumps to finish, mCurrent is then final and the rest of the buffer can be formatted
+    //  The owners never wait for the collector in the fast path, and the refills are done with the lock taken
+    //  The regions and the runs of the pointer-free space bump allocate the same way
+    ThreadAllocBuffer * buffer;
+    for (buffer = sAllThreadAllocBuffers ; buffer != NULL ; buffer = buffer->mNextBuffer)
+    {
+        BeginRetireThreadAllocBuffer(buffer);
+    }
+    RegionScope::BeginRetireAllRegions();
+    GCPointerFreeSpace::BeginRetireAllThreadCursors();
+
+    GCThread::FlushWriteBuffers();
+
+    for (buffer = sAllThreadAllocBuffers ; buffer != NULL ; buffer = buffer->mNextBuffer)
+    {
+        EndRetireThreadAllocBuffer(buffer);
+    }
+    RegionScope::EndRetireAllRegions();
+    GCPointerFreeSpace::EndRetireAllThreadCursors();
+
+    // The pooled buffers are marked as reserved, the sweep is going to consolidate them with the other free blocks
+    sThreadAllocBufferPool = 0;
+}
+
+void    GCAllocator::BeginRetireThreadAllocBuffer(ThreadAllocBuffer * buffer)
+{
+    buffer->mRetiredEnd = buffer->mEnd;
+    buffer->mEnd = NULL;
+}
+
+void    GCAllocator::EndRetireThreadAllocBuffer(ThreadAllocBuffer * buffer)
+{
+    // Wait for the bump the owner might have started before BeginRetireThreadAllocBuffer()
+    for (int i = 0 ; buffer->mAllocating != 0 ; ++i)
+    {
+        GCThread::Relax(i);
+    }
+    // mEnd stays NULL, so the owner can't bump anymore
+    ReserveBufferTail(buffer->mCurrent, buffer->mRetiredEnd);
+    buffer->mCurrent = NULL;
+    buffer->mRetiredEnd = NULL;
+}
+
+void    GCAllocator::SuspendOtherThreads()
+{
+    // The threads are only suspended once their buffer is retired: a thread stopped in the middle of a bump
+    //  would make EndRetireThreadAllocBuffer() wait forever. A thread that bumps from now on goes to the slow path,
+    //  which waits for the lock (or attaches, which also waits for it).
+    //  The detached threads keep their buffer in the list, but they don't have managed pointers anymore
+    ThreadAllocBuffer * current = sThreadAllocBuffer;
+    for (ThreadAllocBuffer * buffer = sAllThreadAllocBuffers ; buffer != NULL ; buffer = buffer->mNextBuffer)
+    {
+        if ((buffer != current) && (buffer->mThread != NULL))
+        {
+            buffer->mStackPointer = GCThread::Suspend(buffer->mThread, buffer->mRegisters);
+        }
+    }
+}
+
+void    GCAllocator::ResumeOtherThreads()
+{
+    for (ThreadAllocBuffer * buffer = sAllThreadAllocBuffers ; buffer != NULL ; buffer = buffer->mNextBuffer)
+    {
+        if (buffer->mStackPointer != NULL)
+        {
+            buffer->mStackPointer = NULL;
+            GCThread::Resume(buffer->mThread);
+        }
+    }
+}
+
+bool    GCAllocator::ReplenishThreadAllocBufferPool()
+{
+    // The allocator lock must be taken
+    CROSSNET_ASSERT(sLockDepth > 0, "");
+
+    if (GCManager::IsLazySweeping())
+    {
+        // Each refill sweeps one chunk, so the sweep progresses with the allocations of small objects
+        //  (These never go through Allocate() until the end of the main buffer is reached)
+        GCManager::SweepNextChunk();
+    }
+
+    // Carve several buffers in one go at the end of the main buffer
+    int numBuffers = 0;
+    while (numBuffers < THREAD_ALLOC_BUFFER_REPLENISH_COUNT)
+    {
+        unsigned char * currentAlloc = sCurrentAllocPointer;
+        unsigned char * endAlloc = currentAlloc + sThreadAllocBufferSize;
+        if (endAlloc >= sEndMainBuffer)
+        {
+            break;
+        }
+        sCurrentAllocPointer = endAlloc;
+
+        AllocStructure * chunk = reinterpret_cast<AllocStructure *>(currentAlloc);
+        PushThreadAllocBufferPool(chunk, sThreadAllocBufferSize);
+        ++numBuffers;
+    }
+
+    if (numBuffers == 0)
+    {
+        // No more room at the end of the main buffer, carve the buffer from the free blocks
+        int size = sThreadAllocBufferSize;
+        AllocStructure * chunk = CarveThreadAllocBuffer(size);
+        if (chunk == NULL)
+        {
+            // Not even a small buffer, the standard allocation sweeps, collects or grows the heap
+            size = sThreadAllocBufferSize;
+            chunk = static_cast<AllocStructure *>(Allocate(size, false));
+            if (chunk == NULL)
+            {
+                return (false);
+            }
+        }
+        PushThreadAllocBufferPool(chunk, size);
+    }
+    return (true);
+}
+
+GCAllocator::AllocStructure * GCAllocator::CarveThreadAllocBuffer(int & size)
+{
+    // Returns a free block of about size bytes (and its actual size), NULL if there is none
+    //  On a fragmented heap there might be no block as big as a whole buffer, but still a lot of smaller ones
+    //  So the requested size is halved until a block is found, instead of collecting for each refill
+    for (int requestedSize = size ; requestedSize >= MIN_THREAD_ALLOC_BUFFER_SIZE ; requestedSize = Align(requestedSize >> 1))
+    {
+        AllocStructure * block = FindMediumBlock(requestedSize);
+        if (block == NULL)
+        {
+            continue;
+        }
+        int deltaSize = block->mSize - requestedSize;
+        CROSSNET_ASSERT(IsAligned(deltaSize), "");
+        if (deltaSize > 0)
+        {
+            // The rest goes back in the bins
+            InternalFree(reinterpret_cast<AllocStructure *>(reinterpret_cast<unsigned char *>(block) + requestedSize), deltaSize);
+        }
+        size = requestedSize;
+        return (block);
+    }
+    return (NULL);
+}
+
+GCAllocator::AllocStructure * GCAllocator::PopThreadAllocBufferPool()
+{
+    for ( ; ; )
+    {
+        ThreadAllocBufferPoolHead oldHead;
+        // Atomic 64 bits read
+        oldHead.mValue = _InterlockedCompareExchange64(&sThreadAllocBufferPool, 0, 0);
+        if (oldHead.mTop == NULL)
+        {
+            return (NULL);
+        }
+
+        // If another thread popped oldHead.mTop in the meantime, mNext might be garbage
+        //  But in that case the tag changed and the exchange will fail
+        ThreadAllocBufferPoolHead newHead;
+        newHead.mTop = oldHead.mTop->mNext;
+        newHead.mTag = oldHead.mTag + 1;
+        if (_InterlockedCompareExchange64(&sThreadAllocBufferPool, newHead.mValue, oldHead.mValue) == oldHead.mValue)
+        {
+            return (oldHead.mTop);
+        }
+    }
+}
+
+void    GCAllocator::PushThreadAllocBufferPool(AllocStructure * chunk, int size)
+{
+    // The buffers carved from the free blocks can be smaller than sThreadAllocBufferSize
+    chunk->mMarker = RESERVED_MARKER;
+    chunk->mSize = size;
+
+    for ( ; ; )
+    {
+        ThreadAllocBufferPoolHead oldHead;
+        oldHead.mValue = _InterlockedCompareExchange64(&sThreadAllocBufferPool, 0, 0);
+
+        ThreadAllocBufferPoolHead newHead;
+        chunk->mNext = oldHead.mTop;
+        newHead.mTop = chunk;
+        newHead.mTag = oldHead.mTag;
+        if (_InterlockedCompareExchange64(&sThreadAllocBufferPool, newHead.mValue, oldHead.mValue) == oldHead.mValue)
+        {
+            return;
+        }
+    }
+}
+
+void    GCAllocator::Lock()
+{
+    if (sThreadAllocBufferSize == 0)
+    {
+        // Single threaded, no need to lock
+        return;
+    }
+    if (sLockDepth++ == 0)
+    {
+        while (_InterlockedCompareExchange(&sAllocatorLock, 1, 0) != 0)
+        {
+            _mm_pause();
+        }
+    }
+}
+
+void    GCAllocator::Unlock()
+{
+    if (sThreadAllocBufferSize == 0)
+    {
+        return;
+    }
+    CROSSNET_ASSERT(sLockDepth > 0, "");
+    if (--sLockDepth == 0)
+    {
+        _InterlockedExchange(&sAllocatorLock, 0);
     }
 }
 
@@ -369,12 +1441,18 @@ void * GCAllocator::GetCurrentAllocPointer()
 
 void    GCAllocator::SetCurrentAllocPointer(void * currentPointer)
 {
-    sCurrentAllocPointer = (unsigned char *)currentPointer;
+    unsigned char * newPointer = (unsigned char *)currentPointer;
+    if (newPointer < sCurrentAllocPointer)
+    {
+        // The memory after goes back to the bump allocation, none of it is a free block in a bin anymore
+        sFreeBlockBitmap.ClearRange(newPointer, sCurrentAllocPointer);
+    }
+    sCurrentAllocPointer = newPointer;
 }
 
 bool    GCAllocator::InCurrentAllocationSpace(void * pointer)
 {
-    if (pointer < GetOptions().mMainBuffer)
+    if (pointer < sHeapBase)
     {
         // before the main buffer
         return (false);
@@ -386,38 +1464,299 @@ bool    GCAllocator::InCurrentAllocationSpace(void * pointer)
         return (false);
     }
 
+    if (sSegmentStates != NULL)
+    {
+        // The pages of a released segment can't be read (at least on some platforms)
+        size_t segment = ((unsigned char *)pointer - sHeapBase) >> sSegmentShift;
+        if (sSegmentStates[segment] == SEGMENT_RELEASED)
+        {
+            return (false);
+        }
+    }
+
     return (true);
 }
 
-void   GCAllocator::ClearBins()
+bool    GCAllocator::GrowHeap(int alignedSize)
 {
-    for (int i = 0 ; i < sizeof(sSmallBin) / sizeof(sSmallBin[0]) ; ++i)
+    if (sSegmentStates == NULL)
     {
-        sSmallBin[i] = NULL;
+        // The user provided the buffer, we can't grow it
+        return (false);
+    }
+
+    if ((alignedSize <= sSegmentSize) && (GCManager::IsIncrementalCollectionInProgress() == false))
+    {
+        // First reuse the segments that have been given back to the OS during the last collections
+        //  (Not during an incremental collection, they are before the limit of its sweep)
+        //  Only the segments before the current alloc pointer can be released
+        int numSegments = (int)((sCurrentAllocPointer - sHeapBase) >> sSegmentShift);
+        for (int i = 0 ; i < numSegments ; ++i)
+        {
+            if (sSegmentStates[i] != SEGMENT_RELEASED)
+            {
+                continue;
+            }
+            unsigned char * segment = sHeapBase + ((size_t)i << sSegmentShift);
+            if (GCVirtualMemory::Commit(segment, sSegmentSize) == false)
+            {
+                return (false);
+            }
+            if (sHeapBacking == HB_PREFAULT)
+            {
+                GCVirtualMemory::Prefault(segment, sSegmentSize);
+            }
+            sSegmentStates[i] = SEGMENT_COMMITTED;
+            InternalFree(reinterpret_cast<AllocStructure *>(segment), sSegmentSize);
+            return (true);
+        }
+    }
+
+    // Otherwise commit new segments at the end of the heap
+    //  +1 as the bump allocation needs the end of the allocation to be strictly before the end of the buffer
+    unsigned char * endAlloc = sCurrentAllocPointer + alignedSize + 1;
+    unsigned char * endCommitted = static_cast<unsigned char *>(sEndMainBuffer);
+    if (endAlloc <= endCommitted)
+    {
+        // Already enough committed memory at the end (it's a fragmentation issue, not a size issue)
+        return (false);
+    }
+
+    size_t sizeToCommit = (size_t)(endAlloc - endCommitted);
+    sizeToCommit = (sizeToCommit + sSegmentSize - 1) & ~(size_t)(sSegmentSize - 1);
+    if (endCommitted + sizeToCommit > sEndReservedHeap)
+    {
+        // The heap reached its maximum size
+        return (false);
+    }
+
+    if (GCVirtualMemory::Commit(endCommitted, sizeToCommit) == false)
+    {
+        return (false);
+    }
+    if (sHeapBacking == HB_PREFAULT)
+    {
+        GCVirtualMemory::Prefault(endCommitted, sizeToCommit);
+    }
+    sEndMainBuffer = endCommitted + sizeToCommit;
+    return (true);
+}
+
+void    GCAllocator::FreeRun(void * start, int size, LocalBins * bins)
+{
+    // Called by the sweep for each run of free blocks (the allocator lock is taken, or the blocks go in local bins)
+    unsigned char * begin = static_cast<unsigned char *>(start);
+    unsigned char * end = begin + size;
+
+    if (sSegmentStates != NULL)
+    {
+        size_t mask = (size_t)(sSegmentSize - 1);
+        unsigned char * firstSegment = sHeapBase + (((begin - sHeapBase) + mask) & ~mask);
+        unsigned char * endSegment = sHeapBase + ((end - sHeapBase) & ~mask);
+
+        if (firstSegment < endSegment)
+        {
+            // The run covers at least one segment completely, give those pages back to the OS
+            //  Only the remainders before and after go in the bins
+            //  (Release first, so the remainder before doesn't try to coalesce with the released segment)
+            GCVirtualMemory::Decommit(firstSegment, endSegment - firstSegment);
+            for (unsigned char * segment = firstSegment ; segment < endSegment ; segment += sSegmentSize)
+            {
+                sSegmentStates[(segment - sHeapBase) >> sSegmentShift] = SEGMENT_RELEASED;
+            }
+
+            if (begin < firstSegment)
+            {
+                FreeRun(begin, (int)(firstSegment - begin), bins);
+            }
+
+            if (endSegment < end)
+            {
+                FreeRun(endSegment, (int)(end - endSegment), bins);
+            }
+            return;
+        }
     }
 
-    for (int i = 0 ; i < sizeof(sMediumBin) / sizeof(sMediumBin[0]) ; ++i)
+    AllocStructure * block = static_cast<AllocStructure *>(start);
+    if (bins == NULL)
     {
-        sMediumBin[i] = NULL;
+        InternalFree(block, size);
+        return;
     }
+
+    // Parallel sweep, the run goes at the end of its local list
+    //  It is not coalesced, the sweep gives the whole run between two live objects
+    block->mMarker = FREE_MARKER;
+    block->mSize = size;
+    block->mNext = NULL;
+    if (size > MIN_SIZE)
+    {
+        reinterpret_cast<int *>(end)[-1] = size;
+    }
+    // The other sweeping threads can set the bits of the same word
+    if (sFreeBlockBitmap.Covers(block))
+    {
+        sFreeBlockBitmap.TestAndSetAtomic(block);
+    }
+
+    AllocStructure * * head;
+    AllocStructure * * tail;
+    if (size <= SMALL_SIZE_BIN)
+    {
+        int indexSmallBin = size >> ALIGNMENT_SHIFT;
+        head = &bins->mSmallHead[indexSmallBin];
+        tail = &bins->mSmallTail[indexSmallBin];
+    }
+    else
+    {
+        int firstLevel, secondLevel;
+        MediumMapping(size, firstLevel, secondLevel);
+        head = &bins->mMediumHead[firstLevel][secondLevel];
+        tail = &bins->mMediumTail[firstLevel][secondLevel];
+    }
+    block->mPrev = *tail;
+    if (*tail != NULL)
+    {
+        (*tail)->mNext = block;
+    }
+    else
+    {
+        *head = block;
+    }
+    *tail = block;
 }
 
-void    GCAllocator::ReconcileMediumCache()
+void    GCAllocator::ClearLocalBins(LocalBins & bins)
 {
-    // Simply clear the cache so now the cached state and the memory state are reconciled
-    if (sCurrentMediumSize != 0)
+    __memclear__(&bins, sizeof(bins));
+}
+
+void    GCAllocator::SpliceLocalBins(LocalBins & bins)
+{
+    // The allocator lock is taken
+    //  Each local list goes in front of the corresponding bin
+    for (int i = 0 ; i < SMALL_BIN_COUNT ; ++i)
     {
-        InternalFree(sCurrentMediumPointer, sCurrentMediumSize);
-        sCurrentMediumSize = 0;
+        AllocStructure * head = bins.mSmallHead[i];
+        if (head == NULL)
+        {
+            continue;
+        }
+        AllocStructure * tail = bins.mSmallTail[i];
+        AllocStructure * next = sSmallBin[i];
+        tail->mNext = next;
+        if (next != NULL)
+        {
+            next->mPrev = tail;
+        }
+        sSmallBin[i] = head;
+        sSmallBinMask[i >> 5] |= (1U << (i & 31));
     }
-    sCurrentMediumPointer = NULL;
+
+    for (int i = 0 ; i < MEDIUM_FIRST_LEVEL_COUNT ; ++i)
+    {
+        for (int j = 0 ; j < MEDIUM_SECOND_LEVEL_COUNT ; ++j)
+        {
+            AllocStructure * head = bins.mMediumHead[i][j];
+            if (head == NULL)
+            {
+                continue;
+            }
+            AllocStructure * tail = bins.mMediumTail[i][j];
+            AllocStructure * next = sMediumBin[i][j];
+            tail->mNext = next;
+            if (next != NULL)
+            {
+                next->mPrev = tail;
+            }
+            sMediumBin[i][j] = head;
+            sMediumFirstLevelMask |= (1U << i);
+            sMediumSecondLevelMask[i] |= (1U << j);
+        }
+    }
+}
+
+void    GCAllocator::ReleaseTailSegments()
+{
+    // Called after the sweep moved the current alloc pointer back
+    //  The committed segments after it are not used anymore, give them back to the OS
+    //  But keep the initial committed size so we don't commit / decommit all the time
+    if (sSegmentStates == NULL)
+    {
+        return;
+    }
+
+    size_t mask = (size_t)(sSegmentSize - 1);
+    unsigned char * firstUnused = sHeapBase + (((sCurrentAllocPointer - sHeapBase) + mask) & ~mask);
+    unsigned char * minCommitted = sHeapBase + sMinCommittedSize;
+    unsigned char * endCommitted = static_cast<unsigned char *>(sEndMainBuffer);
+
+    // The bump allocator is going to use the segments after the current alloc pointer,
+    //  the ones released by the sweep must not stay marked as released
+    for (unsigned char * segment = firstUnused ; segment < endCommitted ; segment += sSegmentSize)
+    {
+        unsigned char & state = sSegmentStates[(segment - sHeapBase) >> sSegmentShift];
+        if (state != SEGMENT_RELEASED)
+        {
+            continue;
+        }
+        state = SEGMENT_COMMITTED;
+        if (segment < minCommitted)
+        {
+            // This one is kept, so it has to be committed again
+            GCVirtualMemory::Commit(segment, sSegmentSize);
+        }
+    }
+
+    if (firstUnused < minCommitted)
+    {
+        firstUnused = minCommitted;
+    }
+    if (firstUnused < endCommitted)
+    {
+        GCVirtualMemory::Decommit(firstUnused, endCommitted - firstUnused);
+        sEndMainBuffer = firstUnused;
+    }
+}
+
+void *  GCAllocator::SkipReleasedSegments(void * pointer)
+{
+    // Returns the start of the first segment (at or after pointer) that has not been released
+    unsigned char * current = static_cast<unsigned char *>(pointer);
+    while ((current < sCurrentAllocPointer) && IsReleasedSegment(current))
+    {
+        current += sSegmentSize;
+    }
+    return (current);
 }
 
-void    GCAllocator::SafeReconcileMediumCache()
+void   GCAllocator::ClearBins()
 {
-    if (sCurrentMediumPointer != NULL)
+    for (int i = 0 ; i < sizeof(sSmallBin) / sizeof(sSmallBin[0]) ; ++i)
+    {
+        sSmallBin[i] = NULL;
+    }
+
+    for (int i = 0 ; i < sizeof(sSmallBinMask) / sizeof(sSmallBinMask[0]) ; ++i)
+    {
+        sSmallBinMask[i] = 0;
+    }
+
+    for (int i = 0 ; i < MEDIUM_FIRST_LEVEL_COUNT ; ++i)
+    {
+        for (int j = 0 ; j < MEDIUM_SECOND_LEVEL_COUNT ; ++j)
+        {
+            sMediumBin[i][j] = NULL;
+        }
+        sMediumSecondLevelMask[i] = 0;
+    }
+    sMediumFirstLevelMask = 0;
+
+    // The free blocks are not in a bin anymore (the next sweep puts them back)
+    if (sCurrentAllocPointer > sHeapBase)
     {
-        ReconcileMediumCache();
+        sFreeBlockBitmap.ClearRange(sHeapBase, sCurrentAllocPointer);
     }
 }
 
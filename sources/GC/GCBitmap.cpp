@@ -0,0 +1,327 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CrossNetRuntime/GC/GCBitmap.h"
+#include "CrossNetRuntime/GC/GCVirtualMemory.h"
+#include "CrossNetRuntime/Assert.h"
+
+// For _BitScanForward and _BitScanReverse
+#include <intrin.h>
+
+namespace CrossNetRuntime
+{
+
+namespace
+{
+    // Counts the bits in parallel (no dependency on the popcnt instruction)
+    CROSSNET_FINLINE
+    int CountBits(unsigned int bits)
+    {
+        bits = bits - ((bits >> 1) & 0x55555555);
+        bits = (bits & 0x33333333) + ((bits >> 2) & 0x33333333);
+        bits = (bits + (bits >> 4)) & 0x0f0f0f0f;
+        return ((int)((bits * 0x01010101) >> 24));
+    }
+}
+
+GCBitmap::GCBitmap()
+    :
+    mBase(NULL),
+    mSize(0),
+    mBits(NULL),
+    mBitsSize(0)
+{
+    // Do nothing...
+}
+
+void GCBitmap::Setup(void * base, size_t size)
+{
+    CROSSNET_ASSERT(mBits == NULL, "The bitmap is already setup!");
+
+    mBase = static_cast<unsigned char *>(base);
+    mSize = size;
+
+    // One bit per granule, rounded to the next 32 bits word and the next page
+    size_t numWords = ((size >> GRANULE_SHIFT) + 31) >> 5;
+    size_t pageSize = GCVirtualMemory::GetPageSize();
+    mBitsSize = ((numWords * sizeof(unsigned int)) + pageSize - 1) & ~(pageSize - 1);
+
+    mBits = static_cast<unsigned int *>(GCVirtualMemory::Reserve(mBitsSize));
+    CROSSNET_FATAL(mBits != NULL, "Could not reserve the bitmap!");
+    bool committed = GCVirtualMemory::Commit(mBits, mBitsSize);
+    CROSSNET_FATAL(committed, "Could not commit the bitmap!");
+    committed;
+}
+
+void GCBitmap::Teardown()
+{
+    if (mBits != NULL)
+    {
+        GCVirtualMemory::Release(mBits, mBitsSize);
+    }
+    mBase = NULL;
+    mSize = 0;
+    mBits = NULL;
+    mBitsSize = 0;
+}
+
+void GCBitmap::SetRange(void * start, void * end)
+{
+    size_t first = GetIndex(start);
+    size_t last = GetIndex(end);
+    if (first >= last)
+    {
+        return;
+    }
+
+    size_t firstWord = first >> 5;
+    size_t lastWord = (last - 1) >> 5;
+    unsigned int firstMask = 0xffffffff << (first & 31);
+    unsigned int lastMask = 0xffffffff >> (31 - ((last - 1) & 31));
+    if (firstWord == lastWord)
+    {
+        // Most common case, small object
+        mBits[firstWord] |= (firstMask & lastMask);
+        return;
+    }
+
+    mBits[firstWord] |= firstMask;
+    for (size_t i = firstWord + 1 ; i < lastWord ; ++i)
+    {
+        mBits[i] = 0xffffffff;
+    }
+    mBits[lastWord] |= lastMask;
+}
+
+bool GCBitmap::SetRangeAtomic(void * start, void * end)
+{
+    size_t first = GetIndex(start);
+    size_t last = GetIndex(end);
+    CROSSNET_ASSERT(first < last, "");
+
+    size_t firstWord = first >> 5;
+    size_t lastWord = (last - 1) >> 5;
+    unsigned int firstMask = 0xffffffff << (first & 31);
+    unsigned int lastMask = 0xffffffff >> (31 - ((last - 1) & 31));
+    unsigned int firstBit = 1U << (first & 31);
+    if (firstWord == lastWord)
+    {
+        // Most common case, small object
+        long previous = _InterlockedOr(reinterpret_cast<volatile long *>(&mBits[firstWord]), (long)(firstMask & lastMask));
+        return ((previous & firstBit) == 0);
+    }
+
+    // The first and the last words can be shared with other ranges, the words in the middle can't
+    //  (If another thread sets the same range, it writes the same values)
+    long previous = _InterlockedOr(reinterpret_cast<volatile long *>(&mBits[firstWord]), (long)firstMask);
+    if ((previous & firstBit) != 0)
+    {
+        return (false);
+    }
+    for (size_t i = firstWord + 1 ; i < lastWord ; ++i)
+    {
+        mBits[i] = 0xffffffff;
+    }
+    _InterlockedOr(reinterpret_cast<volatile long *>(&mBits[lastWord]), (long)lastMask);
+    return (true);
+}
+
+void GCBitmap::ClearRange(void * start, void * end)
+{
+    size_t first = GetIndex(start);
+    size_t last = GetIndex(end);
+    if (first >= last)
+    {
+        return;
+    }
+
+    size_t firstWord = first >> 5;
+    size_t lastWord = (last - 1) >> 5;
+    unsigned int firstMask = 0xffffffff << (first & 31);
+    unsigned int lastMask = 0xffffffff >> (31 - ((last - 1) & 31));
+    if (firstWord == lastWord)
+    {
+        mBits[firstWord] &= ~(firstMask & lastMask);
+        return;
+    }
+
+    mBits[firstWord] &= ~firstMask;
+    if (lastWord > firstWord + 1)
+    {
+        __memclear__(mBits + firstWord + 1, (lastWord - firstWord - 1) * sizeof(unsigned int));
+    }
+    mBits[lastWord] &= ~lastMask;
+}
+
+void GCBitmap::ClearRangeAtomic(void * start, void * end)
+{
+    size_t first = GetIndex(start);
+    size_t last = GetIndex(end);
+    if (first >= last)
+    {
+        return;
+    }
+
+    size_t firstWord = first >> 5;
+    size_t lastWord = (last - 1) >> 5;
+    unsigned int firstMask = 0xffffffff << (first & 31);
+    unsigned int lastMask = 0xffffffff >> (31 - ((last - 1) & 31));
+    if (firstWord == lastWord)
+    {
+        _InterlockedAnd(reinterpret_cast<volatile long *>(&mBits[firstWord]), ~(long)(firstMask & lastMask));
+        return;
+    }
+
+    // Only the first and the last words can have bits outside the range
+    _InterlockedAnd(reinterpret_cast<volatile long *>(&mBits[firstWord]), ~(long)firstMask);
+    if (lastWord > firstWord + 1)
+    {
+        __memclear__(mBits + firstWord + 1, (lastWord - firstWord - 1) * sizeof(unsigned int));
+    }
+    _InterlockedAnd(reinterpret_cast<volatile long *>(&mBits[lastWord]), ~(long)lastMask);
+}
+
+int GCBitmap::TakeRange(GCBitmap & source, void * start, void * end)
+{
+    CROSSNET_ASSERT((mBase == source.mBase) && (mSize == source.mSize), "The bitmaps must cover the same memory!");
+    size_t first = GetIndex(start);
+    size_t last = GetIndex(end);
+    CROSSNET_ASSERT(((first | last) & 31) == 0, "The range must be on a 32 granules boundary!");
+
+    int count = 0;
+    for (size_t word = first >> 5 ; word < (last >> 5) ; ++word)
+    {
+        unsigned int bits = source.mBits[word];
+        mBits[word] = bits;
+        if (bits != 0)
+        {
+            source.mBits[word] = 0;
+            count += CountBits(bits);
+        }
+    }
+    return (count);
+}
+
+int GCBitmap::CountRange(void * start, void * end) const
+{
+    size_t first = GetIndex(start);
+    size_t last = GetIndex(end);
+    if (first >= last)
+    {
+        return (0);
+    }
+
+    size_t firstWord = first >> 5;
+    size_t lastWord = (last - 1) >> 5;
+    unsigned int firstMask = 0xffffffff << (first & 31);
+    unsigned int lastMask = 0xffffffff >> (31 - ((last - 1) & 31));
+    if (firstWord == lastWord)
+    {
+        return (CountBits(mBits[firstWord] & firstMask & lastMask));
+    }
+
+    int count = CountBits(mBits[firstWord] & firstMask);
+    for (size_t word = firstWord + 1 ; word < lastWord ; ++word)
+    {
+        unsigned int bits = mBits[word];
+        if (bits != 0)
+        {
+            count += CountBits(bits);
+        }
+    }
+    count += CountBits(mBits[lastWord] & lastMask);
+    return (count);
+}
+
+void * GCBitmap::FindNextSet(void * start, void * end) const
+{
+    return (FindNext(start, end, 0));
+}
+
+void * GCBitmap::FindNextClear(void * start, void * end) const
+{
+    return (FindNext(start, end, 0xffffffff));
+}
+
+void * GCBitmap::FindPrevSet(void * start, void * pointer) const
+{
+    if (pointer < start)
+    {
+        return (NULL);
+    }
+
+    size_t first = GetIndex(start);
+    size_t index = GetIndex(pointer);
+    size_t firstWord = first >> 5;
+    size_t word = index >> 5;
+    // Mask out the granules after pointer
+    unsigned int mask = mBits[word] & (0xffffffff >> (31 - (index & 31)));
+    for ( ; ; )
+    {
+        if (mask != 0)
+        {
+            unsigned long bit;
+            _BitScanReverse(&bit, mask);
+            size_t found = (word << 5) + bit;
+            if (found < first)
+            {
+                return (NULL);
+            }
+            return (GetPointer(found));
+        }
+        if (word == firstWord)
+        {
+            return (NULL);
+        }
+        --word;
+        mask = mBits[word];
+    }
+}
+
+void * GCBitmap::FindNext(void * start, void * end, unsigned int invert) const
+{
+    size_t index = GetIndex(start);
+    size_t last = GetIndex(end);
+    if (index >= last)
+    {
+        return (end);
+    }
+
+    size_t word = index >> 5;
+    size_t lastWord = (last - 1) >> 5;
+    // Mask out the granules before start
+    unsigned int mask = (mBits[word] ^ invert) & (0xffffffff << (index & 31));
+    for ( ; ; )
+    {
+        if (mask != 0)
+        {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            size_t found = (word << 5) + bit;
+            if (found >= last)
+            {
+                return (end);
+            }
+            return (GetPointer(found));
+        }
+        if (++word > lastWord)
+        {
+            return (end);
+        }
+        mask = mBits[word] ^ invert;
+    }
+}
+
+}
@@ -0,0 +1,132 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CrossNetRuntime/GC/GCCardTable.h"
+#include "CrossNetRuntime/GC/GCVirtualMemory.h"
+#include "CrossNetRuntime/Assert.h"
+
+namespace CrossNetRuntime
+{
+
+GCCardTable::GCCardTable()
+    :
+    mBase(NULL),
+    mSize(0),
+    mCards(NULL),
+    mCardsSize(0)
+{
+    // Do nothing...
+}
+
+void GCCardTable::Setup(void * base, size_t size)
+{
+    CROSSNET_ASSERT(mCards == NULL, "The card table is already setup!");
+
+    mBase = static_cast<unsigned char *>(base);
+    mSize = size;
+
+    // One byte per card, rounded to the next page
+    size_t numCards = (size + CARD_SIZE - 1) >> CARD_SHIFT;
+    size_t pageSize = GCVirtualMemory::GetPageSize();
+    mCardsSize = (numCards + pageSize - 1) & ~(pageSize - 1);
+
+    mCards = static_cast<unsigned char *>(GCVirtualMemory::Reserve(mCardsSize));
+    CROSSNET_FATAL(mCards != NULL, "Could not reserve the card table!");
+    bool committed = GCVirtualMemory::Commit(mCards, mCardsSize);
+    CROSSNET_FATAL(committed, "Could not commit the card table!");
+    committed;
+}
+
+void GCCardTable::Teardown()
+{
+    if (mCards != NULL)
+    {
+        GCVirtualMemory::Release(mCards, mCardsSize);
+    }
+    mBase = NULL;
+    mSize = 0;
+    mCards = NULL;
+    mCardsSize = 0;
+}
+
+void GCCardTable::MarkRange(void * start, void * end)
+{
+    if (start >= end)
+    {
+        return;
+    }
+    size_t first = GetIndex(start);
+    size_t last = GetIndex(static_cast<unsigned char *>(end) - 1);
+    __memset__(mCards + first, DIRTY_CARD, last - first + 1);
+}
+
+void GCCardTable::ClearRange(void * start, void * end)
+{
+    if (start >= end)
+    {
+        return;
+    }
+    size_t first = GetIndex(start);
+    size_t last = GetIndex(static_cast<unsigned char *>(end) - 1);
+    __memclear__(mCards + first, last - first + 1);
+}
+
+bool GCCardTable::FindDirtyRun(void * start, void * end, unsigned char * & runStart, unsigned char * & runEnd) const
+{
+    if (start >= end)
+    {
+        return (false);
+    }
+    size_t index = GetIndex(start);
+    size_t last = GetIndex(static_cast<unsigned char *>(end) - 1) + 1;
+
+    // Skip the clean cards, one by one until the index is aligned, then 4 at a time
+    while ((index < last) && (mCards[index] == CLEAN_CARD))
+    {
+        ++index;
+        if ((index & 3) == 0)
+        {
+            while ((index + 4 <= last) && (*reinterpret_cast<const unsigned int *>(mCards + index) == 0))
+            {
+                index += 4;
+            }
+        }
+    }
+    if (index >= last)
+    {
+        return (false);
+    }
+
+    size_t endIndex = index + 1;
+    while ((endIndex < last) && (mCards[endIndex] != CLEAN_CARD))
+    {
+        ++endIndex;
+    }
+
+    runStart = mBase + (index << CARD_SHIFT);
+    runEnd = mBase + (endIndex << CARD_SHIFT);
+    if (runStart < start)
+    {
+        runStart = static_cast<unsigned char *>(start);
+    }
+    if (runEnd > end)
+    {
+        runEnd = static_cast<unsigned char *>(end);
+    }
+    return (true);
+}
+
+}
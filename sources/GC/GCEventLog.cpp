@@ -0,0 +1,355 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CrossNetRuntime/GC/GCEventLog.h"
+#include "CrossNetRuntime/GC/GCClock.h"
+#include "CrossNetRuntime/Assert.h"
+
+// For the interlocked operations
+#include <intrin.h>
+#include <algorithm>
+#include <vector>
+
+namespace CrossNetRuntime
+{
+
+namespace
+{
+    const char * const  sKindNames[] =
+    {
+        "Collect",
+        "Step",
+        "Sweep",
+    };
+
+    const char * const  sPhaseNames[GCEventLog::NUM_PHASES] =
+    {
+        "Permanent roots",
+        "Stack",
+        "Statics",
+        "Mark",
+        "Compact",
+        "Sweep",
+    };
+
+    // Nearest rank, the pauses must be sorted
+    long long Percentile(const std::vector<long long> & pauses, int percent)
+    {
+        size_t rank = (pauses.size() * percent + 99) / 100;
+        if (rank == 0)
+        {
+            rank = 1;
+        }
+        return (pauses[rank - 1]);
+    }
+}
+
+GCEventLog::Slot *          GCEventLog::sSlots = NULL;
+int                         GCEventLog::sLogSize = 0;
+volatile long               GCEventLog::sNextIndex = 0;
+CROSSNET_THREAD_LOCAL GCEventLog::Event    GCEventLog::sCurrentEvent;
+volatile long               GCEventLog::sObjectsFreed = 0;
+volatile long               GCEventLog::sBytesFreed = 0;
+volatile long               GCEventLog::sFreeRuns = 0;
+long long                   GCEventLog::sSweepStart = -1;
+long long                   GCEventLog::sSweepDuration = 0;
+
+void GCEventLog::Setup(const ::CrossNetRuntime::InitOptions & options)
+{
+    int logSize = DEFAULT_LOG_SIZE;
+    if (options.mGcEventLogSize > 0)
+    {
+        // Power of 2, so the slot of an index is a simple mask
+        logSize = 1;
+        while (logSize < options.mGcEventLogSize)
+        {
+            logSize <<= 1;
+        }
+    }
+    sSlots = static_cast<Slot *>(options.mUnmanagedAllocateCallback(logSize * sizeof(Slot)));
+    CROSSNET_FATAL(sSlots != NULL, "Could not allocate the GC event log!");
+    __memclear__(sSlots, logSize * sizeof(Slot));
+    sLogSize = logSize;
+    sNextIndex = 0;
+
+    __memclear__(&sCurrentEvent, sizeof(sCurrentEvent));
+    sObjectsFreed = 0;
+    sBytesFreed = 0;
+    sFreeRuns = 0;
+    sSweepStart = -1;
+    sSweepDuration = 0;
+}
+
+void GCEventLog::Teardown()
+{
+    if (sSlots != NULL)
+    {
+        ::CrossNetRuntime::GetOptions().mUnmanagedFreeCallback(sSlots);
+        sSlots = NULL;
+    }
+    sLogSize = 0;
+}
+
+void GCEventLog::BeginEvent(EventKind kind, int generation)
+{
+    Event & event = sCurrentEvent;
+    event.mStart = GCClock::GetMicroseconds();
+    event.mDuration = 0;
+    for (int i = 0 ; i < NUM_PHASES ; ++i)
+    {
+        event.mPhaseStarts[i] = -1;
+        event.mPhaseDurations[i] = 0;
+    }
+    event.mKind = kind;
+    event.mGeneration = generation;
+}
+
+void GCEventLog::AddPhase(Phase phase, long long start, long long end)
+{
+    Event & event = sCurrentEvent;
+    if (event.mPhaseStarts[phase] < 0)
+    {
+        event.mPhaseStarts[phase] = (int)(start - event.mStart);
+    }
+    event.mPhaseDurations[phase] += (int)(end - start);
+}
+
+void GCEventLog::EndEvent(int bytesAfter, int compactedBytes)
+{
+    Event & event = sCurrentEvent;
+    event.mDuration = GCClock::GetMicroseconds() - event.mStart;
+    event.mBytesAfter = bytesAfter;
+    event.mCompactedBytes = compactedBytes;
+
+    // What has been freed since the previous event (the sweeping threads are done)
+    event.mObjectsFreed = _InterlockedExchange(&sObjectsFreed, 0);
+    event.mFreeRuns = _InterlockedExchange(&sFreeRuns, 0);
+    event.mBytesBefore = bytesAfter + _InterlockedExchange(&sBytesFreed, 0);
+    Record(event);
+}
+
+void GCEventLog::AddFreed(int numObjects, int bytes, int numRuns)
+{
+    if (numObjects != 0)
+    {
+        _InterlockedExchangeAdd(&sObjectsFreed, numObjects);
+        _InterlockedExchangeAdd(&sBytesFreed, bytes);
+    }
+    if (numRuns != 0)
+    {
+        _InterlockedExchangeAdd(&sFreeRuns, numRuns);
+    }
+}
+
+void GCEventLog::AddSweepChunk(long long start, long long end)
+{
+    if (sSweepStart < 0)
+    {
+        sSweepStart = start;
+    }
+    sSweepDuration += end - start;
+}
+
+void GCEventLog::EndSweep(int bytesAfter)
+{
+    // Recorded directly, the step that finished the sweep (if any) is still being built
+    Event event;
+    __memclear__(&event, sizeof(event));
+    event.mStart = (sSweepStart >= 0) ? sSweepStart : GCClock::GetMicroseconds();
+    event.mDuration = sSweepDuration;
+    for (int i = 0 ; i < NUM_PHASES ; ++i)
+    {
+        event.mPhaseStarts[i] = -1;
+    }
+    event.mKind = EVENT_SWEEP;
+    event.mGeneration = -1;
+    event.mBytesAfter = bytesAfter;
+    event.mObjectsFreed = _InterlockedExchange(&sObjectsFreed, 0);
+    event.mFreeRuns = _InterlockedExchange(&sFreeRuns, 0);
+    event.mBytesBefore = bytesAfter + _InterlockedExchange(&sBytesFreed, 0);
+    Record(event);
+
+    sSweepStart = -1;
+    sSweepDuration = 0;
+}
+
+void GCEventLog::Record(const Event & event)
+{
+    if (sSlots == NULL)
+    {
+        return;
+    }
+    // Several writers can't get the same slot (unless the log wraps around during a write, the readers detect it)
+    long index = _InterlockedIncrement(&sNextIndex) - 1;
+    Slot * slot = &sSlots[index & (sLogSize - 1)];
+    _InterlockedExchange(&slot->mSequence, 2 * index + 1);
+    slot->mEvent = event;
+    // x86 doesn't reorder the stores, only the compiler has to be prevented to (same for the loads in ReadSlot())
+    _ReadWriteBarrier();
+    slot->mSequence = 2 * (index + 1);
+}
+
+bool GCEventLog::ReadSlot(long index, Event & event)
+{
+    Slot * slot = &sSlots[index & (sLogSize - 1)];
+    long sequence = slot->mSequence;
+    if (sequence != 2 * (index + 1))
+    {
+        // Being written, or already overwritten by a more recent event
+        return (false);
+    }
+    _ReadWriteBarrier();
+    event = slot->mEvent;
+    _ReadWriteBarrier();
+    return (slot->mSequence == sequence);
+}
+
+int GCEventLog::GetEvents(Event * events, int maxEvents)
+{
+    if (sSlots == NULL)
+    {
+        return (0);
+    }
+    long next = sNextIndex;
+    long first = next - ((maxEvents < sLogSize) ? maxEvents : sLogSize);
+    if (first < 0)
+    {
+        first = 0;
+    }
+
+    int count = 0;
+    for (long index = first ; index < next ; ++index)
+    {
+        if (ReadSlot(index, events[count]))
+        {
+            ++count;
+        }
+    }
+    return (count);
+}
+
+void GCEventLog::GetPauseStatistics(PauseStatistics & statistics)
+{
+    __memclear__(&statistics, sizeof(statistics));
+
+    std::vector<Event> events(sLogSize);
+    int numEvents = (sLogSize != 0) ? GetEvents(&events[0], sLogSize) : 0;
+    std::vector<long long> pauses;
+    pauses.reserve(numEvents);
+    for (int i = 0 ; i < numEvents ; ++i)
+    {
+        if (events[i].mKind != EVENT_SWEEP)
+        {
+            pauses.push_back(events[i].mDuration);
+            statistics.mTotal += events[i].mDuration;
+        }
+    }
+    if (pauses.empty())
+    {
+        return;
+    }
+
+    std::sort(pauses.begin(), pauses.end());
+    statistics.mNumPauses = (int)pauses.size();
+    statistics.mP50 = Percentile(pauses, 50);
+    statistics.mP90 = Percentile(pauses, 90);
+    statistics.mP99 = Percentile(pauses, 99);
+    statistics.mMax = pauses.back();
+}
+
+void GCEventLog::DumpPauseHistogram(FILE * file)
+{
+    PauseStatistics statistics;
+    GetPauseStatistics(statistics);
+    fprintf(file, "GC pauses: %d, total %lld us\n", statistics.mNumPauses, statistics.mTotal);
+    if (statistics.mNumPauses == 0)
+    {
+        return;
+    }
+    fprintf(file, "p50 %lld us, p90 %lld us, p99 %lld us, max %lld us\n", statistics.mP50, statistics.mP90, statistics.mP99, statistics.mMax);
+
+    // One bucket per power of 2 (in microseconds), up to the max
+    const int NUM_BUCKETS = 40;
+    int buckets[NUM_BUCKETS];
+    __memclear__(buckets, sizeof(buckets));
+    std::vector<Event> events(sLogSize);
+    int numEvents = GetEvents(&events[0], sLogSize);
+    int lastBucket = 0;
+    for (int i = 0 ; i < numEvents ; ++i)
+    {
+        if (events[i].mKind == EVENT_SWEEP)
+        {
+            continue;
+        }
+        int bucket = 0;
+        while ((bucket < NUM_BUCKETS - 1) && (events[i].mDuration >= (2LL << bucket)))
+        {
+            ++bucket;
+        }
+        ++buckets[bucket];
+        if (bucket > lastBucket)
+        {
+            lastBucket = bucket;
+        }
+    }
+    for (int bucket = 0 ; bucket <= lastBucket ; ++bucket)
+    {
+        long long low = (bucket == 0) ? 0 : (1LL << bucket);
+        fprintf(file, "%10lld - %10lld us: %d\n", low, (2LL << bucket) - 1, buckets[bucket]);
+    }
+}
+
+void GCEventLog::DumpChromeTrace(FILE * file)
+{
+    std::vector<Event> events(sLogSize);
+    int numEvents = (sLogSize != 0) ? GetEvents(&events[0], sLogSize) : 0;
+
+    // The pauses are on the thread 1, the lazy sweeps (spread over the allocations) on the thread 2
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    for (int i = 0 ; i < numEvents ; ++i)
+    {
+        const Event & event = events[i];
+        int tid = (event.mKind == EVENT_SWEEP) ? 2 : 1;
+        fprintf(file, "%s{\"name\":\"%s", first ? "" : ",\n", sKindNames[event.mKind]);
+        if (event.mGeneration >= 0)
+        {
+            fprintf(file, " gen %d", event.mGeneration);
+        }
+        fprintf(file, "\",\"cat\":\"gc\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld,", tid, event.mStart, event.mDuration);
+        fprintf(file, "\"args\":{\"bytesBefore\":%d,\"bytesAfter\":%d,\"compactedBytes\":%d,\"objectsFreed\":%d,\"freeRuns\":%d}}",
+                    event.mBytesBefore, event.mBytesAfter, event.mCompactedBytes, event.mObjectsFreed, event.mFreeRuns);
+        first = false;
+
+        for (int phase = 0 ; phase < NUM_PHASES ; ++phase)
+        {
+            if (event.mPhaseStarts[phase] < 0)
+            {
+                continue;
+            }
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"gc\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%d}",
+                        sPhaseNames[phase], tid, event.mStart + event.mPhaseStarts[phase], event.mPhaseDurations[phase]);
+        }
+
+        if (event.mBytesAfter != 0)
+        {
+            fprintf(file, ",\n{\"name\":\"Live bytes\",\"ph\":\"C\",\"pid\":1,\"ts\":%lld,\"args\":{\"bytes\":%d}}",
+                        event.mStart + event.mDuration, event.mBytesAfter);
+        }
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+}
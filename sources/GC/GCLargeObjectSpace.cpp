@@ -0,0 +1,351 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CrossNetRuntime/GC/GCLargeObjectSpace.h"
+#include "CrossNetRuntime/GC/GCVirtualMemory.h"
+#include "CrossNetRuntime/Assert.h"
+
+// For _BitScanForward and _BitScanReverse
+#include <intrin.h>
+
+namespace CrossNetRuntime
+{
+
+unsigned char *     GCLargeObjectSpace::sBase = NULL;
+size_t              GCLargeObjectSpace::sSize = 0;
+int *               GCLargeObjectSpace::sPageMap = NULL;
+int *               GCLargeObjectSpace::sNextRun = NULL;
+int *               GCLargeObjectSpace::sPrevRun = NULL;
+int                 GCLargeObjectSpace::sBins[NUM_BINS];
+unsigned int        GCLargeObjectSpace::sBinMask = 0;
+int                 GCLargeObjectSpace::sNumPages = 0;
+int                 GCLargeObjectSpace::sPageShift = 0;
+int                 GCLargeObjectSpace::sThreshold = 0x7fffffff;     // Disabled by default
+
+void GCLargeObjectSpace::Setup(const ::CrossNetRuntime::InitOptions & options)
+{
+    sThreshold = 0x7fffffff;
+    if (options.mLargeObjectSpaceSize == 0)
+    {
+        // Disabled, large objects are allocated in the main buffer like any other object
+        return;
+    }
+
+    int pageSize = GCVirtualMemory::GetPageSize();
+    sPageShift = 0;
+    while ((1 << sPageShift) < pageSize)
+    {
+        ++sPageShift;
+    }
+    CROSSNET_ASSERT((1 << sPageShift) == pageSize, "The page size must be a power of 2!");
+
+    sNumPages = (options.mLargeObjectSpaceSize + pageSize - 1) >> sPageShift;
+    sSize = (size_t)sNumPages << sPageShift;
+    if (options.mIncrementalCollection || options.mGenerationalCollection)
+    {
+        // The incremental marking rescans the objects written to during the marking
+        //  And the young collections the old objects written to since the last collection
+        sBase = static_cast<unsigned char *>(GCVirtualMemory::ReserveWatched(sSize));
+    }
+    else
+    {
+        sBase = static_cast<unsigned char *>(GCVirtualMemory::Reserve(sSize));
+    }
+    CROSSNET_FATAL(sBase != NULL, "Could not reserve the address space for the large object space!");
+
+    sPageMap = static_cast<int *>(options.mUnmanagedAllocateCallback(sNumPages * sizeof(int)));
+    __memclear__(sPageMap, sNumPages * sizeof(int));
+    sNextRun = static_cast<int *>(options.mUnmanagedAllocateCallback(sNumPages * sizeof(int)));
+    sPrevRun = static_cast<int *>(options.mUnmanagedAllocateCallback(sNumPages * sizeof(int)));
+    for (int i = 0 ; i < NUM_BINS ; ++i)
+    {
+        sBins[i] = NO_RUN;
+    }
+    sBinMask = 0;
+
+    // At the beginning, all the pages are in one single free run
+    InsertRun(0, sNumPages);
+
+    // An object smaller than a few pages would waste too much memory in its last page
+    const int DEFAULT_THRESHOLD = 16 * 1024;
+    sThreshold = options.mLargeObjectThreshold;
+    if (sThreshold == 0)
+    {
+        sThreshold = DEFAULT_THRESHOLD;
+    }
+    if (sThreshold < pageSize)
+    {
+        sThreshold = pageSize;
+    }
+}
+
+void GCLargeObjectSpace::Teardown()
+{
+    if (sBase == NULL)
+    {
+        return;
+    }
+    GCVirtualMemory::Release(sBase, sSize);
+    ::CrossNetRuntime::GetOptions().mUnmanagedFreeCallback(sPageMap);
+    ::CrossNetRuntime::GetOptions().mUnmanagedFreeCallback(sNextRun);
+    ::CrossNetRuntime::GetOptions().mUnmanagedFreeCallback(sPrevRun);
+    sBase = NULL;
+    sSize = 0;
+    sPageMap = NULL;
+    sNextRun = NULL;
+    sPrevRun = NULL;
+    sBinMask = 0;
+    sNumPages = 0;
+    sThreshold = 0x7fffffff;
+}
+
+void * GCLargeObjectSpace::Allocate(int size)
+{
+    CROSSNET_ASSERT(sBase != NULL, "The large object space is disabled!");
+
+    int pageSize = 1 << sPageShift;
+    int numPages = (size + pageSize - 1) >> sPageShift;
+
+    // Good fit: the first run of the bin of the size if it is big enough,
+    //  otherwise the first run of the next bin not empty (all its runs are big enough)
+    int bin = GetBinIndex(numPages);
+    int page = sBins[bin];
+    if ((page == NO_RUN) || (-sPageMap[page] < numPages))
+    {
+        unsigned int mask = sBinMask & ~((2u << bin) - 1);
+        if (mask != 0)
+        {
+            unsigned long biggerBin;
+            _BitScanForward(&biggerBin, mask);
+            page = sBins[biggerBin];
+        }
+        else if (page != NO_RUN)
+        {
+            // Last chance, first fit through the other runs of the same bin
+            do
+            {
+                page = sNextRun[page];
+            }
+            while ((page != NO_RUN) && (-sPageMap[page] < numPages));
+        }
+    }
+    if (page == NO_RUN)
+    {
+        // Not enough contiguous pages
+        return (NULL);
+    }
+
+    unsigned char * object = sBase + ((size_t)page << sPageShift);
+    if (GCVirtualMemory::Commit(object, (size_t)numPages << sPageShift) == false)
+    {
+        // The OS doesn't have any memory left
+        return (NULL);
+    }
+
+    // Split the run, the remaining pages go back to their bin
+    int freePages = -sPageMap[page];
+    RemoveRun(page);
+    sPageMap[page + freePages - 1] = 0;
+    sPageMap[page] = numPages;
+    if (freePages > numPages)
+    {
+        InsertRun(page + numPages, freePages - numPages);
+    }
+
+    // The pages come fresh from the OS, they are already zeroed
+    return (object);
+}
+
+void GCLargeObjectSpace::Free(void * object)
+{
+    CROSSNET_ASSERT(IsObjectStart(object), "The object was not allocated in the large object space!");
+    int page = (int)(((unsigned char *)object - sBase) >> sPageShift);
+
+    int numPages = sPageMap[page];
+    // Give the pages back to the OS right away, the next commit will get zero pages
+    GCVirtualMemory::Decommit(object, (size_t)numPages << sPageShift);
+    sPageMap[page] = 0;
+
+    // Coalesce with the free run before (its last page is tagged)
+    int start = page;
+    if ((page > 0) && (sPageMap[page - 1] < 0))
+    {
+        int previousPages = -sPageMap[page - 1];
+        start = page - previousPages;
+        RemoveRun(start);
+        sPageMap[start] = 0;
+        sPageMap[page - 1] = 0;
+        numPages += previousPages;
+    }
+
+    // And with the free run after
+    int next = start + numPages;
+    if ((next < sNumPages) && (sPageMap[next] < 0))
+    {
+        int nextPages = -sPageMap[next];
+        RemoveRun(next);
+        sPageMap[next] = 0;
+        sPageMap[next + nextPages - 1] = 0;
+        numPages += nextPages;
+    }
+
+    InsertRun(start, numPages);
+}
+
+int GCLargeObjectSpace::GetBinIndex(int numPages)
+{
+    // One bin per power of 2, a run of the bin N has between 2^N and 2^(N+1)-1 pages
+    CROSSNET_ASSERT(numPages > 0, "A run must have at least one page!");
+    unsigned long index;
+    _BitScanReverse(&index, (unsigned long)numPages);
+    return (int)(index);
+}
+
+void GCLargeObjectSpace::InsertRun(int page, int numPages)
+{
+    // Tag both ends of the run
+    sPageMap[page] = -numPages;
+    sPageMap[page + numPages - 1] = -numPages;
+
+    int bin = GetBinIndex(numPages);
+    int head = sBins[bin];
+    sNextRun[page] = head;
+    sPrevRun[page] = NO_RUN;
+    if (head != NO_RUN)
+    {
+        sPrevRun[head] = page;
+    }
+    sBins[bin] = page;
+    sBinMask |= (1u << bin);
+}
+
+void GCLargeObjectSpace::RemoveRun(int page)
+{
+    CROSSNET_ASSERT(sPageMap[page] < 0, "This is not a free run!");
+    int bin = GetBinIndex(-sPageMap[page]);
+    int next = sNextRun[page];
+    int previous = sPrevRun[page];
+    if (next != NO_RUN)
+    {
+        sPrevRun[next] = previous;
+    }
+    if (previous != NO_RUN)
+    {
+        sNextRun[previous] = next;
+    }
+    else
+    {
+        CROSSNET_ASSERT(sBins[bin] == page, "The bins are corrupted!");
+        sBins[bin] = next;
+        if (next == NO_RUN)
+        {
+            sBinMask &= ~(1u << bin);
+        }
+    }
+}
+
+bool GCLargeObjectSpace::IsObjectStart(void * pointer)
+{
+    if (InLargeObjectSpace(pointer) == false)
+    {
+        return (false);
+    }
+    size_t offset = (unsigned char *)pointer - sBase;
+    if ((offset & ((1 << sPageShift) - 1)) != 0)
+    {
+        // Objects always start at the beginning of a page
+        return (false);
+    }
+    return (sPageMap[offset >> sPageShift] > 0);
+}
+
+void * GCLargeObjectSpace::FindObjectContaining(void * pointer)
+{
+    if (InLargeObjectSpace(pointer) == false)
+    {
+        return (NULL);
+    }
+    int page = (int)(((unsigned char *)pointer - sBase) >> sPageShift);
+    // The other pages of an object are 0, go back to its first page
+    //  In a free run, we stop at the start of the run (or at its last page)
+    int first = page;
+    while ((sPageMap[first] == 0) && (first > 0))
+    {
+        --first;
+    }
+    int run = sPageMap[first];
+    if ((run > 0) && (first + run > page))
+    {
+        return (sBase + ((size_t)first << sPageShift));
+    }
+    return (NULL);
+}
+
+void * GCLargeObjectSpace::GetBase()
+{
+    return (sBase);
+}
+
+size_t GCLargeObjectSpace::GetReservedSize()
+{
+    return (sSize);
+}
+
+void * GCLargeObjectSpace::GetFirstObject()
+{
+    if (sBase == NULL)
+    {
+        return (NULL);
+    }
+    int page = FindObject(0);
+    if (page < 0)
+    {
+        return (NULL);
+    }
+    return (sBase + ((size_t)page << sPageShift));
+}
+
+void * GCLargeObjectSpace::GetNextObject(void * object)
+{
+    int page = (int)(((unsigned char *)object - sBase) >> sPageShift);
+    int run = sPageMap[page];
+    CROSSNET_ASSERT(run > 0, "The object has been freed already!");
+    page += run;
+    page = FindObject(page);
+    if (page < 0)
+    {
+        return (NULL);
+    }
+    return (sBase + ((size_t)page << sPageShift));
+}
+
+int GCLargeObjectSpace::FindObject(int page)
+{
+    // Returns the first page of the first object at or after page (-1 if none)
+    //  page must be the first page of a run
+    while (page < sNumPages)
+    {
+        int run = sPageMap[page];
+        CROSSNET_ASSERT(run != 0, "The page map is corrupted!");
+        if (run > 0)
+        {
+            return (page);
+        }
+        page -= run;
+    }
+    return (-1);
+}
+
+}
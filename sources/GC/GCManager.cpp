@@ -15,8 +15,18 @@
 
 #include "CrossNetRuntime/GC/GCManager.h"
 #include "CrossNetRuntime/GC/GCAllocator.h"
+#include "CrossNetRuntime/GC/GCAllocationProfiler.h"
+#include "CrossNetRuntime/GC/GCPolicy.h"
+#include "CrossNetRuntime/GC/GCClock.h"
+#include "CrossNetRuntime/GC/GCEventLog.h"
+#include "CrossNetRuntime/GC/GCVirtualMemory.h"
+#include "CrossNetRuntime/GC/GCThread.h"
+#include "CrossNetRuntime/GC/GCParallelSweeper.h"
+#include "CrossNetRuntime/GC/GCShadowStack.h"
 #include "CrossNetRuntime/CrossNetRuntime.h"
-#include <time.h>
+
+// For the SSE2 filtering of the stack
+#include <emmintrin.h>
 
 namespace CrossNetRuntime
 {
@@ -27,194 +37,1728 @@ namespace CrossNetRuntime
 unsigned char   GCManager::sCurrentMarker = (unsigned char)(~::System::Object::__MARKER_AT_CREATION__);
 bool            GCManager::sCollecting = false;
 int             GCManager::sNumCollections = 0;
+int             GCManager::sLiveBytes = 0;
 double          GCManager::sNumSecondsInGcManager = 0.0f;
 double          GCManager::sNumSecondsInTracingPermanent = 0.0f;
 double          GCManager::sNumSecondsInTracingStack = 0.0f;
 double          GCManager::sNumSecondsInTracingStatics = 0.0f;
 double          GCManager::sNumSecondsInCollect = 0.0f;
 void *          GCManager::sTopOfStack = NULL;
+GCMarkStack     GCManager::sMarkStack;
+bool            GCManager::sIncrementalEnabled = false;
+GCManager::Phase    GCManager::sPhase = GCManager::PHASE_IDLE;
+#ifndef CN_GC_HEADER_MARK
+GCBitmap        GCManager::sMarkBitmap;
+GCBitmap        GCManager::sObjectStartBitmap;
+bool            GCManager::sRecordObjectStarts = false;
+bool            GCManager::sPrecleaned = false;
+unsigned char * GCManager::sMarkingLimit = NULL;
+unsigned char * GCManager::sSweepCursor = NULL;
+std::vector<void *> GCManager::sLargeObjectsAllocatedBlack;
+void *          GCManager::sSweeperThread = NULL;
+void *          GCManager::sSweeperSemaphore = NULL;
+volatile bool   GCManager::sSweeperShutdown = false;
+GCCardTable     GCManager::sCardTable;
+GCCardTable     GCManager::sLargeObjectCardTable;
+GCCardTable     GCManager::sPinnedCards;
+GCCardTable     GCManager::sEvacuatedCards;
+unsigned char * GCManager::sCopyCurrent = NULL;
+unsigned char * GCManager::sCopyEnd = NULL;
+#endif
+bool            GCManager::sGenerationalEnabled = false;
+bool            GCManager::sGeneratedWriteBarrier = false;
+int             GCManager::sGeneration = GCManager::MAX_GENERATION;
+int             GCManager::sPointerFreeLiveBytes = 0;
+bool            GCManager::sCompactionEnabled = false;
+bool            GCManager::sCompactionRequested = false;
+bool            GCManager::sLastCollectionCompact = false;
+GCManager::CompactionPhase  GCManager::sCompactionPhase = GCManager::COMPACTION_NONE;
+int             GCManager::sCompactedBytes = 0;
+bool            GCManager::sLazySweepingEnabled = false;
+bool            GCManager::sSweepingChunk = false;
+
+namespace
+{
+    // A negative deadline means no deadline
+    CROSSNET_FINLINE
+    bool IsPastDeadline(long long deadline)
+    {
+        return ((deadline >= 0) && (GCClock::GetMicroseconds() >= deadline));
+    }
+}
+
+void GCManager::Setup(const InitOptions & options)
+{
+    // Don't store anything, we'll call GetOptions() as needed
+
+    GCAllocationProfiler::Setup(options);
+    GCPolicy::Setup(options);
+    GCShadowStack::Setup(options);
+    GCEventLog::Setup(options);
+    // Also used by the regions, even without card table
+    sGeneratedWriteBarrier = options.mGeneratedWriteBarrier;
+
+#ifndef CN_GC_HEADER_MARK
+    // The mark bitmap covers the whole address space the main buffer can use
+    //  (GCAllocator is setup before the GCManager)
+    unsigned char * heapBase = GCAllocator::GetHeapBase();
+    sMarkBitmap.Setup(heapBase, GCAllocator::GetHeapEnd() - heapBase);
+
+    sIncrementalEnabled = options.mIncrementalCollection;
+    sGenerationalEnabled = options.mGenerationalCollection;
+    sCompactionEnabled = options.mCompaction;
+    if (sIncrementalEnabled || sGenerationalEnabled || sCompactionEnabled)
+    {
+        sObjectStartBitmap.Setup(heapBase, GCAllocator::GetHeapEnd() - heapBase);
+    }
+    if (sCompactionEnabled)
+    {
+        sPinnedCards.Setup(heapBase, GCAllocator::GetHeapEnd() - heapBase);
+        sEvacuatedCards.Setup(heapBase, GCAllocator::GetHeapEnd() - heapBase);
+    }
+    if (sGenerationalEnabled)
+    {
+        // The cards cover the whole address space of the main buffer and of the large object space
+        sCardTable.Setup(heapBase, GCAllocator::GetHeapEnd() - heapBase);
+        if (GCLargeObjectSpace::GetBase() != NULL)
+        {
+            sLargeObjectCardTable.Setup(GCLargeObjectSpace::GetBase(), GCLargeObjectSpace::GetReservedSize());
+        }
+    }
+
+    sLazySweepingEnabled = options.mLazySweeping;
+    if (sLazySweepingEnabled && (GCAllocator::sThreadAllocBufferSize != 0))
+    {
+        // The allocator is thread safe, the remaining chunks can be swept in the background
+        //  (Otherwise they are swept by the allocations and the steps only)
+        sSweeperShutdown = false;
+        sSweeperSemaphore = GCThread::NewSemaphore();
+        if (sSweeperSemaphore != NULL)
+        {
+            sSweeperThread = GCThread::Start(BackgroundSweeperThread, NULL);
+        }
+    }
+#endif
+
+    sMarkStack.Setup(MARK_STACK_RESERVED_SIZE);
+    GCParallelMarker::Setup(options);
+#ifndef CN_GC_HEADER_MARK
+    GCParallelSweeper::Setup(options);
+#endif
+}
+
+void GCManager::Teardown()
+{
+    // Do one last collect
+    Collect(MAX_GENERATION, true);
+
+    // Here we should make sure that no more object is allocated
+    //  TODO:   Make sure of that!
+
+#ifndef CN_GC_HEADER_MARK
+    if (sSweeperThread != NULL)
+    {
+        // The last collect swept everything, the thread is waiting for the next one
+        sSweeperShutdown = true;
+        GCThread::SignalSemaphore(sSweeperSemaphore, 1);
+        GCThread::Join(sSweeperThread);
+        sSweeperThread = NULL;
+    }
+    if (sSweeperSemaphore != NULL)
+    {
+        GCThread::DeleteSemaphore(sSweeperSemaphore);
+        sSweeperSemaphore = NULL;
+    }
+
+    sMarkBitmap.Teardown();
+    sObjectStartBitmap.Teardown();
+    sCardTable.Teardown();
+    sLargeObjectCardTable.Teardown();
+    sPinnedCards.Teardown();
+    sEvacuatedCards.Teardown();
+#endif
+    sMarkStack.Teardown();
+    sIncrementalEnabled = false;
+    sGenerationalEnabled = false;
+    sCompactionEnabled = false;
+    sLazySweepingEnabled = false;
+    GCParallelMarker::Teardown();
+    GCParallelSweeper::Teardown();
+
+    // After the last collect, the profile can still be dumped until here
+    GCAllocationProfiler::Teardown();
+    GCPolicy::Teardown();
+    GCShadowStack::Teardown();
+    GCEventLog::Teardown();
+}
+
+// Note that this implementation doesn't do Intra-frame yet
+//  TODO:   Improve this...
+//          Parse the stack and the registers and see what object to not collect
+void GCManager::Collect(int generation, bool final)
+{
+    if (sPhase != PHASE_IDLE)
+    {
+        // Finish the incremental collection (or the lazy sweep) first, then do a complete one
+        //  (The objects allocated during the incremental collection were not collected)
+        Step(-1);
+    }
+
+    // The pauses are measured with the high resolution clock (clock() is the CPU time, with a coarse resolution)
+    long long startGc = GCClock::GetMicroseconds();
+
+    // Young collection: the old objects keep their mark (and their mark bits), so they are neither traced nor swept
+    //  Everything is collected with final, and the writes to the objects allocated by the callbacks are not tracked
+    bool young = sGenerationalEnabled && (generation < MAX_GENERATION) && (final == false) && (GCAllocator::sExternalObjects == false);
+    sGeneration = young ? generation : MAX_GENERATION;
+    GCEventLog::BeginEvent(GCEventLog::EVENT_COLLECT, sGeneration);
+
+    // The compaction needs all the live objects to be marked, and all the pointers to them to be found
+    //  (The objects allocated by the callbacks can't be found)
+    bool forced = sCompactionRequested;
+    sCompactionRequested = false;
+    sLastCollectionCompact = forced;
+    sCompactedBytes = 0;
+#ifndef CN_GC_HEADER_MARK
+    bool compact = sCompactionEnabled && (young == false) && (final == false) && (GCAllocator::sExternalObjects == false);
+#endif
+
+    // Let the application drop its caches before we trace
+    GCPolicy::OnBeforeCollect(sGeneration);
+
+    // Other threads can't allocate or free during the collection
+    GCAllocator::Lock();
+
+    // The last object sampled by this thread must get its type before it is potentially collected
+    //  (The pending samples of other threads will be recorded without type)
+    GCAllocationProfiler::ResolvePendingSample();
+
+    // The unused parts of the thread allocation buffers are marked as free
+    //  So the collection happen on correct memory buffers
+    GCAllocator::RetireAllThreadAllocBuffers();
+    // The other threads don't touch the objects until the end of the collection, their stacks are scanned as roots
+    GCAllocator::SuspendOtherThreads();
+
+    // The young collections keep the current marker, so the old large objects stay marked
+    unsigned int currentMarker = young ? sCurrentMarker : NextMarker();
+
+#ifndef CN_GC_HEADER_MARK
+    if (young == false)
+    {
+        // With the mark bitmap, unmarked simply means bit cleared
+        //  Only the allocated part of the main buffer needs to be cleared
+        sMarkBitmap.ClearRange(GCAllocator::GetHeapBase(), GCAllocator::GetCurrentAllocPointer());
+        if (sGenerationalEnabled || compact)
+        {
+            // The old objects are going to be the ones marked by this collection
+            sObjectStartBitmap.ClearRange(GCAllocator::GetHeapBase(), GCAllocator::GetCurrentAllocPointer());
+        }
+        if (sGenerationalEnabled)
+        {
+            // The pointer-free objects marked by the young collections have not been swept since
+            GCPointerFreeSpace::ClearMarks();
+            // Everything is traced from the roots, only the writes done from now on matter
+            //  The compaction resets them at its end instead, so it is done once per collection
+            if (compact == false)
+            {
+                ResetCards();
+            }
+        }
+    }
+    // The young collections find the old objects of the dirty cards from their start
+    //  And the compaction the live objects of the blocks it evacuates
+    sRecordObjectStarts = sGenerationalEnabled || compact;
+    if (compact)
+    {
+        // Nothing can be pinned after the current alloc pointer
+        sPinnedCards.ClearRange(GCAllocator::GetHeapBase(), GCAllocator::GetCurrentAllocPointer());
+        sCompactionPhase = COMPACTION_MARKING;
+    }
+#endif
+
+    // Now the current marker is different from any other marker currently stored in previous managed objects
+    //  And it is also different from any newly created object...
+
+    // Now trace all the objects from the roots
+    //  The user has to provide a single function to do that
+    //  If he doesn't, there is big chance that all the objects will be collected
+    if (final == false)
+    {
+        if (GCParallelMarker::IsEnabled())
+        {
+            // The worker threads start to steal the roots as soon as they are pushed
+            GCParallelMarker::Begin((unsigned char)currentMarker);
+            TraceRoots((unsigned char)currentMarker, false);
+            long long startTracing = GCClock::GetMicroseconds();
+#ifndef CN_GC_HEADER_MARK
+            if (young)
+            {
+                ScanDirtyCards((unsigned char)currentMarker);
+            }
+#endif
+            GCParallelMarker::End();
+            long long endTracing = GCClock::GetMicroseconds();
+            sNumSecondsInTracingPermanent += (double)(endTracing - startTracing) / 1000000.0;
+            GCEventLog::AddPhase(GCEventLog::PHASE_MARK, startTracing, endTracing);
+        }
+        else
+        {
+            TraceRoots((unsigned char)currentMarker, true);
+#ifndef CN_GC_HEADER_MARK
+            if (young)
+            {
+                long long startTracing = GCClock::GetMicroseconds();
+                ScanDirtyCards((unsigned char)currentMarker);
+                DrainMarkStack((unsigned char)currentMarker, -1);
+                GCEventLog::AddPhase(GCEventLog::PHASE_MARK, startTracing, GCClock::GetMicroseconds());
+            }
+#endif
+        }
+    }
+#ifndef CN_GC_HEADER_MARK
+    sRecordObjectStarts = false;
+    if (compact)
+    {
+        // Before the bins are cleared, they give the free blocks where the objects can be copied
+        long long startCompact = GCClock::GetMicroseconds();
+        CompactMainBuffer((unsigned char)currentMarker, forced ? COMPACTION_FORCED_LIVE_PERCENT : COMPACTION_LIVE_PERCENT);
+        GCEventLog::AddPhase(GCEventLog::PHASE_COMPACT, startCompact, GCClock::GetMicroseconds());
+    }
+#endif
+
+    sCollecting = true;
+    // Counted by the sweeps
+    sLiveBytes = 0;
+
+    // We are going to consolidate all the free blocks,
+    //  the bins won't contain any useful information anymore
+    //  Clean them to not have garbage next pointers
+    GCAllocator::ClearBins();
+
+    long long startInCollect = GCClock::GetMicroseconds();
+
+    // Then we have to parse every single object and find out which one is not traced yet...
+    //  With lazy sweeping, the main buffer is swept by chunks after the pause
+    bool lazy = StartLazySweep(final);
+    if (lazy == false)
+    {
+        SweepMainBuffer((unsigned char)currentMarker, final);
+
+        // The segments after the current alloc pointer are not needed anymore
+        GCAllocator::ReleaseTailSegments();
+    }
+
+    // The large objects are not in the main buffer, sweep them separately
+    SweepLargeObjects(currentMarker, final);
+
+    // Same for the pointer-free objects, they don't have anything to destruct
+    //  (With final, nothing has been marked so everything is freed)
+    //  The young collections don't sweep them, the old ones are not marked again
+    if (young == false)
+    {
+        sPointerFreeLiveBytes = GCPointerFreeSpace::Sweep();
+    }
+    sLiveBytes += sPointerFreeLiveBytes;
+
+    long long endInCollect = GCClock::GetMicroseconds();
+    sNumSecondsInCollect += (double)(endInCollect - startInCollect) / 1000000.0;
+    GCEventLog::AddPhase(GCEventLog::PHASE_SWEEP, startInCollect, endInCollect);
+
+    sCollecting = false;
+
+    if (lazy == false)
+    {
+        // Otherwise the collection is counted at the end of the sweep
+        ++sNumCollections;
+    }
+
+    // With lazy sweeping, the live bytes are known at the end of the sweep (see GCEventLog::EndSweep())
+    GCEventLog::EndEvent(lazy ? 0 : sLiveBytes, sCompactedBytes);
+    GCAllocator::ResumeOtherThreads();
+    GCAllocator::Unlock();
+
+    long long endGc = endInCollect;
+    sNumSecondsInGcManager += (double)(endGc - startGc) / 1000000.0;
+
+    if (lazy)
+    {
+        // The live bytes are known at the end of the sweep, the budget until the next collection is set then
+        //  Until then the allocations consume the previous budget again
+        GCPolicy::RestartBudget();
+#ifndef CN_GC_HEADER_MARK
+        if (sSweeperThread != NULL)
+        {
+            GCThread::SignalSemaphore(sSweeperSemaphore, 1);
+        }
+#endif
+        return;
+    }
+
+    // Budget until the next collection
+    GCPolicy::OnAfterCollect(sGeneration, sLiveBytes);
+}
+
+bool GCManager::Step(int budgetMicroseconds)
+{
+#ifdef CN_GC_HEADER_MARK
+    // The incremental marking needs the mark bitmap
+    budgetMicroseconds;
+    Collect(MAX_GENERATION, false);
+    return (true);
+#else
+    if ((sIncrementalEnabled == false) && (sPhase == PHASE_IDLE))
+    {
+        // Only the lazy sweep of the last Collect() can be done by steps
+        Collect(MAX_GENERATION, false);
+        return (true);
+    }
+
+    long long startStep = GCClock::GetMicroseconds();
+    long long deadline = (budgetMicroseconds >= 0) ? startStep + budgetMicroseconds : -1;
+    GCEventLog::BeginEvent(GCEventLog::EVENT_STEP, MAX_GENERATION);
+
+    if (sPhase == PHASE_IDLE)
+    {
+        // First step, mark the roots
+        StartMarking();
+    }
+
+    if (sPhase == PHASE_MARKING)
+    {
+        GCAllocator::Lock();
+        long long startMarking = GCClock::GetMicroseconds();
+        unsigned char currentMarker = sCurrentMarker;
+        bool marked = DrainMarkStack(currentMarker, deadline);
+        if (marked && (sPrecleaned == false))
+        {
+            // Trace again the objects written to so far (and what they point to)
+            //  So the last step only has to handle the writes done after this one
+            sPrecleaned = true;
+            RescanWrittenPages(currentMarker);
+            marked = DrainMarkStack(currentMarker, deadline);
+        }
+        if (marked)
+        {
+            // This one is not bounded by the budget (but most of the work has been done by the previous steps)
+            FinishMarking(currentMarker);
+        }
+        GCEventLog::AddPhase(GCEventLog::PHASE_MARK, startMarking, GCClock::GetMicroseconds());
+        GCAllocator::Unlock();
+    }
+
+    if ((sPhase == PHASE_SWEEPING) && (IsPastDeadline(deadline) == false))
+    {
+        long long startSweeping = GCClock::GetMicroseconds();
+        SweepStep(deadline, -1);
+        GCEventLog::AddPhase(GCEventLog::PHASE_SWEEP, startSweeping, GCClock::GetMicroseconds());
+    }
+
+    long long endStep = GCClock::GetMicroseconds();
+    sNumSecondsInGcManager += (double)(endStep - startStep) / 1000000.0;
+    // The live bytes are only known once the cycle is over
+    GCEventLog::EndEvent((sPhase == PHASE_IDLE) ? sLiveBytes : 0, 0);
+
+    return (sPhase == PHASE_IDLE);
+#endif
+}
+
+void GCManager::OnIdle(int budgetMicroseconds)
+{
+    if (sPhase == PHASE_IDLE)
+    {
+        // Don't start a collection too early, most of the objects allocated since the last one would still be alive
+        if (GCPolicy::GetRemainingBudget() > GCPolicy::GetAllocationBudget() / 2)
+        {
+            return;
+        }
+    }
+    Step(budgetMicroseconds);
+}
+
+void GCManager::Compact()
+{
+    // Same as a complete collection, but the fuller blocks are evacuated too
+    sCompactionRequested = true;
+    Collect(MAX_GENERATION, false);
+}
+
+int GCManager::GetCompactedBytes()
+{
+    return (sCompactedBytes);
+}
+
+void GCManager::TraceConservative(void * pointer, unsigned char currentMark)
+{
+    if (sCompactionPhase > COMPACTION_MARKING)
+    {
+        // Whatever it points to has been pinned during the marking, there is nothing to update
+        return;
+    }
+    ValidateRoot2(pointer, currentMark);
+}
+
+void GCManager::OnLargeObjectAllocated(void * object)
+{
+#ifndef CN_GC_HEADER_MARK
+    if (sPhase == PHASE_MARKING)
+    {
+        // The allocator lock is taken
+        sLargeObjectsAllocatedBlack.push_back(object);
+    }
+#else
+    object;
+#endif
+}
+
+unsigned char GCManager::NextMarker()
+{
+    // First increase marker and avoid ::System::Object::__MARKER_AT_CREATION__
+    unsigned int currentMarker = sCurrentMarker;
+    ++currentMarker;
+    currentMarker &= 0xff;
+    if (currentMarker == ::System::Object::__MARKER_AT_CREATION__)
+    {
+        // We looped, so do it another time
+        ++currentMarker;
+        currentMarker &= 0xff;
+    }
+    sCurrentMarker = (unsigned char)currentMarker;
+    return (sCurrentMarker);
+}
+
+void GCManager::TraceRoots(unsigned char currentMarker, bool drain)
+{
+    // If drain is false, the roots are only marked and pushed on the gray worklist
+
+    // Trace all the types registered...
+    // And all the static members
+    // And all the global strings
+
+    long long startTracingPermanent = GCClock::GetMicroseconds();
+    CrossNetRuntime::Trace(currentMarker);
+    if (drain)
+    {
+        DrainMarkStack(currentMarker, -1);
+    }
+    long long endTracingPermanent = GCClock::GetMicroseconds();
+    sNumSecondsInTracingPermanent += (double)(endTracingPermanent - startTracingPermanent) / 1000000.0;
+    GCEventLog::AddPhase(GCEventLog::PHASE_PERMANENT_ROOTS, startTracingPermanent, endTracingPermanent);
+
+    long long startTracingStack = endTracingPermanent;
+    // Stack crawling should be implemented here
+    TraceStack(currentMarker);
+    if (drain)
+    {
+        DrainMarkStack(currentMarker, -1);
+    }
+    long long endTracingStack = GCClock::GetMicroseconds();
+    sNumSecondsInTracingStack += (double)(endTracingStack - startTracingStack) / 1000000.0;
+    GCEventLog::AddPhase(GCEventLog::PHASE_STACK, startTracingStack, endTracingStack);
+
+    // Then call the user provided function
+    long long startTracingStatics = endTracingStack;
+    const InitOptions & options = ::CrossNetRuntime::GetOptions();
+    if (options.mMainTrace != NULL)
+    {
+        options.mMainTrace(currentMarker);
+    }
+    if (drain)
+    {
+        DrainMarkStack(currentMarker, -1);
+    }
+    long long endTracingStatics = GCClock::GetMicroseconds();
+    sNumSecondsInTracingStatics += (double)(endTracingStatics - startTracingStatics) / 1000000.0;
+    GCEventLog::AddPhase(GCEventLog::PHASE_STATICS, startTracingStatics, endTracingStatics);
+}
+
+bool GCManager::DrainMarkStack(unsigned char currentMarker, long long deadline)
+{
+    int numTraced = 0;
+    for ( ; ; )
+    {
+        if ((++numTraced % DEADLINE_CHECK_INTERVAL) == 0)
+        {
+            if (IsPastDeadline(deadline))
+            {
+                return (sMarkStack.IsEmpty());
+            }
+        }
+
+        ::System::Object * object = sMarkStack.Pop();
+        if (object == NULL)
+        {
+            return (true);
+        }
+
+        // Now trace all the other pointers
+        // One possible cache miss here to get the VTable
+        // And another one to access the corresponding method
+        // Note that if we are calling the same types over and over, the number of cache misses will be reduced
+
+        // There are ways to improve that...
+        object->__Trace__(currentMarker);
+    }
+}
+
+void GCManager::SweepMainBuffer(unsigned char currentMarker, bool final)
+{
+    final;
+
+#ifdef CN_GC_HEADER_MARK
+    //  I.e. is marker is different from the currentMarker...
+
+    void * mainBuffer = GCAllocator::GetHeapBase();
+    GCAllocator::AllocStructure * ptr = static_cast<GCAllocator::AllocStructure *>(mainBuffer);
+    // Nothing has been allocated after the current alloc pointer...
+    void * endBuffer = GCAllocator::GetCurrentAllocPointer();
+
+    void * firstFree = NULL;
+    // Start of the current range of dead objects (cleared in one go if the free memory is kept zeroed)
+    unsigned char * deadStart = NULL;
+    // Reported to the event log once at the end
+    int numObjectsFreed = 0;
+    int numBytesFreed = 0;
+    int numFreeRuns = 0;
+
+    while (ptr < endBuffer)
+    {
+        if (GCAllocator::IsReleasedSegment(ptr))
+        {
+            // The pages have been given back to the OS, we can't read them
+            //  But the whole segment is free, so it simply extends the current free region
+            if (firstFree == NULL)
+            {
+                firstFree = ptr;
+            }
+            ClearDeadObjects(deadStart, reinterpret_cast<unsigned char *>(ptr));
+            ptr = static_cast<GCAllocator::AllocStructure *>(GCAllocator::SkipReleasedSegments(ptr));
+            continue;
+        }
+
+        if ((ptr->mMarker == GCAllocator::FREE_MARKER) || (ptr->mMarker == GCAllocator::RESERVED_MARKER))
+        {
+            // Free block, go to the next block...
+            if (firstFree == NULL)
+            {
+                firstFree = ptr;        // Mark it as the first free block of the region
+            }
+            CROSSNET_ASSERT(GCAllocator::IsAligned(ptr->mSize), "");
+            ClearDeadObjects(deadStart, reinterpret_cast<unsigned char *>(ptr));
+            int blockSize = ptr->mSize;
+            if (GCAllocator::IsZeroingFreeMemory())
+            {
+                // Its header and boundary tag are going to be in the middle of the free run
+                GCAllocator::ClearFreeBlockTags(ptr, blockSize);
+            }
+            ptr += (blockSize / sizeof(GCAllocator::AllocStructure));
+            continue;
+        }
+
+        GCAllocator::AllocStructure * nextPtr;
+
+        // ptr points to an allocated block, 2 cases...
+        ::System::Object * obj = reinterpret_cast<::System::Object *>(ptr);
+        // Assert before the crash so it's clearer what is hapenning
+        // Look at the VTable to see what is the actual type
+        CROSSNET_ASSERT((void *)(obj->m__InterfaceMap__) != NULL, "The interface map has not been set correctly.");
+        CROSSNET_ASSERT((int)(obj->m__InterfaceMap__) != System::Object::__FAKE_INTERFACE_MAP__, "The interface map has not been set correctly.");
+
+        int size = GetSize(obj);
+        int alignedSize = GCAllocator::Align(size);
+        nextPtr = ptr + (alignedSize / sizeof(GCAllocator::AllocStructure));
+
+        // Now that we have the next pointer, we can see if the collection is needed
+        if (obj->__GetMark__() != currentMarker)
+        {
+            // The mark is different, it means that we need to collect this object
+            obj->__OnCollect__();
+            ++numObjectsFreed;
+            numBytesFreed += alignedSize;
+
+            // Now we can free the block, at the same time, we can actually free the previous blocks as well
+            if (firstFree == NULL)
+            {
+                firstFree = obj;        // Mark the block as first free block...
+            }
+            if (deadStart == NULL)
+            {
+                deadStart = reinterpret_cast<unsigned char *>(obj);
+            }
+        }
+        else
+        {
+            CROSSNET_ASSERT(final == false, "If final, all objects should be collected!");
+            ClearDeadObjects(deadStart, reinterpret_cast<unsigned char *>(ptr));
+            sLiveBytes += alignedSize;
+
+            // This block is not free
+            if (firstFree != NULL)
+            {
+                // Set the size for the previous free block
+                //  Runs of SMALL_SIZE_BIN or less go directly to their exact size class
+                //  Segments completely covered by the run are given back to the OS
+                size = (int)ptr - (int)firstFree;
+                GCAllocator::FreeRun(firstFree, size, NULL);
+                ++numFreeRuns;
+                firstFree = NULL;
+            }
+        }
+
+        // Go to the next object...
+        ptr = nextPtr;
+    }
+
+    // The pointers should match (otherwise we missed something...)
+    CROSSNET_ASSERT(ptr == endBuffer, "");
+    ClearDeadObjects(deadStart, reinterpret_cast<unsigned char *>(ptr));
+
+    // We are done with this loop
+    if (firstFree != NULL)
+    {
+        // And it seems that the last block (or set of block) is actually free!
+        // Update the current pointer accordingly (as such enables a little defragmentation)
+        GCAllocator::SetCurrentAllocPointer(firstFree);
+        ++numFreeRuns;
+    }
+    GCEventLog::AddFreed(numObjectsFreed, numBytesFreed, numFreeRuns);
+#else
+    unsigned char * endBuffer = static_cast<unsigned char *>(GCAllocator::GetCurrentAllocPointer());
+    if (GCParallelSweeper::IsEnabled())
+    {
+        // The chunks are swept by several threads, then their free lists are spliced into the bins
+        sLiveBytes += GCParallelSweeper::Sweep(GCAllocator::GetHeapBase(), endBuffer);
+        return;
+    }
+    SweepMainBufferRange(GCAllocator::GetHeapBase(), endBuffer, endBuffer, -1, final);
+#endif
+}
+
+bool GCManager::StartLazySweep(bool final)
+{
+#ifdef CN_GC_HEADER_MARK
+    // The objects allocated before the sweep would look dead (their mark is not the current one)
+    final;
+    return (false);
+#else
+    if ((sLazySweepingEnabled == false) || final)
+    {
+        return (false);
+    }
+
+    // Same state as after the last step of the incremental marking (the allocator lock is taken)
+    //  The main buffer is swept up to the current alloc pointer, the objects allocated after it are alive
+    //  The marks stay valid until the sweep reaches them, the allocations before the cursor reuse swept memory
+    sMarkingLimit = static_cast<unsigned char *>(GCAllocator::GetCurrentAllocPointer());
+    sSweepCursor = GCAllocator::GetHeapBase();
+    sPhase = PHASE_SWEEPING;
+    return (true);
+#endif
+}
+
+void GCManager::SweepNextChunk()
+{
+#ifndef CN_GC_HEADER_MARK
+    long long startSweep = GCClock::GetMicroseconds();
+    SweepStep(-1, LAZY_SWEEP_CHUNK_SIZE);
+    sNumSecondsInGcManager += (double)(GCClock::GetMicroseconds() - startSweep) / 1000000.0;
+#endif
+}
+
+#ifndef CN_GC_HEADER_MARK
+unsigned char * GCManager::SweepMainBufferRange(unsigned char * ptr, unsigned char * endBuffer, unsigned char * stop, long long deadline, bool final)
+{
+    final;
+    // The mark bitmap tells directly where the dead runs are
+    //  Only the dead objects and the free blocks are read, the live objects are not touched at all
+    //  Nothing has been allocated after the current alloc pointer (end for a complete sweep)...
+    int numRuns = 0;
+    while (ptr < endBuffer)
+    {
+        if (ptr >= stop)
+        {
+            // End of the chunk, ptr is at the start of a live object
+            //  (A run of dead objects is never split, so the cursor never ends in the middle of one)
+            break;
+        }
+        if ((++numRuns % DEADLINE_CHECK_INTERVAL) == 0)
+        {
+            if (IsPastDeadline(deadline))
+            {
+                // Stop between two runs, the next step continues from here
+                break;
+            }
+        }
+
+        // Skip the live objects (32 granules at a time)
+        unsigned char * firstFree = static_cast<unsigned char *>(sMarkBitmap.FindNextClear(ptr, endBuffer));
+        CROSSNET_ASSERT((final == false) || (firstFree == ptr), "If final, all objects should be collected!");
+        sLiveBytes += (int)(firstFree - ptr);
+        if (firstFree == endBuffer)
+        {
+            ptr = endBuffer;
+            break;
+        }
+        // The run of dead objects and free blocks goes until the next live object
+        unsigned char * endFree = static_cast<unsigned char *>(sMarkBitmap.FindNextSet(firstFree, endBuffer));
+        CollectDeadRun(firstFree, endFree, true);
+
+        if (endFree == GCAllocator::GetCurrentAllocPointer())
+        {
+            // The last set of blocks is free, update the current pointer accordingly
+            GCAllocator::SetCurrentAllocPointer(firstFree);
+            ptr = endBuffer;
+            break;
+        }
+
+        // Segments completely covered by the run are given back to the OS
+        GCAllocator::FreeRun(firstFree, (int)(endFree - firstFree), NULL);
+        ptr = endFree;
+    }
+    return (ptr);
+}
+
+int GCManager::SweepChunk(unsigned char * chunkStart, unsigned char * chunkEnd, unsigned char * endBuffer,
+                            GCAllocator::LocalBins & bins, unsigned char * & tailRun)
+{
+    // Same as SweepMainBufferRange() for one chunk of the parallel sweep, returns the live bytes of the chunk
+    //  Each run of dead objects is swept by the chunk where it starts, even if it ends in the next chunks
+    //  A run always starts right after a live object, so it is found from the mark bitmap alone
+    unsigned char * ptr = chunkStart;
+    if ((ptr != GCAllocator::GetHeapBase()) && (sMarkBitmap.Test(ptr) == false)
+        && (sMarkBitmap.Test(ptr - GCBitmap::GRANULE_SIZE) == false))
+    {
+        // The run started in a previous chunk, skip it
+        ptr = static_cast<unsigned char *>(sMarkBitmap.FindNextSet(ptr, endBuffer));
+    }
+
+    int liveBytes = 0;
+    while (ptr < chunkEnd)
+    {
+        // The live objects are only counted up to the end of the chunk, the next chunk counts the rest
+        unsigned char * firstFree = static_cast<unsigned char *>(sMarkBitmap.FindNextClear(ptr, chunkEnd));
+        liveBytes += (int)(firstFree - ptr);
+        if (firstFree == chunkEnd)
+        {
+            break;
+        }
+        unsigned char * endFree = static_cast<unsigned char *>(sMarkBitmap.FindNextSet(firstFree, endBuffer));
+        // The dead objects have been collected by the collecting thread, see CollectDeadObjects()
+        ClearDeadRun(firstFree, endFree);
+
+        if (endFree == endBuffer)
+        {
+            // The last set of blocks is free, the current alloc pointer is moved back after the sweep
+            tailRun = firstFree;
+            break;
+        }
+
+        GCAllocator::FreeRun(firstFree, (int)(endFree - firstFree), &bins);
+        ptr = endFree;
+    }
+    return (liveBytes);
+}
+
+void GCManager::CollectDeadObjects(unsigned char * start, unsigned char * endBuffer)
+{
+    // First part of the parallel sweep, done by the collecting thread before the other threads start
+    //  So __OnCollect__() is always called from the collecting thread, the sweeping threads only clear and free the runs
+    unsigned char * ptr = start;
+    while (ptr < endBuffer)
+    {
+        unsigned char * firstFree = static_cast<unsigned char *>(sMarkBitmap.FindNextClear(ptr, endBuffer));
+        if (firstFree == endBuffer)
+        {
+            break;
+        }
+        unsigned char * endFree = static_cast<unsigned char *>(sMarkBitmap.FindNextSet(firstFree, endBuffer));
+        CollectDeadRun(firstFree, endFree, false);
+        ptr = endFree;
+    }
+}
+
+void GCManager::ClearDeadRun(unsigned char * firstFree, unsigned char * endFree)
+{
+    if (GCAllocator::IsZeroingFreeMemory() == false)
+    {
+        return;
+    }
+    // The objects of the run have been destructed, they can't be parsed anymore (see CollectDeadObjects())
+    //  So the whole run is cleared, including its free blocks, segment by segment to skip the released ones
+    if (GCAllocator::sSegmentStates == NULL)
+    {
+        // Fixed size heap, no segment
+        GCAllocator::ClearFreedMemory(firstFree, (int)(endFree - firstFree));
+        return;
+    }
+    size_t segmentMask = (size_t)GCAllocator::sSegmentSize - 1;
+    unsigned char * current = firstFree;
+    while (current < endFree)
+    {
+        current = static_cast<unsigned char *>(GCAllocator::SkipReleasedSegments(current));
+        if (current >= endFree)
+        {
+            break;
+        }
+        unsigned char * next = GCAllocator::sHeapBase + (((size_t)(current - GCAllocator::sHeapBase) + segmentMask + 1) & ~segmentMask);
+        if (next > endFree)
+        {
+            next = endFree;
+        }
+        GCAllocator::ClearFreedMemory(current, (int)(next - current));
+        current = next;
+    }
+}
+
+void GCManager::CollectDeadRun(unsigned char * firstFree, unsigned char * endFree, bool clearMemory)
+{
+    // The conservative roots must not find the dead objects anymore
+    GCAllocator::ClearAllocationStarts(firstFree, endFree);
+
+    // Collect the dead objects of the run
+    //  deadStart is the start of the current range of dead objects (cleared in one go if the free memory is kept zeroed)
+    //  Without clearMemory it stays NULL, the run is cleared later by ClearDeadRun()
+    unsigned char * deadStart = NULL;
+    unsigned char * current = firstFree;
+    int numObjectsFreed = 0;
+    int numBytesFreed = 0;
+    while (current < endFree)
+    {
+        if (GCAllocator::IsReleasedSegment(current))
+        {
+            // The pages have been given back to the OS, we can't read them (but there is nothing to collect)
+            ClearDeadObjects(deadStart, current);
+            current = static_cast<unsigned char *>(GCAllocator::SkipReleasedSegments(current));
+            continue;
+        }
+
+        GCAllocator::AllocStructure * block = reinterpret_cast<GCAllocator::AllocStructure *>(current);
+        if (block->mMarker == GCAllocator::FORWARDED_MARKER)
+        {
+            // Object moved by the compaction, its copy is alive so there is nothing to collect
+            //  But its memory is not cleared like a free block
+            if (clearMemory && (deadStart == NULL))
+            {
+                deadStart = current;
+            }
+            current += block->mSize;
+            continue;
+        }
+        if ((block->mMarker == GCAllocator::FREE_MARKER) || (block->mMarker == GCAllocator::RESERVED_MARKER))
+        {
+            // Free block, go to the next block...
+            CROSSNET_ASSERT(GCAllocator::IsAligned(block->mSize), "");
+            ClearDeadObjects(deadStart, current);
+            int blockSize = block->mSize;
+            if (clearMemory && GCAllocator::IsZeroingFreeMemory())
+            {
+                // Its header and boundary tag are going to be in the middle of the free run
+                GCAllocator::ClearFreeBlockTags(current, blockSize);
+            }
+            current += blockSize;
+            continue;
+        }
+
+        ::System::Object * obj = reinterpret_cast<::System::Object *>(current);
+        // Assert before the crash so it's clearer what is hapenning
+        // Look at the VTable to see what is the actual type
+        CROSSNET_ASSERT((void *)(obj->m__InterfaceMap__) != NULL, "The interface map has not been set correctly.");
+        CROSSNET_ASSERT((int)(obj->m__InterfaceMap__) != System::Object::__FAKE_INTERFACE_MAP__, "The interface map has not been set correctly.");
+
+        // Get the size before the object is destructed
+        int alignedSize = GCAllocator::Align(GetSize(obj));
+        obj->__OnCollect__();
+        ++numObjectsFreed;
+        numBytesFreed += alignedSize;
+        if (clearMemory && (deadStart == NULL))
+        {
+            deadStart = current;
+        }
+        current += alignedSize;
+    }
+    // The pointers should match (otherwise we missed something...)
+    CROSSNET_ASSERT(current == endFree, "");
+    ClearDeadObjects(deadStart, current);
+    // Called from the lazy sweeping thread as well, the counters are updated atomically
+    GCEventLog::AddFreed(numObjectsFreed, numBytesFreed, 1);
+}
+#endif
+
+#ifndef CN_GC_HEADER_MARK
+void GCManager::StartMarking()
+{
+    // Let the application drop its caches before we trace
+    GCPolicy::OnBeforeCollect(MAX_GENERATION);
+
+    GCAllocator::Lock();
+
+    GCAllocationProfiler::ResolvePendingSample();
+    GCAllocator::RetireAllThreadAllocBuffers();
+    // Only while the roots are pushed, the writes done by the other threads afterwards are tracked like ours
+    GCAllocator::SuspendOtherThreads();
+
+    unsigned char currentMarker = NextMarker();
+
+    // This collection sweeps the main buffer up to the current alloc pointer
+    unsigned char * heapBase = GCAllocator::GetHeapBase();
+    sMarkingLimit = static_cast<unsigned char *>(GCAllocator::GetCurrentAllocPointer());
+    sSweepCursor = heapBase;
+    sMarkBitmap.ClearRange(heapBase, sMarkingLimit);
+    sObjectStartBitmap.ClearRange(heapBase, sMarkingLimit);
+    // The incremental collections are always complete
+    sGeneration = MAX_GENERATION;
+    if (sGenerationalEnabled)
+    {
+        // The pointer-free objects marked by the young collections have not been swept since
+        GCPointerFreeSpace::ClearMarks();
+    }
+
+    // The free blocks before the limit are going to be recycled by the sweep
+    //  Until then, all the allocations are done after the limit, so they don't have to be marked
+    //  (See IsUnsweptMemory() for the blocks freed during the collection)
+    GCAllocator::ClearBins();
+
+    sPhase = PHASE_MARKING;
+    sRecordObjectStarts = true;
+    sPrecleaned = false;
+
+    // From now on, the pages written to are tracked
+    //  The marked objects on these pages are traced again at the end of the marking
+    ResetCards();
+
+    // The roots are only pushed on the gray worklist, the next steps trace them
+    TraceRoots(currentMarker, false);
+
+    GCAllocator::ResumeOtherThreads();
+    GCAllocator::Unlock();
+}
+
+void GCManager::FinishMarking(unsigned char currentMarker)
+{
+    // Last step of the marking (the allocator lock is taken)
+    //  Like Collect(), it has to be done in one go
+    GCAllocationProfiler::ResolvePendingSample();
+    GCAllocator::RetireAllThreadAllocBuffers();
+    GCAllocator::SuspendOtherThreads();
+
+    // The roots might have changed since the first step
+    TraceRoots(currentMarker, true);
+
+    // The large objects allocated during the marking are alive
+    //  (The objects allocated in the main buffer are after the limit, the sweep doesn't see them)
+    for (size_t i = 0 ; i < sLargeObjectsAllocatedBlack.size() ; ++i)
+    {
+        // Unless it has been freed with CollectOneObject() since
+        void * object = sLargeObjectsAllocatedBlack[i];
+        if (GCLargeObjectSpace::IsObjectStart(object))
+        {
+            Trace(static_cast< ::System::Object *>(object), currentMarker);
+        }
+    }
+    sLargeObjectsAllocatedBlack.clear();
+
+    // And the objects that were traced before one of their pointers changed
+    RescanWrittenPages(currentMarker);
+    RescanNewObjects(currentMarker);
+    DrainMarkStack(currentMarker, -1);
+    sRecordObjectStarts = false;
+    if (sGenerationalEnabled)
+    {
+        // The objects written to so far have been traced again, the next young collection needs the writes done from now on
+        //  (The written pages have been reset by RescanWrittenPages())
+        ClearCards();
+    }
+
+    // The large objects and the pointer-free objects are swept right away
+    //  The main buffer is swept by the next steps
+    sCollecting = true;
+    sLiveBytes = 0;
+    SweepLargeObjects(currentMarker, false);
+    sPointerFreeLiveBytes = GCPointerFreeSpace::Sweep();
+    sLiveBytes += sPointerFreeLiveBytes;
+    sCollecting = false;
+
+    sSweepCursor = GCAllocator::GetHeapBase();
+    sPhase = PHASE_SWEEPING;
+    GCAllocator::ResumeOtherThreads();
+}
+
+bool GCManager::SweepStep(long long deadline, int maxBytes)
+{
+    GCAllocator::Lock();
+
+    if (sPhase != PHASE_SWEEPING)
+    {
+        // Another thread finished the sweep while we were waiting for the lock
+        GCAllocator::Unlock();
+        return (true);
+    }
+
+    unsigned char * stop = sMarkingLimit;
+    if ((maxBytes >= 0) && (maxBytes < sMarkingLimit - sSweepCursor))
+    {
+        stop = sSweepCursor + maxBytes;
+    }
+
+    long long startChunk = GCClock::GetMicroseconds();
+    sCollecting = true;
+    sSweepingChunk = true;
+    sSweepCursor = SweepMainBufferRange(sSweepCursor, sMarkingLimit, stop, deadline, false);
+    sSweepingChunk = false;
+    sCollecting = false;
+    GCEventLog::AddSweepChunk(startChunk, GCClock::GetMicroseconds());
+
+    bool finished = (sSweepCursor == sMarkingLimit);
+    if (finished)
+    {
+        // The segments after the current alloc pointer are not needed anymore
+        GCAllocator::ReleaseTailSegments();
+
+        // The objects allocated during the collection are considered alive
+        unsigned char * currentAllocPointer = static_cast<unsigned char *>(GCAllocator::GetCurrentAllocPointer());
+        if (currentAllocPointer > sMarkingLimit)
+        {
+            sLiveBytes += (int)(currentAllocPointer - sMarkingLimit);
+        }
+
+        sMarkStack.Shrink();
+        ++sNumCollections;
+        sPhase = PHASE_IDLE;
+
+        // The chunks swept by the allocations, the steps and the background thread make one event
+        GCEventLog::EndSweep(sLiveBytes);
+    }
+
+    GCAllocator::Unlock();
+
+    if (finished)
+    {
+        // Budget until the next collection
+        GCPolicy::OnAfterCollect(sGeneration, sLiveBytes);
+    }
+    return (finished);
+}
+
+void GCManager::BackgroundSweeperThread(void * parameter)
+{
+    parameter;
+    for ( ; ; )
+    {
+        // Wait for the end of the next lazy collection
+        GCThread::WaitSemaphore(sSweeperSemaphore);
+        if (sSweeperShutdown)
+        {
+            return;
+        }
+
+        // The allocator lock is released between two chunks, so the other threads can allocate meanwhile
+        //  They might sweep some chunks as well, or even finish the sweep
+        while ((sSweeperShutdown == false) && (SweepStep(-1, LAZY_SWEEP_CHUNK_SIZE) == false))
+        {
+            // Continue with the next chunk
+        }
+    }
+}
+
+void GCManager::RescanWrittenPages(unsigned char currentMarker)
+{
+    void * pages[WRITTEN_PAGES_BATCH];
+    int pageSize = GCVirtualMemory::GetPageSize();
+
+    // The main buffer up to the limit (the pages are read and reset by batches)
+    unsigned char * current = GCAllocator::GetHeapBase();
+    while (current < sMarkingLimit)
+    {
+        int numPages = GCVirtualMemory::GetWrittenPages(current, sMarkingLimit - current, pages, WRITTEN_PAGES_BATCH);
+        if (numPages < 0)
+        {
+            // The writes are not tracked, consider that everything has been written to
+            RescanMarkedObjects(current, sMarkingLimit, currentMarker);
+            break;
+        }
+        for (int i = 0 ; i < numPages ; ++i)
+        {
+            unsigned char * page = static_cast<unsigned char *>(pages[i]);
+            unsigned char * endPage = page + pageSize;
+            if (endPage > sMarkingLimit)
+            {
+                endPage = sMarkingLimit;
+            }
+            RescanMarkedObjects(page, endPage, currentMarker);
+        }
+        if (numPages < WRITTEN_PAGES_BATCH)
+        {
+            break;
+        }
+        current = static_cast<unsigned char *>(pages[numPages - 1]) + pageSize;
+    }
+
+    RescanLargeObjects(currentMarker);
+}
+
+void GCManager::RescanMarkedObjects(unsigned char * start, unsigned char * end, unsigned char currentMarker)
+{
+    // Traces again the marked objects overlapping [start, end[
+    //  Their start is known from the object start bitmap
+    unsigned char * heapBase = GCAllocator::GetHeapBase();
+    unsigned char * object = static_cast<unsigned char *>(sObjectStartBitmap.FindPrevSet(heapBase, start));
+    if (object == NULL)
+    {
+        object = static_cast<unsigned char *>(sObjectStartBitmap.FindNextSet(start, end));
+    }
+
+    while (object < end)
+    {
+        GCAllocator::AllocStructure * block = reinterpret_cast<GCAllocator::AllocStructure *>(object);
+        // The object might have been freed during the marking (see GCAllocator::Free())
+        if ((block->mMarker != GCAllocator::FREE_MARKER) && (block->mMarker != GCAllocator::RESERVED_MARKER))
+        {
+            ::System::Object * obj = reinterpret_cast< ::System::Object *>(object);
+            // The object found before start might end before start as well
+            //  Only its part in the range is traced (the other items of a big array have not been written to)
+            if ((object >= start) || (object + GetSize(obj) > start))
+            {
+                obj->__TraceRange__(currentMarker, start, end);
+            }
+        }
+        object = static_cast<unsigned char *>(sObjectStartBitmap.FindNextSet(object + GCBitmap::GRANULE_SIZE, end));
+    }
+}
+
+void GCManager::RescanLargeObjects(unsigned char currentMarker)
+{
+    unsigned char * base = static_cast<unsigned char *>(GCLargeObjectSpace::GetBase());
+    if (base == NULL)
+    {
+        return;
+    }
+    unsigned char * end = base + GCLargeObjectSpace::GetReservedSize();
+
+    void * pages[WRITTEN_PAGES_BATCH];
+    int pageSize = GCVirtualMemory::GetPageSize();
+    void * lastObject = NULL;
+    unsigned char * current = base;
+    while (current < end)
+    {
+        int numPages = GCVirtualMemory::GetWrittenPages(current, end - current, pages, WRITTEN_PAGES_BATCH);
+        if (numPages < 0)
+        {
+            // The writes are not tracked, trace again all the marked large objects
+            for (void * object = GCLargeObjectSpace::GetFirstObject() ; object != NULL ; object = GCLargeObjectSpace::GetNextObject(object))
+            {
+                ::System::Object * obj = static_cast< ::System::Object *>(object);
+                if (obj->__GetMark__() == currentMarker)
+                {
+                    obj->__Trace__(currentMarker);
+                }
+            }
+            return;
+        }
+        for (int i = 0 ; i < numPages ; ++i)
+        {
+            // A large object spans several pages, trace it only once
+            void * object = GCLargeObjectSpace::FindObjectContaining(pages[i]);
+            if ((object == NULL) || (object == lastObject))
+            {
+                continue;
+            }
+            lastObject = object;
+            ::System::Object * obj = static_cast< ::System::Object *>(object);
+            if (obj->__GetMark__() == currentMarker)
+            {
+                obj->__Trace__(currentMarker);
+            }
+        }
+        if (numPages < WRITTEN_PAGES_BATCH)
+        {
+            break;
+        }
+        current = static_cast<unsigned char *>(pages[numPages - 1]) + pageSize;
+    }
+}
+
+void GCManager::RescanNewObjects(unsigned char currentMarker)
+{
+    // The objects allocated during the marking are alive, but they might point to objects not marked yet
+    //  They are not marked (the sweep stops at the limit), all of them are traced
+    //  The thread allocation buffers have been retired, so the memory can be parsed
+    unsigned char * current = sMarkingLimit;
+    unsigned char * end = static_cast<unsigned char *>(GCAllocator::GetCurrentAllocPointer());
+    while (current < end)
+    {
+        if (GCAllocator::IsReleasedSegment(current))
+        {
+            current = static_cast<unsigned char *>(GCAllocator::SkipReleasedSegments(current));
+            continue;
+        }
+
+        GCAllocator::AllocStructure * block = reinterpret_cast<GCAllocator::AllocStructure *>(current);
+        if ((block->mMarker == GCAllocator::FREE_MARKER) || (block->mMarker == GCAllocator::RESERVED_MARKER))
+        {
+            current += block->mSize;
+            continue;
+        }
+
+        ::System::Object * obj = reinterpret_cast< ::System::Object *>(current);
+        int alignedSize = GCAllocator::Align(GetSize(obj));
+        if (sGenerationalEnabled)
+        {
+            // It becomes old, an old object written to during the marking might point to it
+            //  (The pages written to so far have been reset, the next young collection would not see that pointer)
+            Mark(obj, currentMarker);
+        }
+        obj->__Trace__(currentMarker);
+        current += alignedSize;
+    }
+    CROSSNET_ASSERT(current == end, "");
+}
+
+void GCManager::ScanDirtyCards(unsigned char currentMarker)
+{
+    // Each collection makes all the surviving objects old (their mark is kept)
+    //  So an old object can only point to a young one if it has been written to since the last collection
+    //  The young objects are traced from the roots, only the old objects of the dirty cards have to be traced here
+    unsigned char * heapBase = GCAllocator::GetHeapBase();
+    unsigned char * endBuffer = static_cast<unsigned char *>(GCAllocator::GetCurrentAllocPointer());
+    DirtyWrittenPages(sCardTable, heapBase, endBuffer);
+
+    unsigned char * current = heapBase;
+    unsigned char * runStart;
+    unsigned char * runEnd;
+    while (sCardTable.FindDirtyRun(current, endBuffer, runStart, runEnd))
+    {
+        // Same as the last step of the incremental marking, the old objects are the marked ones
+        RescanMarkedObjects(runStart, runEnd, currentMarker);
+        current = runEnd;
+    }
+    sCardTable.ClearRange(heapBase, endBuffer);
+
+    ScanDirtyLargeObjectCards(currentMarker);
+}
+
+void GCManager::ScanDirtyLargeObjectCards(unsigned char currentMarker)
+{
+    unsigned char * base = static_cast<unsigned char *>(GCLargeObjectSpace::GetBase());
+    if (base == NULL)
+    {
+        return;
+    }
+    unsigned char * end = base + GCLargeObjectSpace::GetReservedSize();
+    DirtyWrittenPages(sLargeObjectCardTable, base, end);
+
+    size_t pageMask = (size_t)GCVirtualMemory::GetPageSize() - 1;
+    unsigned char * current = base;
+    unsigned char * runStart;
+    unsigned char * runEnd;
+    while (sLargeObjectCardTable.FindDirtyRun(current, end, runStart, runEnd))
+    {
+        // A run can cover the end of an object and the next objects (each object starts on its own page)
+        unsigned char * pointer = runStart;
+        while (pointer < runEnd)
+        {
+            unsigned char * object = static_cast<unsigned char *>(GCLargeObjectSpace::FindObjectContaining(pointer));
+            if (object == NULL)
+            {
+                // Free page
+                pointer = reinterpret_cast<unsigned char *>(((size_t)pointer + pageMask + 1) & ~pageMask);
+                continue;
+            }
+            ::System::Object * obj = reinterpret_cast< ::System::Object *>(object);
+            unsigned char * objectEnd = object + GetSize(obj);
+            // The young objects (not marked yet) are traced if they are reachable
+            if ((obj->__GetMark__() == currentMarker) && (pointer < objectEnd))
+            {
+                // For a big array, only the items on the dirty cards are traced
+                obj->__TraceRange__(currentMarker, pointer, (runEnd < objectEnd) ? runEnd : objectEnd);
+            }
+            pointer = reinterpret_cast<unsigned char *>(((size_t)objectEnd + pageMask) & ~pageMask);
+        }
+        current = runEnd;
+    }
+    sLargeObjectCardTable.ClearRange(base, end);
+}
+
+void GCManager::DirtyWrittenPages(GCCardTable & cardTable, unsigned char * start, unsigned char * end)
+{
+    // The pages are read and reset by batches, like RescanWrittenPages()
+    void * pages[WRITTEN_PAGES_BATCH];
+    int pageSize = GCVirtualMemory::GetPageSize();
+    unsigned char * current = start;
+    while (current < end)
+    {
+        int numPages = GCVirtualMemory::GetWrittenPages(current, end - current, pages, WRITTEN_PAGES_BATCH);
+        if (numPages < 0)
+        {
+            if (sGeneratedWriteBarrier == false)
+            {
+                // The writes are not tracked, consider that everything has been written to
+                cardTable.MarkRange(current, end);
+            }
+            // Otherwise the generated code dirtied the cards itself
+            return;
+        }
+        for (int i = 0 ; i < numPages ; ++i)
+        {
+            unsigned char * page = static_cast<unsigned char *>(pages[i]);
+            unsigned char * endPage = page + pageSize;
+            if (endPage > end)
+            {
+                endPage = end;
+            }
+            cardTable.MarkRange(page, endPage);
+        }
+        if (numPages < WRITTEN_PAGES_BATCH)
+        {
+            break;
+        }
+        current = static_cast<unsigned char *>(pages[numPages - 1]) + pageSize;
+    }
+}
 
-void GCManager::Setup(const InitOptions & /*options*/)
+void GCManager::ResetCards()
 {
-    // Don't store anything, we'll call GetOptions() as needed
+    // From now on, the pages written to are tracked
+    //  (The main buffer and the large object space at once, on Linux this is done for the whole process)
+    GCVirtualMemory::ResetWrittenPages();
+    if (sGenerationalEnabled)
+    {
+        ClearCards();
+    }
 }
 
-void GCManager::Teardown()
+void GCManager::ClearCards()
 {
-    // Do one last collect
-    Collect(MAX_GENERATION, true);
-
-    // Here we should make sure that no more object is allocated
-    //  TODO:   Make sure of that!
+    // The cards after the current alloc pointer can't be dirty
+    sCardTable.ClearRange(GCAllocator::GetHeapBase(), GCAllocator::GetCurrentAllocPointer());
+    unsigned char * base = static_cast<unsigned char *>(GCLargeObjectSpace::GetBase());
+    if (base != NULL)
+    {
+        sLargeObjectCardTable.ClearRange(base, base + GCLargeObjectSpace::GetReservedSize());
+    }
 }
+#endif
 
-// Note that this implementation doesn't do Intra-frame yet
-//  TODO:   Improve this...
-//          Parse the stack and the registers and see what object to not collect
-void GCManager::Collect(int /* generation */, bool final)
+#ifndef CN_GC_HEADER_MARK
+void GCManager::CompactMainBuffer(unsigned char currentMarker, int maxLivePercent)
 {
-    double diff;
-    clock_t startGc = clock();
-
-    // Reconcile the cache and the memory so the collection happen on correct memory buffers
-    GCAllocator::SafeReconcileMediumCache();
-
-    // First increase marker and avoid ::System::Object::__MARKER_AT_CREATION__
-    unsigned int currentMarker = sCurrentMarker;
-    ++currentMarker;
-    currentMarker &= 0xff;
-    if (currentMarker == ::System::Object::__MARKER_AT_CREATION__)
+    // Mostly-copying compaction (Bartlett)
+    //  The marking pinned what can't be moved: the memory pointed by the stack and the registers
+    //  (the values might not be pointers, or point inside the objects) and the objects traced by value.
+    //  The other live objects of the sparse blocks are copied next to each other, then the pointers to them are updated.
+    sCompactionPhase = COMPACTION_NONE;
+    unsigned char * heapBase = GCAllocator::GetHeapBase();
+    unsigned char * endBuffer = static_cast<unsigned char *>(GCAllocator::GetCurrentAllocPointer());
+    if (SelectSparseBlocks(heapBase, endBuffer, maxLivePercent) == 0)
     {
-        // We looped, so do it another time
-        ++currentMarker;
-        currentMarker &= 0xff;
+        return;
     }
-    sCurrentMarker = (unsigned char)currentMarker;
-
-    // Now the current marker is different from any other marker currently stored in previous managed objects
-    //  And it is also different from any newly created object...
 
-    // Now trace all the objects from the roots
-    //  The user has to provide a single function to do that
-    //  If he doesn't, there is big chance that all the objects will be collected
-    if (final == false)
+    // Each object is copied the first time it is reached, then the objects it points to are copied
+    //  from the gray worklist (depth-first), so the objects of a structure end up next to each other
+    sCompactionPhase = COMPACTION_EVACUATING;
+    for (unsigned char * block = heapBase ; block < endBuffer ; block += COMPACTION_BLOCK_SIZE)
     {
-        // Trace all the types registered...
-        // And all the static members
-        // And all the global strings
+        if (sEvacuatedCards.IsCardDirty(block) == false)
+        {
+            continue;
+        }
+        unsigned char * blockEnd = block + COMPACTION_BLOCK_SIZE;
+        if (blockEnd > endBuffer)
+        {
+            blockEnd = endBuffer;
+        }
+
+        // The live objects starting in the block (the ones already evacuated don't have a start anymore)
+        unsigned char * current = block;
+        for ( ; ; )
+        {
+            current = static_cast<unsigned char *>(sObjectStartBitmap.FindNextSet(current, blockEnd));
+            if (current == blockEnd)
+            {
+                break;
+            }
+            ::System::Object * object = reinterpret_cast< ::System::Object *>(current);
+            current += GCAllocator::Align(GetSize(object));
+            if (Evacuate(object, currentMarker) != NULL)
+            {
+                DrainMarkStack(currentMarker, -1);
+            }
+        }
+    }
+    RetireCopyChunk();
 
-        clock_t startTracingPermanent = clock();
-        CrossNetRuntime::Trace((unsigned char)currentMarker);
-        clock_t endTracingPermanent = clock();
-        diff = (double)(endTracingPermanent - startTracingPermanent) / (double)CLOCKS_PER_SEC;
-        sNumSecondsInTracingPermanent += diff;
+    if (sCompactedBytes > 0)
+    {
+        sCompactionPhase = COMPACTION_FIXING;
+        FixupPointers(currentMarker);
+    }
+    sCompactionPhase = COMPACTION_NONE;
+    sEvacuatedCards.ClearRange(heapBase, endBuffer);
 
-        clock_t startTracingStack = endTracingPermanent;
-        // Stack crawling should be implemented here
-        TraceStack((unsigned char)currentMarker);
-        clock_t endTracingStack = clock();
-        diff = (double)(endTracingStack - startTracingStack) / (double)CLOCKS_PER_SEC;
-        sNumSecondsInTracingStack += diff;
+    if (sGenerationalEnabled)
+    {
+        // The copies and the updated pointers are not writes of the application, all the objects are old
+        ResetCards();
+    }
+}
 
-        // Then call the user provided function
-        clock_t startTracingStatics = endTracingStack;
-        const InitOptions & options = ::CrossNetRuntime::GetOptions();
-        if (options.mMainTrace != NULL)
+int GCManager::SelectSparseBlocks(unsigned char * start, unsigned char * end, int maxLivePercent)
+{
+    int numBlocks = 0;
+    for (unsigned char * block = start ; block < end ; block += COMPACTION_BLOCK_SIZE)
+    {
+        unsigned char * blockEnd = block + COMPACTION_BLOCK_SIZE;
+        if (blockEnd > end)
         {
-            options.mMainTrace((unsigned char)currentMarker);
+            blockEnd = end;
         }
-        clock_t endTracingStatics = clock();
-        diff = (double)(endTracingStatics - startTracingStatics) / (double)CLOCKS_PER_SEC;
-        sNumSecondsInTracingStatics += diff;
+        // One bit per live granule, the pages of the block are not read
+        int liveBytes = sMarkBitmap.CountRange(block, blockEnd) << GCBitmap::GRANULE_SHIFT;
+        if ((liveBytes == 0) || (liveBytes * 100 >= (int)(blockEnd - block) * maxLivePercent))
+        {
+            // Nothing to gain from a free block (or from a dense one)
+            continue;
+        }
+        sEvacuatedCards.MarkRange(block, blockEnd);
+        ++numBlocks;
     }
+    return (numBlocks);
+}
 
-    // Then we have to parse every single object and find out which one is not traced yet...
-    //  I.e. is marker is different from the currentMarker...
-
-    void * mainBuffer = CrossNetRuntime::GetOptions().mMainBuffer;
-    GCAllocator::AllocStructure * ptr = static_cast<GCAllocator::AllocStructure *>(mainBuffer);
-    // Nothing has been allocated after the current alloc pointer...
-    void * endBuffer = GCAllocator::GetCurrentAllocPointer();
+bool GCManager::IsPinned(::System::Object * object, int alignedSize)
+{
+    if ((object->m__AllFlags__ & (::System::Object::__FIXED__ | ::System::Object::__HASHED__ | ::System::Object::__ALIGNED__)) != 0)
+    {
+        return (true);
+    }
+    // Any pinned card overlapping the object
+    unsigned char * start = reinterpret_cast<unsigned char *>(object);
+    unsigned char * runStart;
+    unsigned char * runEnd;
+    return (sPinnedCards.FindDirtyRun(start, start + alignedSize, runStart, runEnd));
+}
 
-    void * firstFree = NULL;
+::System::Object * GCManager::Evacuate(::System::Object * object, unsigned char currentMarker)
+{
+    int alignedSize = GCAllocator::Align(GetSize(object));
+    if (IsPinned(object, alignedSize))
+    {
+        return (NULL);
+    }
+    unsigned char * copy = AllocateCopy(alignedSize);
+    if (copy == NULL)
+    {
+        // No room left, the object stays where it is
+        return (NULL);
+    }
 
-    sCollecting = true;
+    unsigned char * start = reinterpret_cast<unsigned char *>(object);
+    __memcopy__(copy, start, alignedSize);
+    // The copy is the live object now (and an old one for the generational collection)
+    sMarkBitmap.ClearRange(start, start + alignedSize);
+    sObjectStartBitmap.Clear(start);
+    sMarkBitmap.SetRange(copy, copy + alignedSize);
+    sObjectStartBitmap.Set(copy);
+    GCAllocator::ClearAllocationStarts(start, start + alignedSize);
+    GCAllocator::RecordAllocationStart(copy);
+
+    // The forwarding block stays until the sweep
+    GCAllocator::AllocStructure * forward = reinterpret_cast<GCAllocator::AllocStructure *>(start);
+    forward->mMarker = GCAllocator::FORWARDED_MARKER;
+    forward->mNext = reinterpret_cast<GCAllocator::AllocStructure *>(copy);
+    forward->mSize = alignedSize;
+    sCompactedBytes += alignedSize;
+
+    // Its pointers are visited from the gray worklist (or now if it is full)
+    ::System::Object * moved = reinterpret_cast< ::System::Object *>(copy);
+    if (sMarkStack.Push(moved) == false)
+    {
+        moved->__Trace__(currentMarker);
+    }
+    return (moved);
+}
 
-    // We are going to consolidate all the free blocks,
-    //  the bins won't contain any useful information anymore
-    //  Clean them to not have garbage next pointers
-    GCAllocator::ClearBins();
+unsigned char * GCManager::AllocateCopy(int alignedSize)
+{
+    if (sCopyEnd - sCopyCurrent >= alignedSize)
+    {
+        unsigned char * copy = sCopyCurrent;
+        sCopyCurrent += alignedSize;
+        return (copy);
+    }
+    RetireCopyChunk();
 
-    clock_t startInCollect = clock();
-    while (ptr < endBuffer)
+    int chunkSize = (alignedSize > COMPACTION_COPY_CHUNK_SIZE) ? alignedSize : COMPACTION_COPY_CHUNK_SIZE;
+    for ( ; ; )
     {
-        if (ptr->mMarker == GCAllocator::FREE_MARKER)
+        // First the free blocks of the dense parts of the heap (the bins are still the ones of the last sweep)
+        GCAllocator::AllocStructure * block;
+        while ((block = GCAllocator::FindMediumBlock(chunkSize)) != NULL)
         {
-            // Free block, go to the next block...
-            if (firstFree == NULL)
+            unsigned char * blockStart = reinterpret_cast<unsigned char *>(block);
+            unsigned char * blockEnd = blockStart + block->mSize;
+            unsigned char * runStart;
+            unsigned char * runEnd;
+            if (sEvacuatedCards.FindDirtyRun(blockStart, blockEnd, runStart, runEnd) == false)
             {
-                firstFree = ptr;        // Mark it as the first free block of the region
+                sCopyCurrent = blockStart;
+                sCopyEnd = blockEnd;
+                return (AllocateCopy(alignedSize));
             }
-            CROSSNET_ASSERT(GCAllocator::IsAligned(ptr->mSize), "");
-            ptr += (ptr->mSize / sizeof(GCAllocator::AllocStructure));
-            continue;
+            // In a block being evacuated, it simply stays out of the bins (the sweep rebuilds them)
         }
 
-        GCAllocator::AllocStructure * nextPtr;
-
-        // ptr points to an allocated block, 2 cases...
-        ::System::Object * obj = reinterpret_cast<::System::Object *>(ptr);
-        // Assert before the crash so it's clearer what is hapenning
-        // Look at the VTable to see what is the actual type
-        CROSSNET_ASSERT((void *)(obj->m__InterfaceMap__) != NULL, "The interface map has not been set correctly.");
-        CROSSNET_ASSERT((int)(obj->m__InterfaceMap__) != System::Object::__FAKE_INTERFACE_MAP__, "The interface map has not been set correctly.");
+        // Then at the end of the heap
+        //  (Like the allocator, the end of the allocation must be strictly before the end of the buffer)
+        unsigned char * current = GCAllocator::sCurrentAllocPointer;
+        if (current + chunkSize < static_cast<unsigned char *>(GCAllocator::sEndMainBuffer))
+        {
+            GCAllocator::sCurrentAllocPointer = current + chunkSize;
+            sCopyCurrent = current;
+            sCopyEnd = current + chunkSize;
+            return (AllocateCopy(alignedSize));
+        }
 
-        int size;
-        if ((obj->m__AllFlags__ & ::System::Object::__DYN_ALLOC__) == 0)
+        if (GCAllocator::GrowHeap(chunkSize))
         {
-            // Standard allocation, use the interface map to get the size
-            size = (int)InterfaceMapper::GetSize(obj->m__InterfaceMap__);
+            // A released segment is back in the bins, or more memory has been committed at the end
+            continue;
         }
-        else
+        if (chunkSize == alignedSize)
         {
-            // Variable size allocations (for arrays and strings)
-            size = obj->__GetVariableSize__();
+            return (NULL);
         }
-        int alignedSize = GCAllocator::Align(size);
-        nextPtr = ptr + (alignedSize / sizeof(GCAllocator::AllocStructure));
+        // Not enough room for a whole chunk, maybe for this object only
+        chunkSize = alignedSize;
+    }
+}
 
-        // Now that we have the next pointer, we can see if the collection is needed
-        if (obj->__GetMark__() != (unsigned char)currentMarker)
-        {
-            // The mark is different, it means that we need to collect this object
-            obj->__OnCollect__();
+void GCManager::RetireCopyChunk()
+{
+    if (sCopyCurrent < sCopyEnd)
+    {
+        // The rest of the chunk is free, the sweep consolidates it with the dead objects around it
+        GCAllocator::AllocStructure * tail = reinterpret_cast<GCAllocator::AllocStructure *>(sCopyCurrent);
+        tail->mMarker = GCAllocator::RESERVED_MARKER;
+        tail->mSize = (int)(sCopyEnd - sCopyCurrent);
+    }
+    sCopyCurrent = NULL;
+    sCopyEnd = NULL;
+}
 
-            // Now we can free the block, at the same time, we can actually free the previous blocks as well
-            if (firstFree == NULL)
-            {
-                firstFree = obj;        // Mark the block as first free block...
-            }
-        }
-        else
+void GCManager::VisitSlot(void * * slot, unsigned char currentMarker)
+{
+    void * target = *slot;
+    if ((sEvacuatedCards.Covers(target) == false) || (sEvacuatedCards.IsCardDirty(target) == false))
+    {
+        // Not in a block being evacuated (NULL is not covered either)
+        return;
+    }
+    GCAllocator::AllocStructure * block = static_cast<GCAllocator::AllocStructure *>(target);
+    if (block->mMarker == GCAllocator::FORWARDED_MARKER)
+    {
+        *slot = block->mNext;
+        return;
+    }
+    if (sCompactionPhase == COMPACTION_EVACUATING)
+    {
+        // First time this object is reached from an evacuated one, move it next to it (unless it is pinned)
+        ::System::Object * copy = Evacuate(static_cast< ::System::Object *>(target), currentMarker);
+        if (copy != NULL)
         {
-            CROSSNET_ASSERT(final == false, "If final, all objects should be collected!");
-
-            // This block is not free
-            if (firstFree != NULL)
-            {
-                // Set the size for the previous free block
-                size = (int)ptr - (int)firstFree;
-                GCAllocator::Free(firstFree, size);
-                firstFree = NULL;
-            }
+            *slot = copy;
         }
+    }
+}
 
-        // Go to the next object...
-        ptr = nextPtr;
+void GCManager::FixupPointers(unsigned char currentMarker)
+{
+    // The roots first, the ones traced by value have been pinned (and the stack is not parsed again)
+    CrossNetRuntime::Trace(currentMarker);
+    const InitOptions & options = ::CrossNetRuntime::GetOptions();
+    if (options.mMainTrace != NULL)
+    {
+        options.mMainTrace(currentMarker);
+    }
+    if (GCShadowStack::IsEnabled())
+    {
+        // The precise stack roots are not pinned, their slots are updated like the fields
+        GCShadowStack::Trace(currentMarker);
     }
 
-    // The pointers should match (otherwise we missed something...)
-    CROSSNET_ASSERT(ptr == endBuffer, "");
+    // Then the live objects of the main buffer, found from their start (the copies included)
+    unsigned char * current = GCAllocator::GetHeapBase();
+    unsigned char * endBuffer = static_cast<unsigned char *>(GCAllocator::GetCurrentAllocPointer());
+    for ( ; ; )
+    {
+        current = static_cast<unsigned char *>(sObjectStartBitmap.FindNextSet(current, endBuffer));
+        if (current == endBuffer)
+        {
+            break;
+        }
+        ::System::Object * object = reinterpret_cast< ::System::Object *>(current);
+        current += GCAllocator::Align(GetSize(object));
+        object->__Trace__(currentMarker);
+    }
 
-    // We are done with this loop
-    if (firstFree != NULL)
+    // And the live large objects (they are never moved)
+    ::System::Object * obj = static_cast< ::System::Object *>(GCLargeObjectSpace::GetFirstObject());
+    while (obj != NULL)
     {
-        // And it seems that the last block (or set of block) is actually free!
-        // Update the current pointer accordingly (as such enables a little defragmentation)
-        GCAllocator::SetCurrentAllocPointer(firstFree);
+        if (obj->__GetMark__() == currentMarker)
+        {
+            obj->__Trace__(currentMarker);
+        }
+        obj = static_cast< ::System::Object *>(GCLargeObjectSpace::GetNextObject(obj));
     }
+}
+#endif
 
-    clock_t endInCollect = clock();
-    diff = (double)(endInCollect - startInCollect) / (double)CLOCKS_PER_SEC;
-    sNumSecondsInCollect += diff;
+void GCManager::WriteBarrierRange(void * start, int size)
+{
+    if (size <= 0)
+    {
+        return;
+    }
+    unsigned char * end = static_cast<unsigned char *>(start) + size;
+    // The range is outside the arena if one of its ends is (the arena is contiguous)
+    RegionScope::OnStore(start);
+    RegionScope::OnStore(end - 1);
+#ifndef CN_GC_HEADER_MARK
+    if (sCardTable.Covers(start))
+    {
+        sCardTable.MarkRange(start, end);
+    }
+    else if (sLargeObjectCardTable.Covers(start))
+    {
+        sLargeObjectCardTable.MarkRange(start, end);
+    }
+#endif
+}
 
-    sCollecting = false;
+void GCManager::SweepLargeObjects(unsigned char currentMarker, bool final)
+{
+    final;
+    ::System::Object * obj = static_cast<::System::Object *>(GCLargeObjectSpace::GetFirstObject());
+    while (obj != NULL)
+    {
+        // Get the next object first, the pages of the current one might be released
+        ::System::Object * nextObj = static_cast<::System::Object *>(GCLargeObjectSpace::GetNextObject(obj));
 
-    ++sNumCollections;
+        if (obj->__GetMark__() != currentMarker)
+        {
+            GCEventLog::AddFreed(1, GetSize(obj), 0);
+            obj->__OnCollect__();
+            // The pages are given back to the OS right away
+            GCLargeObjectSpace::Free(obj);
+        }
+        else
+        {
+            CROSSNET_ASSERT(final == false, "If final, all objects should be collected!");
+            sLiveBytes += GetSize(obj);
+        }
 
-    clock_t endGc = endInCollect;
-    diff = (double)(endGc - startGc) / (double)CLOCKS_PER_SEC;
-    sNumSecondsInGcManager += diff;
+        obj = nextObj;
+    }
 }
 
 void GCManager::CollectOneObject(::System::Object * object)
@@ -225,18 +1769,23 @@ void GCManager::CollectOneObject(::System::Object * object)
     object->__OnCollect__();
 
     // Then we need to free the corresponding memory
-    int size;
-    if ((object->m__AllFlags__ & ::System::Object::__DYN_ALLOC__) == 0)
+    int size = GetSize(object);
+    if (GCLargeObjectSpace::IsObjectStart(object))
     {
-        // Standard allocation, use the interface map to get the size
-        size = (int)InterfaceMapper::GetSize(object->m__InterfaceMap__);
+        GCAllocator::Lock();
+        GCLargeObjectSpace::Free(object);
+        GCAllocator::Unlock();
+    }
+    else if (GCPointerFreeSpace::InPointerFreeSpace(object))
+    {
+        GCAllocator::Lock();
+        GCPointerFreeSpace::Free(object);
+        GCAllocator::Unlock();
     }
     else
     {
-        // Variable size allocations (for arrays and strings)
-        size = object->__GetVariableSize__();
+        GCAllocator::Free(object, size);
     }
-    GCAllocator::Free(object, size);
 
     sCollecting = false;
 }
@@ -252,6 +1801,11 @@ int GCManager::GetNumCollections()
     return (sNumCollections);
 }
 
+int GCManager::GetLiveBytes()
+{
+    return (sLiveBytes);
+}
+
 double GCManager::GetNumSecondsInGcManager()
 {
     return (sNumSecondsInGcManager);
@@ -288,6 +1842,14 @@ void GCManager::SetTopOfStack()
 
 void GCManager::TraceStack(unsigned char mark)
 {
+    if (GCShadowStack::IsEnabled())
+    {
+        // The generated code registers its managed locals, no need to parse the stack and the registers
+        //  The slots of all the threads are traced, not only the ones of the collecting thread
+        GCShadowStack::Trace(mark);
+        return;
+    }
+
     // Platform specific code
     void * _EAX;
     void * _EBX;
@@ -310,6 +1872,7 @@ void GCManager::TraceStack(unsigned char mark)
         mov _EBP, ebp
     }
 
+    // During the marking of a compaction, the memory pointed by these values is pinned (see ValidateRoot2())
     ValidateRoot2(_EAX, mark);
     ValidateRoot2(_EBX, mark);
     ValidateRoot2(_ECX, mark);
@@ -333,18 +1896,98 @@ void GCManager::TraceStack(unsigned char mark)
 
     // For each value from _ESP to TopOfStack
     // We are going to check if they are valid roots...
+    ValidateRoots((void * const *)_ESP, (void * const *)sTopOfStack, mark);
+
+    // Same for the other threads, they are suspended (see GCAllocator::SuspendOtherThreads())
+    for (GCAllocator::ThreadAllocBuffer * buffer = GCAllocator::sAllThreadAllocBuffers ; buffer != NULL ; buffer = buffer->mNextBuffer)
+    {
+        if (buffer->mStackPointer == NULL)
+        {
+            // The current thread, or a detached one
+            continue;
+        }
+        for (int i = 0 ; i < GCThread::NUM_SAVED_REGISTERS ; ++i)
+        {
+            ValidateRoot2(buffer->mRegisters[i], mark);
+        }
+        ValidateRoots((void * const *)buffer->mStackPointer, (void * const *)buffer->mStackBase, mark);
+    }
+}
+
+void GCManager::ValidateRoots(void * const * start, void * const * end, unsigned char mark)
+{
+    // Most of the values on the stack don't point to managed memory (return addresses, integers, pointers to the stack)
+    //  Each range is checked with (value - base) < size, unsigned. SSE2 only has signed compares,
+    //  so both sides are offset by 0x80000000 (a disabled space has a size of 0, nothing is in it)
+    const __m128i bias = _mm_set1_epi32((int)0x80000000);
+    unsigned char * heapBase = GCAllocator::GetHeapBase();
+    unsigned char * heapEnd = static_cast<unsigned char *>(GCAllocator::GetCurrentAllocPointer());
+    const __m128i mainBase = _mm_set1_epi32((int)heapBase);
+    const __m128i mainSize = _mm_xor_si128(_mm_set1_epi32((int)(heapEnd - heapBase)), bias);
+    const __m128i largeBase = _mm_set1_epi32((int)GCLargeObjectSpace::GetBase());
+    const __m128i largeSize = _mm_xor_si128(_mm_set1_epi32((int)GCLargeObjectSpace::GetReservedSize()), bias);
+    const __m128i pointerFreeBase = _mm_set1_epi32((int)GCPointerFreeSpace::GetBase());
+    const __m128i pointerFreeSize = _mm_xor_si128(_mm_set1_epi32((int)GCPointerFreeSpace::GetReservedSize()), bias);
+
+    void * const * current = start;
+    for ( ; current + 4 <= end ; current += 4)
+    {
+        __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i *>(current));
+        __m128i inMain = _mm_cmplt_epi32(_mm_xor_si128(_mm_sub_epi32(values, mainBase), bias), mainSize);
+        __m128i inLarge = _mm_cmplt_epi32(_mm_xor_si128(_mm_sub_epi32(values, largeBase), bias), largeSize);
+        __m128i inPointerFree = _mm_cmplt_epi32(_mm_xor_si128(_mm_sub_epi32(values, pointerFreeBase), bias), pointerFreeSize);
+        // One bit per byte, so the bits 0, 4, 8 and 12 tell for each value
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(inMain, inLarge), inPointerFree));
+        if (mask == 0)
+        {
+            // Most common case
+            continue;
+        }
+        for (int i = 0 ; i < 4 ; ++i)
+        {
+            if ((mask & (1 << (i * 4))) != 0)
+            {
+                ValidateRoot2(current[i], mark);
+            }
+        }
+    }
 
-    void * * bottomOfStack = (void * *)_ESP;
-    void * * topOfStack = (void * *)sTopOfStack;
+    // The last values one by one (ValidateRoot() rejects them the same way)
+    for ( ; current < end ; ++current)
+    {
+        ValidateRoot2(*current, mark);
+    }
+}
 
-    while (bottomOfStack < topOfStack)
+bool GCManager::MarkHeaderAtomic(System::Object * object, unsigned char currentMark)
+{
+    volatile long * flags = reinterpret_cast<volatile long *>(&object->m__AllFlags__);
+    for ( ; ; )
     {
-        ValidateRoot2(*bottomOfStack++, mark);
+        long previous = *flags;
+        if ((unsigned char)previous == currentMark)
+        {
+            return (false);
+        }
+        long marked = (previous & 0xffffff00) | currentMark;
+        if (_InterlockedCompareExchange(flags, marked, previous) == previous)
+        {
+            return (true);
+        }
+        // Another bit changed at the same time (or another thread marked it), try again
     }
 }
 
 void GCManager::ValidateRoot2(void * value, unsigned char mark)
 {
+#ifndef CN_GC_HEADER_MARK
+    if (sCompactionPhase == COMPACTION_MARKING)
+    {
+        // The value might be a pointer inside an object (or not a pointer at all), it can't be updated
+        //  Whatever it points to in the main buffer stays where it is
+        Pin(value);
+    }
+#endif
     bool tryAnother = (ValidateRoot(value, mark) == false);
     if (tryAnother)
     {
@@ -357,6 +2000,7 @@ void GCManager::ValidateRoot2(void * value, unsigned char mark)
 
         // In a perfect world, we would either make sure this never happens
         // Or find the corresponding object (sizeof(System::Object) might not always be enough...)
+        //  That's what InitOptions::mExactInteriorPointers does, ValidateRoot() never fails then
         pointer -= sizeof(::System::Object);
         pointer &= ~(GCAllocator::ALIGNMENT - 1);
 
@@ -366,6 +2010,33 @@ void GCManager::ValidateRoot2(void * value, unsigned char mark)
 
 bool GCManager::ValidateRoot(void * value, unsigned char currentMark)
 {
+    if (GCPointerFreeSpace::InPointerFreeSpace(value))
+    {
+        // The start of the object is known from the address, even for a pointer inside the object
+        //  And there is nothing to trace inside
+        void * object = GCPointerFreeSpace::FindObject(value);
+        if (object != NULL)
+        {
+            GCPointerFreeSpace::Mark(object);
+        }
+        return (true);
+    }
+
+#ifndef CN_GC_HEADER_MARK
+    if (GCAllocator::IsRecordingAllocationStarts())
+    {
+        // The start of the object is known exactly, even for a pointer inside the object
+        //  And nothing is read before the start is found, so any value can be checked safely
+        ::System::Object * object = FindObjectContaining(value);
+        if (object != NULL)
+        {
+            Trace(object, currentMark);
+        }
+        // Don't try around, there is nothing else to find
+        return (true);
+    }
+#endif
+
     if (GCAllocator::IsAligned(value) == false)
     {
         // The value is not aligned, it can't point to a managed object
@@ -375,9 +2046,18 @@ bool GCManager::ValidateRoot(void * value, unsigned char currentMark)
 
     if (GCAllocator::InCurrentAllocationSpace(value) == false)
     {
-        // The value is not in the allocated memory, it can't point to a managed object
-        // No need to try around either
-        return (true);
+        if (GCLargeObjectSpace::InLargeObjectSpace(value) == false)
+        {
+            // The value is not in the allocated memory, it can't point to a managed object
+            // No need to try around either
+            return (true);
+        }
+        if (GCLargeObjectSpace::IsObjectStart(value) == false)
+        {
+            // Inside a large object (or in a free page), we can't read it
+            //  But it might be just after the start of the object, try around
+            return (false);
+        }
     }
     // It's in the allocated space (so we can now read the memory)
 
@@ -443,4 +2123,38 @@ bool GCManager::ValidateRoot(void * value, unsigned char currentMark)
     return (true);
 }
 
-}
\ No newline at end of file
+::System::Object * GCManager::FindObjectContaining(void * value)
+{
+    void * start;
+    if (GCAllocator::InCurrentAllocationSpace(value))
+    {
+        // Bounded by the size of the biggest object of the main buffer (usually one or two words of the bitmap)
+        start = GCAllocator::FindAllocationStart(value);
+    }
+    else
+    {
+        // NULL if the value is not in the large object space either
+        start = GCLargeObjectSpace::FindObjectContaining(value);
+    }
+    if (start == NULL)
+    {
+        return (NULL);
+    }
+
+    ::System::Object * object = static_cast< ::System::Object *>(start);
+    if (InterfaceMapper::InInterfaceMapSpace(object->m__InterfaceMap__) == false)
+    {
+        // The object is still being constructed (its constructor allocates), its size is not known yet
+        //  Like before, it is not traced
+        return (NULL);
+    }
+    // The value might be in the free memory after the object
+    size_t alignedSize = (size_t)GCAllocator::Align(GetSize(object));
+    if ((size_t)(static_cast<unsigned char *>(value) - static_cast<unsigned char *>(start)) >= alignedSize)
+    {
+        return (NULL);
+    }
+    return (object);
+}
+
+}
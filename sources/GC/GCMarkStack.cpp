@@ -0,0 +1,91 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CrossNetRuntime/GC/GCMarkStack.h"
+#include "CrossNetRuntime/GC/GCVirtualMemory.h"
+#include "CrossNetRuntime/Assert.h"
+
+namespace CrossNetRuntime
+{
+
+GCMarkStack::GCMarkStack()
+    :
+    mBottom(NULL),
+    mTop(NULL),
+    mCommittedEnd(NULL),
+    mReservedEnd(NULL)
+{
+    // Do nothing...
+    //  Until Setup() is called, Push() fails and the objects are traced recursively
+}
+
+void GCMarkStack::Setup(size_t reservedSize)
+{
+    CROSSNET_ASSERT(mBottom == NULL, "The mark stack is already setup!");
+
+    reservedSize = (reservedSize + COMMIT_SIZE - 1) & ~(size_t)(COMMIT_SIZE - 1);
+    mBottom = static_cast< ::System::Object * *>(GCVirtualMemory::Reserve(reservedSize));
+    if (mBottom == NULL)
+    {
+        // Not critical, the marking is simply recursive
+        return;
+    }
+    mTop = mBottom;
+    mCommittedEnd = mBottom;
+    mReservedEnd = reinterpret_cast< ::System::Object * *>(reinterpret_cast<unsigned char *>(mBottom) + reservedSize);
+}
+
+void GCMarkStack::Teardown()
+{
+    if (mBottom != NULL)
+    {
+        GCVirtualMemory::Release(mBottom, (unsigned char *)mReservedEnd - (unsigned char *)mBottom);
+    }
+    mBottom = NULL;
+    mTop = NULL;
+    mCommittedEnd = NULL;
+    mReservedEnd = NULL;
+}
+
+void GCMarkStack::Shrink()
+{
+    CROSSNET_ASSERT(IsEmpty(), "");
+
+    unsigned char * keep = reinterpret_cast<unsigned char *>(mBottom) + COMMIT_SIZE;
+    unsigned char * committedEnd = reinterpret_cast<unsigned char *>(mCommittedEnd);
+    if (committedEnd > keep)
+    {
+        GCVirtualMemory::Decommit(keep, committedEnd - keep);
+        mCommittedEnd = reinterpret_cast< ::System::Object * *>(keep);
+    }
+}
+
+bool GCMarkStack::Grow()
+{
+    if (mCommittedEnd == mReservedEnd)
+    {
+        // Not setup, or the reservation is full
+        return (false);
+    }
+    if (GCVirtualMemory::Commit(mCommittedEnd, COMMIT_SIZE) == false)
+    {
+        return (false);
+    }
+    mCommittedEnd = reinterpret_cast< ::System::Object * *>(reinterpret_cast<unsigned char *>(mCommittedEnd) + COMMIT_SIZE);
+    return (true);
+}
+
+}
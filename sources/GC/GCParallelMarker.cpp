@@ -0,0 +1,222 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CrossNetRuntime/GC/GCParallelMarker.h"
+#include "CrossNetRuntime/GC/GCThread.h"
+#include "CrossNetRuntime/GC/GCManager.h"
+#include "CrossNetRuntime/Assert.h"
+
+namespace CrossNetRuntime
+{
+
+int                     GCParallelMarker::sNumThreads = 1;
+GCWorkStealingDeque *   GCParallelMarker::sDeques = NULL;
+void * *                GCParallelMarker::sThreads = NULL;
+void *                  GCParallelMarker::sStartSemaphore = NULL;
+volatile long           GCParallelMarker::sNumActive = 0;
+volatile long           GCParallelMarker::sNumFinished = 0;
+volatile bool           GCParallelMarker::sShutdown = false;
+bool                    GCParallelMarker::sMarking = false;
+unsigned char           GCParallelMarker::sCurrentMarker = 0;
+CROSSNET_THREAD_LOCAL GCWorkStealingDeque *     GCParallelMarker::sThreadDeque = NULL;
+
+void GCParallelMarker::Setup(const ::CrossNetRuntime::InitOptions & options)
+{
+    sNumThreads = 1;
+    sShutdown = false;
+    if (options.mNumMarkThreads <= 1)
+    {
+        // Disabled, the collecting thread marks alone
+        return;
+    }
+
+    sStartSemaphore = GCThread::NewSemaphore();
+    if (sStartSemaphore == NULL)
+    {
+        return;
+    }
+
+    // The collecting thread is the first one, it uses the first deque
+    int numThreads = options.mNumMarkThreads;
+    sDeques = new GCWorkStealingDeque[numThreads];
+    sThreads = new void *[numThreads];
+    sThreads[0] = NULL;
+    for (int i = 0 ; i < numThreads ; ++i)
+    {
+        sDeques[i].Setup(DEQUE_CAPACITY);
+    }
+
+    int numStarted = 1;
+    while (numStarted < numThreads)
+    {
+        void * thread = GCThread::Start(WorkerThread, reinterpret_cast<void *>(numStarted));
+        if (thread == NULL)
+        {
+            // Continue with the threads we have
+            break;
+        }
+        sThreads[numStarted++] = thread;
+    }
+    sNumThreads = numStarted;
+}
+
+void GCParallelMarker::Teardown()
+{
+    if (sDeques == NULL)
+    {
+        return;
+    }
+
+    // Wake up the workers, they exit instead of marking
+    sShutdown = true;
+    GCThread::SignalSemaphore(sStartSemaphore, sNumThreads - 1);
+    for (int i = 1 ; i < sNumThreads ; ++i)
+    {
+        GCThread::Join(sThreads[i]);
+    }
+    GCThread::DeleteSemaphore(sStartSemaphore);
+    sStartSemaphore = NULL;
+
+    for (int i = 0 ; i < sNumThreads ; ++i)
+    {
+        sDeques[i].Teardown();
+    }
+    delete [] sDeques;
+    delete [] sThreads;
+    sDeques = NULL;
+    sThreads = NULL;
+    sNumThreads = 1;
+}
+
+void GCParallelMarker::Begin(unsigned char currentMarker)
+{
+    CROSSNET_ASSERT(IsEnabled(), "");
+    CROSSNET_ASSERT(sMarking == false, "");
+
+    sCurrentMarker = currentMarker;
+    sThreadDeque = &sDeques[0];
+    sNumFinished = 0;
+    // All the threads are active until they don't find anything to trace
+    sNumActive = sNumThreads;
+    sMarking = true;
+
+    GCThread::SignalSemaphore(sStartSemaphore, sNumThreads - 1);
+}
+
+void GCParallelMarker::End()
+{
+    CROSSNET_ASSERT(sMarking, "");
+
+    MarkLoop(0);
+
+    // The workers are leaving their loop as well, wait for them before the sweep reads the marks
+    int iteration = 0;
+    while (sNumFinished != sNumThreads - 1)
+    {
+        GCThread::Relax(iteration++);
+    }
+    sMarking = false;
+}
+
+void GCParallelMarker::MarkLoop(int index)
+{
+    GCWorkStealingDeque & deque = sDeques[index];
+    unsigned char currentMarker = sCurrentMarker;
+    for ( ; ; )
+    {
+        // First the objects pushed by this thread (the most recent ones, better locality)
+        ::System::Object * object = deque.Pop();
+        if (object == NULL)
+        {
+            // Then the oldest objects of the other threads
+            object = StealWork(index);
+            if (object == NULL)
+            {
+                if (WaitForWork() == false)
+                {
+                    return;
+                }
+                continue;
+            }
+        }
+
+        // The objects it points to are pushed on the deque of this thread
+        object->__Trace__(currentMarker);
+    }
+}
+
+::System::Object * GCParallelMarker::StealWork(int index)
+{
+    for (int i = 1 ; i < sNumThreads ; ++i)
+    {
+        int victim = index + i;
+        if (victim >= sNumThreads)
+        {
+            victim -= sNumThreads;
+        }
+        ::System::Object * object = sDeques[victim].Steal();
+        if (object != NULL)
+        {
+            return (object);
+        }
+    }
+    return (NULL);
+}
+
+bool GCParallelMarker::WaitForWork()
+{
+    // Returns false when the marking is done
+    //  Only the owner of a deque pushes on it, and it stays active until its deque is empty
+    //  So when no thread is active, all the deques are empty and nobody can push anymore
+    _InterlockedDecrement(&sNumActive);
+    int iteration = 0;
+    for ( ; ; )
+    {
+        if (sNumActive == 0)
+        {
+            return (false);
+        }
+        for (int i = 0 ; i < sNumThreads ; ++i)
+        {
+            if (sDeques[i].IsEmpty() == false)
+            {
+                // Try to steal it (we might be too late, then we come back here)
+                _InterlockedIncrement(&sNumActive);
+                return (true);
+            }
+        }
+        GCThread::Relax(iteration++);
+    }
+}
+
+void GCParallelMarker::WorkerThread(void * parameter)
+{
+    int index = (int)reinterpret_cast<size_t>(parameter);
+    sThreadDeque = &sDeques[index];
+    for ( ; ; )
+    {
+        // Wait for the next collection
+        GCThread::WaitSemaphore(sStartSemaphore);
+        if (sShutdown)
+        {
+            return;
+        }
+        MarkLoop(index);
+        _InterlockedIncrement(&sNumFinished);
+    }
+}
+
+}
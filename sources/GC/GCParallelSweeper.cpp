@@ -0,0 +1,179 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CrossNetRuntime/GC/GCParallelSweeper.h"
+#include "CrossNetRuntime/GC/GCThread.h"
+#include "CrossNetRuntime/GC/GCManager.h"
+#include "CrossNetRuntime/Assert.h"
+
+namespace CrossNetRuntime
+{
+
+int                                 GCParallelSweeper::sNumThreads = 1;
+GCParallelSweeper::ThreadResult *   GCParallelSweeper::sResults = NULL;
+void * *                            GCParallelSweeper::sThreads = NULL;
+void *                              GCParallelSweeper::sStartSemaphore = NULL;
+volatile long                       GCParallelSweeper::sNextChunk = 0;
+volatile long                       GCParallelSweeper::sNumFinished = 0;
+volatile bool                       GCParallelSweeper::sShutdown = false;
+int                                 GCParallelSweeper::sNumChunks = 0;
+unsigned char *                     GCParallelSweeper::sStart = NULL;
+unsigned char *                     GCParallelSweeper::sEnd = NULL;
+
+void GCParallelSweeper::Setup(const ::CrossNetRuntime::InitOptions & options)
+{
+    sNumThreads = 1;
+    sShutdown = false;
+    if (options.mNumSweepThreads <= 1)
+    {
+        // Disabled, the collecting thread sweeps alone
+        return;
+    }
+
+    sStartSemaphore = GCThread::NewSemaphore();
+    if (sStartSemaphore == NULL)
+    {
+        return;
+    }
+
+    // The collecting thread is the first one
+    int numThreads = options.mNumSweepThreads;
+    sResults = new ThreadResult[numThreads];
+    sThreads = new void *[numThreads];
+    sThreads[0] = NULL;
+
+    int numStarted = 1;
+    while (numStarted < numThreads)
+    {
+        void * thread = GCThread::Start(WorkerThread, reinterpret_cast<void *>(numStarted));
+        if (thread == NULL)
+        {
+            // Continue with the threads we have
+            break;
+        }
+        sThreads[numStarted++] = thread;
+    }
+    sNumThreads = numStarted;
+}
+
+void GCParallelSweeper::Teardown()
+{
+    if (sResults == NULL)
+    {
+        return;
+    }
+
+    // Wake up the workers, they exit instead of sweeping
+    sShutdown = true;
+    GCThread::SignalSemaphore(sStartSemaphore, sNumThreads - 1);
+    for (int i = 1 ; i < sNumThreads ; ++i)
+    {
+        GCThread::Join(sThreads[i]);
+    }
+    GCThread::DeleteSemaphore(sStartSemaphore);
+    sStartSemaphore = NULL;
+
+    delete [] sResults;
+    delete [] sThreads;
+    sResults = NULL;
+    sThreads = NULL;
+    sNumThreads = 1;
+}
+
+int GCParallelSweeper::Sweep(unsigned char * start, unsigned char * end)
+{
+    CROSSNET_ASSERT(IsEnabled(), "");
+
+    sStart = start;
+    sEnd = end;
+    sNumChunks = (int)((end - start + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    sNextChunk = 0;
+    sNumFinished = 0;
+    for (int i = 0 ; i < sNumThreads ; ++i)
+    {
+        ThreadResult & result = sResults[i];
+        GCAllocator::ClearLocalBins(result.mBins);
+        result.mLiveBytes = 0;
+        result.mTailRun = NULL;
+    }
+
+    // The destructors of the dead objects are called first, by this thread alone
+    //  The workers then only clear the dead runs and put them in their bins
+    GCManager::CollectDeadObjects(start, end);
+
+    // The workers take the chunks as soon as they wake up
+    GCThread::SignalSemaphore(sStartSemaphore, sNumThreads - 1);
+    SweepChunks(0);
+    int iteration = 0;
+    while (sNumFinished != sNumThreads - 1)
+    {
+        GCThread::Relax(iteration++);
+    }
+
+    // All the chunks are swept, the free runs can go in the bins
+    int liveBytes = 0;
+    for (int i = 0 ; i < sNumThreads ; ++i)
+    {
+        ThreadResult & result = sResults[i];
+        GCAllocator::SpliceLocalBins(result.mBins);
+        liveBytes += result.mLiveBytes;
+        if (result.mTailRun != NULL)
+        {
+            // Only one chunk can have the last run
+            GCAllocator::SetCurrentAllocPointer(result.mTailRun);
+        }
+    }
+    return (liveBytes);
+}
+
+void GCParallelSweeper::SweepChunks(int index)
+{
+    ThreadResult & result = sResults[index];
+    for ( ; ; )
+    {
+        long chunk = _InterlockedIncrement(&sNextChunk) - 1;
+        if (chunk >= sNumChunks)
+        {
+            return;
+        }
+
+        unsigned char * chunkStart = sStart + (size_t)chunk * CHUNK_SIZE;
+        unsigned char * chunkEnd = chunkStart + CHUNK_SIZE;
+        if (chunkEnd > sEnd)
+        {
+            chunkEnd = sEnd;
+        }
+        result.mLiveBytes += GCManager::SweepChunk(chunkStart, chunkEnd, sEnd, result.mBins, result.mTailRun);
+    }
+}
+
+void GCParallelSweeper::WorkerThread(void * parameter)
+{
+    int index = (int)reinterpret_cast<size_t>(parameter);
+    for ( ; ; )
+    {
+        // Wait for the next collection
+        GCThread::WaitSemaphore(sStartSemaphore);
+        if (sShutdown)
+        {
+            return;
+        }
+        SweepChunks(index);
+        _InterlockedIncrement(&sNumFinished);
+    }
+}
+
+}
@@ -0,0 +1,508 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CrossNetRuntime/GC/GCPointerFreeSpace.h"
+#include "CrossNetRuntime/GC/GCVirtualMemory.h"
+#include "CrossNetRuntime/GC/GCThread.h"
+#include "CrossNetRuntime/Assert.h"
+
+// For _ReadWriteBarrier()
+#include <intrin.h>
+
+namespace CrossNetRuntime
+{
+
+unsigned char *     GCPointerFreeSpace::sBase = NULL;
+size_t              GCPointerFreeSpace::sSize = 0;
+int                 GCPointerFreeSpace::sMaxSize = 0;       // Disabled by default
+int                 GCPointerFreeSpace::sNumBlocks = 0;
+unsigned char *     GCPointerFreeSpace::sBlockClasses = NULL;
+int *               GCPointerFreeSpace::sNextBlocks = NULL;
+int                 GCPointerFreeSpace::sFirstFreeBlock = GCPointerFreeSpace::NO_BLOCK;
+GCBitmap            GCPointerFreeSpace::sAllocBitmap;
+GCBitmap            GCPointerFreeSpace::sMarkBitmap;
+int                 GCPointerFreeSpace::sClassSizes[NUM_SIZE_CLASSES];
+unsigned char       GCPointerFreeSpace::sSizeToClass[(MAX_OBJECT_SIZE >> GCBitmap::GRANULE_SHIFT) + 1];
+int                 GCPointerFreeSpace::sAvailableBlocks[NUM_SIZE_CLASSES];
+unsigned char *     GCPointerFreeSpace::sCursors[NUM_SIZE_CLASSES];
+unsigned char *     GCPointerFreeSpace::sCursorEnds[NUM_SIZE_CLASSES];
+bool                GCPointerFreeSpace::sCursorsZeroed[NUM_SIZE_CLASSES];
+GCPointerFreeSpace::ThreadCursors *     GCPointerFreeSpace::sAllThreadCursors = NULL;
+
+CROSSNET_THREAD_LOCAL GCPointerFreeSpace::ThreadCursors *   GCPointerFreeSpace::sThreadCursors = NULL;
+
+void GCPointerFreeSpace::Setup(const ::CrossNetRuntime::InitOptions & options)
+{
+    sMaxSize = 0;
+    if (options.mPointerFreeSpaceSize == 0)
+    {
+        // Disabled, the pointer-free objects are allocated like any other object
+        return;
+    }
+
+    sNumBlocks = (options.mPointerFreeSpaceSize + BLOCK_SIZE - 1) >> BLOCK_SHIFT;
+    sSize = (size_t)sNumBlocks << BLOCK_SHIFT;
+    sBase = static_cast<unsigned char *>(GCVirtualMemory::Reserve(sSize));
+    CROSSNET_FATAL(sBase != NULL, "Could not reserve the address space for the pointer-free space!");
+
+    sAllocBitmap.Setup(sBase, sSize);
+    sMarkBitmap.Setup(sBase, sSize);
+
+    // At the beginning, all the blocks are free (and not committed)
+    sBlockClasses = static_cast<unsigned char *>(options.mUnmanagedAllocateCallback(sNumBlocks));
+    sNextBlocks = static_cast<int *>(options.mUnmanagedAllocateCallback(sNumBlocks * sizeof(int)));
+    for (int block = 0 ; block < sNumBlocks ; ++block)
+    {
+        sBlockClasses[block] = FREE_BLOCK;
+        sNextBlocks[block] = block + 1;
+    }
+    sNextBlocks[sNumBlocks - 1] = NO_BLOCK;
+    sFirstFreeBlock = 0;
+
+    // Size classes: 16, 32, ... 128, then 160, 192, 224, 256, 320, 384... up to MAX_OBJECT_SIZE
+    //  The space lost at the end of a slot is less than 25% of the object
+    int sizeClass = 0;
+    int size = GCBitmap::GRANULE_SIZE;
+    while (size <= 128)
+    {
+        sClassSizes[sizeClass++] = size;
+        size += GCBitmap::GRANULE_SIZE;
+    }
+    for (int powerOf2 = 128 ; powerOf2 < MAX_OBJECT_SIZE ; powerOf2 *= 2)
+    {
+        for (int quarter = 5 ; quarter <= 8 ; ++quarter)
+        {
+            sClassSizes[sizeClass++] = (powerOf2 * quarter) / 4;
+        }
+    }
+    CROSSNET_ASSERT(sizeClass == NUM_SIZE_CLASSES, "");
+    CROSSNET_ASSERT(sClassSizes[NUM_SIZE_CLASSES - 1] == MAX_OBJECT_SIZE, "");
+
+    // Table from the number of granules to the size class, so the allocation doesn't search
+    sizeClass = 0;
+    for (int numGranules = 0 ; numGranules <= (MAX_OBJECT_SIZE >> GCBitmap::GRANULE_SHIFT) ; ++numGranules)
+    {
+        while (sClassSizes[sizeClass] < (numGranules << GCBitmap::GRANULE_SHIFT))
+        {
+            ++sizeClass;
+        }
+        sSizeToClass[numGranules] = (unsigned char)sizeClass;
+    }
+
+    for (sizeClass = 0 ; sizeClass < NUM_SIZE_CLASSES ; ++sizeClass)
+    {
+        sAvailableBlocks[sizeClass] = NO_BLOCK;
+        sCursors[sizeClass] = NULL;
+        sCursorEnds[sizeClass] = NULL;
+        sCursorsZeroed[sizeClass] = false;
+    }
+
+    sMaxSize = MAX_OBJECT_SIZE;
+}
+
+void GCPointerFreeSpace::Teardown()
+{
+    if (sBase == NULL)
+    {
+        return;
+    }
+    sAllocBitmap.Teardown();
+    sMarkBitmap.Teardown();
+    GCVirtualMemory::Release(sBase, sSize);
+    ::CrossNetRuntime::GetOptions().mUnmanagedFreeCallback(sBlockClasses);
+    ::CrossNetRuntime::GetOptions().mUnmanagedFreeCallback(sNextBlocks);
+    while (sAllThreadCursors != NULL)
+    {
+        ThreadCursors * cursors = sAllThreadCursors;
+        sAllThreadCursors = cursors->mNextCursors;
+        ::CrossNetRuntime::GetOptions().mUnmanagedFreeCallback(cursors);
+    }
+    sThreadCursors = NULL;
+    sBase = NULL;
+    sSize = 0;
+    sMaxSize = 0;
+    sNumBlocks = 0;
+    sBlockClasses = NULL;
+    sNextBlocks = NULL;
+    sFirstFreeBlock = NO_BLOCK;
+}
+
+void * GCPointerFreeSpace::BumpThreadCursor(int size)
+{
+    CROSSNET_ASSERT(IsPointerFreeSize(size), "The object is too big for the pointer-free space!");
+
+    ThreadCursors * cursors = sThreadCursors;
+    if (cursors == NULL)
+    {
+        // First pointer-free allocation of this thread, the refill attaches it
+        return (NULL);
+    }
+
+    // Same handshake as GCAllocator::BumpThreadAllocBuffer()
+    //  The slots of the run are already set in the allocation bitmap
+    int sizeClass = GetSizeClass(size);
+    cursors->mAllocating = 1;
+    // Only the compiler must not read the cursor before the flag is set
+    _ReadWriteBarrier();
+    unsigned char * slot = cursors->mCurrent[sizeClass];
+    unsigned char * next = slot + sClassSizes[sizeClass];
+    if (next <= cursors->mEnd[sizeClass])
+    {
+        cursors->mCurrent[sizeClass] = next;
+    }
+    else
+    {
+        slot = NULL;
+    }
+    _ReadWriteBarrier();
+    cursors->mAllocating = 0;
+
+    if ((slot != NULL) && (cursors->mZeroed[sizeClass] == false))
+    {
+        // The slot contains a dead object
+        __memclear__(slot, size);
+    }
+    return (slot);
+}
+
+void * GCPointerFreeSpace::RefillThreadCursor(int size, bool markRun)
+{
+    CROSSNET_ASSERT(IsPointerFreeSize(size), "The object is too big for the pointer-free space!");
+
+    ThreadCursors * cursors = sThreadCursors;
+    if (cursors == NULL)
+    {
+        cursors = AttachThread();
+    }
+
+    // The previous run is empty (or has been retired by the collector)
+    int sizeClass = GetSizeClass(size);
+    int slotSize = sClassSizes[sizeClass];
+    CROSSNET_ASSERT(cursors->mCurrent[sizeClass] + slotSize > cursors->mEnd[sizeClass], "The run is not empty!");
+
+    unsigned char * start;
+    unsigned char * end;
+    bool zeroed;
+    if (TakeRun(sizeClass, start, end, zeroed) == false)
+    {
+        cursors->mCurrent[sizeClass] = NULL;
+        cursors->mEnd[sizeClass] = NULL;
+        return (NULL);
+    }
+
+    if (markRun)
+    {
+        for (unsigned char * slot = start ; slot < end ; slot += slotSize)
+        {
+            Mark(slot);
+        }
+    }
+
+    // The first slot is returned, the owner bumps the others without lock
+    cursors->mCurrent[sizeClass] = start + slotSize;
+    cursors->mEnd[sizeClass] = end;
+    cursors->mZeroed[sizeClass] = zeroed;
+    if (zeroed == false)
+    {
+        // The slot contains a dead object
+        __memclear__(start, size);
+    }
+    return (start);
+}
+
+int GCPointerFreeSpace::GetRunSize(int size)
+{
+    int slotSize = sClassSizes[GetSizeClass(size)];
+    return ((slotSize > RUN_SIZE) ? slotSize : RUN_SIZE);
+}
+
+void GCPointerFreeSpace::Free(void * object)
+{
+    CROSSNET_ASSERT(sAllocBitmap.Test(object), "The object is not allocated!");
+    sAllocBitmap.Clear(object);
+}
+
+void * GCPointerFreeSpace::GetBase()
+{
+    return (sBase);
+}
+
+size_t GCPointerFreeSpace::GetReservedSize()
+{
+    return (sSize);
+}
+
+void * GCPointerFreeSpace::FindObject(void * pointer)
+{
+    size_t offset = (size_t)((unsigned char *)pointer - sBase);
+    int block = (int)(offset >> BLOCK_SHIFT);
+    int sizeClass = sBlockClasses[block];
+    if (sizeClass == FREE_BLOCK)
+    {
+        return (NULL);
+    }
+
+    int slot = (int)(offset & (BLOCK_SIZE - 1)) / sClassSizes[sizeClass];
+    if (slot >= GetCapacity(sizeClass))
+    {
+        // In the few bytes at the end of the block that can't contain a slot
+        return (NULL);
+    }
+    unsigned char * object = sBase + ((size_t)block << BLOCK_SHIFT) + (slot * sClassSizes[sizeClass]);
+    if (sAllocBitmap.Test(object) == false)
+    {
+        return (NULL);
+    }
+    return (object);
+}
+
+int GCPointerFreeSpace::Sweep()
+{
+    // The allocation cursors are going to be reset
+    int sizeClass;
+    for (sizeClass = 0 ; sizeClass < NUM_SIZE_CLASSES ; ++sizeClass)
+    {
+        sAvailableBlocks[sizeClass] = NO_BLOCK;
+        sCursors[sizeClass] = NULL;
+        sCursorEnds[sizeClass] = NULL;
+    }
+
+    // Backward so the blocks are chained in address order
+    int liveBytes = 0;
+    sFirstFreeBlock = NO_BLOCK;
+    for (int block = sNumBlocks - 1 ; block >= 0 ; --block)
+    {
+        sizeClass = sBlockClasses[block];
+        if (sizeClass != FREE_BLOCK)
+        {
+            // The marked objects are the live ones, they become the allocated ones
+            //  The mark bits are cleared at the same time for the next collection
+            unsigned char * start = sBase + ((size_t)block << BLOCK_SHIFT);
+            int numLiveObjects = sAllocBitmap.TakeRange(sMarkBitmap, start, start + BLOCK_SIZE);
+            if (numLiveObjects != 0)
+            {
+                liveBytes += numLiveObjects * sClassSizes[sizeClass];
+                if (numLiveObjects < GetCapacity(sizeClass))
+                {
+                    sNextBlocks[block] = sAvailableBlocks[sizeClass];
+                    sAvailableBlocks[sizeClass] = block;
+                }
+                continue;
+            }
+
+            // Everything is dead, the block goes back to the OS
+            GCVirtualMemory::Decommit(start, BLOCK_SIZE);
+            sBlockClasses[block] = FREE_BLOCK;
+        }
+        sNextBlocks[block] = sFirstFreeBlock;
+        sFirstFreeBlock = block;
+    }
+    return (liveBytes);
+}
+
+void GCPointerFreeSpace::ClearMarks()
+{
+    // Only the blocks in use can have marks
+    for (int block = 0 ; block < sNumBlocks ; ++block)
+    {
+        if (sBlockClasses[block] != FREE_BLOCK)
+        {
+            unsigned char * start = sBase + ((size_t)block << BLOCK_SHIFT);
+            sMarkBitmap.ClearRange(start, start + BLOCK_SIZE);
+        }
+    }
+}
+
+bool GCPointerFreeSpace::GetNextBlock(int sizeClass)
+{
+    // First the blocks of this size class that have free slots, then a new block
+    bool zeroed = false;
+    int block = sAvailableBlocks[sizeClass];
+    if (block != NO_BLOCK)
+    {
+        sAvailableBlocks[sizeClass] = sNextBlocks[block];
+    }
+    else
+    {
+        block = sFirstFreeBlock;
+        if (block == NO_BLOCK)
+        {
+            return (false);
+        }
+        unsigned char * start = sBase + ((size_t)block << BLOCK_SHIFT);
+        if (GCVirtualMemory::Commit(start, BLOCK_SIZE) == false)
+        {
+            // The OS doesn't have any memory left
+            return (false);
+        }
+        sFirstFreeBlock = sNextBlocks[block];
+        sBlockClasses[block] = (unsigned char)sizeClass;
+        // The pages come fresh from the OS, they are already zeroed
+        zeroed = true;
+    }
+
+    unsigned char * start = sBase + ((size_t)block << BLOCK_SHIFT);
+    sCursors[sizeClass] = start;
+    sCursorEnds[sizeClass] = start + (GetCapacity(sizeClass) * sClassSizes[sizeClass]);
+    sCursorsZeroed[sizeClass] = zeroed;
+    return (true);
+}
+
+int GCPointerFreeSpace::GetCapacity(int sizeClass)
+{
+    return (BLOCK_SIZE / sClassSizes[sizeClass]);
+}
+
+int GCPointerFreeSpace::GetSizeClass(int size)
+{
+    return (sSizeToClass[(size + GCBitmap::GRANULE_SIZE - 1) >> GCBitmap::GRANULE_SHIFT]);
+}
+
+bool GCPointerFreeSpace::TakeRun(int sizeClass, unsigned char * & start, unsigned char * & end, bool & zeroed)
+{
+    int slotSize = sClassSizes[sizeClass];
+    int runSize = (slotSize > RUN_SIZE) ? slotSize : RUN_SIZE;
+    for ( ; ; )
+    {
+        // Parse the slots of the current block until one is free
+        //  In a block coming from the OS, that's simply a bump allocation
+        unsigned char * current = sCursors[sizeClass];
+        unsigned char * blockEnd = sCursorEnds[sizeClass];
+        while ((current < blockEnd) && sAllocBitmap.Test(current))
+        {
+            current += slotSize;
+        }
+
+        if (current < blockEnd)
+        {
+            // Then take the free slots that follow, up to the size of a run
+            start = current;
+            do
+            {
+                sAllocBitmap.Set(current);
+                current += slotSize;
+            }
+            while ((current < blockEnd) && (current + slotSize - start <= runSize) && (sAllocBitmap.Test(current) == false));
+
+            sCursors[sizeClass] = current;
+            end = current;
+            zeroed = sCursorsZeroed[sizeClass];
+            return (true);
+        }
+
+        if (GetNextBlock(sizeClass) == false)
+        {
+            // Full, the caller falls back to the main buffer
+            sCursors[sizeClass] = NULL;
+            sCursorEnds[sizeClass] = NULL;
+            return (false);
+        }
+    }
+}
+
+void GCPointerFreeSpace::ReleaseRun(unsigned char * start, unsigned char * end)
+{
+    // The unused slots of a run become free again (they can be marked if the run has been allocated black)
+    //  Like a freed slot, they are reused after the next sweep
+    if (start < end)
+    {
+        sAllocBitmap.ClearRange(start, end);
+        sMarkBitmap.ClearRange(start, end);
+    }
+}
+
+void GCPointerFreeSpace::BeginRetireAllThreadCursors()
+{
+    for (ThreadCursors * cursors = sAllThreadCursors ; cursors != NULL ; cursors = cursors->mNextCursors)
+    {
+        for (int sizeClass = 0 ; sizeClass < NUM_SIZE_CLASSES ; ++sizeClass)
+        {
+            cursors->mRetiredEnd[sizeClass] = cursors->mEnd[sizeClass];
+            cursors->mEnd[sizeClass] = NULL;
+        }
+    }
+}
+
+void GCPointerFreeSpace::EndRetireAllThreadCursors()
+{
+    for (ThreadCursors * cursors = sAllThreadCursors ; cursors != NULL ; cursors = cursors->mNextCursors)
+    {
+        // Wait for the bump the owner might have started before BeginRetireAllThreadCursors()
+        for (int i = 0 ; cursors->mAllocating != 0 ; ++i)
+        {
+            GCThread::Relax(i);
+        }
+        // mEnd stays NULL, so the owner can't bump anymore
+        for (int sizeClass = 0 ; sizeClass < NUM_SIZE_CLASSES ; ++sizeClass)
+        {
+            ReleaseRun(cursors->mCurrent[sizeClass], cursors->mRetiredEnd[sizeClass]);
+            cursors->mCurrent[sizeClass] = NULL;
+            cursors->mRetiredEnd[sizeClass] = NULL;
+        }
+    }
+}
+
+void GCPointerFreeSpace::DetachThread()
+{
+    ThreadCursors * cursors = sThreadCursors;
+    if (cursors == NULL)
+    {
+        return;
+    }
+    for (int sizeClass = 0 ; sizeClass < NUM_SIZE_CLASSES ; ++sizeClass)
+    {
+        ReleaseRun(cursors->mCurrent[sizeClass], cursors->mEnd[sizeClass]);
+        cursors->mCurrent[sizeClass] = NULL;
+        cursors->mEnd[sizeClass] = NULL;
+    }
+    sThreadCursors = NULL;
+    // Now another thread can pick these cursors
+    cursors->mInUse = false;
+}
+
+GCPointerFreeSpace::ThreadCursors * GCPointerFreeSpace::AttachThread()
+{
+    // Same as GCAllocator::AttachThread(), but the allocator lock is taken so the list doesn't need interlocked operations
+    ThreadCursors * cursors;
+    for (cursors = sAllThreadCursors ; cursors != NULL ; cursors = cursors->mNextCursors)
+    {
+        if (cursors->mInUse == false)
+        {
+            break;
+        }
+    }
+
+    if (cursors == NULL)
+    {
+        cursors = static_cast<ThreadCursors *>(::CrossNetRuntime::GetOptions().mUnmanagedAllocateCallback(sizeof(ThreadCursors)));
+        for (int sizeClass = 0 ; sizeClass < NUM_SIZE_CLASSES ; ++sizeClass)
+        {
+            cursors->mCurrent[sizeClass] = NULL;
+            cursors->mEnd[sizeClass] = NULL;
+            cursors->mRetiredEnd[sizeClass] = NULL;
+            cursors->mZeroed[sizeClass] = false;
+        }
+        cursors->mAllocating = 0;
+        cursors->mNextCursors = sAllThreadCursors;
+        sAllThreadCursors = cursors;
+    }
+
+    cursors->mInUse = true;
+    sThreadCursors = cursors;
+    return (cursors);
+}
+
+}
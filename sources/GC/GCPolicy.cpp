@@ -0,0 +1,321 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CrossNetRuntime/GC/GCPolicy.h"
+#include "CrossNetRuntime/GC/GCAllocator.h"
+#include "CrossNetRuntime/GC/GCManager.h"
+#include "CrossNetRuntime/Assert.h"
+
+// For the interlocked operations
+#include <intrin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+namespace CrossNetRuntime
+{
+
+volatile long   GCPolicy::sBudgetRemaining = UNLIMITED_BUDGET;
+int             GCPolicy::sBudget = UNLIMITED_BUDGET;
+bool            GCPolicy::sEnabled = false;
+int             GCPolicy::sMinBudget = 0;
+int             GCPolicy::sLivePercent = 0;
+long long       GCPolicy::sMemoryLimit = 0;
+int             GCPolicy::sMemoryLimitPercent = 0;
+volatile long   GCPolicy::sMemoryPressure = 0;
+int             GCPolicy::sCompleteLiveBytes = 0;
+int             GCPolicy::sCompleteBudget = UNLIMITED_BUDGET;
+int             GCPolicy::sLastLiveBytes = 0;
+
+void GCPolicy::Setup(const ::CrossNetRuntime::InitOptions & options)
+{
+    sEnabled = (options.mGcBudgetMinSize > 0);
+    sMinBudget = options.mGcBudgetMinSize;
+    sLivePercent = (options.mGcBudgetLivePercent > 0) ? options.mGcBudgetLivePercent : 100;
+    sMemoryLimitPercent = (options.mGcMemoryLimitPercent > 0) ? options.mGcMemoryLimitPercent : 90;
+    sMemoryPressure = 0;
+
+    sMemoryLimit = options.mGcMemoryLimit;
+    if ((sMemoryLimit == 0) && sEnabled)
+    {
+        // No explicit limit, use the one of the container (if any)
+        sMemoryLimit = ReadSystemMemoryLimit();
+    }
+
+    // Nothing is alive yet
+    OnAfterCollect(GCManager::MAX_GENERATION, 0);
+}
+
+void GCPolicy::Teardown()
+{
+    sEnabled = false;
+    sBudget = UNLIMITED_BUDGET;
+    sBudgetRemaining = UNLIMITED_BUDGET;
+}
+
+bool GCPolicy::ConsumeBudgetShared(int size)
+{
+    long remaining = _InterlockedExchangeAdd(&sBudgetRemaining, -size) - size;
+    return (remaining >= 0);
+}
+
+void GCPolicy::CollectIfNeeded()
+{
+    if (sBudgetRemaining >= 0)
+    {
+        return;
+    }
+
+    GCAllocator::Lock();
+    // Another thread might have collected while we were waiting for the lock
+    //  And the destructors called during the sweep should not trigger another collection
+    if ((sBudgetRemaining < 0) && (GCManager::IsCollecting() == false))
+    {
+        if (sEnabled && GCManager::IsIncrementalCollectionEnabled())
+        {
+            if (GCManager::IsIncrementalCollectionInProgress())
+            {
+                // The application allocated a whole budget before the end of the collection
+                //  It has to be finished now (the budget is set again at the end)
+                GCManager::Step(-1);
+            }
+            else
+            {
+                // The host didn't call GCManager::OnIdle() soon enough, start the collection now
+                //  The next steps are done by the host, the allocations can continue meanwhile
+                RestartBudget();
+                GCManager::Step(0);
+            }
+        }
+        else if (sEnabled)
+        {
+            // The budget is set again at the end of the collection
+            GCManager::Collect(GetNextGeneration(), false);
+        }
+        else
+        {
+            // Only the heap being full triggers a collection
+            sBudgetRemaining = UNLIMITED_BUDGET;
+        }
+    }
+    GCAllocator::Unlock();
+}
+
+void GCPolicy::AddMemoryPressure(int bytes)
+{
+    CROSSNET_ASSERT(bytes >= 0, "");
+    _InterlockedExchangeAdd(&sMemoryPressure, bytes);
+
+    // The unmanaged memory consumes the budget like a managed allocation
+    if (ConsumeBudgetShared(bytes) == false)
+    {
+        CollectIfNeeded();
+    }
+}
+
+void GCPolicy::RemoveMemoryPressure(int bytes)
+{
+    CROSSNET_ASSERT(bytes >= 0, "");
+    long pressure = _InterlockedExchangeAdd(&sMemoryPressure, -bytes) - bytes;
+    CROSSNET_ASSERT(pressure >= 0, "More memory pressure removed than added!");
+    pressure;
+}
+
+int GCPolicy::GetMemoryPressure()
+{
+    return (sMemoryPressure);
+}
+
+long long GCPolicy::GetMemoryLimit()
+{
+    return (sMemoryLimit);
+}
+
+int GCPolicy::GetAllocationBudget()
+{
+    return (sBudget);
+}
+
+int GCPolicy::GetRemainingBudget()
+{
+    return (sBudgetRemaining);
+}
+
+void GCPolicy::RestartBudget()
+{
+    _InterlockedExchange(&sBudgetRemaining, sBudget);
+}
+
+int GCPolicy::GetNextGeneration()
+{
+    if (GCManager::IsGenerationalCollectionEnabled() == false)
+    {
+        return (GCManager::MAX_GENERATION);
+    }
+    // The old objects are only collected by the complete collections
+    //  Once they have grown as much as a budget, the dead ones are likely to take as much memory as the young ones
+    long long promoted = (long long)sLastLiveBytes - sCompleteLiveBytes;
+    if (promoted > sCompleteBudget)
+    {
+        return (GCManager::MAX_GENERATION);
+    }
+    return (0);
+}
+
+void GCPolicy::OnBeforeCollect(int generation)
+{
+    CollectCallbackFunctionPointer callback = ::CrossNetRuntime::GetOptions().mBeforeCollectCallback;
+    if (callback != NULL)
+    {
+        callback(generation);
+    }
+}
+
+void GCPolicy::OnAfterCollect(int generation, int liveBytes)
+{
+    if (sEnabled)
+    {
+        // The more is alive, the longer we wait before the next collection
+        //  So the cost of the collections stays proportional to the allocations
+        long long footprint = (long long)liveBytes + sMemoryPressure;
+        long long budget = (footprint * sLivePercent) / 100;
+        if (budget < sMinBudget)
+        {
+            budget = sMinBudget;
+        }
+
+        if (sMemoryLimit > 0)
+        {
+            // Don't let the heap grow past the limit, collect more often instead
+            long long room = (((long long)sMemoryLimit * sMemoryLimitPercent) / 100) - footprint;
+            if (budget > room)
+            {
+                budget = room;
+            }
+        }
+
+        if (budget < MIN_BUDGET)
+        {
+            budget = MIN_BUDGET;
+        }
+        if (budget > UNLIMITED_BUDGET)
+        {
+            budget = UNLIMITED_BUDGET;
+        }
+        sBudget = (int)budget;
+    }
+    else
+    {
+        sBudget = UNLIMITED_BUDGET;
+    }
+    _InterlockedExchange(&sBudgetRemaining, sBudget);
+
+    sLastLiveBytes = liveBytes;
+    if (generation >= GCManager::MAX_GENERATION)
+    {
+        sCompleteLiveBytes = liveBytes;
+        sCompleteBudget = sBudget;
+    }
+
+    // No callback at setup
+    if (GCManager::GetNumCollections() == 0)
+    {
+        return;
+    }
+    CollectCallbackFunctionPointer callback = ::CrossNetRuntime::GetOptions().mAfterCollectCallback;
+    if (callback != NULL)
+    {
+        callback(generation);
+    }
+}
+
+long long GCPolicy::ReadSystemMemoryLimit()
+{
+    long long limit = 0;
+#ifdef _WIN32
+    // The job object of the process (if any) can limit the memory of the process and of the whole job
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION info;
+    if (QueryInformationJobObject(NULL, JobObjectExtendedLimitInformation, &info, sizeof(info), NULL))
+    {
+        if (info.BasicLimitInformation.LimitFlags & JOB_OBJECT_LIMIT_PROCESS_MEMORY)
+        {
+            limit = (long long)info.ProcessMemoryLimit;
+        }
+        if ((info.BasicLimitInformation.LimitFlags & JOB_OBJECT_LIMIT_JOB_MEMORY)
+            && ((limit == 0) || ((long long)info.JobMemoryLimit < limit)))
+        {
+            limit = (long long)info.JobMemoryLimit;
+        }
+    }
+    // Otherwise the process is not in a job (or the job has no memory limit)
+#else
+    // With cgroup v2, /proc/self/cgroup contains a single line "0::/path/of/the/cgroup"
+    //  In most containers the path is "/" and the limit is in /sys/fs/cgroup/memory.max
+    char path[512];
+    strcpy(path, "/sys/fs/cgroup/memory.max");
+    FILE * file = fopen("/proc/self/cgroup", "r");
+    if (file != NULL)
+    {
+        char line[400];
+        while (fgets(line, sizeof(line), file) != NULL)
+        {
+            if (strncmp(line, "0::", 3) == 0)
+            {
+                line[strcspn(line, "\n")] = '\0';
+                sprintf(path, "/sys/fs/cgroup%s/memory.max", line + 3);
+                break;
+            }
+        }
+        fclose(file);
+    }
+
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        // No cgroup v2 (or not mounted in the container), so no limit
+        return (0);
+    }
+    char value[64];
+    if (fgets(value, sizeof(value), file) != NULL)
+    {
+        // "max" if there is no limit
+        if (strncmp(value, "max", 3) != 0)
+        {
+            limit = strtoll(value, NULL, 10);
+        }
+    }
+    fclose(file);
+#endif
+
+    // A limit bigger than the address space can't be reached, the address space is the limit then
+    //  (A 32 bits process in a container of 8 GB is limited to 4 GB, instead of having no limit)
+    const unsigned long long addressSpace = (unsigned long long)(size_t)-1;
+    if ((unsigned long long)limit > addressSpace)
+    {
+        limit = (long long)addressSpace;
+    }
+    if (limit < 0)
+    {
+        limit = 0;
+    }
+    return (limit);
+}
+
+}
@@ -0,0 +1,128 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CrossNetRuntime/GC/GCShadowStack.h"
+#include "CrossNetRuntime/GC/GCManager.h"
+#include "CrossNetRuntime/GC/GCAllocator.h"
+
+// For _InterlockedCompareExchange
+#include <intrin.h>
+
+namespace CrossNetRuntime
+{
+
+bool                                        GCShadowStack::sEnabled = false;
+GCShadowStack::ThreadStack * volatile       GCShadowStack::sAllThreadStacks = NULL;
+CROSSNET_THREAD_LOCAL GCShadowStack::ThreadStack *  GCShadowStack::sThreadStack = NULL;
+
+void GCShadowStack::Setup(const InitOptions & options)
+{
+    sEnabled = options.mPreciseStackRoots;
+}
+
+void GCShadowStack::Teardown()
+{
+    // The stacks are kept, the threads might still pop their frames
+    sEnabled = false;
+}
+
+void GCShadowStack::DetachThread()
+{
+    ThreadStack * stack = sThreadStack;
+    if (stack == NULL)
+    {
+        // This thread never registered a frame
+        return;
+    }
+    CROSSNET_ASSERT(stack->mTop == NULL, "All the frames must be popped before the thread detaches!");
+    sThreadStack = NULL;
+
+    // Now another thread can pick this stack
+    _InterlockedExchange(&stack->mInUse, 0);
+}
+
+GCShadowStack::ThreadStack * GCShadowStack::AttachThread()
+{
+    // Same as GCAllocator::AttachThread()
+    //  The collections have to suspend this thread before tracing its frames, even if it never allocates
+    GCAllocator::AttachCurrentThread();
+    ThreadStack * stack;
+
+    // First try to reuse the stack of a thread that detached
+    //  Stacks are never removed from the list, so we can iterate without lock
+    for (stack = sAllThreadStacks ; stack != NULL ; stack = stack->mNextStack)
+    {
+        if ((stack->mInUse == 0) && (_InterlockedCompareExchange(&stack->mInUse, 1, 0) == 0))
+        {
+            sThreadStack = stack;
+            return (stack);
+        }
+    }
+
+    // None available, create a new one and push it on the list
+    stack = static_cast<ThreadStack *>(::CrossNetRuntime::GetOptions().mUnmanagedAllocateCallback(sizeof(ThreadStack)));
+    stack->mTop = NULL;
+    stack->mInUse = 1;
+
+    ThreadStack * head;
+    do
+    {
+        head = sAllThreadStacks;
+        stack->mNextStack = head;
+    }
+    while (_InterlockedCompareExchange((volatile long *)&sAllThreadStacks, (long)stack, (long)head) != (long)head);
+
+    sThreadStack = stack;
+    return (stack);
+}
+
+void GCShadowStack::Trace(unsigned char currentMark)
+{
+    // Only the registered slots are read, the time is proportional to the number of managed locals
+    for (ThreadStack * stack = sAllThreadStacks ; stack != NULL ; stack = stack->mNextStack)
+    {
+        for (GCShadowFrame * frame = stack->mTop ; frame != NULL ; frame = frame->mPrevious)
+        {
+            for (int i = 0 ; i < frame->mNumSlots ; ++i)
+            {
+                ::System::Object * & slot = *reinterpret_cast< ::System::Object * *>(frame->mSlots[i]);
+                GCManager::TraceSlot(slot, currentMark);
+            }
+        }
+    }
+}
+
+bool GCShadowStack::IsReferenced(void * start, size_t size)
+{
+    ThreadStack * stack = sThreadStack;
+    if (stack == NULL)
+    {
+        return (false);
+    }
+    for (GCShadowFrame * frame = stack->mTop ; frame != NULL ; frame = frame->mPrevious)
+    {
+        for (int i = 0 ; i < frame->mNumSlots ; ++i)
+        {
+            if ((size_t)((unsigned char *)*frame->mSlots[i] - (unsigned char *)start) < size)
+            {
+                return (true);
+            }
+        }
+    }
+    return (false);
+}
+
+}
@@ -0,0 +1,389 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CrossNetRuntime/GC/GCThread.h"
+#include "CrossNetRuntime/Assert.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+// For FlushProcessWriteBuffers (Vista and later)
+#if !defined(_WIN32_WINNT) || (_WIN32_WINNT < 0x0600)
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+// For membarrier() (Linux 4.14 and later), the system call is used directly
+#ifndef MEMBARRIER_CMD_PRIVATE_EXPEDITED
+#define MEMBARRIER_CMD_PRIVATE_EXPEDITED            (1 << 3)
+#define MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED   (1 << 4)
+#endif
+#endif
+
+// For _mm_pause
+#include <intrin.h>
+
+namespace
+{
+    struct ThreadStart
+    {
+        ::CrossNetRuntime::GCThread::ThreadFunction mFunction;
+        void *                                      mParameter;
+    };
+
+#ifndef _WIN32
+    // 1 once the process is registered for membarrier(), -1 if the kernel doesn't support it, 0 if not checked yet
+    volatile int    sMembarrierState = 0;
+    // Page whose protection is changed by GCThread::FlushWriteBuffers() when membarrier() is not available
+    void *          sFlushPage = NULL;
+    pthread_mutex_t sFlushMutex = PTHREAD_MUTEX_INITIALIZER;
+
+    // There is no way to suspend a pthread, GCThread::Suspend() sends it a signal instead
+    //  The thread then waits in the signal handler until GCThread::Resume() sends the second signal
+#ifdef SIGPWR
+    const int       SUSPEND_SIGNAL = SIGPWR;
+#else
+    const int       SUSPEND_SIGNAL = SIGUSR1;
+#endif
+    const int       RESUME_SIGNAL = SIGXCPU;
+
+    struct SuspendableThread
+    {
+        pthread_t       mThread;
+        void * volatile mStackPointer;      // Set in the signal handler, NULL while the thread runs
+        volatile int    mResumed;
+    };
+
+    // Thread being suspended, for the signal handler (the threads are suspended one by one)
+    SuspendableThread * volatile    sSuspending = NULL;
+    sem_t                           sSuspendAcknowledged;
+    pthread_once_t                  sSuspendSetup = PTHREAD_ONCE_INIT;
+
+    void SuspendHandler(int /*signal*/)
+    {
+        int savedErrno = errno;
+        SuspendableThread * self = sSuspending;
+
+        // The registers of the interrupted code have been saved by the kernel on the stack, above this local
+        volatile int stackPointer = 0;
+        self->mStackPointer = (void *)&stackPointer;
+        sem_post(&sSuspendAcknowledged);
+
+        // The resume signal is blocked in this handler except during sigsuspend(), so it can't be missed
+        sigset_t mask;
+        sigfillset(&mask);
+        sigdelset(&mask, RESUME_SIGNAL);
+        while (self->mResumed == 0)
+        {
+            sigsuspend(&mask);
+        }
+        self->mStackPointer = NULL;
+        errno = savedErrno;
+    }
+
+    void ResumeHandler(int /*signal*/)
+    {
+        // Only there to interrupt sigsuspend()
+    }
+
+    void SetupSuspendSignals()
+    {
+        sem_init(&sSuspendAcknowledged, 0, 0);
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        action.sa_handler = ResumeHandler;
+        sigaction(RESUME_SIGNAL, &action, NULL);
+
+        sigaddset(&action.sa_mask, RESUME_SIGNAL);
+        action.sa_handler = SuspendHandler;
+        sigaction(SUSPEND_SIGNAL, &action, NULL);
+    }
+#endif
+
+#ifdef _WIN32
+    DWORD WINAPI ThreadEntry(LPVOID parameter)
+#else
+    void * ThreadEntry(void * parameter)
+#endif
+    {
+        ThreadStart start = *static_cast<ThreadStart *>(parameter);
+        delete static_cast<ThreadStart *>(parameter);
+        start.mFunction(start.mParameter);
+        return (0);
+    }
+}
+
+namespace CrossNetRuntime
+{
+
+void * GCThread::Start(ThreadFunction function, void * parameter)
+{
+    ThreadStart * start = new ThreadStart;
+    start->mFunction = function;
+    start->mParameter = parameter;
+
+#ifdef _WIN32
+    HANDLE thread = CreateThread(NULL, 0, ThreadEntry, start, 0, NULL);
+    if (thread == NULL)
+    {
+        delete start;
+    }
+    return (thread);
+#else
+    pthread_t * thread = new pthread_t;
+    if (pthread_create(thread, NULL, ThreadEntry, start) != 0)
+    {
+        delete start;
+        delete thread;
+        return (NULL);
+    }
+    return (thread);
+#endif
+}
+
+void GCThread::Join(void * thread)
+{
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_t * handle = static_cast<pthread_t *>(thread);
+    pthread_join(*handle, NULL);
+    delete handle;
+#endif
+}
+
+void * GCThread::NewSemaphore()
+{
+#ifdef _WIN32
+    return (CreateSemaphoreA(NULL, 0, 0x7fffffff, NULL));
+#else
+    sem_t * semaphore = new sem_t;
+    if (sem_init(semaphore, 0, 0) != 0)
+    {
+        delete semaphore;
+        return (NULL);
+    }
+    return (semaphore);
+#endif
+}
+
+void GCThread::DeleteSemaphore(void * semaphore)
+{
+#ifdef _WIN32
+    CloseHandle(semaphore);
+#else
+    sem_destroy(static_cast<sem_t *>(semaphore));
+    delete static_cast<sem_t *>(semaphore);
+#endif
+}
+
+void GCThread::WaitSemaphore(void * semaphore)
+{
+#ifdef _WIN32
+    WaitForSingleObject(semaphore, INFINITE);
+#else
+    while (sem_wait(static_cast<sem_t *>(semaphore)) != 0)
+    {
+        // Interrupted by a signal, wait again
+    }
+#endif
+}
+
+void GCThread::SignalSemaphore(void * semaphore, int count)
+{
+#ifdef _WIN32
+    ReleaseSemaphore(semaphore, count, NULL);
+#else
+    for (int i = 0 ; i < count ; ++i)
+    {
+        sem_post(static_cast<sem_t *>(semaphore));
+    }
+#endif
+}
+
+void GCThread::Relax(int iteration)
+{
+    // Spin a bit first (the other threads are most likely about to push more work)
+    const int SPIN_COUNT = 64;
+    if (iteration < SPIN_COUNT)
+    {
+        _mm_pause();
+        return;
+    }
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+void GCThread::FlushWriteBuffers()
+{
+#ifdef _WIN32
+    FlushProcessWriteBuffers();
+#else
+#ifdef __NR_membarrier
+    // The kernel interrupts the processors currently running a thread of the process (and an interrupt flushes the write buffer)
+    //  The process has to register first, once
+    if (sMembarrierState == 0)
+    {
+        sMembarrierState = (syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0) ? 1 : -1;
+    }
+    if ((sMembarrierState > 0) && (syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) == 0))
+    {
+        return;
+    }
+#endif
+
+    // Older kernels: same trick as FlushProcessWriteBuffers() on Windows
+    //  Removing the write access of a page that has been written to needs a TLB shootdown,
+    //  the OS sends an inter-processor interrupt to all the processors running a thread of the process
+    //  (And an interrupt flushes the write buffer of the processor)
+    pthread_mutex_lock(&sFlushMutex);
+    if (sFlushPage == NULL)
+    {
+        sFlushPage = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        CROSSNET_FATAL(sFlushPage != MAP_FAILED, "Could not allocate the page to flush the write buffers!");
+    }
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    mprotect(sFlushPage, pageSize, PROT_READ | PROT_WRITE);
+    // The page must be in the TLB of this processor, otherwise there is nothing to shoot down
+    *static_cast<volatile int *>(sFlushPage) = 0;
+    mprotect(sFlushPage, pageSize, PROT_NONE);
+    pthread_mutex_unlock(&sFlushMutex);
+#endif
+}
+
+void * GCThread::OpenCurrentThread()
+{
+#ifdef _WIN32
+    // GetCurrentThread() is a pseudo handle, only valid in the calling thread
+    HANDLE thread = NULL;
+    BOOL result = DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(), &thread,
+                                  THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT, FALSE, 0);
+    CROSSNET_FATAL(result != FALSE, "Could not open the current thread!");
+    return (thread);
+#else
+    pthread_once(&sSuspendSetup, SetupSuspendSignals);
+    SuspendableThread * thread = new SuspendableThread;
+    thread->mThread = pthread_self();
+    thread->mStackPointer = NULL;
+    thread->mResumed = 0;
+    return (thread);
+#endif
+}
+
+void GCThread::CloseThread(void * thread)
+{
+#ifdef _WIN32
+    CloseHandle(thread);
+#else
+    delete static_cast<SuspendableThread *>(thread);
+#endif
+}
+
+void * GCThread::GetStackBase()
+{
+#ifdef _WIN32
+    return (reinterpret_cast<NT_TIB *>(NtCurrentTeb())->StackBase);
+#elif defined(__APPLE__)
+    return (pthread_get_stackaddr_np(pthread_self()));
+#else
+    pthread_attr_t attributes;
+    void * stackAddress = NULL;
+    size_t stackSize = 0;
+    pthread_getattr_np(pthread_self(), &attributes);
+    pthread_attr_getstack(&attributes, &stackAddress, &stackSize);
+    pthread_attr_destroy(&attributes);
+    return (static_cast<unsigned char *>(stackAddress) + stackSize);
+#endif
+}
+
+void * GCThread::Suspend(void * thread, void * * registers)
+{
+#ifdef _WIN32
+    HANDLE handle = thread;
+    DWORD result = SuspendThread(handle);
+    CROSSNET_FATAL(result != (DWORD)-1, "Could not suspend a thread!");
+
+    // SuspendThread() is asynchronous, GetThreadContext() returns once the thread is actually stopped
+    CONTEXT context;
+    context.ContextFlags = CONTEXT_INTEGER | CONTEXT_CONTROL;
+    BOOL ok = GetThreadContext(handle, &context);
+    CROSSNET_FATAL(ok != FALSE, "Could not get the registers of a suspended thread!");
+
+    // Platform specific code
+    registers[0] = (void *)context.Eax;
+    registers[1] = (void *)context.Ebx;
+    registers[2] = (void *)context.Ecx;
+    registers[3] = (void *)context.Edx;
+    registers[4] = (void *)context.Esi;
+    registers[5] = (void *)context.Edi;
+    registers[6] = (void *)context.Ebp;
+    return ((void *)context.Esp);
+    // End of platform specific code
+#else
+    pthread_once(&sSuspendSetup, SetupSuspendSignals);
+    SuspendableThread * suspended = static_cast<SuspendableThread *>(thread);
+    suspended->mResumed = 0;
+    sSuspending = suspended;
+    int result = pthread_kill(suspended->mThread, SUSPEND_SIGNAL);
+    CROSSNET_FATAL(result == 0, "Could not suspend a thread!");
+    while (sem_wait(&sSuspendAcknowledged) != 0)
+    {
+        // Interrupted by a signal, wait again
+    }
+    sSuspending = NULL;
+
+    // The registers are on the stack of the thread, with the signal frame
+    for (int i = 0 ; i < NUM_SAVED_REGISTERS ; ++i)
+    {
+        registers[i] = NULL;
+    }
+    return (suspended->mStackPointer);
+#endif
+}
+
+void GCThread::Resume(void * thread)
+{
+#ifdef _WIN32
+    ResumeThread(thread);
+#else
+    SuspendableThread * suspended = static_cast<SuspendableThread *>(thread);
+    suspended->mResumed = 1;
+    pthread_kill(suspended->mThread, RESUME_SIGNAL);
+    // Wait for the thread to leave the signal handler, otherwise it could miss the next Suspend()
+    for (int i = 0 ; suspended->mStackPointer != NULL ; ++i)
+    {
+        Relax(i);
+    }
+#endif
+}
+
+}
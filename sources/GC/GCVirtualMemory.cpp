@@ -0,0 +1,298 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CrossNetRuntime/GC/GCVirtualMemory.h"
+#include "CrossNetRuntime/Assert.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+namespace CrossNetRuntime
+{
+
+int     GCVirtualMemory::sPagemapFile = -2;
+void *  GCVirtualMemory::sWatchedAddresses[MAX_WATCHED_RESERVATIONS];
+size_t  GCVirtualMemory::sWatchedSizes[MAX_WATCHED_RESERVATIONS];
+int     GCVirtualMemory::sNumWatched = 0;
+
+#ifndef _WIN32
+// Bit of an entry of /proc/self/pagemap set when the page has been written to since the last clear
+//  (see the soft-dirty documentation of the Linux kernel)
+static const unsigned long long SOFT_DIRTY_BIT = 1ULL << 55;
+// Number of entries of /proc/self/pagemap read at once
+static const int PAGEMAP_BATCH = 512;
+#endif
+
+int GCVirtualMemory::GetPageSize()
+{
+    static int sPageSize = 0;
+    if (sPageSize == 0)
+    {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        sPageSize = (int)info.dwPageSize;
+#else
+        sPageSize = (int)sysconf(_SC_PAGESIZE);
+#endif
+    }
+    return (sPageSize);
+}
+
+void * GCVirtualMemory::Reserve(size_t size)
+{
+#ifdef _WIN32
+    return (VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS));
+#else
+    // MAP_NORESERVE so the reservation doesn't count against the overcommit limit
+    void * address = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (address == MAP_FAILED)
+    {
+        return (NULL);
+    }
+    return (address);
+#endif
+}
+
+void * GCVirtualMemory::ReserveWatched(size_t size)
+{
+    CROSSNET_FATAL(sNumWatched < MAX_WATCHED_RESERVATIONS, "Too many watched reservations!");
+#ifdef _WIN32
+    void * address = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_WRITE_WATCH, PAGE_NOACCESS);
+#else
+    // The soft-dirty bits are tracked for every page of the process, the reservation itself is a normal one
+    //  If they are not available, GetWrittenPages() reports that the writes are not tracked
+    SetupSoftDirtyBits();
+    void * address = Reserve(size);
+#endif
+    if (address != NULL)
+    {
+        // For ResetWrittenPages()
+        sWatchedAddresses[sNumWatched] = address;
+        sWatchedSizes[sNumWatched] = size;
+        ++sNumWatched;
+    }
+    return (address);
+}
+
+void GCVirtualMemory::Release(void * address, size_t size)
+{
+    for (int i = 0 ; i < sNumWatched ; ++i)
+    {
+        if (sWatchedAddresses[i] == address)
+        {
+            --sNumWatched;
+            sWatchedAddresses[i] = sWatchedAddresses[sNumWatched];
+            sWatchedSizes[i] = sWatchedSizes[sNumWatched];
+            break;
+        }
+    }
+#ifdef _WIN32
+    size;
+    VirtualFree(address, 0, MEM_RELEASE);
+#else
+    munmap(address, size);
+#endif
+}
+
+bool GCVirtualMemory::Commit(void * address, size_t size)
+{
+#ifdef _WIN32
+    return (VirtualAlloc(address, size, MEM_COMMIT, PAGE_READWRITE) != NULL);
+#else
+    return (mprotect(address, size, PROT_READ | PROT_WRITE) == 0);
+#endif
+}
+
+void GCVirtualMemory::Decommit(void * address, size_t size)
+{
+#ifdef _WIN32
+    VirtualFree(address, size, MEM_DECOMMIT);
+#else
+    // The pages stay accessible (conservative stack scanning might still read them)
+    //  But the physical memory is returned, and reading them again gives zero filled pages
+    madvise(address, size, MADV_DONTNEED);
+#endif
+}
+
+void GCVirtualMemory::Prefault(void * address, size_t size)
+{
+    int pageSize = GetPageSize();
+    volatile unsigned char * current = static_cast<unsigned char *>(address);
+    volatile unsigned char * end = current + size;
+    while (current < end)
+    {
+        // Write (and not only read), otherwise the OS might map the shared zero page
+        *current = 0;
+        current += pageSize;
+    }
+}
+
+void GCVirtualMemory::AdviseHugePages(void * address, size_t size)
+{
+#if defined(_WIN32) || !defined(MADV_HUGEPAGE)
+    // Large pages on Windows need a specific privilege and must be committed with the reservation
+    //  The heap commits its segments one by one in a single reservation, so they can't be used there
+    address;
+    size;
+#else
+    madvise(address, size, MADV_HUGEPAGE);
+#endif
+}
+
+int GCVirtualMemory::GetWrittenPages(void * address, size_t size, void * * pages, int maxPages)
+{
+#ifdef _WIN32
+    ULONG_PTR count = (ULONG_PTR)maxPages;
+    ULONG granularity;
+    if (GetWriteWatch(WRITE_WATCH_FLAG_RESET, address, size, pages, &count, &granularity) != 0)
+    {
+        // Not a watched reservation
+        return (-1);
+    }
+    return ((int)count);
+#else
+    if (sPagemapFile < 0)
+    {
+        // No watched reservation, or the kernel doesn't track the soft-dirty bits
+        return (-1);
+    }
+
+    // One entry of 8 bytes per page, at the offset given by the page number
+    size_t pageSize = (size_t)GetPageSize();
+    unsigned char * current = reinterpret_cast<unsigned char *>((size_t)address & ~(pageSize - 1));
+    unsigned char * end = static_cast<unsigned char *>(address) + size;
+    unsigned long long entries[PAGEMAP_BATCH];
+    int count = 0;
+    while ((current < end) && (count < maxPages))
+    {
+        size_t numPages = (size_t)(end - current + pageSize - 1) / pageSize;
+        if (numPages > PAGEMAP_BATCH)
+        {
+            numPages = PAGEMAP_BATCH;
+        }
+        off_t offset = (off_t)((size_t)current / pageSize) * (off_t)sizeof(entries[0]);
+        ssize_t readBytes = pread(sPagemapFile, entries, numPages * sizeof(entries[0]), offset);
+        if (readBytes < (ssize_t)sizeof(entries[0]))
+        {
+            return (-1);
+        }
+        numPages = (size_t)readBytes / sizeof(entries[0]);
+        for (size_t i = 0 ; i < numPages ; ++i)
+        {
+            if ((entries[i] & SOFT_DIRTY_BIT) != 0)
+            {
+                pages[count] = current + i * pageSize;
+                if (++count == maxPages)
+                {
+                    // The caller calls again from the page after the last one
+                    return (count);
+                }
+            }
+        }
+        current += numPages * pageSize;
+    }
+    return (count);
+#endif
+}
+
+void GCVirtualMemory::ResetWrittenPages()
+{
+#ifdef _WIN32
+    for (int i = 0 ; i < sNumWatched ; ++i)
+    {
+        ResetWriteWatch(sWatchedAddresses[i], sWatchedSizes[i]);
+    }
+#else
+    // One clear covers all the reservations (and every other page of the process)
+    if ((sNumWatched != 0) && (sPagemapFile >= 0))
+    {
+        ClearSoftDirtyBits();
+    }
+#endif
+}
+
+bool GCVirtualMemory::SetupSoftDirtyBits()
+{
+#ifdef _WIN32
+    return (false);
+#else
+    // Checked once, by the first watched reservation
+    if (sPagemapFile != -2)
+    {
+        return (sPagemapFile >= 0);
+    }
+    sPagemapFile = -1;
+
+    int file = open("/proc/self/pagemap", O_RDONLY);
+    if (file < 0)
+    {
+        return (false);
+    }
+
+    // The kernel might not track the soft-dirty bits (CONFIG_MEM_SOFT_DIRTY), or not report them
+    //  Check with a page of our own: clean right after the clear, dirty after a write
+    int pageSize = GetPageSize();
+    bool tracked = false;
+    void * page = mmap(NULL, pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page != MAP_FAILED)
+    {
+        volatile unsigned char * pointer = static_cast<unsigned char *>(page);
+        off_t offset = (off_t)((size_t)page / pageSize) * (off_t)sizeof(unsigned long long);
+        unsigned long long entry;
+        *pointer = 1;
+        if (ClearSoftDirtyBits()
+            && (pread(file, &entry, sizeof(entry), offset) == (ssize_t)sizeof(entry)) && ((entry & SOFT_DIRTY_BIT) == 0))
+        {
+            *pointer = 2;
+            tracked = (pread(file, &entry, sizeof(entry), offset) == (ssize_t)sizeof(entry)) && ((entry & SOFT_DIRTY_BIT) != 0);
+        }
+        munmap(page, pageSize);
+    }
+
+    if (tracked == false)
+    {
+        close(file);
+        return (false);
+    }
+    sPagemapFile = file;
+    return (true);
+#endif
+}
+
+bool GCVirtualMemory::ClearSoftDirtyBits()
+{
+#ifdef _WIN32
+    return (false);
+#else
+    // Clears the soft-dirty bits of all the pages of the process (and write protects them, so the next write is seen)
+    int file = open("/proc/self/clear_refs", O_WRONLY);
+    if (file < 0)
+    {
+        return (false);
+    }
+    bool cleared = (write(file, "4", 1) == 1);
+    close(file);
+    return (cleared);
+#endif
+}
+
+}
@@ -0,0 +1,76 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CrossNetRuntime/GC/GCWorkStealingDeque.h"
+#include "CrossNetRuntime/InitOptions.h"
+#include "CrossNetRuntime/Assert.h"
+
+namespace CrossNetRuntime
+{
+
+GCWorkStealingDeque::GCWorkStealingDeque()
+    :
+    mItems(NULL),
+    mCapacity(0),
+    mMask(0),
+    mTop(0),
+    mBottom(0)
+{
+    // Do nothing...
+    //  Until Setup() is called, the capacity is 0 and Push() always fails
+}
+
+void GCWorkStealingDeque::Setup(int capacity)
+{
+    CROSSNET_ASSERT((capacity & (capacity - 1)) == 0, "The capacity must be a power of 2!");
+    mItems = static_cast< ::System::Object * volatile *>(::CrossNetRuntime::GetOptions().mUnmanagedAllocateCallback(capacity * sizeof(::System::Object *)));
+    mCapacity = (mItems != NULL) ? capacity : 0;
+    mMask = capacity - 1;
+    mTop = 0;
+    mBottom = 0;
+}
+
+void GCWorkStealingDeque::Teardown()
+{
+    if (mItems != NULL)
+    {
+        ::CrossNetRuntime::GetOptions().mUnmanagedFreeCallback((void *)mItems);
+    }
+    mItems = NULL;
+    mCapacity = 0;
+    mMask = 0;
+}
+
+::System::Object * GCWorkStealingDeque::Steal()
+{
+    long top = mTop;
+    // top must be read before bottom
+    _ReadWriteBarrier();
+    long bottom = mBottom;
+    if (top >= bottom)
+    {
+        return (NULL);
+    }
+    ::System::Object * object = mItems[top & mMask];
+    if (_InterlockedCompareExchange(&mTop, top + 1, top) != top)
+    {
+        // Another thief (or the owner for the last object) took it first
+        return (NULL);
+    }
+    return (object);
+}
+
+}
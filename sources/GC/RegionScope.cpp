@@ -0,0 +1,313 @@
+/*
+    CrossNet - Copyright (c) 2007 Olivier Nallet
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+    OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "CrossNetRuntime/GC/RegionScope.h"
+#include "CrossNetRuntime/GC/GCManager.h"
+#include "CrossNetRuntime/GC/GCPolicy.h"
+#include "CrossNetRuntime/GC/GCShadowStack.h"
+#include "CrossNetRuntime/Assert.h"
+
+#if defined(_MSC_VER) && defined(_M_IX86)
+// For _AddressOfReturnAddress() and __readfsdword()
+#include <intrin.h>
+#endif
+
+namespace CrossNetRuntime
+{
+
+RegionScope *   RegionScope::sActiveRegions = NULL;
+CROSSNET_THREAD_LOCAL RegionScope *     RegionScope::sCurrentRegion = NULL;
+
+RegionScope::RegionScope(int arenaSize)
+{
+    CROSSNET_ASSERT(arenaSize > 0, "");
+    mArenaSize = GCAllocator::Align(arenaSize);
+    mArenaStart = NULL;
+    mPromoted = false;
+    mEscaped = false;
+
+    GCAllocator::Lock();
+
+    // The whole arena consumes the budget, like a thread allocation buffer
+    if (GCPolicy::ConsumeBudgetShared(mArenaSize) == false)
+    {
+        GCPolicy::CollectIfNeeded();
+    }
+    void * arena = GCAllocator::Allocate(mArenaSize, false);
+    if ((arena != NULL) && GCAllocator::InCurrentAllocationSpace(arena))
+    {
+        // Formatted like a retired buffer, the heap can be parsed even if a collection happens before the first allocation
+        GCAllocator::AllocStructure * header = static_cast<GCAllocator::AllocStructure *>(arena);
+        header->mMarker = GCAllocator::RESERVED_MARKER;
+        header->mSize = mArenaSize;
+        mArenaStart = static_cast<unsigned char *>(arena);
+    }
+    // Otherwise we are out of memory (or the memory comes from the user callback and can't be reset),
+    //  all the allocations of the region go to the heap
+
+    mBuffer.mCurrent = mArenaStart;
+    mBuffer.mEnd = (mArenaStart != NULL) ? mArenaStart + mArenaSize : NULL;
+    mBuffer.mNextBuffer = NULL;
+    mBuffer.mInUse = 1;
+    mBuffer.mAllocating = 0;
+    mBuffer.mRetiredEnd = NULL;
+    mBuffer.mBypassed = false;
+    mNumCollections = GCManager::GetNumCollections();
+
+    mNextRegion = sActiveRegions;
+    sActiveRegions = this;
+
+    GCAllocator::Unlock();
+
+    // From now on, the allocations of this thread go in the arena
+    //  Nested regions simply stack their buffers
+    mPreviousBuffer = GCAllocator::sThreadAllocBuffer;
+    GCAllocator::sThreadAllocBuffer = &mBuffer;
+    // And the stores are checked against this arena
+    mPreviousRegion = sCurrentRegion;
+    sCurrentRegion = this;
+}
+
+RegionScope::~RegionScope()
+{
+#if defined(_MSC_VER) && defined(_M_IX86)
+    // Registers the calling functions might still use, read before this function modifies them
+    //  eax, ecx and edx are not preserved across calls, ebp has been pushed by the prologue
+    // Platform specific code
+    void * _EBX;
+    void * _ESI;
+    void * _EDI;
+    void * _EBP;
+
+    __asm
+    {
+        mov _EBX, ebx
+        mov _ESI, esi
+        mov _EDI, edi
+        mov eax, [ebp]
+        mov _EBP, eax
+    }
+    void * registers[] = { _EBX, _ESI, _EDI, _EBP };
+    const int numRegisters = sizeof(registers) / sizeof(registers[0]);
+    // The frames of the calling functions start right after the return address
+    void * const * callerFrame = static_cast<void * const *>(_AddressOfReturnAddress()) + 1;
+    // End of platform specific code
+#else
+    // The registers and the native stack are not scanned on this platform, see IsReferencedFromStack()
+    void * const * registers = NULL;
+    const int numRegisters = 0;
+    void * const * callerFrame = NULL;
+#endif
+
+    CROSSNET_ASSERT(GCAllocator::sThreadAllocBuffer == &mBuffer, "The regions must be ended in the reverse order!");
+    GCAllocator::sThreadAllocBuffer = mPreviousBuffer;
+    sCurrentRegion = mPreviousRegion;
+
+    GCAllocator::Lock();
+
+    RegionScope ** link = &sActiveRegions;
+    while (*link != this)
+    {
+        link = &(*link)->mNextRegion;
+    }
+    *link = mNextRegion;
+
+    bool release = CanRelease();
+    if (release)
+    {
+        release = (IsReferencedFromStack(callerFrame, registers, numRegisters) == false);
+    }
+
+    if (release)
+    {
+        Release();
+    }
+    else
+    {
+        // The objects are promoted, they are now normal objects of the main buffer
+        mPromoted = true;
+        if (mPreviousBuffer != NULL)
+        {
+            // They can point to the objects of the enclosing region, it can't be released either
+            mPreviousBuffer->mBypassed = true;
+        }
+
+        unsigned char * current = mBuffer.mCurrent;
+        if ((mArenaStart != NULL) && (mNumCollections == GCManager::GetNumCollections())
+            && (GCManager::IsIncrementalCollectionInProgress() == false)
+            && (current >= mArenaStart) && (current < mArenaStart + mArenaSize))
+        {
+            // The unused part of the arena can be reused right away
+            GCAllocator::InternalFree(reinterpret_cast<GCAllocator::AllocStructure *>(current), (int)(mArenaStart + mArenaSize - current));
+            mBuffer.mCurrent = NULL;
+            mBuffer.mEnd = NULL;
+        }
+        else
+        {
+            // The buffer has been refilled after a collection or with a thread allocation buffer
+            //  Format the unused part so the heap can be parsed, the next sweep will recycle it
+            GCAllocator::RetireThreadAllocBuffer(&mBuffer);
+        }
+    }
+
+    GCAllocator::Unlock();
+}
+
+void    RegionScope::Promote()
+{
+    mPromoted = true;
+}
+
+bool    RegionScope::CanRelease() const
+{
+    if ((mArenaStart == NULL) || mPromoted)
+    {
+        return (false);
+    }
+    if (GCManager::IsWriteBarrierGenerated() == false)
+    {
+        // The stores are not tracked, nothing proves that the heap or the statics don't point to the arena
+        return (false);
+    }
+    if (mEscaped)
+    {
+        // A managed pointer has been stored outside the arena, it might point to the arena
+        return (false);
+    }
+    if (mBuffer.mBypassed)
+    {
+        // Some objects allocated during the region are not in the arena, they might point to the arena
+        //  Or an object of the arena has been freed and is now in a bin
+        return (false);
+    }
+    if (GCManager::GetNumCollections() != mNumCollections)
+    {
+        // The arena has been swept with the rest of the main buffer, its objects are normal objects now
+        return (false);
+    }
+    if (GCManager::IsIncrementalCollectionInProgress())
+    {
+        // The arena might be before the limit of the incremental collection, its sweep will recycle it
+        return (false);
+    }
+    return (true);
+}
+
+bool    RegionScope::IsReferencedFromStack(void * const * callerFrame, void * const * registers, int numRegisters) const
+{
+    // Conservative scan, like GCManager::TraceStack() but only for the used part of the arena
+    //  Any value in the range is considered as a pointer (even to the middle of an object)
+    //  A stale value in a calling function promotes the region, that's not an issue
+    size_t arenaStart = (size_t)mArenaStart;
+    size_t usedSize = (size_t)(mBuffer.mCurrent - mArenaStart);
+
+    // With the precise stack roots, the registered slots of this thread are the only stack roots, like for the collection
+    //  (The frames of the region have been popped before its end)
+    if (GCShadowStack::IsEnabled())
+    {
+        return (GCShadowStack::IsReferenced(mArenaStart, usedSize));
+    }
+
+#if defined(_MSC_VER) && defined(_M_IX86)
+    for (int i = 0 ; i < numRegisters ; ++i)
+    {
+        if ((size_t)registers[i] - arenaStart < usedSize)
+        {
+            return (true);
+        }
+    }
+
+    // The stack of the current thread ends at NT_TIB::StackBase
+    //  So unlike GCManager::TraceStack(), this works for every thread
+    // Platform specific code
+    void * const * stackBase = reinterpret_cast<void * const *>(__readfsdword(0x04));
+    // End of platform specific code
+    CROSSNET_ASSERT(callerFrame < stackBase, "");
+
+    // The region itself is on the stack and points to the arena, skip it
+    void * const * regionStart = reinterpret_cast<void * const *>(this);
+    void * const * regionEnd = reinterpret_cast<void * const *>(this + 1);
+
+    for (void * const * current = callerFrame ; current < stackBase ; ++current)
+    {
+        if ((current >= regionStart) && (current < regionEnd))
+        {
+            continue;
+        }
+        if ((size_t)*current - arenaStart < usedSize)
+        {
+            return (true);
+        }
+    }
+    return (false);
+#else
+    // The registers and the stack can't be scanned here, nothing proves that the calling functions don't point to the arena
+    callerFrame;
+    registers;
+    numRegisters;
+    return (true);
+#endif
+}
+
+void    RegionScope::Release()
+{
+    // Nothing points to the arena anymore, collect all its objects
+    //  The destructors are called in the allocation order
+    unsigned char * usedEnd = mBuffer.mCurrent;
+    unsigned char * current = mArenaStart;
+
+    GCManager::sCollecting = true;
+    while (current < usedEnd)
+    {
+        ::System::Object * object = reinterpret_cast< ::System::Object *>(current);
+        // The size is needed before the destructor (the variable size is returned by a virtual function)
+        int size = GCManager::GetSize(object);
+        object->__OnCollect__();
+        current += GCAllocator::Align(size);
+    }
+    GCManager::sCollecting = false;
+    CROSSNET_ASSERT(current == usedEnd, "The arena is corrupted!");
+    GCAllocator::ClearAllocationStarts(mArenaStart, usedEnd);
+
+    if (GCAllocator::IsZeroingFreeMemory())
+    {
+        // The bump allocation and the bins expect zeroed memory, the unused part is zero already
+        GCAllocator::ClearFreedMemory(mArenaStart, (int)(usedEnd - mArenaStart));
+    }
+
+    // The whole arena goes back to the allocator in one go
+    GCAllocator::InternalFree(reinterpret_cast<GCAllocator::AllocStructure *>(mArenaStart), mArenaSize);
+    mBuffer.mCurrent = NULL;
+    mBuffer.mEnd = NULL;
+}
+
+void    RegionScope::BeginRetireAllRegions()
+{
+    for (RegionScope * region = sActiveRegions ; region != NULL ; region = region->mNextRegion)
+    {
+        GCAllocator::BeginRetireThreadAllocBuffer(&region->mBuffer);
+    }
+}
+
+void    RegionScope::EndRetireAllRegions()
+{
+    for (RegionScope * region = sActiveRegions ; region != NULL ; region = region->mNextRegion)
+    {
+        GCAllocator::EndRetireThreadAllocBuffer(&region->mBuffer);
+    }
+}
+
+}
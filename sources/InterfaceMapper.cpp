@@ -18,7 +18,9 @@
 #include "CrossNetRuntime/System/Object.h"
 #include "CrossNetRuntime/GC/GCManager.h"
 #include "CrossNetRuntime/Internal/BaseTypes.h"
+#include "CrossNetRuntime/Internal/IInterface.h"
 #include <memory.h>
+#include <algorithm>
 
 namespace CrossNetRuntime
 {
@@ -41,6 +43,26 @@ std::vector<int> InterfaceMapper::sStaticObjectId;
 
 std::vector<::System::Type *> InterfaceMapper::sAllTypes;
 
+unsigned char *     InterfaceMapper::sWrapperArenaStart = NULL;
+unsigned char *     InterfaceMapper::sWrapperArenaCurrent = NULL;
+unsigned char *     InterfaceMapper::sWrapperArenaEnd = NULL;
+std::vector<IInterface *>   InterfaceMapper::sWrappers;
+
+namespace
+{
+    // The wrappers are stateless, the vtable is enough to identify them
+    CROSSNET_FINLINE
+    void * GetVTable(IInterface * wrapper)
+    {
+        return (*reinterpret_cast<void * *>(wrapper));
+    }
+
+    bool LessVTable(IInterface * wrapper, void * vtable)
+    {
+        return (GetVTable(wrapper) < vtable);
+    }
+}
+
 void InterfaceMapper::Setup(const ::CrossNetRuntime::InitOptions & options)
 {
     // Instead we might want to allocate by smaller size and maybe several times...
@@ -51,9 +73,20 @@ void InterfaceMapper::Setup(const ::CrossNetRuntime::InitOptions & options)
     interfaceMapSize &= -(int)(sizeof(void *));             // Make sure the size is aligned on 4 bytes
     sInterfaceMap = (void * *)(options.mInterfaceMapBuffer);
     __memclear__(sInterfaceMap, interfaceMapSize);
+
+    // The wrapper arena is at the end of the buffer, so the wrappers are close to the interface maps
+    //  And a type with several interfaces has its wrappers next to each other (they are created in sequence)
+    int wrapperArenaSize = options.mInterfaceWrapperArenaSize & -WRAPPER_ALIGNMENT;
+    CROSSNET_ASSERT(wrapperArenaSize < interfaceMapSize, "The wrapper arena must leave some room for the interface maps!");
+    interfaceMapSize -= wrapperArenaSize;
+    sWrapperArenaStart = (wrapperArenaSize != 0) ? reinterpret_cast<unsigned char *>(sInterfaceMap) + interfaceMapSize : NULL;
+    sWrapperArenaCurrent = sWrapperArenaStart;
+    sWrapperArenaEnd = (wrapperArenaSize != 0) ? sWrapperArenaStart + wrapperArenaSize : NULL;
+
     sInterfaceMapSize = interfaceMapSize / sizeof(void *);
     sNextFreeSlot = sInterfaceMap;
     sAllTypes.reserve(options.mInitialReservedNumTypes);
+    sWrappers.reserve(options.mInitialReservedNumTypes);
 
     options.mRegisterSystemTypeCallback();
 }
@@ -62,6 +95,60 @@ void InterfaceMapper::Teardown()
 {
     sInterfaceMap = NULL;
     sAllTypes.clear();
+
+    // The arena is part of the interface map buffer, it belongs to the user
+    //  The wrappers allocated outside are not freed (like before the arena)
+    sWrapperArenaStart = NULL;
+    sWrapperArenaCurrent = NULL;
+    sWrapperArenaEnd = NULL;
+    sWrappers.clear();
+}
+
+void * InterfaceMapper::AllocateWrapper(size_t size)
+{
+    size = (size + WRAPPER_ALIGNMENT - 1) & -WRAPPER_ALIGNMENT;
+    unsigned char * buffer = sWrapperArenaCurrent;
+    if ((size_t)(sWrapperArenaEnd - buffer) >= size)
+    {
+        sWrapperArenaCurrent = buffer + size;
+        return (buffer);
+    }
+    // No arena or the arena is full
+    return (GetOptions().mUnmanagedAllocateCallback(size));
+}
+
+void InterfaceMapper::FreeWrapper(void * buffer, size_t size)
+{
+    unsigned char * wrapper = static_cast<unsigned char *>(buffer);
+    if ((wrapper >= sWrapperArenaStart) && (wrapper < sWrapperArenaEnd))
+    {
+        // Only the last wrapper can be given back (a duplicate just created), the others stay in the arena
+        size = (size + WRAPPER_ALIGNMENT - 1) & -WRAPPER_ALIGNMENT;
+        if (wrapper + size == sWrapperArenaCurrent)
+        {
+            sWrapperArenaCurrent = wrapper;
+        }
+        return;
+    }
+    GetOptions().mUnmanagedFreeCallback(buffer);
+}
+
+IInterface * InterfaceMapper::DeduplicateWrapper(IInterface * wrapper)
+{
+    // The wrappers don't contain any data, two wrappers with the same vtable are identical
+    //  The same wrapper is implemented by every derived class (and by every type using the same generic wrapper)
+    void * vtable = GetVTable(wrapper);
+    std::vector<IInterface *>::iterator it = std::lower_bound(sWrappers.begin(), sWrappers.end(), vtable, LessVTable);
+    if ((it != sWrappers.end()) && (GetVTable(*it) == vtable))
+    {
+        if (*it != wrapper)
+        {
+            delete wrapper;
+        }
+        return (*it);
+    }
+    sWrappers.insert(it, wrapper);
+    return (wrapper);
 }
 
 void InterfaceMapper::Trace(unsigned char currentMark)
@@ -277,6 +364,16 @@ void * * InterfaceMapper::CreateInterfaceMap(System::Type * type, int id, size_t
         }
     }
 
+    // Share the wrappers already created by other types
+    //  Backward, so a duplicate is the last wrapper of the arena and its room can be given back
+    for (int i = numInterfaceInfos - 1 ; i >= 0 ; --i)
+    {
+        if (info[i].mInterfaceWrapper != NULL)
+        {
+            info[i].mInterfaceWrapper = DeduplicateWrapper(info[i].mInterfaceWrapper);
+        }
+    }
+
     // Finally let's write the interface wrappers
     for (int i = 0 ; i < numInterfaceInfos ; ++i)
     {
@@ -14,6 +14,8 @@
 */
 
 #include "CrossNetRuntime/System/MulticastDelegate.h"
+#include "CrossNetRuntime/GC/GCManager.h"
+#include "CrossNetRuntime/Internal/Tracer.h"
 
 void * * System::MulticastDelegate::s__InterfaceMap__ = NULL;
 
@@ -85,4 +87,16 @@ System::Delegate * System::MulticastDelegate::RemoveImpl(System::Delegate * othe
 
     // We didn't find the corresponding value, return our current state...
     return (this);
-}
\ No newline at end of file
+}
+
+void System::MulticastDelegate::__Trace__(unsigned char currentMark)
+{
+    // Traced through their slot, so the compaction can move them
+    std::vector<System::Delegate *>::iterator it, itEnd;
+    it = mDelegates.begin();
+    itEnd = mDelegates.end();
+    for ( ; it != itEnd ; ++it)
+    {
+        CrossNetRuntime::Tracer::DoTrace(currentMark, *it);
+    }
+}
@@ -16,6 +16,7 @@
 #include "CrossNetRuntime/System/String.h"
 
 #include "CrossNetRuntime/CrossNetRuntime.h"
+#include "CrossNetRuntime/GC/GCShadowStack.h"
 #include "CrossNetRuntime/Internal/BaseTypes.h"
 #include "CrossNetRuntime/System/CharEnumerator.h"
 #include "CrossNetRuntime/System/StringComparison.h"
@@ -138,7 +139,7 @@ String * String::__Create__(const System::Char * text)
         return (Empty);
     }
     int length = (System::Int32)wcslen(text);
-    String * temp = (String *)operator new(sizeof(String) + ((length + 1) * sizeof(System::Char)));
+    String * temp = (String *)operator new(sizeof(String) + ((length + 1) * sizeof(System::Char)), ::CrossNetRuntime::POINTER_FREE);
     temp->String::String(text, length);
     return (temp);
 }
@@ -156,7 +157,7 @@ String * String::__Create__(System::Char * text, System::Int32 start, System::In
     {
         localLength = length;
     }
-    String * temp = (String *)operator new (sizeof(String) + ((localLength + 1) * sizeof(System::Char)));
+    String * temp = (String *)operator new(sizeof(String) + ((localLength + 1) * sizeof(System::Char)), ::CrossNetRuntime::POINTER_FREE);
     temp->String::String(text, start, localLength);
     return (temp);
 }
@@ -167,7 +168,7 @@ String * String::__CreateWithLengthKnown__(System::Char * text, System::Int32 le
     {
         return (Empty);
     }
-    String * temp = (String *)operator new (sizeof(String) + ((length + 1) * sizeof(System::Char)));
+    String * temp = (String *)operator new(sizeof(String) + ((length + 1) * sizeof(System::Char)), ::CrossNetRuntime::POINTER_FREE);
     temp->String::String(text, 0, length);
     return (temp);
 }
@@ -183,7 +184,7 @@ String * String::__Create__(const System::Char c, int number)
     {
         return (Empty);
     }
-    String * temp = (String *)operator new (sizeof(String) + ((number + 1) * sizeof(System::Char)));
+    String * temp = (String *)operator new(sizeof(String) + ((number + 1) * sizeof(System::Char)), ::CrossNetRuntime::POINTER_FREE);
     temp->String::String(c, number);
     return (temp);
 }
@@ -194,13 +195,17 @@ String * String::__Create__(System::Int32 totalSize)
     {
         return (Empty);
     }
-    String * temp = (String *)operator new (sizeof(String) + (totalSize * sizeof(System::Char)));
+    String * temp = (String *)operator new(sizeof(String) + (totalSize * sizeof(System::Char)), ::CrossNetRuntime::POINTER_FREE);
     temp->String::String(totalSize);
     return (temp);
 }
 
 String * String::Concat(const String * s1, const String * s2)
 {
+    // The strings are read after the allocation (see InitOptions::mPreciseStackRoots)
+    void * * slots[] = { (void * *)&s1, (void * *)&s2 };
+    CN_GC_FRAME_ARRAY(slots, 2);
+
     System::Int32 size1 = s1->get_Length();
     System::Int32 size2 = s2->get_Length();
     System::Int32 bufferSize = size1 + size2 + 1;   // +1 for the trailing '\0'
@@ -213,6 +218,9 @@ String * String::Concat(const String * s1, const String * s2)
 
 String * String::Concat(const String * s1, const String * s2, const String * s3)
 {
+    void * * slots[] = { (void * *)&s1, (void * *)&s2, (void * *)&s3 };
+    CN_GC_FRAME_ARRAY(slots, 3);
+
     System::Int32 size1 = s1->get_Length();
     System::Int32 size2 = s2->get_Length();
     System::Int32 size3 = s3->get_Length();
@@ -227,6 +235,9 @@ String * String::Concat(const String * s1, const String * s2, const String * s3)
 
 String * String::Concat(const String * s1, const String * s2, const String * s3, const String * s4)
 {
+    void * * slots[] = { (void * *)&s1, (void * *)&s2, (void * *)&s3, (void * *)&s4 };
+    CN_GC_FRAME_ARRAY(slots, 4);
+
     System::Int32 size1 = s1->get_Length();
     System::Int32 size2 = s2->get_Length();
     System::Int32 size3 = s3->get_Length();
@@ -243,16 +254,25 @@ String * String::Concat(const String * s1, const String * s2, const String * s3,
 
 String * String::Concat(System::Object * a, System::Object * b)
 {
-    System::String * s1 = a->ToString();
+    // Each ToString() might allocate
+    System::String * s1 = NULL;
+    CN_GC_FRAME2(b, s1);
+    s1 = a->ToString();
     System::String * s2 = b->ToString();
     return (Concat(s1, s2));
 }
 
 String * String::Concat(System::Object * a, System::Object * b, System::Object * c)
 {
-    System::String * s1 = a->ToString();
-    System::String * s2 = b->ToString();
-    System::String * s3 = c->ToString();
+    // Each ToString() might allocate, and the strings are read after the last allocation
+    System::String * s1 = NULL;
+    System::String * s2 = NULL;
+    System::String * s3 = NULL;
+    void * * slots[] = { (void * *)&b, (void * *)&c, (void * *)&s1, (void * *)&s2, (void * *)&s3 };
+    CN_GC_FRAME_ARRAY(slots, 5);
+    s1 = a->ToString();
+    s2 = b->ToString();
+    s3 = c->ToString();
 
     System::Int32 size1 = s1->get_Length();
     System::Int32 size2 = s2->get_Length();
@@ -268,10 +288,16 @@ String * String::Concat(System::Object * a, System::Object * b, System::Object *
 
 String * String::Concat(System::Object * a, System::Object * b, System::Object * c, System::Object * d)
 {
-    System::String * s1 = a->ToString();
-    System::String * s2 = b->ToString();
-    System::String * s3 = c->ToString();
-    System::String * s4 = d->ToString();
+    System::String * s1 = NULL;
+    System::String * s2 = NULL;
+    System::String * s3 = NULL;
+    System::String * s4 = NULL;
+    void * * slots[] = { (void * *)&b, (void * *)&c, (void * *)&d, (void * *)&s1, (void * *)&s2, (void * *)&s3, (void * *)&s4 };
+    CN_GC_FRAME_ARRAY(slots, 7);
+    s1 = a->ToString();
+    s2 = b->ToString();
+    s3 = c->ToString();
+    s4 = d->ToString();
 
     System::Int32 size1 = s1->get_Length();
     System::Int32 size2 = s2->get_Length();
@@ -489,13 +515,19 @@ System::Int32 String::IndexOf(System::Char c)
 
 System::Array__G<System::String *> * String::Split(System::Array__G<wchar_t> * array)
 {
-    System::Array__G<System::String *> * result;
+    // With the precise stack roots, the allocations might move this string (see InitOptions::mPreciseStackRoots)
+    //  So it is only used through self after the first one
+    String * self = this;
+    System::Array__G<System::String *> * result = NULL;
+    CN_GC_FRAME3(self, array, result);
+
     int arrayLength = array->get_Length();
     if (arrayLength == 0)
     {
         // In case the array of char is empty, just return an array with 1 item...
         result = System::Array__G<System::String *>::__Create__(1);
-        result->Item(0) = this;
+        result->Item(0) = self;
+        CrossNetRuntime::GCManager::WriteBarrier(&result->Item(0));
         return (result);
     }
 
@@ -524,61 +556,139 @@ System::Array__G<System::String *> * String::Split(System::Array__G<wchar_t> * a
         // The patterns did not split anything...
         // We are roughly in the same case as if there were no pattern
         result = System::Array__G<System::String *>::__Create__(1);
-        result->Item(0) = this;
+        result->Item(0) = self;
+        CrossNetRuntime::GCManager::WriteBarrier(&result->Item(0));
         return (result);
     }
 
     // Now that the number of splist is determined, let's create the corresponding array
     result = System::Array__G<System::String *>::__Create__(numberOfSplits + 1);
+
+    // The strings are created by batches, each batch in one allocation
+    //  So the strings of the result are next to each other in memory
+    System::Int32 starts[SPLIT_BATCH_SIZE];
+    System::Int32 lengths[SPLIT_BATCH_SIZE];
+    int numInBatch = 0;
     int stringStart = 0; 
     int currentStringIndex = 0;
     for (i = 0 ; i < length ; ++i)
     {
-        System::Char c = mBuffer[i];
+        System::Char c = self->mBuffer[i];
 
         for (j = 0 ; j < arrayLength ; ++j)
         {
             System::Char pattern = array->Item(j);
             if (c == pattern)
             {
-                int localLength = i - stringStart;
-                System::String * newString = __Create__(mBuffer, stringStart, localLength);
-                // Put the string and increment the counter
-                result->Item(currentStringIndex++) = newString;
+                starts[numInBatch] = stringStart;
+                lengths[numInBatch] = i - stringStart;
+                ++numInBatch;
                 stringStart = i + 1; // Skip the pattern
                 break;
             }
         }
+
+        if (numInBatch == SPLIT_BATCH_SIZE)
+        {
+            self->__CreateSubstrings__(starts, lengths, numInBatch, result, currentStringIndex);
+            currentStringIndex += numInBatch;
+            numInBatch = 0;
+        }
     }
 
     // And add the last string...
+    starts[numInBatch] = stringStart;
+    lengths[numInBatch] = length - stringStart;
+    ++numInBatch;
+    self->__CreateSubstrings__(starts, lengths, numInBatch, result, currentStringIndex);
+
+    return (result);
+}
+
+void String::__CreateSubstrings__(const System::Int32 * starts, const System::Int32 * lengths, int count,
+                                    System::Array__G<System::String *> * result, int resultIndex)
+{
+    // Same as Split(), this string is only used through self after an allocation
+    String * self = this;
+    CN_GC_FRAME2(self, result);
+
+    // The empty strings are not allocated
+    int sizes[SPLIT_BATCH_SIZE];
+    void * buffers[SPLIT_BATCH_SIZE];
+    int numStrings = 0;
+    int i;
+    CROSSNET_ASSERT(count <= SPLIT_BATCH_SIZE, "");
+    for (i = 0 ; i < count ; ++i)
     {
-        int localLength = length - stringStart;
-        System::String * newString = String::__Create__(mBuffer, stringStart, localLength);
-        // Put the string
-        result->Item(currentStringIndex++) = newString;
+        if (lengths[i] > 0)
+        {
+            sizes[numStrings++] = sizeof(String) + ((lengths[i] + 1) * sizeof(System::Char));
+        }
     }
 
-    return (result);
+    // The pointer-free space allocates each size class separately, the batch would put the strings in the main buffer
+    if (CrossNetRuntime::GCPointerFreeSpace::IsEnabled()
+        || (CrossNetRuntime::GCAllocator::AllocateBatchClear(sizes, numStrings, buffers) == false))
+    {
+        // Not enough memory for the whole batch, create the strings one by one
+        //  (Same as what the allocation of a single string would do)
+        for (i = 0 ; i < count ; ++i)
+        {
+            // The array is read after the allocation
+            String * temp = __Create__(self->mBuffer, starts[i], lengths[i]);
+            result->Item(resultIndex + i) = temp;
+        }
+        // The array might be old (or outside the region of this thread), one barrier for all the items
+        CrossNetRuntime::GCManager::WriteBarrierRange(&result->Item(resultIndex), count * sizeof(System::String *));
+        return;
+    }
+    if (numStrings != 0)
+    {
+        // One sample for the whole batch
+        //  The strings are not contiguous when the batch is cut in several runs (or a string is a large object)
+        int batchSize = 0;
+        for (i = 0 ; i < numStrings ; ++i)
+        {
+            batchSize += sizes[i];
+        }
+        CrossNetRuntime::GCAllocationProfiler::OnAllocate(buffers[0], batchSize);
+    }
+
+    // The lengths are known, no need to look for the end of the string
+    int currentBuffer = 0;
+    for (i = 0 ; i < count ; ++i)
+    {
+        if (lengths[i] <= 0)
+        {
+            result->Item(resultIndex + i) = Empty;
+            continue;
+        }
+        String * temp = static_cast<String *>(buffers[currentBuffer++]);
+        temp->String::String(self->mBuffer, starts[i], lengths[i]);
+        result->Item(resultIndex + i) = temp;
+    }
+    CrossNetRuntime::GCManager::WriteBarrierRange(&result->Item(resultIndex), count * sizeof(System::String *));
 }
 
 System::String * String::Format(System::String * format, System::Object * arg0)
 {
     System::String * string0 = NULL;    // By default the string is not initialized
+    System::Text::StringBuilder * strBuilder = NULL;
+    CN_GC_FRAME4(format, arg0, string0, strBuilder);
 
     int i, length;
-    const System::Char * formatBuffer = format->__ToCString__();
     length = format->get_Length();
-    System::Text::StringBuilder * strBuilder = System::Text::StringBuilder::__Create__(2 * length);
+    strBuilder = System::Text::StringBuilder::__Create__(2 * length);
 
     // TODO: Optimize this code...
     // TODO: Improve parsing and error detection...
+    //  The format is read by index, it might be moved by the allocations (see InitOptions::mPreciseStackRoots)
     bool withinBraces = false;
-    const System::Char * afterStartBraces = NULL;
+    int afterStartBraces = -1;
     for (i = 0 ; i < length ; ++i)
     {
         System::Char c;
-        c = *formatBuffer++;
+        c = format->__ToCString__()[i];
         if (withinBraces)
         {
             if (c != L'}')
@@ -590,11 +700,11 @@ System::String * String::Format(System::String * format, System::Object * arg0)
                 withinBraces = false;
 
                 // Now we can evaluate the value between { and }
-                const System::Char * beforeEndBraces =  formatBuffer - 2;   // Character just before the brace
+                int beforeEndBraces = i - 1;    // Character just before the brace
                 beforeEndBraces;
                 // Because that's a Format function with just one parameter, only 0 is expected
                 CROSSNET_ASSERT(afterStartBraces == beforeEndBraces, "");
-                CROSSNET_ASSERT(*afterStartBraces == L'0', "");
+                CROSSNET_ASSERT(format->__ToCString__()[afterStartBraces] == L'0', "");
 
                 if (string0 == NULL)
                 {
@@ -616,7 +726,7 @@ System::String * String::Format(System::String * format, System::Object * arg0)
             else
             {
                 withinBraces = true;
-                afterStartBraces = formatBuffer;
+                afterStartBraces = i + 1;
             }
         }
     }
@@ -631,6 +741,16 @@ System::String * String::Concat(System::Array__G<System::Object *> * array)
     // Reserve room for the string pointers
     System::String * * allStrs = (System::String * *)_alloca(arrayLength * sizeof(System::String *));
 
+    // Each ToString() might allocate, the array and the strings obtained so far are registered
+    void * * * slots = (void * * *)_alloca((arrayLength + 1) * sizeof(void * *));
+    slots[0] = reinterpret_cast<void * *>(&array);
+    for (int i = 0 ; i < arrayLength ; ++i)
+    {
+        allStrs[i] = NULL;
+        slots[i + 1] = reinterpret_cast<void * *>(&allStrs[i]);
+    }
+    CN_GC_FRAME_ARRAY(slots, arrayLength + 1);
+
     // Get all the strings, stores them in a temporary array and calculate the total length
     for (int i = 0 ; i < arrayLength ; ++i)
     {
@@ -659,6 +779,9 @@ System::String * String::Concat(System::Array__G<System::Object *> * array)
 
 System::String * String::Concat(System::Array__G<System::String *> * array)
 {
+    // The strings are read after the allocation
+    CN_GC_FRAME1(array);
+
     System::Int32 totalSize = 1;
     int arrayLength = array->get_Length();
 
@@ -15,6 +15,8 @@
 
 #include "CrossNetRuntime/System/Text/StringBuilder.h"
 #include "CrossNetRuntime/System/String.h"
+#include "CrossNetRuntime/GC/GCPolicy.h"
+#include "CrossNetRuntime/GC/GCShadowStack.h"
 
 namespace System
 {
@@ -37,6 +39,15 @@ StringBuilder::StringBuilder()
     m__InterfaceMap__ = __GetInterfaceMap__();
 }
 
+StringBuilder::~StringBuilder()
+{
+    if (mBuffer != NULL)
+    {
+        delete[] mBuffer;
+        CrossNetRuntime::GCPolicy::RemoveMemoryPressure(mCapacity * sizeof(System::Char));
+    }
+}
+
 StringBuilder * StringBuilder::__Create__()
 {
     StringBuilder * temp = new StringBuilder();
@@ -46,6 +57,8 @@ StringBuilder * StringBuilder::__Create__()
 StringBuilder * StringBuilder::__Create__(System::Int32 capacity)
 {
     StringBuilder * temp = new StringBuilder();
+    // The memory pressure of the buffer might trigger a collection (see InitOptions::mPreciseStackRoots)
+    CN_GC_FRAME1(temp);
     temp->Reserve(capacity);
     return (temp);
 }
@@ -61,6 +74,11 @@ System::String *    StringBuilder::ToString()
 
 StringBuilder * StringBuilder::Append(System::String * text)
 {
+    // Reserve() might trigger a collection, which might move this builder and the text
+    //  So they are only used through self and the registered text after it
+    StringBuilder * self = this;
+    CN_GC_FRAME2(self, text);
+
     int stringLength = text->get_Length();
     int newSize = mSize + stringLength + 1;     // +1 for the trailing '\0'
     if (newSize > mCapacity)
@@ -68,24 +86,28 @@ StringBuilder * StringBuilder::Append(System::String * text)
         Reserve(newSize);
     }
     // Copy the string and the trailing '\0' as well
-    wmemcpy(mBuffer + mSize, text->__ToCString__(), stringLength + 1);
-    mSize += stringLength;
-    CROSSNET_ASSERT(mSize + 1 <= mCapacity, "");
-    return (this);
+    wmemcpy(self->mBuffer + self->mSize, text->__ToCString__(), stringLength + 1);
+    self->mSize += stringLength;
+    CROSSNET_ASSERT(self->mSize + 1 <= self->mCapacity, "");
+    return (self);
 }
 
 StringBuilder * StringBuilder::Append(System::Char c)
 {
+    // Same as above
+    StringBuilder * self = this;
+    CN_GC_FRAME1(self);
+
     int newSize = mSize + 1 + 1;                // +1 for the char and +1 for the trailing '\0'
     if (newSize > mCapacity)
     {
         Reserve(newSize);
     }
-    mBuffer[mSize] = c;
-    ++mSize;
-    mBuffer[mSize] = L'\0';
-    CROSSNET_ASSERT(mSize + 1 <= mCapacity, "");
-    return (this);
+    self->mBuffer[self->mSize] = c;
+    ++self->mSize;
+    self->mBuffer[self->mSize] = L'\0';
+    CROSSNET_ASSERT(self->mSize + 1 <= self->mCapacity, "");
+    return (self);
 }
 
 void    StringBuilder::Reserve(System::Int32 newSize)
@@ -111,6 +133,8 @@ void    StringBuilder::Reserve(System::Int32 newSize)
         mCapacity = newSize;
         // mSize is 0 already
         mBuffer = new System::Char[newSize];
+        // The buffer is not managed, but it is kept alive by this managed object
+        CrossNetRuntime::GCPolicy::AddMemoryPressure(newSize * sizeof(System::Char));
         return;
     }
 
@@ -126,8 +150,12 @@ void    StringBuilder::Reserve(System::Int32 newSize)
     wmemcpy(newBuffer, mBuffer, mSize + 1);
 
     delete[] mBuffer;
+    int previousCapacity = mCapacity;
     mBuffer = newBuffer;
     mCapacity = newSize;
+    // Last, as it might trigger a collection (this builder is not used after)
+    CrossNetRuntime::GCPolicy::RemoveMemoryPressure(previousCapacity * sizeof(System::Char));
+    CrossNetRuntime::GCPolicy::AddMemoryPressure(newSize * sizeof(System::Char));
 }
 
 }